@@ -11,7 +11,9 @@ bench_antispoof_SOURCES = \
   tests/antispoof/bench.c
 bench_antispoof_OBJECTS = $(bench_antispoof_SOURCES:.c=.o)
 bench_core_SOURCES = \
+  tests/core/bench-flush.c\
   tests/core/bench-hub.c\
+  tests/core/bench-mac-table.c\
   tests/core/bench-nop.c\
   tests/core/bench.c
 bench_core_OBJECTS = $(bench_core_SOURCES:.c=.o)
@@ -61,6 +63,10 @@ bench_tap_SOURCES = \
   tests/tap/bench-tap.c\
   tests/tap/bench.c
 bench_tap_OBJECTS = $(bench_tap_SOURCES:.c=.o)
+bench_udp_filter_SOURCES = \
+  tests/udp-filter/bench-udp-filter.c\
+  tests/udp-filter/bench.c
+bench_udp_filter_OBJECTS = $(bench_udp_filter_SOURCES:.c=.o)
 
 bench_CFLAGS = $(PG_dev_CFLAGS)
 bench_HEADERS = $(PG_HEADERS)
@@ -154,8 +160,14 @@ bench-rxtx: dev $(bench_rxtx_OBJECTS)
 $(bench_rxtx_OBJECTS): %.o : %.c
 	$(CC) -c $(bench_CFLAGS) $(bench_HEADERS) $< -o $@
 
+bench-udp-filter: dev $(bench_udp_filter_OBJECTS)
+	$(CC) $(bench_CFLAGS) $(bench_HEADERS) $(bench_udp_filter_OBJECTS) $(bench_LDFLAGS) -o $@
 
-bench_compile: dev bench-antispoof bench-core bench-diode bench-firewall bench-nic bench-print bench-queue bench-switch bench-vhost bench-pmtud bench-vtep bench-tap bench-rxtx bench-accumulator
+$(bench_udp_filter_OBJECTS): %.o : %.c
+	$(CC) -c $(bench_CFLAGS) $(bench_HEADERS) $< -o $@
+
+
+bench_compile: dev bench-antispoof bench-core bench-diode bench-firewall bench-nic bench-print bench-queue bench-switch bench-vhost bench-pmtud bench-vtep bench-tap bench-rxtx bench-accumulator bench-udp-filter
 
 ################################################################################
 #                                  Benchmark tests                             #
@@ -176,6 +188,7 @@ bench: bench_compile
 	$(srcdir)/tests/rxtx/bench.sh
 	$(srcdir)/tests/pmtud/bench.sh
 	$(srcdir)/tests/tap/bench.sh
+	$(srcdir)/tests/udp-filter/bench.sh
 
 benchmark.%: $(bench_compile)
 	echo ">>> $@" > $@
@@ -193,9 +206,10 @@ benchmark.%: $(bench_compile)
 	$(srcdir)/tests/rxtx/bench.sh -f $* -o $@
 	$(srcdir)/tests/pmtud/bench.sh -f $* -o $@
 	$(srcdir)/tests/tap/bench.sh -f $* -o $@
+	$(srcdir)/tests/udp-filter/bench.sh -f $* -o $@
 
 benchfclean: benchclean
-	rm -fv bench-antispoof bench-core bench-diode bench-rxtx bench-pmtud bench-firewall bench-nic bench-print bench-queue bench-switch bench-vtep bench-tap bench-thread bench-integration bench-vhost bench-accumulator
+	rm -fv bench-antispoof bench-core bench-diode bench-rxtx bench-pmtud bench-firewall bench-nic bench-print bench-queue bench-switch bench-vtep bench-tap bench-thread bench-integration bench-vhost bench-accumulator bench-udp-filter
 
 benchclean:
-	rm -fv $(bench_antispoof_OBJECTS) $(bench_core_OBJECTS) $(bench_diode_OBJECTS) $(bench_rxtx_OBJECTS) $(bench_pmtud_OBJECTS) $(bench_firewall_OBJECTS) $(bench_nic_OBJECTS) $(bench_print_OBJECTS) $(bench_queue_OBJECTS) $(bench_switch_OBJECTS) $(bench_vtep_OBJECTS) $(bench_tap_OBJECTS) $(bench_thread_OBJECTS) $(bench_integration_OBJECTS) $(bench_vhost_OBJECTS) $(bench_accumulator_OBJECTS)
+	rm -fv $(bench_antispoof_OBJECTS) $(bench_core_OBJECTS) $(bench_diode_OBJECTS) $(bench_rxtx_OBJECTS) $(bench_pmtud_OBJECTS) $(bench_firewall_OBJECTS) $(bench_nic_OBJECTS) $(bench_print_OBJECTS) $(bench_queue_OBJECTS) $(bench_switch_OBJECTS) $(bench_vtep_OBJECTS) $(bench_tap_OBJECTS) $(bench_thread_OBJECTS) $(bench_integration_OBJECTS) $(bench_vhost_OBJECTS) $(bench_accumulator_OBJECTS) $(bench_udp_filter_OBJECTS)
@@ -21,6 +21,7 @@
 #include <packetgraph/common.h>
 #include <packetgraph/errors.h>
 
+/* allowed IPs are not limited anymore, kept for compatibility */
 #define PG_ARP_MAX 100
 #define PG_NPD_MAX 100
 
@@ -31,6 +32,11 @@ struct ether_addr;
  *
  * ARP antispoof is disabled by default
  *
+ * Allowed addresses may be added and removed while other threads poll the
+ * brick, the datapath keeps using the former ones until an update is
+ * complete. Updates of a brick must not be done by several threads at
+ * the same time.
+ *
  * @param   name name of the brick
  * @param   outside content maximum of links you can connect on the west
  *          and east side
@@ -54,6 +60,7 @@ struct pg_brick *pg_antispoof_new(const char *name,
 void pg_antispoof_arp_enable(struct pg_brick *brick);
 
 /** Add authorized ip to antispoof brick
+ * Adding an already authorized ip does nothing.
  *
  * @param	brick pointer to an antispoof brick
  * @param	ip IPv4 to associate with mac address
@@ -103,6 +110,7 @@ void pg_antispoof_arp_disable(struct pg_brick *brick);
 void pg_antispoof_ndp_enable(struct pg_brick *brick);
 
 /** Add authorized ip6 to antispoof brick
+ * Adding an already authorized ip6 does nothing.
  *
  * @param	brick pointer to an antispoof brick
  * @param	ip IPv6 to associate with mac address (16 bytes)
@@ -135,4 +143,80 @@ void pg_antispoof_ndp_del_all(struct pg_brick *brick);
  */
 void pg_antispoof_ndp_disable(struct pg_brick *brick);
 
+/**
+ * Enable source address validation of IPv4 and IPv6 packets
+ *
+ * Once enabled, IP packets coming from the inside are dropped unless their
+ * source address belongs to one of the allowed prefixes (longest prefix
+ * match). Unspecified sources (0.0.0.0 and ::) are always allowed so a VM
+ * can get an address. Remember to allow fe80::/10 for IPv6 neighbor
+ * discovery.
+ *
+ * @param	brick pointer to an antispoof brick
+ */
+void pg_antispoof_ip_src_enable(struct pg_brick *brick);
+
+/**
+ * Disable source address validation of IP packets
+ *
+ * @param	brick pointer to an antispoof brick
+ */
+void pg_antispoof_ip_src_disable(struct pg_brick *brick);
+
+/** Allow an IPv4 prefix as source of packets
+ *
+ * @param	brick pointer to an antispoof brick
+ * @param	ip IPv4 prefix in network byte order
+ * @param	prefix_len length of the prefix, from 0 to 32
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ **/
+int pg_antispoof_ipv4_src_add(struct pg_brick *brick, uint32_t ip,
+			      uint8_t prefix_len, struct pg_error **errp);
+
+/** Remove an allowed IPv4 prefix
+ *
+ * @param	brick pointer to an antispoof brick
+ * @param	ip IPv4 prefix in network byte order
+ * @param	prefix_len length of the prefix
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ **/
+int pg_antispoof_ipv4_src_del(struct pg_brick *brick, uint32_t ip,
+			      uint8_t prefix_len, struct pg_error **errp);
+
+/** Allow an IPv6 prefix as source of packets
+ *
+ * @param	brick pointer to an antispoof brick
+ * @param	ip IPv6 prefix (16 bytes)
+ * @param	prefix_len length of the prefix, from 0 to 128
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ **/
+int pg_antispoof_ipv6_src_add(struct pg_brick *brick, uint8_t *ip,
+			      uint8_t prefix_len, struct pg_error **errp);
+
+/** Remove an allowed IPv6 prefix
+ *
+ * @param	brick pointer to an antispoof brick
+ * @param	ip IPv6 prefix (16 bytes)
+ * @param	prefix_len length of the prefix
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ **/
+int pg_antispoof_ipv6_src_del(struct pg_brick *brick, uint8_t *ip,
+			      uint8_t prefix_len, struct pg_error **errp);
+
+/** Remove all allowed IPv4 and IPv6 prefixes
+ *
+ * @param	brick pointer to an antispoof brick
+ **/
+void pg_antispoof_ip_src_del_all(struct pg_brick *brick);
+
+/**
+ * @param	brick pointer to an antispoof brick
+ * @return	number of IP packets dropped because of their source address
+ */
+uint64_t pg_antispoof_ip_src_drops(struct pg_brick *brick);
+
 #endif  /* _PG_ANTISPOOF_H */
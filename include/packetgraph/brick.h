@@ -102,6 +102,28 @@ int pg_brick_poll(struct pg_brick *brick, uint16_t *count,
  */
 bool pg_brick_pollable(const struct pg_brick *brick);
 
+/**
+ * Send packets a brick kept back, like buffered packets of a nic.
+ * pg_graph_poll does it for all bricks of the graph once they have been
+ * polled, applications polling bricks without graph must call it at the
+ * end of each poll cycle, flushing bricks in the direction packets flow
+ * and until no brick forwards packets anymore.
+ *
+ * @param	brick brick to flush
+ * @param	errp is set in case of an error
+ * @return	number of packets bursted to neighbour bricks, -1 on error
+ */
+int pg_brick_flush(struct pg_brick *brick, struct pg_error **errp);
+
+/**
+ * Know if a brick needs to be flushed or not, like a nic buffering tx
+ * packets or a switch in deferred mode.
+ *
+ * @param	brick brick
+ * @return	true if the brick may keep packets back, false otherwise
+ */
+bool pg_brick_flushable(const struct pg_brick *brick);
+
 /**
  * Number packets received by a specific side.
  *
@@ -171,4 +193,90 @@ void pg_brick_dot_fd(struct pg_brick *brick, FILE *fd);
  */
 char *pg_brick_dot(struct pg_brick *brick);
 
+/**
+ * Number of buckets of burst size histograms.
+ * Bucket 0 counts empty bursts, bucket n counts bursts having between
+ * 2^(n-1) and 2^n - 1 packets, so full bursts land in the last bucket.
+ */
+#define PG_BRICK_STATS_HIST_SIZE 8
+
+struct pg_brick_side_stats {
+	/* number of calls to the brick's burst or poll function */
+	uint64_t calls;
+	/* TSC cycles spent in the brick itself */
+	uint64_t cycles;
+	/* number of packets received (burst) or produced (poll) */
+	uint64_t pkts;
+	uint64_t burst_size_hist[PG_BRICK_STATS_HIST_SIZE];
+};
+
+struct pg_brick_stats {
+	/* bursts, indexed by the side packets come from */
+	struct pg_brick_side_stats sides[PG_MAX_SIDE];
+	struct pg_brick_side_stats poll;
+};
+
+/**
+ * Start recording instrumentation statistics of a brick.
+ * Cycles spent in downstream bricks are not accounted to this brick as long
+ * as those bricks are instrumented too.
+ * Statistics are not atomic, a brick must only be run by one thread while
+ * being instrumented.
+ * A brick which is not instrumented does not pay any extra cost.
+ *
+ * @param	brick brick to instrument
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ */
+int pg_brick_stats_enable(struct pg_brick *brick, struct pg_error **errp);
+
+/**
+ * Stop recording instrumentation statistics of a brick.
+ * Already recorded statistics remain readable.
+ *
+ * @param	brick brick to stop instrumenting
+ */
+void pg_brick_stats_disable(struct pg_brick *brick);
+
+/**
+ * @param	brick brick pointer
+ * @return	true if the brick is being instrumented
+ */
+bool pg_brick_stats_enabled(const struct pg_brick *brick);
+
+/**
+ * Get instrumentation statistics of a brick.
+ *
+ * @param	brick brick pointer
+ * @param	stats where to copy statistics
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 if the brick has never been instrumented
+ */
+int pg_brick_stats_get(const struct pg_brick *brick,
+		       struct pg_brick_stats *stats,
+		       struct pg_error **errp);
+
+/**
+ * Reset instrumentation statistics of a brick.
+ *
+ * @param	brick brick pointer
+ */
+void pg_brick_stats_reset(struct pg_brick *brick);
+
+/**
+ * Declare the processing cost of a brick, relative to other bricks.
+ * Weights are used by pg_graph_partition when the graph has not been
+ * instrumented.
+ *
+ * @param	brick brick pointer
+ * @param	weight cost of the brick, 0 meaning unknown (counted as 1)
+ */
+void pg_brick_weight_set(struct pg_brick *brick, uint64_t weight);
+
+/**
+ * @param	brick brick pointer
+ * @return	the weight declared with pg_brick_weight_set, 0 if none
+ */
+uint64_t pg_brick_weight(const struct pg_brick *brick);
+
 #endif /* _PG_BRICK_H */
@@ -0,0 +1,113 @@
+/* Copyright 2019 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PG_DISPATCHER_H
+#define _PG_DISPATCHER_H
+
+#include <packetgraph/common.h>
+#include <packetgraph/errors.h>
+
+/* number of entries of the indirection table, a power of 2 */
+#define PG_DISPATCHER_RETA_SIZE 256
+
+/**
+ * Create a new dispatcher brick
+ *
+ * A dispatcher spreads packets coming from one side over the edges of its
+ * output side, keeping all packets of a flow on the same edge, like RSS does
+ * on a nic. Linking each output edge to a queue lets one poller feed several
+ * threads while keeping per flow ordering:
+ *
+ *                 / [Queue] ~ [Queue]--[firewall] (thread 1)
+ * [vhost]--[dispatcher]
+ *                 \ [Queue] ~ [Queue]--[firewall] (thread 2)
+ *
+ * The flow hash is the RSS hash computed by the nic when there is one, else
+ * it is computed from IP addresses, protocol and ports. The hash selects an
+ * entry of an indirection table holding the output edge index.
+ * Packets coming from the output side are forwarded to every edge of the
+ * other side.
+ *
+ * @param	name name of the brick
+ * @param	west_max maximum of links you can connect on the west side
+ * @param	east_max maximum of links you can connect on the east side
+ * @param	output side where packets are dispatched
+ * @param	errp is set in case of an error
+ * @return	a pointer to a brick structure on success, NULL on error
+ */
+PG_WARN_UNUSED
+struct pg_brick *pg_dispatcher_new(const char *name,
+				   uint32_t west_max,
+				   uint32_t east_max,
+				   enum pg_side output,
+				   struct pg_error **errp);
+
+/**
+ * Set the indirection table of a dispatcher.
+ * The table can be changed while the dispatcher runs, flows of a modified
+ * entry then move to their new edge. Packets already queued on the old edge
+ * may be handled after the first packets sent to the new one.
+ * Every entry must point to a linked edge. Unlinking an edge used by the
+ * table brings the default table back.
+ * By default, the table spreads flows over linked output edges, entry i
+ * holding the (i % number of linked edges)th linked edge, and follows
+ * links and unlinks.
+ *
+ * @param	brick the dispatcher brick
+ * @param	reta PG_DISPATCHER_RETA_SIZE output edge indexes
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ */
+int pg_dispatcher_reta_set(struct pg_brick *brick, const uint16_t *reta,
+			   struct pg_error **errp);
+
+/**
+ * Get the indirection table of a dispatcher.
+ *
+ * @param	brick the dispatcher brick
+ * @param	reta where to write PG_DISPATCHER_RETA_SIZE edge indexes
+ */
+void pg_dispatcher_reta_get(struct pg_brick *brick, uint16_t *reta);
+
+/**
+ * Number of packets dispatched to an output edge. Packets of entries which
+ * pointed to an edge being unlinked are dropped and not counted.
+ *
+ * @param	brick the dispatcher brick
+ * @param	edge index of the output edge
+ * @return	number of packets
+ */
+uint64_t pg_dispatcher_edge_pkts(struct pg_brick *brick, uint16_t edge);
+
+/**
+ * Number of packets which hit an entry of the indirection table, to find
+ * which entries to move when rebalancing.
+ *
+ * @param	brick the dispatcher brick
+ * @param	entry index in the indirection table
+ * @return	number of packets
+ */
+uint64_t pg_dispatcher_reta_pkts(struct pg_brick *brick, uint16_t entry);
+
+/**
+ * Reset per edge and per entry packet counters.
+ *
+ * @param	brick the dispatcher brick
+ */
+void pg_dispatcher_pkts_reset(struct pg_brick *brick);
+
+#endif  /* _PG_DISPATCHER_H */
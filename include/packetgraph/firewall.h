@@ -97,6 +97,9 @@ void pg_firewall_rule_flush_side(struct pg_brick *brick, enum pg_side side);
  * Reload firewall rules.
  * All rules added in the firewall will be loaded.
  * Old rules won't be effective anymore.
+ * This can be called from any thread while the firewall is processing
+ * packets: the new ruleset is built by the calling thread and atomically
+ * replaces the old one, tracked connections are kept.
  *
  * @param   brick pointer to the firewall brick
  * @param   errp is set in case of an error
@@ -105,4 +108,102 @@ void pg_firewall_rule_flush_side(struct pg_brick *brick, enum pg_side side);
  */
 int pg_firewall_reload(struct pg_brick *brick, struct pg_error **errp);
 
+/**
+ * Enable a per lcore cache of flows allowed by the firewall.
+ * UDP packets belonging to a flow recently passed by NPF are allowed
+ * without going through NPF, a flow being identified by its addresses,
+ * ports and direction.
+ * Each flow still goes through NPF at least once per second so NPF keeps
+ * tracking its connection. TCP segments are never cached since NPF tracks
+ * their sequence numbers and windows. Cached verdicts are dropped by
+ * pg_firewall_reload and pg_firewall_gc.
+ * The verdict of a packet is reused for the following packets of its flow,
+ * so the cache must only be enabled when every rule filter only matches
+ * on IP addresses, UDP ports and the protocol. Filters looking at other
+ * fields (TTL, lengths, DSCP, payload bytes...) would get the verdict of
+ * an earlier packet of the flow instead of their own. This is not
+ * checked.
+ * May be called while the firewall is processing packets, former caches
+ * are freed once no thread uses them anymore.
+ *
+ * @param   brick pointer to the firewall brick
+ * @param   size number of flows per lcore, must be a power of 2
+ * @param   errp is set in case of an error
+ * @return  0 on success, -1 on error
+ */
+int pg_firewall_flow_cache_enable(struct pg_brick *brick, uint32_t size,
+				  struct pg_error **errp);
+
+/**
+ * Disable the flow cache of a firewall.
+ * May be called while the firewall is processing packets.
+ *
+ * @param   brick pointer to the firewall brick
+ */
+void pg_firewall_flow_cache_disable(struct pg_brick *brick);
+
+/**
+ * Get flow cache statistics.
+ *
+ * @param   brick pointer to the firewall brick
+ * @param   hits number of packets which skipped NPF
+ * @param   misses number of cacheable packets which went through NPF
+ */
+void pg_firewall_flow_cache_stats(struct pg_brick *brick, uint64_t *hits,
+				  uint64_t *misses);
+
+struct pg_firewall_match_stats {
+	uint64_t pkts;
+	uint64_t bytes;
+};
+
+/**
+ * Start counting packets matching firewall rules.
+ * Counters are kept per lcore so threads sharing the firewall do not
+ * contend on them.
+ * NPF does not report which rule allowed a packet, nor whether a tracked
+ * connection or the flow cache allowed it without inspecting the rules.
+ * So these are not rule hits: filters of loaded rules are evaluated again
+ * on each allowed IP packet, and the last rule whose filter matches gets
+ * the packet, whatever allowed it. Allowed packets matching no filter
+ * (like replies to a stateful rule) are not counted.
+ *
+ * @param   brick pointer to the firewall brick
+ */
+void pg_firewall_match_stats_enable(struct pg_brick *brick);
+
+/**
+ * Stop counting matching packets, counters keep their values.
+ *
+ * @param   brick pointer to the firewall brick
+ */
+void pg_firewall_match_stats_disable(struct pg_brick *brick);
+
+/**
+ * Get the number of allowed packets and bytes matching a rule, as
+ * described in pg_firewall_match_stats_enable.
+ * Rules are indexed in the order they have been added, starting from 0,
+ * flushed rules being removed. A rule only counts packets once loaded by
+ * pg_firewall_reload.
+ *
+ * @param   brick pointer to the firewall brick
+ * @param   index index of the rule
+ * @param   stats where to store the counters
+ * @param   errp is set in case of an error
+ * @return  0 on success, -1 if there is no such rule
+ */
+int pg_firewall_rule_match_stats(struct pg_brick *brick, uint32_t index,
+				 struct pg_firewall_match_stats *stats,
+				 struct pg_error **errp);
+
+/**
+ * Get the number of IP packets and bytes blocked by the default action,
+ * when no rule allowed them.
+ *
+ * @param   brick pointer to the firewall brick
+ * @param   stats where to store the counters
+ */
+void pg_firewall_default_stats(struct pg_brick *brick,
+			       struct pg_firewall_match_stats *stats);
+
 #endif  /* _PG_FIREWALL_H */
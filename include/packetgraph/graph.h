@@ -98,7 +98,10 @@ int pg_graph_explore_ptr(struct pg_graph *graph,
 			 struct pg_error **error);
 
 /**
-* Poll all pollable bricks of the graph.
+* Poll all pollable bricks of the graph, then flush bricks keeping packets
+* back (see pg_brick_flush), from the closest to pollable bricks to the
+* farthest. The order is computed from brick links when bricks are added to
+* or removed from the graph.
 * Stops on first poll error.
 *
 * @param   graph graph to poll
@@ -107,6 +110,18 @@ int pg_graph_explore_ptr(struct pg_graph *graph,
 */
 int pg_graph_poll(struct pg_graph *graph, struct pg_error **error);
 
+/**
+ * Poll all pollable bricks of the graph and count polled packets.
+ * Stops on first poll error.
+ *
+ * @param   graph graph to poll
+ * @param   count number of packets polled by all bricks
+ * @param   error is set in case of an error
+ * @return  0 on success, -1 on error
+ */
+int pg_graph_poll_count(struct pg_graph *graph, uint32_t *count,
+			struct pg_error **error);
+
 /**
  * Sanity check for a graph.
  *
@@ -224,6 +239,43 @@ int pg_graph_merge(struct pg_graph *graph_west,
 		   struct pg_graph *graph_east,
 		   struct pg_error **error);
 
+/**
+ * Split a graph in up to nb_parts graphs of about the same cost, so each of
+ * them can be run by a different pg_thread.
+ *
+ * Bricks are ordered breadth first from the west end of the graph (a
+ * pollable brick like a nic) and the order is cut in slices of the same
+ * cost, so a pipeline is cut in consecutive stages.
+ * The cost of a brick is the number of cycles measured by its statistics
+ * when all bricks of the graph have been instrumented (see
+ * pg_graph_stats_enable), its declared weight otherwise (see
+ * pg_brick_weight_set).
+ * Each edge linking two parts is replaced by a pair of friend ring queues
+ * (see pg_queue_ring_new) named "<west brick>-<east brick>-queue-west" and
+ * "<west brick>-<east brick>-queue-east".
+ * Queues take the place of the edge on both bricks, which are not notified
+ * of an unlink: they keep what they attached to the edge, like the MACs a
+ * switch learned on a port or the VNI of a vtep port.
+ *
+ * Before: [A]----[B]----[C]----[D]
+ *
+ * => partition in 2
+ *
+ * After: [A]----[B]----[Queue1] ~ [Queue2]----[C]----[D]
+ *
+ * Parts can be merged back with pg_graph_merge.
+ *
+ * @param   graph graph to partition, it will contain the first part
+ * @param   nb_parts maximal number of parts, usually the number of cores
+ * @param   parts array of at least nb_parts graphs where to store parts,
+ *          parts[0] being graph. Other parts are named "<graph name>-<i>".
+ * @param   error is set in case of an error
+ * @return  number of parts, which may be less than nb_parts if the graph
+ *          has not enough bricks, -1 on error with graph left unchanged
+ */
+int pg_graph_partition(struct pg_graph *graph, int nb_parts,
+		       struct pg_graph **parts, struct pg_error **error);
+
 /**
  * Write a dot (graphviz) graph to a file descriptor from a graph.
  * If the graph is splitted, you will see more than one graph.
@@ -233,4 +285,22 @@ int pg_graph_merge(struct pg_graph *graph_west,
  */
 void pg_graph_dot(struct pg_graph *graph, FILE *fd);
 
+/**
+ * Start recording instrumentation statistics of all bricks of a graph.
+ * Statistics are then shown by pg_graph_dot.
+ * See pg_brick_stats_enable for more information.
+ *
+ * @param   graph graph to instrument
+ * @param   error is set in case of an error
+ * @return  0 on success, -1 on error
+ */
+int pg_graph_stats_enable(struct pg_graph *graph, struct pg_error **error);
+
+/**
+ * Stop recording instrumentation statistics of all bricks of a graph.
+ *
+ * @param   graph graph to stop instrumenting
+ */
+void pg_graph_stats_disable(struct pg_graph *graph);
+
 #endif /* _PG_GRAPH_H */
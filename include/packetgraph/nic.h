@@ -52,6 +52,69 @@ struct pg_brick *pg_nic_new_by_id(const char *name,
 				  uint16_t portid,
 				  struct pg_error **errp);
 
+/**
+ * Create a new nic brick opening several RX/TX queues on the port
+ *
+ * Incoming traffic is spread over the queues with RSS (on IP, UDP and TCP
+ * fields, as far as the port supports it).
+ * The returned brick polls and transmits on queue 0, use pg_nic_new_queue()
+ * to get a brick for each other queue so each pg_thread can own one.
+ *
+ * @param   name the brick's name
+ * @param   ifname the name of the interface you want to use, see pg_nic_new()
+ * @param   nb_queues number of RX and TX queues to open
+ * @param   errp set in case of an error
+ * @return  a pointer to a brick structure on success, NULL on error
+ */
+PG_WARN_UNUSED
+struct pg_brick *pg_nic_new_mq(const char *name,
+			       const char *ifname,
+			       uint16_t nb_queues,
+			       struct pg_error **errp);
+
+/**
+ * Same as pg_nic_new_mq() but use a port id
+ *
+ * @param   name name of the brick
+ * @param   portid the id of the interface you want to use
+ * @param   nb_queues number of RX and TX queues to open
+ * @param   errp set in case of an error
+ * @return  a pointer to a brick structure, on success, NULL on error
+ */
+PG_WARN_UNUSED
+struct pg_brick *pg_nic_new_mq_by_id(const char *name,
+				     uint16_t portid,
+				     uint16_t nb_queues,
+				     struct pg_error **errp);
+
+/**
+ * Create a nic brick polling and transmitting on one queue of a port
+ * already opened by another nic brick.
+ * The port is closed when the nic brick and all its queue bricks are
+ * destroyed.
+ * Note: pg_brick_rx_bytes and pg_brick_tx_bytes return the port counters.
+ *
+ * @param   name the brick's name
+ * @param   nic the nic brick which opened the port
+ * @param   queue_id the queue to use, must be lower than the number of queues
+ *          opened by nic
+ * @param   errp set in case of an error
+ * @return  a pointer to a brick structure on success, NULL on error
+ */
+PG_WARN_UNUSED
+struct pg_brick *pg_nic_new_queue(const char *name,
+				  struct pg_brick *nic,
+				  uint16_t queue_id,
+				  struct pg_error **errp);
+
+/**
+ * Get the number of RX/TX queues opened on the port of a nic brick
+ *
+ * @param   nic a pointer to a nic brick
+ * @return  number of queues
+ */
+uint16_t pg_nic_queue_count(struct pg_brick *nic);
+
 /**
  * Get number of available DPDK ports
  *
@@ -117,4 +180,40 @@ void pg_nic_get_mac(struct pg_brick *nic, struct ether_addr *addr);
  */
 void pg_nic_capabilities(struct pg_brick *nic, uint32_t *rx, uint32_t *tx);
 
+/** Maximal threshold accepted by pg_nic_set_tx_buffer */
+#define PG_NIC_TX_BUFFER_MAX 256
+
+struct pg_nic_tx_stats {
+	/* buffer flushes because the threshold has been reached */
+	uint64_t fill_flushes;
+	/* buffer flushes done at the end of a poll cycle */
+	uint64_t poll_flushes;
+	/* tx_burst calls retried after a partial transmit */
+	uint64_t retries;
+	/* packets dropped because the tx queue was full */
+	uint64_t drops;
+};
+
+/**
+ * Buffer packets bursted to the nic instead of sending them right away.
+ * Packets are sent once at least threshold packets are buffered, or when
+ * the nic is flushed at the end of a poll cycle (see pg_brick_flush).
+ * Small bursts coming from a switch are then merged in a single tx_burst.
+ *
+ * @param   nic pointer to a nic brick
+ * @param   threshold number of packets to buffer, 0 disables buffering
+ * @param   errp set in case of an error
+ * @return  0 on success, -1 on error
+ */
+int pg_nic_set_tx_buffer(struct pg_brick *nic, uint16_t threshold,
+			 struct pg_error **errp);
+
+/**
+ * Get transmit statistics of the nic
+ *
+ * @param   nic pointer to a nic brick
+ * @param   stats where to copy statistics
+ */
+void pg_nic_tx_stats(struct pg_brick *nic, struct pg_nic_tx_stats *stats);
+
 #endif  /* _PG_NIC_H */
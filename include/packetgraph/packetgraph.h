@@ -36,6 +36,7 @@
 #include <packetgraph/accumulator.h>
 #include <packetgraph/firewall.h>
 #include <packetgraph/hub.h>
+#include <packetgraph/dispatcher.h>
 #include <packetgraph/nic.h>
 #include <packetgraph/nop.h>
 #include <packetgraph/print.h>
@@ -56,6 +56,30 @@ PG_WARN_UNUSED
 struct pg_brick *pg_queue_new(const char *name, int size,
 			      struct pg_error **error);
 
+/**
+ * Create a new queue brick storing packets in a ring
+ *
+ * Works like pg_queue_new() but packets are stored in a preallocated,
+ * lock-free, single-producer/single-consumer ring instead of a locked list of
+ * bursts, so crossing threads does not need any lock or allocation.
+ * Only one thread may burst into the queue and only its friend may poll it.
+ *
+ * Unlike pg_queue_new(), when the ring is full the newest packets are dropped.
+ * Both friends must have been created with this function.
+ * Resetting or destroying the queue drains its ring from the calling thread,
+ * so its friend must not be polled meanwhile: stop the thread polling the
+ * friend first (see pg_thread_stop()). This is asserted.
+ *
+ * @param   name name of the brick
+ * @param   size maximal size of the queue in bursts of PG_MAX_PKTS_BURST
+ *          packets. If size <= 0, a default queue size of 10 will be chosen.
+ * @param   error is set in case of an error
+ * @return  a pointer to a brick structure on success, NULL on error
+ */
+PG_WARN_UNUSED
+struct pg_brick *pg_queue_ring_new(const char *name, int size,
+				   struct pg_error **error);
+
 /**
  * Make two queues friend together.
  *
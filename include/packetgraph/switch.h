@@ -37,4 +37,65 @@ struct pg_brick *pg_switch_new(const char *name,
 			       enum pg_side output,
 			       struct pg_error **errp);
 
+/**
+ * Replace the mac table of the switch, forgetting all learned addresses.
+ * With a capacity, the switch use a compact hash table which never hold
+ * more than capacity addresses: once full, packets to unknown
+ * addresses are flooded. The default 24/24 layout has no limit but
+ * reserve a huge amount of virtual memory.
+ *
+ * @param	brick a pointer to a switch brick
+ * @param	capacity maximum number of mac addresses to learn,
+ *		0 to go back to the default layout
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ */
+int pg_switch_set_mac_table_capacity(struct pg_brick *brick,
+				     uint32_t capacity,
+				     struct pg_error **errp);
+
+/** Bursts are counted on 32 bits, longer lifetimes are truncated */
+#define PG_SWITCH_MAC_LIFETIME_MAX INT32_MAX
+
+/**
+ * Set how long a learned mac address is remembered.
+ * The lifetime is counted in bursts received by the switch: an address
+ * which has not been seen as a source during max_lifetime bursts is
+ * forgotten and packets sent to it are flooded until it is learned again.
+ * Expired addresses are also removed from the table a few at each burst.
+ * A compact mac table (see pg_switch_set_mac_table_capacity) gives their
+ * memory back, the default layout keeps the memory of each OUI it has seen.
+ * Addresses never expire by default.
+ *
+ * @param	brick a pointer to a switch brick
+ * @param	max_lifetime lifetime in bursts, 0 to never expire, at most
+ *		PG_SWITCH_MAC_LIFETIME_MAX
+ */
+void pg_switch_set_mac_lifetime(struct pg_brick *brick, uint64_t max_lifetime);
+
+/**
+ * Count addresses in the mac table of a switch, including expired ones
+ * the aging has not removed yet.
+ * This walks the whole table, do not call it from the datapath.
+ *
+ * @param	brick a pointer to a switch brick
+ * @return	number of learned mac addresses
+ */
+uint32_t pg_switch_mac_count(struct pg_brick *brick);
+
+/**
+ * Stage packets per output port during a poll cycle instead of forwarding
+ * them as soon as they are switched. Staged packets are forwarded when the
+ * switch is flushed (see pg_brick_flush), so bursts coming from many ports
+ * leave the switch as a few full bursts.
+ * Disabling deferred mode forwards staged packets.
+ *
+ * @param	brick a pointer to a switch brick
+ * @param	deferred true to stage packets until the end of the poll
+ * @param	errp is set in case of an error
+ * @return	0 on success, -1 on error
+ */
+int pg_switch_set_deferred(struct pg_brick *brick, bool deferred,
+			   struct pg_error **errp);
+
 #endif  /* _PG_SWITCH_H */
@@ -113,6 +113,112 @@ int pg_thread_add_graph(int16_t tid, struct pg_graph *graph);
  */
 struct pg_graph *pg_thread_pop_graph(int16_t tid, int32_t graph_id);
 
+enum pg_thread_idle_policy {
+	/* poll graphs continuously, even when they get no packets */
+	PG_THREAD_IDLE_BUSY_POLL,
+	/* when graphs get no packets, pause the core, then sleep for longer
+	 * and longer periods, back to busy polling on the first packet */
+	PG_THREAD_IDLE_ADAPTIVE
+};
+
+struct pg_thread_idle_stats {
+	/* number of short core pauses (tpause when available) */
+	uint64_t pauses;
+	/* number of sleeps, from 1us to 128us */
+	uint64_t sleeps;
+	/* number of times packets came after the thread waited */
+	uint64_t wakeups;
+	/* duration of the wait preceding a wakeup, which is the latency added
+	 * to the first packets */
+	uint64_t wakeup_latency_avg_ns;
+	uint64_t wakeup_latency_max_ns;
+};
+
+/**
+ * Choose what the thread does when its graphs get no packets.
+ * Busy polling is the default, giving the lowest latency but using a whole
+ * core. The adaptive policy frees the core (and its hyperthread sibling)
+ * when graphs are idle, at the cost of some latency on the first packets.
+ *
+ * @param   tid the thread id
+ * @param   policy the idle policy
+ * @return  0 on success, -1 on failure
+ */
+int pg_thread_set_idle_policy(int16_t tid, enum pg_thread_idle_policy policy);
+
+/**
+ * Get statistics of the adaptive idle policy.
+ *
+ * @param   tid the thread id
+ * @param   stats where to write statistics
+ * @return  0 on success, -1 on failure
+ */
+int pg_thread_idle_stats(int16_t tid, struct pg_thread_idle_stats *stats);
+
+/* graph id to get statistics of the whole thread */
+#define PG_THREAD_ALL_GRAPHS -1
+
+struct pg_thread_stats {
+	/* polls which got packets and TSC cycles they took */
+	uint64_t busy_polls;
+	uint64_t busy_cycles;
+	/* polls which got no packets and TSC cycles they took */
+	uint64_t idle_polls;
+	uint64_t idle_cycles;
+	/* packets got by polls */
+	uint64_t pkts;
+};
+
+/**
+ * Get poll statistics of a graph, or of all graphs run by a thread.
+ * The load of a graph is busy_cycles / (busy_cycles + idle_cycles).
+ * Statistics of a graph are reset when it is added to the thread.
+ * Counters are read while the thread updates them, so they may not be
+ * consistent with each others.
+ *
+ * @param   tid the thread id
+ * @param   graph_id id of the graph or PG_THREAD_ALL_GRAPHS
+ * @param   stats where to write statistics
+ * @return  0 on success, -1 on failure
+ */
+int pg_thread_stats(int16_t tid, int32_t graph_id,
+		    struct pg_thread_stats *stats);
+
+/**
+ * Move a graph from a thread to another one without stopping any of them.
+ * The source thread hands the graph over between two poll rounds, so no
+ * packet is in flight in the graph while it moves.
+ *
+ * @param   src_tid the thread running the graph
+ * @param   graph_id id of the graph in src_tid
+ * @param   dst_tid the thread which will run the graph
+ * @return  the new graph id in dst_tid, -1 on failure, in which case the
+ *	    graph may still be run by src_tid with a different id
+ */
+int pg_thread_migrate_graph(int16_t src_tid, int32_t graph_id,
+			    int16_t dst_tid);
+
+/* default gap between thread loads, in percent, worth a migration */
+#define PG_THREAD_REBALANCE_THRESHOLD 20
+
+/**
+ * Balance graphs between threads according to their load.
+ * The load of a thread is the part of the time its graphs spent on polls
+ * getting packets since the previous call; the first call only starts the
+ * measure. When the load gap between the busiest and the least busy running
+ * threads exceeds threshold, the graph of the busiest thread narrowing the
+ * gap the most is migrated with pg_thread_migrate_graph.
+ * At most one graph is moved per call, call it periodically (every second
+ * or so) to converge without oscillating.
+ *
+ * @param   tids threads to balance graphs between
+ * @param   nb_tids number of threads in tids
+ * @param   threshold minimal load gap in percent, see
+ *	    PG_THREAD_REBALANCE_THRESHOLD
+ * @return  number of migrated graphs, -1 on failure
+ */
+int pg_thread_rebalance(const int16_t *tids, int nb_tids, int threshold);
+
 /**
  * Destroy the thread designate by tid.
  * @param   tid the thread id to be destroy
@@ -30,7 +30,13 @@ struct pg_udp_filter_info {
 };
 
 /**
- * Create a new hub brick
+ * Create a new udp filter brick
+ *
+ * UDP packets over IPv4 or IPv6, vlan tagged or not, matching a filter go
+ * to the edge of the first matching filter (edge 0 being for packets
+ * matching no filter, filter n going to edge n + 1).
+ * Filters are compiled into per port tables, so the cost of a packet does
+ * not depend on the number of filters.
  *
  * @param	name name of the brick
  * @param	ports array of pg_udp_port_sw_info that describe where
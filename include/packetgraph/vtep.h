@@ -37,6 +37,16 @@ enum pg_vtep_flags {
 	PG_VTEP_ALL_OPTI = PG_VTEP_NO_COPY | PG_VTEP_NO_INNERMAC_CHECK
 };
 
+/* how the outer UDP source port of encapsulated packets is chosen */
+enum pg_vtep_src_port_mode {
+	/* hash of the inner flow, use the RSS hash of the packet if any */
+	PG_VTEP_SRC_PORT_FLOW_HASH = 0,
+	/* hash of the inner flow, always computed in software */
+	PG_VTEP_SRC_PORT_SW_HASH,
+	/* same source port for all packets */
+	PG_VTEP_SRC_PORT_FIXED
+};
+
 struct ether_addr;
 
 /**
@@ -70,7 +80,9 @@ void pg_vtep6_cleanup_mac(struct pg_brick *brick, int port_id);
  * @param   brick the brick we are working on
  * @param   neighbor a brick connected to the VTEP port
  * @param   vni the VNI to add, must be < 2^24
- * @param   multicast_ip the multicast ip to associate to the VNI
+ * @param   multicast_ip the multicast ip to associate to the VNI, or 0 for
+ *          a VNI without group whose BUM frames are only sent to its flood
+ *          list (see pg_vtep4_add_flood_dst)
  * @param   errp an error pointer
  * @return  0 on success, -1 on error
  */
@@ -85,7 +97,8 @@ int pg_vtep4_add_vni(struct pg_brick *brick,
  * @param   brick the brick we are working on
  * @param   neighbor a brick connected to the VTEP port
  * @param   vni the VNI to add, must be < 2^24
- * @param   multicast_ip the multicast ip to associate to the VNI
+ * @param   multicast_ip the multicast ip to associate to the VNI, or ::
+ *          for a VNI without group, see pg_vtep4_add_vni
  * @param   errp an error pointer
  * @return  0 on success, -1 on error
  */
@@ -136,6 +149,105 @@ inline int pg_vtep_add_vni(struct pg_brick *brick,
 
 #endif
 
+/**
+ * Add a remote VTEP to the flood list of a VNI.
+ * Once a VNI has a flood list, its broadcast, unknown unicast and multicast
+ * frames are no longer sent to the VNI multicast group but replicated to
+ * each remote VTEP of the list (head-end replication), which is useful
+ * when the underlay network does not support multicast.
+ * The VNI leaves its multicast group, if it has one, while the list is not
+ * empty.
+ * Replicas share the payload of the original packet, only outer headers
+ * are allocated.
+ * Adding an already present IP updates its MAC address.
+ *
+ * @param   brick the brick we are working on
+ * @param   vni the VNI, must have been added with pg_vtep_add_vni
+ * @param   ip unicast IP of the remote VTEP
+ * @param   mac destination MAC address of packets sent to this VTEP
+ * @param   errp an error pointer
+ * @return  0 on success, -1 on error
+ */
+int pg_vtep4_add_flood_dst(struct pg_brick *brick, uint32_t vni,
+			   uint32_t ip, struct ether_addr *mac,
+			   struct pg_error **errp);
+
+/**
+ * Add a remote VTEP to the flood list of a VNI, see pg_vtep4_add_flood_dst.
+ */
+int pg_vtep6_add_flood_dst(struct pg_brick *brick, uint32_t vni,
+			   uint8_t *ip, struct ether_addr *mac,
+			   struct pg_error **errp);
+
+/**
+ * Remove a remote VTEP from the flood list of a VNI.
+ * BUM frames go back to the VNI multicast group once the list is empty,
+ * the group being joined again, or are dropped if the VNI has no group.
+ *
+ * @param   brick the brick we are working on
+ * @param   vni the VNI
+ * @param   ip IP of the remote VTEP
+ * @param   errp an error pointer
+ * @return  0 on success, -1 on error
+ */
+int pg_vtep4_remove_flood_dst(struct pg_brick *brick, uint32_t vni,
+			      uint32_t ip, struct pg_error **errp);
+
+/**
+ * Remove a remote VTEP from the flood list of a VNI,
+ * see pg_vtep4_remove_flood_dst.
+ */
+int pg_vtep6_remove_flood_dst(struct pg_brick *brick, uint32_t vni,
+			      uint8_t *ip, struct pg_error **errp);
+
+#ifndef __cplusplus
+
+#define pg_vtep_add_flood_dst(brick, vni, ip, mac, errp)		\
+	(_Generic((ip), uint32_t : pg_vtep4_add_flood_dst,		\
+		  int32_t : pg_vtep4_add_flood_dst,			\
+		  PG_VTEP_GENERIC_IPV6(pg_vtep6_add_flood_dst))		\
+	 (brick, vni, ip, mac, errp))
+
+#define pg_vtep_remove_flood_dst(brick, vni, ip, errp)			\
+	(_Generic((ip), uint32_t : pg_vtep4_remove_flood_dst,		\
+		  int32_t : pg_vtep4_remove_flood_dst,			\
+		  PG_VTEP_GENERIC_IPV6(pg_vtep6_remove_flood_dst))	\
+	 (brick, vni, ip, errp))
+
+#else
+
+extern "C++" {
+namespace {
+inline int pg_vtep_add_flood_dst(struct pg_brick *brick, uint32_t vni,
+				 uint32_t ip, struct ether_addr *mac,
+				 struct pg_error **errp)
+{
+	return pg_vtep4_add_flood_dst(brick, vni, ip, mac, errp);
+}
+
+inline int pg_vtep_add_flood_dst(struct pg_brick *brick, uint32_t vni,
+				 uint8_t *ip, struct ether_addr *mac,
+				 struct pg_error **errp)
+{
+	return pg_vtep6_add_flood_dst(brick, vni, ip, mac, errp);
+}
+
+inline int pg_vtep_remove_flood_dst(struct pg_brick *brick, uint32_t vni,
+				    uint32_t ip, struct pg_error **errp)
+{
+	return pg_vtep4_remove_flood_dst(brick, vni, ip, errp);
+}
+
+inline int pg_vtep_remove_flood_dst(struct pg_brick *brick, uint32_t vni,
+				    uint8_t *ip, struct pg_error **errp)
+{
+	return pg_vtep6_remove_flood_dst(brick, vni, ip, errp);
+}
+}
+}
+
+#endif
+
 /**
  * Add a MAC to the VTEP VNI
  *
@@ -159,6 +271,47 @@ int pg_vtep_add_mac(struct pg_brick *brick, uint32_t vni,
 int pg_vtep_unset_mac(struct pg_brick *brick, uint32_t vni,
 		      struct ether_addr *mac, struct pg_error **errp);
 
+/**
+ * Use a compact mac table for each VNI added after this call.
+ * The default layout reserve a huge amount of virtual memory per VNI,
+ * a compact table only allocate memory for capacity macs, once full,
+ * new macs are not learned and their packets go to the multicast group.
+ *
+ * @param   brick the brick we are working on
+ * @param   capacity maximum number of macs per VNI and per table,
+ *          0 to go back to the default layout
+ * @param   errp an error pointer
+ * @return  0 on success, -1 on error
+ */
+int pg_vtep_set_mac_table_capacity(struct pg_brick *brick, uint32_t capacity,
+				   struct pg_error **errp);
+
+/**
+ * Choose how the outer UDP source port of encapsulated packets is computed.
+ * Default is PG_VTEP_SRC_PORT_FLOW_HASH so packets of a same flow share
+ * their source port while flows are spread for ECMP and RSS.
+ *
+ * @param   brick the brick we are working on
+ * @param   mode see pg_vtep_src_port_mode
+ */
+void pg_vtep_set_src_port_mode(struct pg_brick *brick,
+			       enum pg_vtep_src_port_mode mode);
+
+/**
+ * Stage encapsulated packets instead of sending them at once, so packets
+ * received from many inner ports during a poll cycle leave the vtep as full
+ * bursts when the graph flushes it. See pg_switch_set_deferred.
+ * Decapsulated packets and IGMP/MLD messages are still sent directly.
+ * Disabling deferred mode sends staged packets.
+ *
+ * @param   brick the brick we are working on
+ * @param   deferred true to stage packets until the end of the poll
+ * @param   errp is set in case of an error
+ * @return  0 on success, -1 on error
+ */
+int pg_vtep_set_deferred(struct pg_brick *brick, bool deferred,
+			 struct pg_error **errp);
+
 /**
  * Create a new vtep
  *
@@ -15,9 +15,12 @@
  * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
 #include <rte_config.h>
 #include <rte_ether.h>
+#include <rte_hash_crc.h>
 #include <rte_ip.h>
+#include <rte_lcore.h>
 #include <rte_memcpy.h>
 #include <packetgraph/packetgraph.h>
 #include "brick-int.h"
@@ -25,6 +28,8 @@
 #include "utils/mac.h"
 #include "utils/ip.h"
 #include "utils/network.h"
+#include "src/npf/liblpm/src/lpm.h"
+#include "src/npf/libqsbr/src/ebr.h"
 #include <packetgraph/antispoof.h>
 
 struct pg_antispoof_arp {
@@ -48,11 +53,6 @@ struct pg_antispoof_arp {
 	uint32_t target_ip;
 } __attribute__ ((__packed__));
 
-struct arp {
-	uint32_t ip;
-	struct pg_antispoof_arp packet;
-};
-
 struct opt_ll_addr {
 	/* 1 for Source Link-layer Address
 	 * 2 for Target Link-layer Address (X)
@@ -76,8 +76,19 @@ struct neighbor_advertisement {
 	struct opt_ll_addr ll;
 } __attribute__ ((__packed__));
 
-struct ndp {
-	uint8_t ip[16];
+/*
+ * Allowed addresses. The datapath reads one copy while the control plane
+ * changes the other one, see antispoof_update.
+ */
+struct antispoof_set {
+	/* set of allowed IPv4, keys are the IPs themselves */
+	GHashTable *arps;
+	/* set of allowed IPv6, keys are 16 bytes arrays */
+	GHashTable *ndps;
+	/* IPv4 and IPv6 tables, liblpm shares /0 between address lengths */
+	lpm_t *ip_srcs[2];
+	/* /0 is allowed in each table, liblpm does not tell it */
+	bool ip_src_any[2];
 };
 
 struct pg_antispoof_state {
@@ -85,24 +96,45 @@ struct pg_antispoof_state {
 	enum pg_side outside;
 	struct ether_addr mac;
 	bool arp_enabled;
-	uint16_t arps_size;
-	struct arp arps[PG_ARP_MAX];
 	/* icmpv6 / neighbor discovery */
 	bool ndp_enabled;
-	uint16_t ndps_size;
-	struct ndp ndps[PG_NPD_MAX];
+	/* source address validation of IPv4 and IPv6 packets */
+	bool ip_src_enabled;
+	uint64_t ip_src_drops;
+	struct antispoof_set sets[2];
+	/* one of sets, the one read by antispoof_burst */
+	struct antispoof_set *set;
+	ebr_t *ebr;
+	bool lcore_registered[RTE_MAX_LCORE];
 };
 
+/* address or prefix added or removed by the control plane */
+struct antispoof_change {
+	const void *ip;
+	size_t len;
+	uint8_t prefix_len;
+};
+
+typedef int (*antispoof_apply_t)(struct antispoof_set *set,
+				 const struct antispoof_change *change);
+
+/* value of allowed prefixes, liblpm uses NULL for misses */
+static int antispoof_ip_src_allowed;
+
 struct pg_antispoof_config {
 	enum pg_side outside;
 	struct ether_addr mac;
 };
 
-/* Size of the beginning of struct pg_antispoof_arp until ar_op (excluded) */
-#define PG_ANTISPOOF_ARP_CHECK_PART1 (2 + 2 + 1 + 1)
+static guint antispoof_ip6_hash(gconstpointer ip)
+{
+	return rte_hash_crc(ip, 16, 0);
+}
 
-/* Size of the "Sender" part of struct pg_antispoof_arp */
-#define PG_ANTISPOOF_ARP_CHECK_PART2 (6 + 4)
+static gboolean antispoof_ip6_equal(gconstpointer a, gconstpointer b)
+{
+	return !memcmp(a, b, 16);
+}
 
 void pg_antispoof_arp_enable(struct pg_brick *brick)
 {
@@ -110,30 +142,92 @@ void pg_antispoof_arp_enable(struct pg_brick *brick)
 		true;
 }
 
-int pg_antispoof_arp_add(struct pg_brick *brick, uint32_t ip,
-			 struct pg_error **errp)
+static struct antispoof_set *antispoof_standby(
+	struct pg_antispoof_state *state)
 {
-	struct pg_antispoof_state *state =
-		pg_brick_get_state(brick, struct pg_antispoof_state);
-	uint16_t n = state->arps_size;
-	struct arp *arp = &state->arps[n];
+	if (state->set == &state->sets[0])
+		return &state->sets[1];
+	return &state->sets[0];
+}
+
+/* let the datapath read set, then wait for readers of the other one */
+static void antispoof_publish(struct pg_antispoof_state *state,
+			      struct antispoof_set *set)
+{
+	__atomic_store_n(&state->set, set, __ATOMIC_RELEASE);
+	ebr_full_sync(state->ebr, 1);
+}
+
+/**
+ * Apply a change to both copies of the allowed addresses, so the datapath
+ * never reads a copy being changed: the standby copy is changed and
+ * published, then the former one once antispoof_burst stopped using it.
+ * Only one thread may update a brick at a time.
+ *
+ * @param	state the antispoof brick
+ * @param	apply the change, called on each copy
+ * @param	undo reverts a successful apply, only needed if apply may
+ *		fail on the second copy, after it succeeded on the first
+ * @param	change address or prefix to add or remove
+ * @return	0 on success, -1 with errno kept if apply failed, the
+ *		allowed addresses being left unchanged
+ */
+static int antispoof_update(struct pg_antispoof_state *state,
+			    antispoof_apply_t apply, antispoof_apply_t undo,
+			    const struct antispoof_change *change)
+{
+	struct antispoof_set *active = state->set;
+	struct antispoof_set *standby = antispoof_standby(state);
+	int err;
 
-	if (unlikely(n == PG_ARP_MAX)) {
-		*errp = pg_error_new("Maximal IP reached");
+	if (apply(standby, change) < 0)
 		return -1;
-	}
+	antispoof_publish(state, standby);
+	if (likely(apply(active, change) == 0))
+		return 0;
+
+	/* go back to the unchanged copy and revert the other one */
+	err = errno;
+	g_assert(undo);
+	antispoof_publish(state, active);
+	undo(standby, change);
+	errno = err;
+	return -1;
+}
+
+static int antispoof_arp_insert(struct antispoof_set *set,
+				const struct antispoof_change *change)
+{
+	g_hash_table_add(set->arps,
+			 GUINT_TO_POINTER(*(const uint32_t *)change->ip));
+	return 0;
+}
+
+static int antispoof_arp_remove(struct antispoof_set *set,
+				const struct antispoof_change *change)
+{
+	uint32_t ip = *(const uint32_t *)change->ip;
+
+	if (!g_hash_table_remove(set->arps, GUINT_TO_POINTER(ip)))
+		return -1;
+	return 0;
+}
 
-	/* let's start the pre-build of ARP anti-spoof */
-	arp->packet.ar_hrd = rte_cpu_to_be_16(1);
-	arp->packet.ar_pro = PG_BE_ETHER_TYPE_IPv4;
-	arp->packet.ar_hln = ETHER_ADDR_LEN;
-	arp->packet.ar_pln = 4;
-	arp->packet.sender_ip = ip;
-	rte_memcpy(&arp->packet.sender_mac, &state->mac, ETHER_ADDR_LEN);
+static int antispoof_arp_clear(struct antispoof_set *set,
+			       const struct antispoof_change *change)
+{
+	g_hash_table_remove_all(set->arps);
+	return 0;
+}
 
-	arp->ip = ip;
+int pg_antispoof_arp_add(struct pg_brick *brick, uint32_t ip,
+			 struct pg_error **errp)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+	struct antispoof_change change = {.ip = &ip, .len = 4};
 
-	state->arps_size++;
+	antispoof_update(state, antispoof_arp_insert, NULL, &change);
 	return 0;
 }
 
@@ -142,25 +236,13 @@ int pg_antispoof_arp_del(struct pg_brick *brick, uint32_t ip,
 {
 	struct pg_antispoof_state *state =
 		pg_brick_get_state(brick, struct pg_antispoof_state);
-	int index = -1;
-	uint16_t size = state->arps_size;
-	struct arp *arps = state->arps;
-
-	for (int16_t i = 0; i < size; i++) {
-		if (arps[i].ip == ip) {
-			index = i;
-			break;
-		}
-	}
+	struct antispoof_change change = {.ip = &ip, .len = 4};
 
-	if (index < 0) {
+	if (antispoof_update(state, antispoof_arp_remove, NULL,
+			     &change) < 0) {
 		*errp = pg_error_new("IP not found");
 		return -1;
 	}
-
-	if (index != size - 1)
-		rte_memcpy(&arps[index], &arps[size - 1], sizeof(struct arp));
-	state->arps_size--;
 	return 0;
 }
 
@@ -168,7 +250,8 @@ void pg_antispoof_arp_del_all(struct pg_brick *brick)
 {
 	struct pg_antispoof_state *state =
 		pg_brick_get_state(brick, struct pg_antispoof_state);
-	state->arps_size = 0;
+
+	antispoof_update(state, antispoof_arp_clear, NULL, NULL);
 }
 
 void pg_antispoof_arp_disable(struct pg_brick *brick)
@@ -193,24 +276,21 @@ static struct pg_brick_config *antispoof_config_new(const char *name,
 }
 
 static inline int antispoof_arp(struct pg_antispoof_state *state,
+				struct antispoof_set *set,
 				struct rte_mbuf *pkt)
 {
-	uint16_t size = state->arps_size;
-	struct pg_antispoof_arp *p;
 	struct pg_antispoof_arp *a = pg_utils_get_l3(pkt);
 
-	for (uint16_t i = 0; i < size; i++) {
-		/* Check that all fields match reference packet except the
-		 * "ar_op" (arp operation code) part.
-		 */
-		p = &state->arps[i].packet;
-		if (!memcmp(p, a, PG_ANTISPOOF_ARP_CHECK_PART1) &&
-		    memcmp(&p->sender_mac, &a->sender_mac,
-			   PG_ANTISPOOF_ARP_CHECK_PART2) == 0) {
-			return 0;
-		}
-	}
-	return -1;
+	/* only the operation code and the target may change */
+	if (unlikely(a->ar_hrd != rte_cpu_to_be_16(1) ||
+		     a->ar_pro != PG_BE_ETHER_TYPE_IPv4 ||
+		     a->ar_hln != ETHER_ADDR_LEN || a->ar_pln != 4 ||
+		     memcmp(&a->sender_mac, &state->mac, ETHER_ADDR_LEN)))
+		return -1;
+	if (unlikely(!g_hash_table_contains(set->arps,
+					    GUINT_TO_POINTER(a->sender_ip))))
+		return -1;
+	return 0;
 }
 
 void pg_antispoof_ndp_enable(struct pg_brick *brick)
@@ -219,23 +299,37 @@ void pg_antispoof_ndp_enable(struct pg_brick *brick)
 		true;
 }
 
+static int antispoof_ndp_insert(struct antispoof_set *set,
+				const struct antispoof_change *change)
+{
+	g_hash_table_add(set->ndps, g_memdup(change->ip, 16));
+	return 0;
+}
+
+static int antispoof_ndp_remove(struct antispoof_set *set,
+				const struct antispoof_change *change)
+{
+	if (!g_hash_table_remove(set->ndps, change->ip))
+		return -1;
+	return 0;
+}
+
+static int antispoof_ndp_clear(struct antispoof_set *set,
+			       const struct antispoof_change *change)
+{
+	g_hash_table_remove_all(set->ndps);
+	return 0;
+}
+
 int pg_antispoof_ndp_add(struct pg_brick *brick, uint8_t *ip,
 			struct pg_error **errp)
 {
 	struct pg_antispoof_state *state =
 		pg_brick_get_state(brick, struct pg_antispoof_state);
-	uint16_t n = state->ndps_size;
-	struct ndp *ndp = &state->ndps[n];
-
-	if (unlikely(n == PG_NPD_MAX)) {
-		*errp = pg_error_new("Maximal IPV6 reached");
-		return -1;
-	}
+	struct antispoof_change change = {.ip = ip, .len = 16};
 
-	pg_ip_copy(ip, ndp->ip);
-	state->ndps_size++;
+	antispoof_update(state, antispoof_ndp_insert, NULL, &change);
 	return 0;
-
 }
 
 int pg_antispoof_ndp_del(struct pg_brick *brick, uint8_t *ip,
@@ -243,31 +337,22 @@ int pg_antispoof_ndp_del(struct pg_brick *brick, uint8_t *ip,
 {
 	struct pg_antispoof_state *state =
 		pg_brick_get_state(brick, struct pg_antispoof_state);
-	int index = -1;
-	uint16_t size = state->ndps_size;
-	struct ndp *ndps = state->ndps;
-
-	for (int16_t i = 0; i < size; i++) {
-		if (pg_ip_is_same(ndps[i].ip, ip)) {
-			index = i;
-			break;
-		}
-	}
+	struct antispoof_change change = {.ip = ip, .len = 16};
 
-	if (index < 0) {
+	if (antispoof_update(state, antispoof_ndp_remove, NULL,
+			     &change) < 0) {
 		*errp = pg_error_new("IPV6 not found");
 		return -1;
 	}
-
-	if (index != size - 1)
-		pg_ip_copy(ndps[size - 1].ip, ndps[index].ip);
-	state->ndps_size--;
 	return 0;
 }
 
 void pg_antispoof_ndp_del_all(struct pg_brick *brick)
 {
-	pg_brick_get_state(brick, struct pg_antispoof_state)->ndps_size = 0;
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+
+	antispoof_update(state, antispoof_ndp_clear, NULL, NULL);
 }
 
 void pg_antispoof_ndp_disable(struct pg_brick *brick)
@@ -276,7 +361,195 @@ void pg_antispoof_ndp_disable(struct pg_brick *brick)
 		false;
 }
 
+void pg_antispoof_ip_src_enable(struct pg_brick *brick)
+{
+	pg_brick_get_state(brick, struct pg_antispoof_state)->ip_src_enabled =
+		true;
+}
+
+void pg_antispoof_ip_src_disable(struct pg_brick *brick)
+{
+	pg_brick_get_state(brick, struct pg_antispoof_state)->ip_src_enabled =
+		false;
+}
+
+/* index of the IPv4 or IPv6 table of an address length */
+static inline int antispoof_ip_family(size_t len)
+{
+	return len == 16;
+}
+
+/* clear host bits of a prefix */
+static void antispoof_prefix_mask(uint8_t *prefix, const void *ip,
+				  size_t len, uint8_t prefix_len)
+{
+	memcpy(prefix, ip, len);
+	for (size_t i = 0; i < len; i++) {
+		if (prefix_len >= 8) {
+			prefix_len -= 8;
+			continue;
+		}
+		prefix[i] &= ~(0xff >> prefix_len);
+		prefix_len = 0;
+	}
+}
+
+static int antispoof_ip_src_insert(struct antispoof_set *set,
+				   const struct antispoof_change *change)
+{
+	int family = antispoof_ip_family(change->len);
+	uint8_t prefix[16];
+
+	antispoof_prefix_mask(prefix, change->ip, change->len,
+			      change->prefix_len);
+	if (lpm_insert(set->ip_srcs[family], prefix, change->len,
+		       change->prefix_len, &antispoof_ip_src_allowed) < 0)
+		return -1;
+	if (!change->prefix_len)
+		set->ip_src_any[family] = true;
+	return 0;
+}
+
+static int antispoof_ip_src_remove(struct antispoof_set *set,
+				   const struct antispoof_change *change)
+{
+	int family = antispoof_ip_family(change->len);
+	uint8_t prefix[16];
+
+	antispoof_prefix_mask(prefix, change->ip, change->len,
+			      change->prefix_len);
+	/* liblpm always succeeds to remove /0 */
+	if ((!change->prefix_len && !set->ip_src_any[family]) ||
+	    lpm_remove(set->ip_srcs[family], prefix, change->len,
+		       change->prefix_len) < 0)
+		return -1;
+	if (!change->prefix_len)
+		set->ip_src_any[family] = false;
+	return 0;
+}
+
+static int antispoof_ip_src_clear(struct antispoof_set *set,
+				  const struct antispoof_change *change)
+{
+	for (int i = 0; i < 2; i++) {
+		lpm_clear(set->ip_srcs[i], NULL, NULL);
+		set->ip_src_any[i] = false;
+	}
+	return 0;
+}
+
+static int antispoof_ip_src_add(struct pg_brick *brick, const void *ip,
+				size_t len, uint8_t prefix_len,
+				struct pg_error **errp)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+	struct antispoof_change change = {
+		.ip = ip, .len = len, .prefix_len = prefix_len};
+
+	if (prefix_len > len * 8) {
+		*errp = pg_error_new("Invalid prefix length %u", prefix_len);
+		return -1;
+	}
+	/* inserting a new prefix allocates, it may fail on either copy */
+	if (antispoof_update(state, antispoof_ip_src_insert,
+			     antispoof_ip_src_remove, &change) < 0) {
+		*errp = pg_error_new_errno(errno, "Cannot add prefix");
+		return -1;
+	}
+	return 0;
+}
+
+static int antispoof_ip_src_del(struct pg_brick *brick, const void *ip,
+				size_t len, uint8_t prefix_len,
+				struct pg_error **errp)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+	struct antispoof_change change = {
+		.ip = ip, .len = len, .prefix_len = prefix_len};
+
+	if (prefix_len > len * 8) {
+		*errp = pg_error_new("Invalid prefix length %u", prefix_len);
+		return -1;
+	}
+	if (antispoof_update(state, antispoof_ip_src_remove, NULL,
+			     &change) < 0) {
+		*errp = pg_error_new("Prefix not found");
+		return -1;
+	}
+	return 0;
+}
+
+int pg_antispoof_ipv4_src_add(struct pg_brick *brick, uint32_t ip,
+			      uint8_t prefix_len, struct pg_error **errp)
+{
+	return antispoof_ip_src_add(brick, &ip, 4, prefix_len, errp);
+}
+
+int pg_antispoof_ipv4_src_del(struct pg_brick *brick, uint32_t ip,
+			      uint8_t prefix_len, struct pg_error **errp)
+{
+	return antispoof_ip_src_del(brick, &ip, 4, prefix_len, errp);
+}
+
+int pg_antispoof_ipv6_src_add(struct pg_brick *brick, uint8_t *ip,
+			      uint8_t prefix_len, struct pg_error **errp)
+{
+	return antispoof_ip_src_add(brick, ip, 16, prefix_len, errp);
+}
+
+int pg_antispoof_ipv6_src_del(struct pg_brick *brick, uint8_t *ip,
+			      uint8_t prefix_len, struct pg_error **errp)
+{
+	return antispoof_ip_src_del(brick, ip, 16, prefix_len, errp);
+}
+
+void pg_antispoof_ip_src_del_all(struct pg_brick *brick)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+
+	antispoof_update(state, antispoof_ip_src_clear, NULL, NULL);
+}
+
+uint64_t pg_antispoof_ip_src_drops(struct pg_brick *brick)
+{
+	return pg_brick_get_state(brick,
+				  struct pg_antispoof_state)->ip_src_drops;
+}
+
+/* unspecified sources are used before getting an address (DHCP, DAD) */
+static const uint8_t antispoof_ip_unspecified[16];
+
+static inline int antispoof_ip_src(struct pg_antispoof_state *state,
+				   struct antispoof_set *set,
+				   struct rte_mbuf *pkt, uint16_t etype)
+{
+	const uint8_t *src;
+	size_t len;
+
+	if (etype == PG_BE_ETHER_TYPE_IPv4) {
+		struct ipv4_hdr *ip = pg_utils_get_l3(pkt);
+
+		src = (const uint8_t *)&ip->src_addr;
+		len = 4;
+	} else {
+		struct ipv6_hdr *ip = pg_utils_get_l3(pkt);
+
+		src = ip->src_addr;
+		len = 16;
+	}
+	if (likely(lpm_lookup(set->ip_srcs[antispoof_ip_family(len)],
+			       src, len) != NULL) ||
+	    !memcmp(src, antispoof_ip_unspecified, len))
+		return 0;
+	state->ip_src_drops++;
+	return -1;
+}
+
 static inline int antispoof_ndp(struct pg_antispoof_state *state,
+				struct antispoof_set *set,
 				struct rte_mbuf *pkt)
 {
 	uint8_t ipv6_type;
@@ -295,19 +568,11 @@ static inline int antispoof_ndp(struct pg_antispoof_state *state,
 		return 0;
 
 	/* check ipv6 source validity */
-	uint16_t size = state->ndps_size;
-	struct ndp *ndps = state->ndps;
-	bool ipv6_allowed = false;
 	struct ipv6_hdr *h6 = (struct ipv6_hdr *) pg_utils_get_l3(pkt);
 
-	for (uint16_t i = 0; i < size; i++) {
-		if (pg_ip_is_same(h6->src_addr, ndps[i].ip) &&
-		    !memcmp(na->target_address, ndps[i].ip, 16)) {
-			ipv6_allowed = true;
-			break;
-		}
-	}
-	if (unlikely(!ipv6_allowed))
+	if (unlikely(memcmp(h6->src_addr, na->target_address, 16) ||
+		     !g_hash_table_contains(set->ndps,
+					    na->target_address)))
 		return -1;
 
 	/* check link layer address option */
@@ -319,12 +584,26 @@ static inline int antispoof_ndp(struct pg_antispoof_state *state,
 	return 0;
 }
 
+/* register the calling thread to the EBR the first time it reads the set */
+static inline void antispoof_thread_register(struct pg_antispoof_state *state)
+{
+	unsigned int lcore = rte_lcore_id();
+
+	if (unlikely(lcore >= RTE_MAX_LCORE ||
+		     !state->lcore_registered[lcore])) {
+		ebr_register(state->ebr);
+		if (lcore < RTE_MAX_LCORE)
+			state->lcore_registered[lcore] = true;
+	}
+}
+
 static int antispoof_burst(struct pg_brick *brick, enum pg_side from,
 			   uint16_t edge_index, struct rte_mbuf **pkts,
 			   uint64_t pkts_mask,
 			   struct pg_error **errp)
 {
 	struct pg_antispoof_state *state;
+	struct antispoof_set *set;
 	struct pg_brick_side *s;
 	struct ether_hdr *eth;
 	uint16_t etype;
@@ -340,6 +619,9 @@ static int antispoof_burst(struct pg_brick *brick, enum pg_side from,
 		goto forward;
 
 	/* packets come from inside, let's check few things */
+	antispoof_thread_register(state);
+	ebr_enter(state->ebr);
+	set = __atomic_load_n(&state->set, __ATOMIC_ACQUIRE);
 	it_mask = pkts_mask;
 	for (; it_mask;) {
 		pg_low_bit_iterate_full(it_mask, bit, i);
@@ -354,13 +636,19 @@ static int antispoof_burst(struct pg_brick *brick, enum pg_side from,
 			pkts_mask &= ~bit;
 		else if (state->arp_enabled &&
 			 unlikely(etype == PG_BE_ETHER_TYPE_ARP) &&
-			 antispoof_arp(state, pkts[i]) < 0)
+			 antispoof_arp(state, set, pkts[i]) < 0)
+			pkts_mask &= ~bit;
+		else if (state->ip_src_enabled &&
+			 (etype == PG_BE_ETHER_TYPE_IPv4 ||
+			  etype == PG_BE_ETHER_TYPE_IPv6) &&
+			 antispoof_ip_src(state, set, pkts[i], etype) < 0)
 			pkts_mask &= ~bit;
 		else if (state->ndp_enabled &&
 			 unlikely(etype == PG_BE_ETHER_TYPE_IPv6) &&
-			 antispoof_ndp(state, pkts[i]) < 0)
+			 antispoof_ndp(state, set, pkts[i]) < 0)
 			pkts_mask &= ~bit;
 	}
+	ebr_exit(state->ebr);
 	if (unlikely(pkts_mask == 0))
 		return 0;
 forward:
@@ -368,6 +656,32 @@ forward:
 			      pkts, pkts_mask, errp);
 }
 
+static int antispoof_set_init(struct antispoof_set *set)
+{
+	set->arps = g_hash_table_new(g_direct_hash, g_direct_equal);
+	set->ndps = g_hash_table_new_full(antispoof_ip6_hash,
+					  antispoof_ip6_equal, g_free, NULL);
+	set->ip_srcs[0] = lpm_create();
+	set->ip_srcs[1] = lpm_create();
+	if (!set->ip_srcs[0] || !set->ip_srcs[1])
+		return -1;
+	return 0;
+}
+
+/* also frees partially initialized sets */
+static void antispoof_set_free(struct antispoof_set *set)
+{
+	if (set->arps)
+		g_hash_table_destroy(set->arps);
+	if (set->ndps)
+		g_hash_table_destroy(set->ndps);
+	for (int i = 0; i < 2; i++) {
+		if (set->ip_srcs[i])
+			lpm_destroy(set->ip_srcs[i]);
+	}
+	memset(set, 0, sizeof(*set));
+}
+
 static int antispoof_init(struct pg_brick *brick,
 			  struct pg_brick_config *config,
 			  struct pg_error **errp)
@@ -382,10 +696,39 @@ static int antispoof_init(struct pg_brick *brick,
 	state->outside = antispoof_config->outside;
 	rte_memcpy(&state->mac, &antispoof_config->mac, ETHER_ADDR_LEN);
 	state->arp_enabled = false;
-	state->arps_size = 0;
+	if (antispoof_set_init(&state->sets[0]) < 0 ||
+	    antispoof_set_init(&state->sets[1]) < 0) {
+		antispoof_set_free(&state->sets[0]);
+		antispoof_set_free(&state->sets[1]);
+		*errp = pg_error_new("Failed to create prefix table");
+		return -1;
+	}
+	state->set = &state->sets[0];
+	state->ebr = ebr_create();
+	if (!state->ebr) {
+		antispoof_set_free(&state->sets[0]);
+		antispoof_set_free(&state->sets[1]);
+		*errp = pg_error_new("Failed to create EBR");
+		return -1;
+	}
+	ebr_register(state->ebr);
+	if (rte_lcore_id() < RTE_MAX_LCORE)
+		state->lcore_registered[rte_lcore_id()] = true;
 	return 0;
 }
 
+static void antispoof_destroy(struct pg_brick *brick,
+			      struct pg_error **errp)
+{
+	struct pg_antispoof_state *state =
+		pg_brick_get_state(brick, struct pg_antispoof_state);
+
+	antispoof_set_free(&state->sets[0]);
+	antispoof_set_free(&state->sets[1]);
+	ebr_unregister(state->ebr);
+	ebr_destroy(state->ebr);
+}
+
 struct pg_brick *pg_antispoof_new(const char *name,
 				  enum pg_side outside,
 				  struct ether_addr *mac,
@@ -405,6 +748,7 @@ static struct pg_brick_ops antispoof_ops = {
 	.name		= "antispoof",
 	.state_size	= sizeof(struct pg_antispoof_state),
 	.init		= antispoof_init,
+	.destroy	= antispoof_destroy,
 	.unlink		= pg_brick_generic_unlink,
 };
 
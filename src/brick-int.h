@@ -23,6 +23,7 @@
 #include <rte_config.h>
 #include <rte_mbuf.h>
 #include <rte_atomic.h>
+#include <rte_lcore.h>
 #include <packetgraph/common.h>
 #include <packetgraph/errors.h>
 #include <packetgraph/brick.h>
@@ -62,6 +63,7 @@
 #endif
 
 struct pg_brick_ops;
+struct pg_brick_stats_state;
 
 /* The end of an edge linking two struct pg_brick */
 struct pg_brick_edge {
@@ -70,8 +72,19 @@ struct pg_brick_edge {
 	uint32_t padding;		/* for 64 bits alignment */
 };
 
+/**
+ * Incoming packets count of each side of a brick, for one lcore.
+ * Each lcore has its own cache line so counting does not need any atomic
+ * operation nor bounces between cores. The extra slot after the
+ * RTE_MAX_LCORE ones is shared by non-EAL threads and is updated atomically.
+ */
+struct pg_brick_pkts_count {
+	uint64_t sides[PG_MAX_SIDE];
+} __rte_cache_aligned;
+
+#define PG_BRICK_PKTS_COUNT_SLOTS (RTE_MAX_LCORE + 1)
+
 struct pg_brick_side {
-	PG_PKTS_COUNT_TYPE packet_count;	/* incoming pkts count */
 	/* Optional callback to set to get the number of packets which has been
 	 * bursted/enqueue. Default: NULL.
 	 */
@@ -111,6 +124,8 @@ struct pg_brick {
 	/* polling */
 	int (*poll)(struct pg_brick *brick,
 		    uint16_t *count, struct pg_error **errp);
+	/* end of poll cycle, only set while the brick keeps packets back */
+	int (*flush)(struct pg_brick *brick, struct pg_error **errp);
 
 	struct pg_brick_ops *ops;	/* management ops */
 	int64_t refcount;		/* reference count */
@@ -124,6 +139,15 @@ struct pg_brick {
 		struct pg_brick_side sides[PG_MAX_SIDE];
 		struct pg_brick_side side;
 	};
+
+	/* incoming pkts count, PG_BRICK_PKTS_COUNT_SLOTS entries */
+	struct pg_brick_pkts_count *pkts_count;
+
+	/* instrumentation, NULL until pg_brick_stats_enable is called */
+	struct pg_brick_stats_state *stats;
+
+	/* declared cost, see pg_brick_weight_set */
+	uint64_t weight;
 };
 
 
@@ -251,6 +275,63 @@ int pg_brick_side_forward(struct pg_brick_side *brick_side, enum pg_side from,
 			  struct rte_mbuf **pkts, uint64_t pkts_mask,
 			  struct pg_error **errp);
 
+/* incremented each time the flush callback of a brick changes */
+extern uint32_t pg_brick_flush_gen;
+
+/**
+ * Set the callback called at the end of each poll cycle of the graph owning
+ * the brick, to send packets the brick kept back. It returns the number of
+ * packets bursted to other bricks, so the graph knows they may have staged
+ * some in turn, or -1 on error.
+ * Bricks only set it while they may keep packets back and set it to NULL
+ * otherwise, so graphs do not flush them. Graphs see the change at their
+ * next poll. See pg_brick_flush.
+ */
+void pg_brick_flush_set(struct pg_brick *brick,
+			int (*flush)(struct pg_brick *brick,
+				     struct pg_error **errp));
+
+/**
+ * Change the burst callback of a brick once initialized, keeping it
+ * wrapped if pg_brick_stats_enable has been called.
+ */
+void pg_brick_burst_set(struct pg_brick *brick,
+			int (*burst)(struct pg_brick *brick,
+				     enum pg_side from, uint16_t edge_index,
+				     struct rte_mbuf **pkts,
+				     uint64_t pkts_mask,
+				     struct pg_error **errp));
+
+/**
+ * Packets staged for one edge, so small bursts received during a poll
+ * cycle leave the brick as a single burst when it is flushed.
+ */
+struct pg_brick_stage {
+	struct rte_mbuf *pkts[PG_MAX_PKTS_BURST];
+	uint16_t count;
+};
+
+/**
+ * Stage packets for an edge instead of bursting them.
+ * Staged packets are referenced, the caller keeps ownership of pkts.
+ * The stage is flushed first if it can not hold all packets.
+ * @from:	same as pg_brick_burst
+ * @return:	number of packets bursted to edge->link, -1 on error
+ */
+int pg_brick_stage_burst(struct pg_brick_stage *stage,
+			 struct pg_brick_edge *edge, enum pg_side from,
+			 struct rte_mbuf **pkts, uint64_t pkts_mask,
+			 struct pg_error **errp);
+
+/**
+ * Burst staged packets to edge->link, or drop them if the edge has been
+ * unlinked.
+ * @return:	number of packets bursted, -1 on error
+ */
+int pg_brick_stage_flush(struct pg_brick_stage *stage,
+			 struct pg_brick_edge *edge, enum pg_side from,
+			 struct pg_error **errp);
+
 /**
  * Get the edge of a brick.
  * @brick:	the brick
@@ -266,6 +347,27 @@ struct pg_brick_edge *pg_brick_get_edge(struct pg_brick *brick,
  */
 uint32_t pg_side_get_max(const struct pg_brick *brick, enum pg_side side);
 
+/**
+ * Replace the edge from @west to @east by an edge from @west to @west_link
+ * and an edge from @east_link to @east.
+ * @west and @east keep the edge indexes they had and are not notified, so
+ * what they attached to these indexes (learned MACs, VNIs...) is kept.
+ * @west_link and @east_link are notified as by pg_brick_link.
+ * @return:	0 on success, -1 on error with no edge changed
+ */
+int pg_brick_splice(struct pg_brick *west, struct pg_brick *east,
+		    struct pg_brick *west_link, struct pg_brick *east_link,
+		    struct pg_error **errp);
+
+/**
+ * Link @west and @east back on the edge indexes pg_brick_splice kept,
+ * unlinking @west_link and @east_link from them without notifications.
+ * @return:	0 on success, -1 on error with no edge changed
+ */
+int pg_brick_unsplice(struct pg_brick *west, struct pg_brick *east,
+		      struct pg_brick *west_link, struct pg_brick *east_link,
+		      struct pg_error **errp);
+
 
 struct pg_brick_edge_iterator {
 	struct pg_brick *brick;
@@ -19,10 +19,15 @@
  * the public brick API function implementations.
  */
 
+#include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <glib.h>
+#include <rte_config.h>
+#include <rte_cycles.h>
 #include <packetgraph/packetgraph.h>
 #include "brick-int.h"
+#include "packets.h"
 #include "utils/errors.h"
 #include "utils/bitmask.h"
 
@@ -90,12 +95,23 @@ static void pg_brick_set_max_edges(struct pg_brick *brick,
 	brick->sides[PG_EAST_SIDE].max = east_edges;
 }
 
-static void zero_brick_counters(struct pg_brick *brick)
+static int alloc_brick_counters(struct pg_brick *brick,
+				struct pg_error **errp)
 {
-	enum pg_side i;
+	size_t size = sizeof(struct pg_brick_pkts_count) *
+		PG_BRICK_PKTS_COUNT_SLOTS;
+	void *counts;
+	int ret;
 
-	for (i = 0; i < PG_MAX_SIDE; ++i)
-		PG_PKTS_COUNT_SET(brick->sides[i].packet_count, 0);
+	ret = posix_memalign(&counts, RTE_CACHE_LINE_SIZE, size);
+	if (ret) {
+		*errp = pg_error_new_errno(ret,
+			"Failed to allocate packet counters");
+		return -1;
+	}
+	memset(counts, 0, size);
+	brick->pkts_count = counts;
+	return 0;
 }
 
 /* Convenient macro to get a pointer to brick ops */
@@ -178,11 +194,12 @@ struct pg_brick *pg_brick_new(const char *name,
 	brick->refcount = 1;
 	brick->type = config->type;
 
-	zero_brick_counters(brick);
-
 	if (check_side_max(config, errp) < 0)
 		goto fail_exit;
 
+	if (alloc_brick_counters(brick, errp) < 0)
+		goto fail_exit;
+
 	pg_brick_set_max_edges(brick, config->west_max, config->east_max);
 	brick->name = g_strdup(config->name);
 
@@ -201,6 +218,7 @@ struct pg_brick *pg_brick_new(const char *name,
 	return brick;
 
 fail_exit:
+	free(brick->pkts_count);
 	g_free(brick->name);
 	g_free(brick);
 	return NULL;
@@ -262,6 +280,8 @@ struct pg_brick *pg_brick_decref(struct pg_brick *brick, struct pg_error **errp)
 			g_free(brick->sides[i].edges);
 	}
 
+	g_free(brick->stats);
+	free(brick->pkts_count);
 	g_free(brick->name);
 	/* The brick struct is be the first member of the state. */
 	g_free(brick);
@@ -639,6 +659,22 @@ void pg_brick_generic_unlink(struct pg_brick *brick, struct pg_error **errp)
  * function.
  */
 
+static inline void pkts_count_add(struct pg_brick *brick, enum pg_side side,
+				  uint64_t nb)
+{
+	unsigned int lcore = rte_lcore_id();
+	uint64_t *count;
+
+	if (likely(lcore < RTE_MAX_LCORE)) {
+		/* only this lcore writes here, no need for a locked add */
+		count = &brick->pkts_count[lcore].sides[side];
+		__atomic_store_n(count, *count + nb, __ATOMIC_RELAXED);
+	} else {
+		count = &brick->pkts_count[RTE_MAX_LCORE].sides[side];
+		__atomic_fetch_add(count, nb, __ATOMIC_RELAXED);
+	}
+}
+
 inline int pg_brick_burst(struct pg_brick *brick, enum pg_side from,
 			  uint16_t edge_index, struct rte_mbuf **pkts,
 			  uint64_t pkts_mask, struct pg_error **errp)
@@ -649,8 +685,7 @@ inline int pg_brick_burst(struct pg_brick *brick, enum pg_side from,
 	 * @from is the opposite side of the direction on which
 	 * we send the packets, so we flip it
 	 */
-	PG_PKTS_COUNT_ADD(brick->sides[pg_flip_side(from)].packet_count,
-			 pg_mask_count(pkts_mask));
+	pkts_count_add(brick, pg_flip_side(from), pg_mask_count(pkts_mask));
 	return brick->burst(brick, from, edge_index, pkts, pkts_mask, errp);
 }
 
@@ -691,6 +726,28 @@ bool pg_brick_pollable(const struct pg_brick *brick)
 	return brick && brick->poll;
 }
 
+uint32_t pg_brick_flush_gen;
+
+void pg_brick_flush_set(struct pg_brick *brick,
+			int (*flush)(struct pg_brick *brick,
+				     struct pg_error **errp))
+{
+	brick->flush = flush;
+	__atomic_add_fetch(&pg_brick_flush_gen, 1, __ATOMIC_RELEASE);
+}
+
+int pg_brick_flush(struct pg_brick *brick, struct pg_error **errp)
+{
+	if (!brick->flush)
+		return 0;
+	return brick->flush(brick, errp);
+}
+
+bool pg_brick_flushable(const struct pg_brick *brick)
+{
+	return brick && brick->flush;
+}
+
 /* These functions are are for automated testing purpose */
 struct rte_mbuf **pg_brick_west_burst_get(struct pg_brick *brick,
 					  uint64_t *pkts_mask,
@@ -745,12 +802,55 @@ int pg_brick_side_forward(struct pg_brick_side *brick_side, enum pg_side from,
 	return 0;
 }
 
+int pg_brick_stage_flush(struct pg_brick_stage *stage,
+			 struct pg_brick_edge *edge, enum pg_side from,
+			 struct pg_error **errp)
+{
+	uint16_t count = stage->count;
+	uint64_t mask = pg_mask_firsts(count);
+	int ret = 0;
+
+	if (!count)
+		return 0;
+	if (edge->link)
+		ret = pg_brick_burst(edge->link, from, edge->pair_index,
+				     stage->pkts, mask, errp);
+	pg_packets_free(stage->pkts, mask);
+	stage->count = 0;
+	if (unlikely(ret < 0))
+		return -1;
+	return edge->link ? count : 0;
+}
+
+int pg_brick_stage_burst(struct pg_brick_stage *stage,
+			 struct pg_brick_edge *edge, enum pg_side from,
+			 struct rte_mbuf **pkts, uint64_t pkts_mask,
+			 struct pg_error **errp)
+{
+	int ret = 0;
+
+	if (stage->count + pg_mask_count(pkts_mask) > PG_MAX_PKTS_BURST) {
+		ret = pg_brick_stage_flush(stage, edge, from, errp);
+		if (unlikely(ret < 0))
+			return -1;
+	}
+	pg_packets_incref(pkts, pkts_mask);
+	stage->count += pg_packets_pack(stage->pkts + stage->count,
+					pkts, pkts_mask);
+	return ret;
+}
+
 uint64_t pg_brick_pkts_count_get(struct pg_brick *brick,
 				 enum pg_side side)
 {
+	uint64_t count = 0;
+
 	if (!brick)
 		return 0;
-	return PG_PKTS_COUNT_GET(brick->sides[side].packet_count);
+	for (int i = 0; i < PG_BRICK_PKTS_COUNT_SLOTS; ++i)
+		count += __atomic_load_n(&brick->pkts_count[i].sides[side],
+					 __ATOMIC_RELAXED);
+	return count;
 }
 
 uint64_t pg_brick_rx_bytes(struct pg_brick *brick)
@@ -835,6 +935,288 @@ int pg_brick_unlink_edge(struct pg_brick *west,
 	return 0;
 }
 
+/* edge of brick on side linked to target, NULL if there is none */
+static struct pg_brick_edge *find_edge(struct pg_brick *brick,
+				       enum pg_side side,
+				       struct pg_brick *target,
+				       uint16_t *index)
+{
+	struct pg_brick_side *s = get_side(brick, side);
+
+	for (uint16_t i = 0; i < s->max; i++) {
+		struct pg_brick_edge *edge = pg_brick_get_edge(brick, side, i);
+
+		if (edge && edge->link == target) {
+			*index = i;
+			return edge;
+		}
+	}
+	return NULL;
+}
+
+int pg_brick_splice(struct pg_brick *west, struct pg_brick *east,
+		    struct pg_brick *west_link, struct pg_brick *east_link,
+		    struct pg_error **errp)
+{
+	struct pg_brick_edge *west_edge, *east_edge;
+	uint16_t west_index, east_index, wl_index, el_index;
+
+	if (!is_brick_valid(west) || !is_brick_valid(east) ||
+	    !is_brick_valid(west_link) || !is_brick_valid(east_link)) {
+		*errp = pg_error_new("Node is not valid");
+		return -1;
+	}
+	west_edge = find_edge(west, PG_EAST_SIDE, east, &west_index);
+	if (!west_edge) {
+		*errp = pg_error_new("%s does not seem to be linked with %s",
+				     west->name, east->name);
+		return -1;
+	}
+	east_index = west_edge->pair_index;
+	east_edge = pg_brick_get_edge(east, PG_WEST_SIDE, east_index);
+	if (!is_place_available(west_link, PG_WEST_SIDE)) {
+		*errp = pg_error_new("%s:WEST side full", west_link->name);
+		return -1;
+	}
+	if (!is_place_available(east_link, PG_EAST_SIDE)) {
+		*errp = pg_error_new("%s:EAST side full", east_link->name);
+		return -1;
+	}
+
+	wl_index = insert_link(west_link, west, PG_WEST_SIDE);
+	if (west_link->ops->link_notify)
+		west_link->ops->link_notify(west_link, PG_WEST_SIDE, wl_index);
+	set_edge(west_link, PG_WEST_SIDE, wl_index, west_index);
+	el_index = insert_link(east_link, east, PG_EAST_SIDE);
+	if (east_link->ops->link_notify)
+		east_link->ops->link_notify(east_link, PG_EAST_SIDE, el_index);
+	set_edge(east_link, PG_EAST_SIDE, el_index, east_index);
+
+	/* west and east now reference the new bricks instead of each other */
+	pg_brick_incref(west_link);
+	west_edge->link = west_link;
+	west_edge->pair_index = wl_index;
+	pg_brick_incref(east_link);
+	east_edge->link = east_link;
+	east_edge->pair_index = el_index;
+	pg_brick_decref(east, errp);
+	pg_brick_decref(west, errp);
+	if (pg_error_is_set(errp))
+		return -1;
+	return 0;
+}
+
+int pg_brick_unsplice(struct pg_brick *west, struct pg_brick *east,
+		      struct pg_brick *west_link, struct pg_brick *east_link,
+		      struct pg_error **errp)
+{
+	struct pg_brick_edge *west_edge, *east_edge, *wl_edge, *el_edge;
+	uint16_t west_index, east_index, wl_index, el_index;
+
+	if (!is_brick_valid(west) || !is_brick_valid(east) ||
+	    !is_brick_valid(west_link) || !is_brick_valid(east_link)) {
+		*errp = pg_error_new("Node is not valid");
+		return -1;
+	}
+	west_edge = find_edge(west, PG_EAST_SIDE, west_link, &west_index);
+	east_edge = find_edge(east, PG_WEST_SIDE, east_link, &east_index);
+	wl_edge = find_edge(west_link, PG_WEST_SIDE, west, &wl_index);
+	el_edge = find_edge(east_link, PG_EAST_SIDE, east, &el_index);
+	if (!west_edge || !east_edge || !wl_edge || !el_edge) {
+		*errp = pg_error_new("%s and %s are not spliced with %s and %s",
+				     west->name, east->name,
+				     west_link->name, east_link->name);
+		return -1;
+	}
+
+	pg_brick_incref(east);
+	west_edge->link = east;
+	west_edge->pair_index = east_index;
+	pg_brick_incref(west);
+	east_edge->link = west;
+	east_edge->pair_index = west_index;
+
+	reset_edge(wl_edge);
+	get_side(west_link, PG_WEST_SIDE)->nb--;
+	reset_edge(el_edge);
+	get_side(east_link, PG_EAST_SIDE)->nb--;
+	pg_brick_decref(west, errp);
+	pg_brick_decref(east, errp);
+	pg_brick_decref(west_link, errp);
+	pg_brick_decref(east_link, errp);
+	if (pg_error_is_set(errp))
+		return -1;
+	return 0;
+}
+
+/**
+ * Brick instrumentation
+ *
+ * Enabling statistics swaps brick->burst and brick->poll with trampolines
+ * which time the original callbacks, so bricks which are not instrumented
+ * keep their usual fast path.
+ */
+
+struct pg_brick_stats_state {
+	/* original callbacks */
+	int (*burst)(struct pg_brick *brick, enum pg_side from,
+		     uint16_t edge_index, struct rte_mbuf **pkts,
+		     uint64_t pkts_mask, struct pg_error **errp);
+	int (*poll)(struct pg_brick *brick,
+		    uint16_t *count, struct pg_error **errp);
+	bool enabled;
+	struct pg_brick_stats stats;
+};
+
+/* cycles spent in instrumented bricks called by the current brick */
+static __thread uint64_t stats_nested_cycles;
+
+static inline void stats_account(struct pg_brick_side_stats *side,
+				 uint64_t start, uint64_t nested,
+				 uint16_t count)
+{
+	uint64_t total = rte_rdtsc() - start;
+	int bucket = 0;
+
+	side->cycles += total - stats_nested_cycles;
+	stats_nested_cycles = nested + total;
+	side->calls++;
+	side->pkts += count;
+	if (count) {
+		bucket = 32 - __builtin_clz(count);
+		if (bucket >= PG_BRICK_STATS_HIST_SIZE)
+			bucket = PG_BRICK_STATS_HIST_SIZE - 1;
+	}
+	side->burst_size_hist[bucket]++;
+}
+
+static int stats_burst(struct pg_brick *brick, enum pg_side from,
+		       uint16_t edge_index, struct rte_mbuf **pkts,
+		       uint64_t pkts_mask, struct pg_error **errp)
+{
+	struct pg_brick_stats_state *st = brick->stats;
+	uint64_t nested = stats_nested_cycles;
+	uint64_t start;
+	int ret;
+
+	stats_nested_cycles = 0;
+	start = rte_rdtsc();
+	ret = st->burst(brick, from, edge_index, pkts, pkts_mask, errp);
+	stats_account(&st->stats.sides[from], start, nested,
+		      pg_mask_count(pkts_mask));
+	return ret;
+}
+
+static int stats_poll(struct pg_brick *brick, uint16_t *count,
+		      struct pg_error **errp)
+{
+	struct pg_brick_stats_state *st = brick->stats;
+	uint64_t nested = stats_nested_cycles;
+	uint64_t start;
+	int ret;
+
+	*count = 0;
+	stats_nested_cycles = 0;
+	start = rte_rdtsc();
+	ret = st->poll(brick, count, errp);
+	stats_account(&st->stats.poll, start, nested, *count);
+	return ret;
+}
+
+int pg_brick_stats_enable(struct pg_brick *brick, struct pg_error **errp)
+{
+	struct pg_brick_stats_state *st;
+
+	if (!is_brick_valid(brick)) {
+		*errp = pg_error_new("brick is not valid");
+		return -1;
+	}
+
+	if (!brick->stats)
+		brick->stats = g_new0(struct pg_brick_stats_state, 1);
+	st = brick->stats;
+	if (st->enabled)
+		return 0;
+
+	st->burst = brick->burst;
+	st->poll = brick->poll;
+	st->enabled = true;
+	brick->burst = stats_burst;
+	if (brick->poll)
+		brick->poll = stats_poll;
+	return 0;
+}
+
+void pg_brick_stats_disable(struct pg_brick *brick)
+{
+	struct pg_brick_stats_state *st = brick->stats;
+
+	if (!st || !st->enabled)
+		return;
+	brick->burst = st->burst;
+	brick->poll = st->poll;
+	st->enabled = false;
+}
+
+void pg_brick_burst_set(struct pg_brick *brick,
+			int (*burst)(struct pg_brick *brick,
+				     enum pg_side from, uint16_t edge_index,
+				     struct rte_mbuf **pkts,
+				     uint64_t pkts_mask,
+				     struct pg_error **errp))
+{
+	if (brick->stats && brick->stats->enabled)
+		brick->stats->burst = burst;
+	else
+		brick->burst = burst;
+}
+
+bool pg_brick_stats_enabled(const struct pg_brick *brick)
+{
+	return brick->stats && brick->stats->enabled;
+}
+
+int pg_brick_stats_get(const struct pg_brick *brick,
+		       struct pg_brick_stats *stats,
+		       struct pg_error **errp)
+{
+	if (!brick->stats) {
+		*errp = pg_error_new("brick '%s' is not instrumented",
+				     brick->name);
+		return -1;
+	}
+	*stats = brick->stats->stats;
+	return 0;
+}
+
+void pg_brick_stats_reset(struct pg_brick *brick)
+{
+	if (brick->stats)
+		memset(&brick->stats->stats, 0, sizeof(struct pg_brick_stats));
+}
+
+void pg_brick_weight_set(struct pg_brick *brick, uint64_t weight)
+{
+	brick->weight = weight;
+}
+
+uint64_t pg_brick_weight(const struct pg_brick *brick)
+{
+	return brick->weight;
+}
+
+static void pg_brick_dot_stats(const char *name,
+			       struct pg_brick_side_stats *side,
+			       GString *s)
+{
+	if (!side->calls)
+		return;
+	g_string_append_printf(s,
+		"&#92;n%s: %"PRIu64" calls, %"PRIu64" pkts, %"PRIu64
+		" cycles/pkt", name, side->calls, side->pkts,
+		side->cycles / (side->pkts ? side->pkts : 1));
+}
+
 static GList *pg_brick_dot_add(GList *todo, GList *done,
 			       struct pg_brick *b, struct pg_brick *n,
 			       enum pg_side i, GString *s)
@@ -880,11 +1262,19 @@ char *pg_brick_dot(struct pg_brick *brick)
 
 		/* declare node */
 		g_string_append_printf(s,
-		"  \"%s:%s\" [ label=\"{ <west> | %s&#92;n%s |<east> }\"];\n",
+		"  \"%s:%s\" [ label=\"{ <west> | %s&#92;n%s",
 			b->ops->name,
 			b->name,
 			b->ops->name,
 			b->name);
+		if (b->stats) {
+			struct pg_brick_stats *st = &b->stats->stats;
+
+			pg_brick_dot_stats("west", &st->sides[PG_WEST_SIDE], s);
+			pg_brick_dot_stats("east", &st->sides[PG_EAST_SIDE], s);
+			pg_brick_dot_stats("poll", &st->poll, s);
+		}
+		g_string_append(s, " |<east> }\"];\n");
 
 		if (b->type == PG_MONOPOLE) {
 			struct pg_brick *n = b->side.edge.link;
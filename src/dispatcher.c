@@ -0,0 +1,312 @@
+/* Copyright 2019 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#include <packetgraph/packetgraph.h>
+#include <packetgraph/dispatcher.h>
+
+#include "utils/bitmask.h"
+#include "utils/network.h"
+#include "brick-int.h"
+
+#define DISPATCHER_RETA_MASK (PG_DISPATCHER_RETA_SIZE - 1)
+
+struct pg_dispatcher_config {
+	enum pg_side output;
+};
+
+struct pg_dispatcher_state {
+	struct pg_brick brick;
+	enum pg_side output;
+	/* output edge of each flow hash bucket */
+	uint16_t reta[PG_DISPATCHER_RETA_SIZE];
+	/* reta has been set by the user, else it spreads over linked edges */
+	bool reta_custom;
+	uint64_t reta_pkts[PG_DISPATCHER_RETA_SIZE];
+	/* per output edge: packets of the current burst and counters */
+	uint64_t *masks;
+	uint64_t *edge_pkts;
+	/* output edges having packets in the current burst */
+	uint16_t *todo;
+};
+
+static inline uint32_t dispatcher_hash(struct rte_mbuf *pkt)
+{
+	uint32_t hash;
+
+	if (pkt->ol_flags & PKT_RX_RSS_HASH)
+		hash = pkt->hash.rss;
+	else
+		hash = pg_utils_flow_hash(pkt);
+	/* low bits of crc32 are fine, fold anyway for rss hashes */
+	return hash ^ (hash >> 16);
+}
+
+static int dispatcher_backward(struct pg_brick *brick, enum pg_side from,
+			       struct rte_mbuf **pkts, uint64_t pkts_mask,
+			       struct pg_error **errp)
+{
+	struct pg_brick_side *s = &brick->sides[pg_flip_side(from)];
+
+	for (uint16_t i = 0; i < s->max; ++i) {
+		if (!s->edges[i].link)
+			continue;
+		if (unlikely(pg_brick_burst(s->edges[i].link, from,
+					    s->edges[i].pair_index,
+					    pkts, pkts_mask, errp) < 0))
+			return -1;
+	}
+	return 0;
+}
+
+static int dispatcher_burst(struct pg_brick *brick, enum pg_side from,
+			    uint16_t edge_index, struct rte_mbuf **pkts,
+			    uint64_t pkts_mask, struct pg_error **errp)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+	struct pg_brick_side *s = &brick->sides[state->output];
+	uint16_t nb_todo = 0;
+	uint32_t bucket;
+	uint16_t edge;
+	uint64_t mask;
+	int ret = 0;
+
+	if (from == state->output)
+		return dispatcher_backward(brick, from, pkts, pkts_mask, errp);
+
+	/* bucket the whole burst in one pass */
+	PG_FOREACH_BIT(pkts_mask, it) {
+		bucket = dispatcher_hash(pkts[it]) & DISPATCHER_RETA_MASK;
+		edge = state->reta[bucket];
+		state->reta_pkts[bucket]++;
+		if (!state->masks[edge])
+			state->todo[nb_todo++] = edge;
+		state->masks[edge] |= ONE64 << it;
+	}
+
+	for (uint16_t i = 0; i < nb_todo; ++i) {
+		edge = state->todo[i];
+		mask = state->masks[edge];
+		state->masks[edge] = 0;
+		/* the edge has been unlinked, packets are dropped */
+		if (unlikely(!s->edges[edge].link || ret < 0))
+			continue;
+		state->edge_pkts[edge] += pg_mask_count(mask);
+		ret = pg_brick_burst(s->edges[edge].link, from,
+				     s->edges[edge].pair_index,
+				     pkts, mask, errp);
+	}
+	return ret;
+}
+
+/**
+ * Spread the indirection table over linked output edges.
+ *
+ * @param	brick the dispatcher brick
+ * @param	skip output edge being unlinked, -1 if none
+ */
+static void dispatcher_reta_default(struct pg_brick *brick, int skip)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+	struct pg_brick_side *s = &brick->sides[state->output];
+	uint16_t *linked = g_new(uint16_t, s->max);
+	uint16_t nb = 0;
+
+	for (uint16_t i = 0; i < s->max; ++i) {
+		if (s->edges[i].link && i != skip)
+			linked[nb++] = i;
+	}
+	for (int i = 0; i < PG_DISPATCHER_RETA_SIZE; ++i)
+		__atomic_store_n(&state->reta[i], nb ? linked[i % nb] : 0,
+				 __ATOMIC_RELAXED);
+	g_free(linked);
+}
+
+static void dispatcher_link(struct pg_brick *brick, enum pg_side side,
+			    int edge)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+
+	if (side == state->output && !state->reta_custom)
+		dispatcher_reta_default(brick, -1);
+}
+
+static void dispatcher_unlink_notify(struct pg_brick *brick,
+				     enum pg_side side, uint16_t edge_index,
+				     struct pg_error **errp)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+
+	if (side != state->output)
+		return;
+	/* a user table pointing to the edge falls back to the default */
+	for (int i = 0; i < PG_DISPATCHER_RETA_SIZE; ++i) {
+		if (state->reta[i] == edge_index)
+			state->reta_custom = false;
+	}
+	if (!state->reta_custom)
+		dispatcher_reta_default(brick, edge_index);
+}
+
+static int dispatcher_init(struct pg_brick *brick,
+			   struct pg_brick_config *config,
+			   struct pg_error **errp)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+	struct pg_dispatcher_config *dispatcher_config = config->brick_config;
+	uint16_t max;
+
+	state->output = dispatcher_config->output;
+	max = brick->sides[state->output].max;
+	if (!max) {
+		*errp = pg_error_new("Dispatcher %s has no output edge",
+				     config->name);
+		return -1;
+	}
+	state->masks = g_new0(uint64_t, max);
+	state->edge_pkts = g_new0(uint64_t, max);
+	state->todo = g_new0(uint16_t, max);
+
+	brick->burst = dispatcher_burst;
+	return 0;
+}
+
+static void dispatcher_destroy(struct pg_brick *brick, struct pg_error **errp)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+
+	g_free(state->masks);
+	g_free(state->edge_pkts);
+	g_free(state->todo);
+}
+
+static struct pg_brick_config *pg_dispatcher_config_new(const char *name,
+							uint32_t west_max,
+							uint32_t east_max,
+							enum pg_side output)
+{
+	struct pg_brick_config *config = g_new0(struct pg_brick_config, 1);
+	struct pg_dispatcher_config *dispatcher_config =
+		g_new0(struct pg_dispatcher_config, 1);
+
+	dispatcher_config->output = output;
+	config->brick_config = dispatcher_config;
+	return pg_brick_config_init(config, name, west_max, east_max,
+				    PG_MULTIPOLE);
+}
+
+struct pg_brick *pg_dispatcher_new(const char *name,
+				   uint32_t west_max,
+				   uint32_t east_max,
+				   enum pg_side output,
+				   struct pg_error **errp)
+{
+	struct pg_brick_config *config =
+		pg_dispatcher_config_new(name, west_max, east_max, output);
+	struct pg_brick *ret = pg_brick_new("dispatcher", config, errp);
+
+	pg_brick_config_free(config);
+	return ret;
+}
+
+int pg_dispatcher_reta_set(struct pg_brick *brick, const uint16_t *reta,
+			   struct pg_error **errp)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+	struct pg_brick_side *s = &brick->sides[state->output];
+
+	for (int i = 0; i < PG_DISPATCHER_RETA_SIZE; ++i) {
+		if (reta[i] >= s->max) {
+			*errp = pg_error_new("Entry %d: edge %u out of %u",
+					     i, reta[i], s->max);
+			return -1;
+		}
+		if (!s->edges[reta[i]].link) {
+			*errp = pg_error_new("Entry %d: edge %u is not linked",
+					     i, reta[i]);
+			return -1;
+		}
+	}
+	state->reta_custom = true;
+	/* entries are aligned 16 bits words, the datapath never sees a
+	 * partially written one */
+	for (int i = 0; i < PG_DISPATCHER_RETA_SIZE; ++i)
+		__atomic_store_n(&state->reta[i], reta[i], __ATOMIC_RELAXED);
+	return 0;
+}
+
+void pg_dispatcher_reta_get(struct pg_brick *brick, uint16_t *reta)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+
+	memcpy(reta, state->reta, sizeof(state->reta));
+}
+
+uint64_t pg_dispatcher_edge_pkts(struct pg_brick *brick, uint16_t edge)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+
+	if (edge >= brick->sides[state->output].max)
+		return 0;
+	return state->edge_pkts[edge];
+}
+
+uint64_t pg_dispatcher_reta_pkts(struct pg_brick *brick, uint16_t entry)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+
+	if (entry >= PG_DISPATCHER_RETA_SIZE)
+		return 0;
+	return state->reta_pkts[entry];
+}
+
+void pg_dispatcher_pkts_reset(struct pg_brick *brick)
+{
+	struct pg_dispatcher_state *state =
+		pg_brick_get_state(brick, struct pg_dispatcher_state);
+
+	memset(state->reta_pkts, 0, sizeof(state->reta_pkts));
+	memset(state->edge_pkts, 0,
+	       sizeof(uint64_t) * brick->sides[state->output].max);
+}
+
+static struct pg_brick_ops dispatcher_ops = {
+	.name		= "dispatcher",
+	.state_size	= sizeof(struct pg_dispatcher_state),
+
+	.init		= dispatcher_init,
+	.destroy	= dispatcher_destroy,
+
+	.unlink		= pg_brick_generic_unlink,
+	.link_notify	= dispatcher_link,
+	.unlink_notify	= dispatcher_unlink_notify,
+};
+
+pg_brick_register(dispatcher, &dispatcher_ops);
@@ -16,9 +16,16 @@
  */
 #include <glib.h>
 #include <rte_config.h>
+#include <rte_cycles.h>
 #include <rte_ether.h>
+#include <rte_hash_crc.h>
+#include <rte_ip.h>
+#include <rte_lcore.h>
+#include <rte_prefetch.h>
+#include <rte_udp.h>
 #include <pcap/pcap.h>
 #include <endian.h>
+#include <netinet/in.h>
 
 #include <packetgraph/packetgraph.h>
 #include "utils/bitmask.h"
@@ -27,19 +34,87 @@
 #include "utils/network.h"
 #include "utils/mempool.h"
 #include "src/npf/npf/dpdk/npf_dpdk.h"
+#include "src/npf/libqsbr/src/ebr.h"
 
 #define FIREWALL_SIDE_TO_NPF(side) \
 	((side) == PG_WEST_SIDE ? PFIL_OUT : PFIL_IN)
 
+/* a flow must be seen again by NPF after this delay to keep its entry */
+#define FIREWALL_FLOW_CACHE_TTL_MS 1000
+
 uint32_t pg_npf_nworkers;
 
 struct ifnet;
 
+struct firewall_flow_key {
+	uint8_t src[16];
+	uint8_t dst[16];
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint8_t proto;
+	uint8_t pf_side;
+	uint16_t padding;
+};
+
+/* a flow to which NPF gave a pass verdict */
+struct firewall_flow_entry {
+	struct firewall_flow_key key;
+	/* firewall generation at insertion time, 0 for a free entry */
+	uint32_t gen;
+	/* when NPF saw the flow for the last time */
+	uint64_t tsc;
+} __rte_cache_aligned;
+
+/* direct mapped flow cache, one per lcore */
+struct firewall_flow_cache {
+	uint32_t mask;
+	uint64_t hits;
+	uint64_t misses;
+	struct firewall_flow_entry entries[];
+};
+
+/* hits of a rule on one lcore */
+struct firewall_rule_count {
+	uint64_t pkts;
+	uint64_t bytes;
+} __rte_cache_aligned;
+
+struct firewall_rule {
+	nl_rule_t *nl_rule;
+	/* filter of the rule, bf_len is 0 when the rule matches everything */
+	struct bpf_program bpf;
+	int side_attr;
+	/* number of rule lists and loaded rulesets using the rule */
+	int refcount;
+	/* RTE_MAX_LCORE counters */
+	struct firewall_rule_count *counts;
+};
+
+/* rules loaded in NPF, in the order NPF inspects them */
+struct firewall_ruleset {
+	uint32_t nb_rules;
+	struct firewall_rule *rules[];
+};
+
 struct pg_firewall_state {
 	struct pg_brick brick;
 	npf_t *npf;
 	struct ifnet *ifp;
+	/* serialize control plane calls, never taken by the datapath */
+	GMutex lock;
 	GList *rules;
+	/* protects the loaded ruleset read by the datapath */
+	ebr_t *ebr;
+	struct firewall_ruleset *ruleset;
+	bool match_stats;
+	/* packets blocked because no rule allowed them, per lcore */
+	struct firewall_rule_count *default_counts;
+	/* lcores registered to NPF, so they can run this firewall */
+	bool lcore_registered[RTE_MAX_LCORE];
+	struct firewall_flow_cache *flow_caches[RTE_MAX_LCORE];
+	/* incremented each time cached verdicts may have become wrong */
+	uint32_t flow_cache_gen;
+	uint64_t flow_cache_ttl;
 };
 
 struct pg_firewall_config {
@@ -66,29 +141,80 @@ void pg_firewall_gc(struct pg_brick *brick)
 	state = pg_brick_get_state(brick,
 				   struct pg_firewall_state);
 	npfk_gc(state->npf);
+	/* some connections may have expired */
+	__atomic_add_fetch(&state->flow_cache_gen, 1, __ATOMIC_RELEASE);
 }
 
-static int firewall_build_pcap_filter(nl_rule_t *rl, const char *filter)
+static struct firewall_rule_count *firewall_counts_new(struct pg_error **errp)
+{
+	size_t size = sizeof(struct firewall_rule_count) * RTE_MAX_LCORE;
+	void *counts;
+	int ret;
+
+	ret = posix_memalign(&counts, RTE_CACHE_LINE_SIZE, size);
+	if (ret) {
+		*errp = pg_error_new_errno(ret,
+			"Failed to allocate rule counters");
+		return NULL;
+	}
+	memset(counts, 0, size);
+	return counts;
+}
+
+static void firewall_counts_sum(struct firewall_rule_count *counts,
+				struct pg_firewall_match_stats *stats)
+{
+	stats->pkts = 0;
+	stats->bytes = 0;
+	for (int i = 0; i < RTE_MAX_LCORE; ++i) {
+		stats->pkts += counts[i].pkts;
+		stats->bytes += counts[i].bytes;
+	}
+}
+
+static int firewall_build_pcap_filter(struct firewall_rule *rule,
+				      const char *filter)
 {
 	const size_t maxsnaplen = 64 * 1024;
-	struct bpf_program bf;
 	size_t len;
 	int ret;
 
 	/* compile the expression (use DLT_RAW for NPF rules). */
-	ret = pcap_compile_nopcap(maxsnaplen, DLT_RAW, &bf,
+	ret = pcap_compile_nopcap(maxsnaplen, DLT_RAW, &rule->bpf,
 				  filter, 1, PCAP_NETMASK_UNKNOWN);
 	if (ret)
 		return ret;
 
-	/* assign the byte-code to this rule. */
-	len = bf.bf_len * sizeof(struct bpf_insn);
-	ret = npf_rule_setcode(rl, NPF_CODE_BPF, bf.bf_insns, len);
+	/* assign the byte-code to this rule, keep it to account hits. */
+	len = rule->bpf.bf_len * sizeof(struct bpf_insn);
+	ret = npf_rule_setcode(rule->nl_rule, NPF_CODE_BPF,
+			       rule->bpf.bf_insns, len);
 	g_assert(ret == 0);
-	pcap_freecode(&bf);
 	return 0;
 }
 
+/* must be called with the firewall lock held */
+static void firewall_rule_unref(struct firewall_rule *rule)
+{
+	if (--rule->refcount)
+		return;
+	npf_rule_destroy(rule->nl_rule);
+	if (rule->bpf.bf_len)
+		pcap_freecode(&rule->bpf);
+	free(rule->counts);
+	g_free(rule);
+}
+
+/* must be called with the firewall lock held */
+static void firewall_ruleset_free(struct firewall_ruleset *ruleset)
+{
+	if (!ruleset)
+		return;
+	for (uint32_t i = 0; i < ruleset->nb_rules; ++i)
+		firewall_rule_unref(ruleset->rules[i]);
+	g_free(ruleset);
+}
+
 static inline int firewall_side_to_npf_rule(enum pg_side side)
 {
 	switch (side) {
@@ -103,22 +229,36 @@ int pg_firewall_rule_add(struct pg_brick *brick, const char *filter,
 			 struct pg_error **errp)
 {
 	struct pg_firewall_state *state;
-	struct nl_rule *rule;
+	struct firewall_rule *rule;
 	int options = 0;
 
 	state = pg_brick_get_state(brick, struct pg_firewall_state);
-	options |= firewall_side_to_npf_rule(side);
+	rule = g_new0(struct firewall_rule, 1);
+	rule->counts = firewall_counts_new(errp);
+	if (!rule->counts) {
+		g_free(rule);
+		return -1;
+	}
+	rule->side_attr = firewall_side_to_npf_rule(side);
+	rule->refcount = 1;
+	options |= rule->side_attr;
 	if (stateful)
 		options |= NPF_RULE_STATEFUL;
-	rule = npf_rule_create(NULL, NPF_RULE_PASS | options, "firewall");
-	g_assert(rule);
-	npf_rule_setprio(rule, NPF_PRI_LAST);
+	rule->nl_rule = npf_rule_create(NULL, NPF_RULE_PASS | options,
+					"firewall");
+	g_assert(rule->nl_rule);
+	npf_rule_setprio(rule->nl_rule, NPF_PRI_LAST);
 	if (filter && firewall_build_pcap_filter(rule, filter)) {
 		*errp = pg_error_new("this filter failed to build: %s",
 				     filter);
+		npf_rule_destroy(rule->nl_rule);
+		free(rule->counts);
+		g_free(rule);
 		return -1;
 	}
+	g_mutex_lock(&state->lock);
 	state->rules = g_list_append(state->rules, rule);
+	g_mutex_unlock(&state->lock);
 	return 0;
 }
 
@@ -127,22 +267,23 @@ void pg_firewall_rule_flush_side(struct pg_brick *brick, enum pg_side side)
 	struct pg_firewall_state *state;
 	GList *it;
 	int pf_side = firewall_side_to_npf_rule(side);
-	int32_t side_attr;
+	struct firewall_rule *rule;
 
 	state = pg_brick_get_state(brick, struct pg_firewall_state);
+	g_mutex_lock(&state->lock);
 	/* clean all rules */
 	it = state->rules;
 	while (it) {
-		side_attr = npf_rule_getattr(it->data) & (NPF_RULE_OUT |
-							  NPF_RULE_IN);
-		if (side_attr & pf_side) {
-			npf_rule_destroy(it->data);
+		rule = it->data;
+		if (rule->side_attr & pf_side) {
+			firewall_rule_unref(rule);
 			state->rules = g_list_delete_link(state->rules, it);
 			it = state->rules;
 			continue;
 		}
 		it = g_list_next(it);
 	}
+	g_mutex_unlock(&state->lock);
 }
 
 void pg_firewall_rule_flush(struct pg_brick *brick)
@@ -151,31 +292,53 @@ void pg_firewall_rule_flush(struct pg_brick *brick)
 	GList *it;
 
 	state = pg_brick_get_state(brick, struct pg_firewall_state);
+	g_mutex_lock(&state->lock);
 	/* clean all rules */
 	it = state->rules;
 	while (it) {
-		npf_rule_destroy(it->data);
+		firewall_rule_unref(it->data);
 		it = g_list_next(it);
 	}
 	/* flush list */
 	g_list_free(state->rules);
 	state->rules = NULL;
+	g_mutex_unlock(&state->lock);
 }
 
+/**
+ * Build a NPF configuration from the rules and load it.
+ * The configuration is built by the calling thread, then npfk_load
+ * publishes the new ruleset with a single pointer swap and reclaims the
+ * old one once every thread running the firewall went through a
+ * quiescent state (NPF uses the EBR of libqsbr), so the datapath never
+ * waits nor sees a partial ruleset. Tracked connections are kept.
+ * Rules used to account hits are published the same way, using our own
+ * EBR instance.
+ * Must be called with the firewall lock held.
+ */
 static int firewall_reload_internal(struct pg_firewall_state *state,
 				    struct pg_error **errp)
 {
 	npf_error_t errinfo;
 	struct nl_config *config;
+	struct firewall_ruleset *ruleset;
 	void *config_build;
 	int npf_ret;
 	GList *it;
 
 	config = npf_config_create();
+	ruleset = g_malloc(sizeof(struct firewall_ruleset) +
+			   g_list_length(state->rules) *
+			   sizeof(struct firewall_rule *));
+	ruleset->nb_rules = 0;
 
 	it = state->rules;
 	while (it != NULL) {
-		npf_rule_insert(config, NULL, it->data);
+		struct firewall_rule *rule = it->data;
+
+		npf_rule_insert(config, NULL, rule->nl_rule);
+		rule->refcount++;
+		ruleset->rules[ruleset->nb_rules++] = rule;
 		it = g_list_next(it);
 	}
 
@@ -185,10 +348,19 @@ static int firewall_reload_internal(struct pg_firewall_state *state,
 	free(config);
 
 	if (npf_ret != 0) {
+		firewall_ruleset_free(ruleset);
 		*errp = pg_error_new_errno(npf_ret,
 					   "NPF failed to load configuration");
 		return -1;
 	}
+
+	ruleset = __atomic_exchange_n(&state->ruleset, ruleset,
+				      __ATOMIC_ACQ_REL);
+	if (ruleset) {
+		/* wait for the datapath to stop using the old rules */
+		ebr_full_sync(state->ebr, 1);
+		firewall_ruleset_free(ruleset);
+	}
 	return 0;
 }
 
@@ -196,7 +368,140 @@ int pg_firewall_reload(struct pg_brick *brick, struct pg_error **errp)
 {
 	struct pg_firewall_state *state =
 		pg_brick_get_state(brick, struct pg_firewall_state);
-	return firewall_reload_internal(state, errp);
+	int ret;
+
+	g_mutex_lock(&state->lock);
+	/* control threads may enter NPF critical sections while loading */
+	npfk_thread_register(state->npf);
+	ret = firewall_reload_internal(state, errp);
+	/* the new ruleset is published, drop verdicts of the old one */
+	__atomic_add_fetch(&state->flow_cache_gen, 1, __ATOMIC_RELEASE);
+	g_mutex_unlock(&state->lock);
+	return ret;
+}
+
+/**
+ * Publish new flow caches, NULL ones disabling the cache, and free the
+ * former ones once the datapath stopped using them.
+ * Must be called with the firewall lock held.
+ */
+static void firewall_flow_cache_swap(struct pg_firewall_state *state,
+				     struct firewall_flow_cache **caches)
+{
+	struct firewall_flow_cache *old[RTE_MAX_LCORE];
+	bool any = false;
+
+	for (int i = 0; i < RTE_MAX_LCORE; ++i) {
+		old[i] = __atomic_exchange_n(&state->flow_caches[i],
+					     caches ? caches[i] : NULL,
+					     __ATOMIC_ACQ_REL);
+		any |= old[i] != NULL;
+	}
+	if (!any)
+		return;
+	ebr_full_sync(state->ebr, 1);
+	for (int i = 0; i < RTE_MAX_LCORE; ++i)
+		g_free(old[i]);
+}
+
+int pg_firewall_flow_cache_enable(struct pg_brick *brick, uint32_t size,
+				  struct pg_error **errp)
+{
+	struct pg_firewall_state *state =
+		pg_brick_get_state(brick, struct pg_firewall_state);
+	struct firewall_flow_cache *caches[RTE_MAX_LCORE] = { NULL };
+	unsigned int lcore;
+
+	if (!size || (size & (size - 1))) {
+		*errp = pg_error_new("flow cache size must be a power of 2");
+		return -1;
+	}
+
+	RTE_LCORE_FOREACH(lcore) {
+		struct firewall_flow_cache *cache;
+
+		cache = g_malloc0(sizeof(struct firewall_flow_cache) +
+				  size * sizeof(struct firewall_flow_entry));
+		cache->mask = size - 1;
+		caches[lcore] = cache;
+	}
+	g_mutex_lock(&state->lock);
+	state->flow_cache_ttl =
+		rte_get_timer_hz() * FIREWALL_FLOW_CACHE_TTL_MS / 1000;
+	firewall_flow_cache_swap(state, caches);
+	g_mutex_unlock(&state->lock);
+	return 0;
+}
+
+void pg_firewall_flow_cache_disable(struct pg_brick *brick)
+{
+	struct pg_firewall_state *state =
+		pg_brick_get_state(brick, struct pg_firewall_state);
+
+	g_mutex_lock(&state->lock);
+	firewall_flow_cache_swap(state, NULL);
+	g_mutex_unlock(&state->lock);
+}
+
+void pg_firewall_flow_cache_stats(struct pg_brick *brick, uint64_t *hits,
+				  uint64_t *misses)
+{
+	struct pg_firewall_state *state =
+		pg_brick_get_state(brick, struct pg_firewall_state);
+
+	*hits = 0;
+	*misses = 0;
+	/* caches are only freed with the lock held */
+	g_mutex_lock(&state->lock);
+	for (int i = 0; i < RTE_MAX_LCORE; ++i) {
+		if (!state->flow_caches[i])
+			continue;
+		*hits += state->flow_caches[i]->hits;
+		*misses += state->flow_caches[i]->misses;
+	}
+	g_mutex_unlock(&state->lock);
+}
+
+void pg_firewall_match_stats_enable(struct pg_brick *brick)
+{
+	pg_brick_get_state(brick, struct pg_firewall_state)->match_stats = true;
+}
+
+void pg_firewall_match_stats_disable(struct pg_brick *brick)
+{
+	struct pg_firewall_state *state =
+		pg_brick_get_state(brick, struct pg_firewall_state);
+
+	state->match_stats = false;
+}
+
+int pg_firewall_rule_match_stats(struct pg_brick *brick, uint32_t index,
+				 struct pg_firewall_match_stats *stats,
+				 struct pg_error **errp)
+{
+	struct pg_firewall_state *state =
+		pg_brick_get_state(brick, struct pg_firewall_state);
+	struct firewall_rule *rule;
+
+	g_mutex_lock(&state->lock);
+	rule = g_list_nth_data(state->rules, index);
+	if (!rule) {
+		g_mutex_unlock(&state->lock);
+		*errp = pg_error_new("no rule at index %u", index);
+		return -1;
+	}
+	firewall_counts_sum(rule->counts, stats);
+	g_mutex_unlock(&state->lock);
+	return 0;
+}
+
+void pg_firewall_default_stats(struct pg_brick *brick,
+			       struct pg_firewall_match_stats *stats)
+{
+	struct pg_firewall_state *state =
+		pg_brick_get_state(brick, struct pg_firewall_state);
+
+	firewall_counts_sum(state->default_counts, stats);
 }
 
 struct pg_brick *pg_firewall_new(const char *name, uint64_t flags,
@@ -211,52 +516,288 @@ struct pg_brick *pg_firewall_new(const char *name, uint64_t flags,
 	return ret;
 }
 
-static int firewall_burst(struct pg_brick *brick, enum pg_side from,
-			  uint16_t edge_index, struct rte_mbuf **pkts,
-			  uint64_t pkts_mask,
-			  struct pg_error **errp)
+/* register the calling lcore to NPF the first time it uses the firewall */
+static inline void firewall_thread_register(struct pg_firewall_state *state)
 {
-	struct pg_brick_side *s = &brick->sides[pg_flip_side(from)];
-	struct pg_firewall_state *state;
-	int pf_side;
-	uint64_t it_mask;
-	uint64_t bit;
-	uint16_t i;
-	int ret;
-	struct rte_mbuf *tmp;
-	uint16_t ether_type;
+	unsigned int lcore = rte_lcore_id();
 
-	state = pg_brick_get_state(brick, struct pg_firewall_state);
-	pf_side = FIREWALL_SIDE_TO_NPF(from);
+	if (unlikely(lcore < RTE_MAX_LCORE &&
+		     !state->lcore_registered[lcore])) {
+		npfk_thread_register(state->npf);
+		ebr_register(state->ebr);
+		state->lcore_registered[lcore] = true;
+	}
+}
 
-	it_mask = pkts_mask;
-	for (; it_mask;) {
-		pg_low_bit_iterate_full(it_mask, bit, i);
-		tmp = pkts[i];
-		ether_type = pg_utils_get_ether_type(tmp);
+/**
+ * Extract the flow of an IP packet.
+ * Only UDP packets are cached: NPF tracks sequence numbers and windows of
+ * TCP connections, so every TCP segment must go through NPF.
+ *
+ * @return	true if the packet can use the flow cache
+ */
+static inline bool firewall_flow_key_get(struct rte_mbuf *pkt,
+					 uint16_t ether_type, int pf_side,
+					 struct firewall_flow_key *key)
+{
+	uint8_t *l3 = rte_pktmbuf_mtod_offset(pkt, uint8_t *, pkt->l2_len);
+	uint16_t l3_len;
+	uint16_t *ports;
+	uint8_t proto;
+
+	memset(key, 0, sizeof(struct firewall_flow_key));
+	if (ether_type == PG_BE_ETHER_TYPE_IPv4) {
+		struct ipv4_hdr *ip = (struct ipv4_hdr *)l3;
+
+		/* fragments do not all carry ports */
+		if (ip->fragment_offset &
+		    rte_cpu_to_be_16(IPV4_HDR_OFFSET_MASK | IPV4_HDR_MF_FLAG))
+			return false;
+		l3_len = (ip->version_ihl & IPV4_HDR_IHL_MASK) *
+			IPV4_IHL_MULTIPLIER;
+		proto = ip->next_proto_id;
+		memcpy(key->src, &ip->src_addr, sizeof(ip->src_addr));
+		memcpy(key->dst, &ip->dst_addr, sizeof(ip->dst_addr));
+	} else {
+		struct ipv6_hdr *ip = (struct ipv6_hdr *)l3;
+
+		l3_len = sizeof(struct ipv6_hdr);
+		proto = ip->proto;
+		memcpy(key->src, ip->src_addr, sizeof(ip->src_addr));
+		memcpy(key->dst, ip->dst_addr, sizeof(ip->dst_addr));
+	}
 
-		/* Firewall only manage IPv4 or IPv6 filtering.
-		 * Let non-ip packets (like ARP) pass.
-		 */
-		if (unlikely(ether_type != PG_BE_ETHER_TYPE_IPv4 &&
-			     ether_type != PG_BE_ETHER_TYPE_IPv6)) {
+	if (proto != IPPROTO_UDP)
+		return false;
+	if (unlikely(rte_pktmbuf_data_len(pkt) <
+		     pkt->l2_len + l3_len + sizeof(struct udp_hdr)))
+		return false;
+	ports = (uint16_t *)(l3 + l3_len);
+	key->src_port = ports[0];
+	key->dst_port = ports[1];
+	key->proto = proto;
+	key->pf_side = pf_side;
+	return true;
+}
+
+/**
+ * Find the last rule whose filter matches a packet, which is the rule NPF
+ * applies when it inspects the ruleset since all rules are non final pass
+ * rules.
+ *
+ * @return	the counter of the rule on this lcore, NULL if no rule matches
+ */
+static inline struct firewall_rule_count *
+firewall_rule_match(struct firewall_ruleset *ruleset, struct rte_mbuf *pkt,
+		    int rule_side, unsigned int lcore)
+{
+	const u_char *l3 = rte_pktmbuf_mtod_offset(pkt, u_char *,
+						   pkt->l2_len);
+	u_int wirelen = rte_pktmbuf_pkt_len(pkt) - pkt->l2_len;
+	u_int buflen = rte_pktmbuf_data_len(pkt) - pkt->l2_len;
+
+	for (uint32_t i = ruleset->nb_rules; i-- > 0;) {
+		struct firewall_rule *rule = ruleset->rules[i];
+
+		if (!(rule->side_attr & rule_side))
+			continue;
+		if (rule->bpf.bf_len &&
+		    !bpf_filter(rule->bpf.bf_insns, l3, wirelen, buflen))
 			continue;
+		return &rule->counts[lcore];
+	}
+	return NULL;
+}
+
+/**
+ * Account allowed IP packets to the last rule whose filter matches them,
+ * and blocked ones to the default action.
+ * NPF does not tell which rule gave its verdict, nor whether a tracked
+ * connection decided it, so filters of the loaded rules are run again on
+ * every allowed packet.
+ */
+static void firewall_match_stats_update(struct pg_firewall_state *state,
+					struct rte_mbuf **pkts,
+					const uint16_t *ip_pkts, uint16_t nb_ip,
+					uint64_t pkts_mask, int pf_side)
+{
+	int rule_side = pf_side == PFIL_OUT ? NPF_RULE_OUT : NPF_RULE_IN;
+	unsigned int lcore = rte_lcore_id();
+	struct firewall_ruleset *ruleset;
+
+	if (unlikely(lcore >= RTE_MAX_LCORE))
+		return;
+	ebr_enter(state->ebr);
+	ruleset = __atomic_load_n(&state->ruleset, __ATOMIC_ACQUIRE);
+	for (uint16_t j = 0; j < nb_ip; ++j) {
+		struct rte_mbuf *pkt = pkts[ip_pkts[j]];
+		struct firewall_rule_count *count =
+			&state->default_counts[lcore];
+
+		if (pkts_mask & (ONE64 << ip_pkts[j])) {
+			count = firewall_rule_match(ruleset, pkt, rule_side,
+						    lcore);
+			if (!count)
+				continue;
 		}
+		count->pkts++;
+		count->bytes += rte_pktmbuf_pkt_len(pkt);
+	}
+	ebr_exit(state->ebr);
+}
+
+/**
+ * Run NPF on the layer 3 of one packet.
+ * NPF only manage layer 3 so layer 2 is hidden by moving data_off by
+ * l2_len while NPF handles the packet. This is not thread safe: a packet
+ * whose reference count is above one may be read by another thread at the
+ * same time (e.g. flooded by a switch to bricks polled by other threads),
+ * so such packets are filtered through a clone which has its own data_off.
+ *
+ * @return	0 if NPF let the packet pass
+ */
+static inline int firewall_npf_handle(struct pg_firewall_state *state,
+				      struct rte_mbuf *pkt, int pf_side)
+{
+	uint8_t l2_len = pkt->l2_len;
+	struct rte_mbuf *tmp = pkt;
+	int ret;
 
-		/* NPF only manage layer 3 so we temporaly cut off layer 2.
-		 * Note that this trick is not thread safe. To do so, we will
-		 * have to clone packets just for filtering and will have to
-		 * restroy cloned packets after handling them in NPF.
-		 * We directly modify data_off instead of calling
+	if (likely(rte_mbuf_refcnt_read(pkt) == 1)) {
+		/* We directly modify data_off instead of calling
 		 * rte_pktmbuf_adj because it's faster
 		 */
-		tmp->data_off += tmp->l2_len;
+		pkt->data_off += l2_len;
 		ret = npfk_packet_handler(state->npf, (struct mbuf **) &tmp,
 					 state->ifp, pf_side);
-		pkts[i]->data_off -= pkts[i]->l2_len;
-		if (ret)
-			pkts_mask &= ~bit;
+		pkt->data_off -= l2_len;
+		return ret;
+	}
+
+	tmp = rte_pktmbuf_clone(pkt, pg_get_mempool());
+	if (unlikely(!tmp))
+		return -1;
+	rte_pktmbuf_adj(tmp, l2_len);
+	ret = npfk_packet_handler(state->npf, (struct mbuf **) &tmp,
+				 state->ifp, pf_side);
+	if (tmp)
+		rte_pktmbuf_free(tmp);
+	return ret;
+}
+
+/**
+ * Filter a whole burst through NPF.
+ * Headers of all packets are prefetched first so their cache misses
+ * overlap, then NPF extracts the connection key of each IP packet from
+ * warm cache lines.
+ * When the flow cache is enabled, the cache entries of the whole burst are
+ * prefetched before being looked up, and packets of flows recently passed
+ * by NPF skip NPF entirely.
+ *
+ * @param	state the firewall
+ * @param	pkts packets to filter
+ * @param	pkts_mask mask of packets to filter
+ * @param	pf_side NPF direction of the packets
+ * @return	mask of the packets allowed to pass
+ */
+static inline uint64_t firewall_filter_burst(struct pg_firewall_state *state,
+					     struct rte_mbuf **pkts,
+					     uint64_t pkts_mask, int pf_side)
+{
+	unsigned int lcore = rte_lcore_id();
+	struct firewall_flow_cache *cache = NULL;
+	struct firewall_flow_entry *entries[PG_MAX_PKTS_BURST];
+	struct firewall_flow_key keys[PG_MAX_PKTS_BURST];
+	uint16_t ether_types[PG_MAX_PKTS_BURST];
+	uint16_t ip_pkts[PG_MAX_PKTS_BURST];
+	uint64_t ttl = state->flow_cache_ttl;
+	uint16_t nb_ip = 0;
+	uint64_t now = 0;
+	uint32_t gen = 0;
+
+	/* the cache is freed once no thread is between ebr_enter and exit */
+	if (lcore < RTE_MAX_LCORE && state->flow_caches[lcore]) {
+		ebr_enter(state->ebr);
+		cache = __atomic_load_n(&state->flow_caches[lcore],
+					__ATOMIC_ACQUIRE);
+		if (unlikely(!cache))
+			ebr_exit(state->ebr);
+		gen = __atomic_load_n(&state->flow_cache_gen,
+				      __ATOMIC_ACQUIRE);
+		now = rte_get_timer_cycles();
+	}
+
+	PG_FOREACH_BIT(pkts_mask, i)
+		rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+
+	/* Firewall only manage IPv4 or IPv6 filtering.
+	 * Let non-ip packets (like ARP) pass.
+	 */
+	PG_FOREACH_BIT(pkts_mask, i) {
+		uint16_t ether_type = pg_utils_get_ether_type(pkts[i]);
+
+		if (likely(ether_type == PG_BE_ETHER_TYPE_IPv4 ||
+			   ether_type == PG_BE_ETHER_TYPE_IPv6)) {
+			ether_types[i] = ether_type;
+			ip_pkts[nb_ip++] = i;
+		}
+	}
+
+	for (uint16_t j = 0; j < nb_ip; ++j) {
+		uint16_t i = ip_pkts[j];
+		uint32_t slot;
+
+		entries[j] = NULL;
+		if (!cache || !firewall_flow_key_get(pkts[i], ether_types[i],
+						     pf_side, &keys[j]))
+			continue;
+		slot = rte_hash_crc(&keys[j], sizeof(keys[j]), 0) & cache->mask;
+		entries[j] = &cache->entries[slot];
+		rte_prefetch0(entries[j]);
 	}
+
+	for (uint16_t j = 0; j < nb_ip; ++j) {
+		struct firewall_flow_entry *entry = entries[j];
+		uint16_t i = ip_pkts[j];
+
+		if (entry) {
+			if (entry->gen == gen && now - entry->tsc < ttl &&
+			    !memcmp(&entry->key, &keys[j], sizeof(keys[j]))) {
+				cache->hits++;
+				continue;
+			}
+			cache->misses++;
+		}
+
+		if (firewall_npf_handle(state, pkts[i], pf_side)) {
+			pkts_mask &= ~(ONE64 << i);
+		} else if (entry) {
+			entry->key = keys[j];
+			entry->gen = gen;
+			entry->tsc = now;
+		}
+	}
+	if (cache)
+		ebr_exit(state->ebr);
+
+	if (state->match_stats)
+		firewall_match_stats_update(state, pkts, ip_pkts, nb_ip,
+					    pkts_mask, pf_side);
+	return pkts_mask;
+}
+
+static int firewall_burst(struct pg_brick *brick, enum pg_side from,
+			  uint16_t edge_index, struct rte_mbuf **pkts,
+			  uint64_t pkts_mask,
+			  struct pg_error **errp)
+{
+	struct pg_brick_side *s = &brick->sides[pg_flip_side(from)];
+	struct pg_firewall_state *state;
+
+	state = pg_brick_get_state(brick, struct pg_firewall_state);
+	firewall_thread_register(state);
+	pkts_mask = firewall_filter_burst(state, pkts, pkts_mask,
+					  FIREWALL_SIDE_TO_NPF(from));
 	if (unlikely(pkts_mask == 0))
 		return 0;
 	return pg_brick_burst(s->edge.link, from, s->edge.pair_index,
@@ -276,6 +817,16 @@ static int firewall_init(struct pg_brick *brick,
 	static int is_dpdk_init;
 
 	state = pg_brick_get_state(brick, struct pg_firewall_state);
+	state->default_counts = firewall_counts_new(errp);
+	if (!state->default_counts)
+		return -1;
+	state->ebr = ebr_create();
+	if (!state->ebr) {
+		free(state->default_counts);
+		*errp = pg_error_new("fail to create firewall EBR");
+		return -1;
+	}
+	g_mutex_init(&state->lock);
 
 	fw_config = (struct pg_firewall_config *) config->brick_config;
 	/* initialize fast path */
@@ -299,6 +850,9 @@ static int firewall_init(struct pg_brick *brick,
 		return -1;
 	}
 	npfk_thread_register(npf);
+	ebr_register(state->ebr);
+	if (rte_lcore_id() < RTE_MAX_LCORE)
+		state->lcore_registered[rte_lcore_id()] = true;
 	state->ifp = npf_dpdk_ifattach(npf, "firewall", firewall_iface_cnt++);
 	if (!state->ifp) {
 		npfk_destroy(state->npf);
@@ -307,6 +861,8 @@ static int firewall_init(struct pg_brick *brick,
 	}
 	state->npf = npf;
 	state->rules = NULL;
+	/* 0 is for free cache entries */
+	state->flow_cache_gen = 1;
 	++nb_firewall;
 	return firewall_reload_internal(state, errp);
 }
@@ -317,10 +873,19 @@ static void firewall_destroy(struct pg_brick *brick,
 	struct pg_firewall_state *state;
 
 	state = pg_brick_get_state(brick, struct pg_firewall_state);
+	g_mutex_lock(&state->lock);
+	firewall_flow_cache_swap(state, NULL);
+	g_mutex_unlock(&state->lock);
 	pg_firewall_rule_flush(brick);
+	firewall_ruleset_free(state->ruleset);
+	state->ruleset = NULL;
+	ebr_unregister(state->ebr);
+	ebr_destroy(state->ebr);
+	free(state->default_counts);
 	npf_dpdk_ifdetach(state->npf, state->ifp);
 	npfk_thread_unregister(state->npf);
 	npfk_destroy(state->npf);
+	g_mutex_clear(&state->lock);
 	--nb_firewall;
 	if (!nb_firewall)
 		npfk_sysfini();
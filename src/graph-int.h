@@ -22,6 +22,14 @@ struct pg_graph {
 	char *name;
 	/* pollable bricks */
 	GSList *pollable;
+	/* bricks to flush at the end of each poll, upstream ones first */
+	GSList *flushable;
+	/* flushable has changed and must be sorted again */
+	bool flush_dirty;
+	/* pg_brick_flush_gen when flushable has been sorted */
+	uint32_t flush_gen;
+	/* maximal number of flush rounds per poll */
+	uint32_t flush_rounds;
 	/* all bricks */
 	GHashTable *all;
 };
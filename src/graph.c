@@ -30,6 +30,11 @@ static inline void empty_graph(struct pg_graph *graph)
 	g_hash_table_steal_all(graph->all);
 	g_slist_free(graph->pollable);
 	graph->pollable = NULL;
+	g_slist_free(graph->flushable);
+	graph->flushable = NULL;
+	graph->flush_dirty = false;
+	graph->flush_gen = 0;
+	graph->flush_rounds = 0;
 }
 
 struct pg_graph *pg_graph_new(const char *name, struct pg_brick *explore,
@@ -41,6 +46,10 @@ struct pg_graph *pg_graph_new(const char *name, struct pg_brick *explore,
 	ret->all = g_hash_table_new_full(g_str_hash, g_str_equal,
 					 NULL, &brick_destroy_cb);
 	ret->pollable = NULL;
+	ret->flushable = NULL;
+	ret->flush_dirty = false;
+	ret->flush_gen = 0;
+	ret->flush_rounds = 0;
 	if (explore && pg_graph_explore_ptr(ret, explore, error) < 0) {
 		empty_graph(ret);
 		pg_graph_destroy(ret);
@@ -60,6 +69,7 @@ void pg_graph_destroy(struct pg_graph *graph)
 	g_free(graph->name);
 	g_hash_table_destroy(graph->all);
 	g_slist_free(graph->pollable);
+	g_slist_free(graph->flushable);
 	g_free(graph);
 }
 
@@ -152,21 +162,114 @@ int pg_graph_explore_ptr(struct pg_graph *graph,
 	return ret;
 }
 
-int pg_graph_poll(struct pg_graph *graph, struct pg_error **error)
+/*
+ * Collect bricks which currently have a flush callback and sort them by
+ * distance from pollable bricks, so bricks feeding other flushable bricks
+ * are flushed first. Pollable bricks come last as they send packets out of
+ * the graph.
+ */
+static void graph_flush_order(struct pg_graph *graph)
+{
+	GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+	uint32_t gen = __atomic_load_n(&pg_brick_flush_gen, __ATOMIC_ACQUIRE);
+	GQueue todo = G_QUEUE_INIT;
+	GSList *order = NULL;
+	GSList *last = NULL;
+	GHashTableIter iter;
+	struct pg_brick *b;
+
+	for (GSList *n = graph->pollable; n; n = g_slist_next(n)) {
+		g_hash_table_add(seen, n->data);
+		g_queue_push_tail(&todo, n->data);
+	}
+	while ((b = g_queue_pop_head(&todo))) {
+		if (b->flush && b->poll)
+			last = g_slist_prepend(last, b);
+		else if (b->flush)
+			order = g_slist_prepend(order, b);
+		PG_BRICK_FOREACH_EDGES(b, it) {
+			struct pg_brick *n =
+				pg_brick_edge_iterator_get(&it)->link;
+
+			if (pg_graph_get(graph, n->name) != n ||
+			    g_hash_table_contains(seen, n))
+				continue;
+			g_hash_table_add(seen, n);
+			g_queue_push_tail(&todo, n);
+		}
+	}
+	/* bricks no pollable brick is linked to */
+	g_hash_table_iter_init(&iter, graph->all);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&b)) {
+		if (b->flush && !g_hash_table_contains(seen, b))
+			order = g_slist_prepend(order, b);
+	}
+	g_hash_table_destroy(seen);
+	g_slist_free(graph->flushable);
+	graph->flushable = g_slist_concat(g_slist_reverse(order),
+					  g_slist_reverse(last));
+	graph->flush_rounds = g_slist_length(graph->flushable);
+	graph->flush_dirty = false;
+	graph->flush_gen = gen;
+}
+
+/*
+ * Packets moving back to an already flushed brick are staged again, so
+ * flush until no brick forwards anything. The number of rounds is bounded
+ * for packets looping in the graph to wait for the next poll.
+ */
+static int graph_flush(struct pg_graph *graph, struct pg_error **error)
+{
+	for (uint32_t round = 0; round < graph->flush_rounds; ++round) {
+		int forwarded = 0;
+
+		for (GSList *n = graph->flushable; n; n = g_slist_next(n)) {
+			int ret = pg_brick_flush(n->data, error);
+
+			if (unlikely(ret < 0)) {
+				if (!*error)
+					*error = pg_error_new(
+						"Cannot flush %s",
+						pg_brick_name(n->data));
+				return -1;
+			}
+			forwarded += ret;
+		}
+		if (!forwarded)
+			break;
+	}
+	return 0;
+}
+
+int pg_graph_poll_count(struct pg_graph *graph, uint32_t *count,
+			struct pg_error **error)
 {
 	GSList *n = graph->pollable;
-	uint16_t count;
+	uint16_t brick_count;
 
+	*count = 0;
 	while (n) {
-		if (pg_brick_poll(n->data, &count, error) < 0) {
+		if (pg_brick_poll(n->data, &brick_count, error) < 0) {
 			if (!*error)
 				*error = pg_error_new("Cannot poll %s",
 					((struct pg_brick *) n->data)->name);
 			return -1;
 		}
+		*count += brick_count;
 		n = g_slist_next(n);
 	}
-	return 0;
+	if (unlikely(graph->flush_dirty ||
+		     graph->flush_gen != __atomic_load_n(&pg_brick_flush_gen,
+							 __ATOMIC_ACQUIRE)))
+		graph_flush_order(graph);
+	return graph_flush(graph, error);
+}
+
+int pg_graph_poll(struct pg_graph *graph, struct pg_error **error)
+{
+	uint32_t count;
+
+	return pg_graph_poll_count(graph, &count, error);
 }
 
 int pg_graph_sanity(struct pg_graph *graph, struct pg_error **error)
@@ -209,6 +312,8 @@ static inline struct pg_brick *graph_pop(struct pg_graph *graph,
 	g_hash_table_steal(graph->all, b->name);
 	if (b->poll)
 		graph->pollable = g_slist_remove(graph->pollable, b);
+	graph->flushable = g_slist_remove(graph->flushable, b);
+	graph->flush_dirty = true;
 	return b;
 }
 
@@ -230,6 +335,8 @@ int pg_graph_push(struct pg_graph *graph,
 	g_hash_table_insert(graph->all, brick->name, brick);
 	if (brick->poll)
 		graph->pollable = g_slist_prepend(graph->pollable, brick);
+	/* flushable bricks are collected when the graph is polled */
+	graph->flush_dirty = true;
 	return 0;
 }
 
@@ -377,7 +484,311 @@ void pg_graph_dot(struct pg_graph *graph, FILE *fd)
 	return pg_brick_dot_fd(get_any_brick(graph), fd);
 }
 
+int pg_graph_stats_enable(struct pg_graph *graph, struct pg_error **error)
+{
+	struct pg_brick *brick;
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, graph->all);
+	while (g_hash_table_iter_next(&iter, &key, (void **)&brick)) {
+		if (pg_brick_stats_enable(brick, error) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+void pg_graph_stats_disable(struct pg_graph *graph)
+{
+	struct pg_brick *brick;
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, graph->all);
+	while (g_hash_table_iter_next(&iter, &key, (void **)&brick))
+		pg_brick_stats_disable(brick);
+}
+
 void pg_graph_empty(struct pg_graph *graph)
 {
 	empty_graph(graph);
 }
+
+/* side of a brick holding the edge an iterator is on */
+static inline enum pg_side graph_edge_side(struct pg_brick *b,
+					   struct pg_brick_edge_iterator *it)
+{
+	if (b->type == PG_MONOPOLE)
+		return b->ops->get_side(b);
+	return it->side;
+}
+
+/* a pollable brick at the west end of the graph, any brick otherwise */
+static struct pg_brick *graph_west_end(struct pg_graph *graph)
+{
+	for (GSList *h = graph->pollable; h; h = g_slist_next(h)) {
+		struct pg_brick *b = h->data;
+
+		if (b->type == PG_MONOPOLE && b->side.edge.link &&
+		    b->ops->get_side(b) == PG_EAST_SIDE)
+			return b;
+	}
+	return get_any_brick(graph);
+}
+
+/* all bricks of a graph in breadth first order from its west end */
+static GList *graph_bfs(struct pg_graph *graph)
+{
+	GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+	struct pg_brick *b = graph_west_end(graph);
+	GQueue todo = G_QUEUE_INIT;
+	GList *order = NULL;
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, graph->all);
+	while (b) {
+		g_hash_table_add(seen, b);
+		g_queue_push_tail(&todo, b);
+		while ((b = g_queue_pop_head(&todo))) {
+			order = g_list_prepend(order, b);
+			PG_BRICK_FOREACH_EDGES(b, it) {
+				struct pg_brick *n =
+					pg_brick_edge_iterator_get(&it)->link;
+
+				if (pg_graph_get(graph, n->name) != n ||
+				    g_hash_table_contains(seen, n))
+					continue;
+				g_hash_table_add(seen, n);
+				g_queue_push_tail(&todo, n);
+			}
+		}
+		/* next part of a graph made of unlinked parts */
+		while (g_hash_table_iter_next(&iter, &key, (void **)&b) &&
+		       g_hash_table_contains(seen, b))
+			b = NULL;
+	}
+	g_hash_table_destroy(seen);
+	return g_list_reverse(order);
+}
+
+/* cost of a brick, see pg_graph_partition */
+static uint64_t graph_brick_cost(struct pg_brick *b, bool measured)
+{
+	struct pg_brick_stats stats;
+	struct pg_error *error = NULL;
+	uint64_t cycles;
+
+	if (!measured)
+		return b->weight ? b->weight : 1;
+	if (pg_brick_stats_get(b, &stats, &error) < 0) {
+		pg_error_free(error);
+		return 0;
+	}
+	cycles = stats.poll.cycles;
+	for (int i = 0; i < PG_MAX_SIDE; ++i)
+		cycles += stats.sides[i].cycles;
+	return cycles;
+}
+
+/* an edge between two parts, replaced by a pair of friend ring queues */
+struct graph_cut {
+	struct pg_brick *w;
+	struct pg_brick *e;
+	struct pg_brick *qw;
+	struct pg_brick *qe;
+	bool spliced;
+};
+
+static struct pg_brick *graph_cut_queue(struct pg_graph *graph,
+					struct graph_cut *cut,
+					const char *end,
+					struct pg_error **error)
+{
+	char *name = g_strdup_printf("%s-%s-queue-%s",
+				     cut->w->name, cut->e->name, end);
+	struct pg_brick *q = NULL;
+
+	/* parallel edges between the same bricks would share queue names */
+	if (pg_graph_get(graph, name))
+		*error = pg_error_new("A brick named %s already in graph %s",
+				      name, graph->name);
+	else
+		q = pg_queue_ring_new(name, 0, error);
+	g_free(name);
+	return q;
+}
+
+/*
+ * Splice a pair of queues between w and e, so the queues take the place
+ * of each other on the edge: w and e are not notified and keep what they
+ * attached to it, like learned MACs or VNIs.
+ */
+static int graph_cut(struct pg_graph *graph, struct graph_cut *cut,
+		     struct pg_error **error)
+{
+	cut->qw = graph_cut_queue(graph, cut, "west", error);
+	if (!cut->qw)
+		return -1;
+	cut->qe = graph_cut_queue(graph, cut, "east", error);
+	if (!cut->qe)
+		return -1;
+	if (pg_queue_friend(cut->qw, cut->qe, error) < 0 ||
+	    pg_brick_splice(cut->w, cut->e, cut->qw, cut->qe, error) < 0)
+		return -1;
+	cut->spliced = true;
+	/* queues stay in graph until bricks are moved to their part */
+	if (pg_graph_push(graph, cut->qw, error) < 0 ||
+	    pg_graph_push(graph, cut->qe, error) < 0)
+		return -1;
+	return 0;
+}
+
+/* link w and e back and destroy the queues of a cut */
+static void graph_uncut(struct pg_graph *graph, struct graph_cut *cut)
+{
+	struct pg_error *error = NULL;
+
+	if (cut->spliced)
+		pg_brick_unsplice(cut->w, cut->e, cut->qw, cut->qe, &error);
+	pg_error_free(error);
+	if (cut->qw) {
+		if (pg_graph_get(graph, cut->qw->name) == cut->qw)
+			graph_pop(graph, cut->qw);
+		pg_brick_destroy(cut->qw);
+	}
+	if (cut->qe) {
+		if (pg_graph_get(graph, cut->qe->name) == cut->qe)
+			graph_pop(graph, cut->qe);
+		pg_brick_destroy(cut->qe);
+	}
+}
+
+int pg_graph_partition(struct pg_graph *graph, int nb_parts,
+		       struct pg_graph **parts, struct pg_error **error)
+{
+	GHashTable *part = g_hash_table_new(g_direct_hash, g_direct_equal);
+	GList *order = graph_bfs(graph);
+	GList *cuts = NULL;
+	bool measured = !!order;
+	uint64_t total = 0, cum = 0, cost;
+	int raw, last_raw = 0, nb = 0;
+	int ret = -1;
+	struct pg_error *tmp = NULL;
+	GHashTableIter iter;
+	struct pg_brick *b;
+	gpointer p;
+
+	if (nb_parts < 1) {
+		*error = pg_error_new("Invalid number of parts %d", nb_parts);
+		goto exit;
+	}
+	if (!order) {
+		parts[0] = graph;
+		ret = 1;
+		goto exit;
+	}
+
+	/* measured costs are only comparable if all bricks have some */
+	for (GList *h = order; h; h = g_list_next(h))
+		measured &= !!((struct pg_brick *)h->data)->stats;
+	for (GList *h = order; h; h = g_list_next(h))
+		total += graph_brick_cost(h->data, measured);
+	if (!total) {
+		measured = false;
+		for (GList *h = order; h; h = g_list_next(h))
+			total += graph_brick_cost(h->data, measured);
+	}
+
+	/*
+	 * Cut the breadth first order in nb_parts slices of the same cost,
+	 * a brick going to the slice where the middle of its cost lands.
+	 */
+	for (GList *h = order; h; h = g_list_next(h)) {
+		cost = graph_brick_cost(h->data, measured);
+		raw = (2 * cum + cost) * nb_parts / (2 * total);
+		if (raw >= nb_parts)
+			raw = nb_parts - 1;
+		/* skip empty slices */
+		if (!nb || raw != last_raw)
+			nb++;
+		last_raw = raw;
+		g_hash_table_insert(part, h->data, GINT_TO_POINTER(nb - 1));
+		cum += cost;
+	}
+
+	/* find edges between parts, once from their west end */
+	for (GList *h = order; h; h = g_list_next(h)) {
+		b = h->data;
+		p = g_hash_table_lookup(part, b);
+
+		PG_BRICK_FOREACH_EDGES(b, it) {
+			struct pg_brick *n =
+				pg_brick_edge_iterator_get(&it)->link;
+			struct graph_cut *cut;
+			gpointer np;
+
+			if (graph_edge_side(b, &it) != PG_EAST_SIDE ||
+			    !g_hash_table_lookup_extended(part, n, NULL, &np) ||
+			    np == p)
+				continue;
+			cut = g_new0(struct graph_cut, 1);
+			cut->w = b;
+			cut->e = n;
+			cuts = g_list_prepend(cuts, cut);
+		}
+	}
+
+	for (GList *h = cuts; h; h = g_list_next(h)) {
+		struct graph_cut *cut = h->data;
+
+		if (graph_cut(graph, cut, error) < 0)
+			goto uncut;
+		g_hash_table_insert(part, cut->qw,
+				    g_hash_table_lookup(part, cut->w));
+		g_hash_table_insert(part, cut->qe,
+				    g_hash_table_lookup(part, cut->e));
+	}
+
+	/* move bricks from graph to the other parts */
+	parts[0] = graph;
+	for (int i = 1; i < nb; ++i) {
+		char *name = g_strdup_printf("%s-%d", graph->name, i);
+
+		parts[i] = pg_graph_new(name, NULL, error);
+		g_free(name);
+	}
+	g_hash_table_iter_init(&iter, part);
+	while (g_hash_table_iter_next(&iter, (void **)&b, &p)) {
+		if (!GPOINTER_TO_INT(p))
+			continue;
+		if (pg_graph_push(parts[GPOINTER_TO_INT(p)], b, error) < 0)
+			goto unmove;
+		graph_pop(graph, b);
+	}
+	ret = nb;
+	goto exit;
+
+unmove:
+	/* bricks were popped from graph, they can always be pushed back */
+	g_hash_table_iter_init(&iter, part);
+	while (g_hash_table_iter_next(&iter, (void **)&b, &p)) {
+		struct pg_graph *g = parts[GPOINTER_TO_INT(p)];
+
+		if (g != graph && pg_graph_get(g, b->name) == b) {
+			graph_pop(g, b);
+			pg_graph_push(graph, b, &tmp);
+		}
+	}
+	pg_error_free(tmp);
+	for (int i = 1; i < nb; ++i)
+		pg_graph_destroy(parts[i]);
+uncut:
+	for (GList *h = cuts; h; h = g_list_next(h))
+		graph_uncut(graph, h->data);
+exit:
+	g_list_free(order);
+	g_list_free_full(cuts, g_free);
+	g_hash_table_destroy(part);
+	return ret;
+}
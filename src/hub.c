@@ -111,9 +111,9 @@ static int hub_burst(struct pg_brick *brick, enum pg_side from,
 void pg_hub_set_no_backward(struct pg_brick *brick, int val)
 {
 	if (val)
-		brick->burst = hub_burst_one_side;
+		pg_brick_burst_set(brick, hub_burst_one_side);
 	else
-		brick->burst = hub_burst;
+		pg_brick_burst_set(brick, hub_burst);
 }
 
 static int hub_init(struct pg_brick *brick,
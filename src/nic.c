@@ -35,6 +35,8 @@
 #include "nic-int.h"
 
 #define NIC_ARGS_MAX_SIZE 1024
+/* number of tx_burst calls tried before dropping packets of a full queue */
+#define NIC_TX_RETRIES 3
 #define TCP_PROTOCOL_NUMBER 6
 #define UDP_PROTOCOL_NUMBER 17
 
@@ -65,6 +67,11 @@ static inline int pg_nic_port(char *ifname)
 struct pg_nic_config {
 	char ifname[NIC_ARGS_MAX_SIZE];
 	uint16_t portid;
+	/* number of RX/TX queues to open on the port */
+	uint16_t nb_queues;
+	/* if set, use queue_id of the port already opened by master */
+	struct pg_brick *master;
+	uint16_t queue_id;
 };
 
 struct pg_nic_state {
@@ -72,8 +79,20 @@ struct pg_nic_state {
 	struct rte_mbuf *pkts[PG_MAX_PKTS_BURST];
 	struct rte_mbuf *exit_pkts[PG_MAX_PKTS_BURST];
 	uint16_t portid;
+	/* RX/TX queue used by this brick */
+	uint16_t queue_id;
+	/* number of RX/TX queues opened on the port */
+	uint16_t nb_queues;
+	/* brick owning the port, NULL if this brick owns it */
+	struct pg_brick *master;
 	/* side of the physical NIC/PMD */
 	enum pg_side output;
+	/* packets kept back until tx_threshold is reached or end of poll */
+	struct rte_mbuf **tx_buf;
+	uint16_t tx_buf_count;
+	/* 0 if tx buffering is disabled */
+	uint16_t tx_threshold;
+	struct pg_nic_tx_stats tx_stats;
 };
 
 struct headers_eth_ipv4_l4 {
@@ -108,7 +127,8 @@ void pg_nic_capabilities(struct pg_brick *nic, uint32_t *rx, uint32_t *tx)
 
 static struct pg_brick_config *nic_config_new(const char *name,
 					      const char *ifname,
-					      uint16_t portid)
+					      uint16_t portid,
+					      uint16_t nb_queues)
 {
 	struct pg_brick_config *config = g_new0(struct pg_brick_config, 1);
 	struct pg_nic_config *nic_config = g_new0(struct pg_nic_config, 1);
@@ -119,6 +139,7 @@ static struct pg_brick_config *nic_config_new(const char *name,
 		nic_config->ifname[0] = '\0';
 		nic_config->portid = portid;
 	}
+	nic_config->nb_queues = nb_queues;
 	config->brick_config = (void *) nic_config;
 	return pg_brick_config_init(config, name, 1, 1, PG_MONOPOLE);
 }
@@ -143,35 +164,33 @@ static uint64_t tx_bytes(struct pg_brick *brick)
 	return tmp.obytes;
 }
 
-/* The fastpath data function of the nic_brick just forward the bursts */
-static int nic_burst(struct pg_brick *brick, enum pg_side from,
-		     uint16_t edge_index, struct rte_mbuf **pkts,
-		     uint64_t pkts_mask,
-		     struct pg_error **errp)
+static inline uint16_t nic_tx_burst(struct pg_nic_state *state,
+				    struct rte_mbuf **pkts, uint16_t count)
+{
+#ifdef PG_NIC_STUB
+	if (count > max_pkts)
+		count = max_pkts;
+#endif /* #ifdef PG_NIC_STUB */
+	return rte_eth_tx_burst(state->portid, state->queue_id, pkts, count);
+}
+
+/* send count packets, free the ones the queue does not take */
+static void nic_tx(struct pg_brick *brick, struct pg_nic_state *state,
+		   struct rte_mbuf **pkts, uint16_t count, int retries)
 {
-	uint16_t count = 0;
 	uint16_t pkts_bursted;
-	struct pg_nic_state *state = pg_brick_get_state(brick,
-							struct pg_nic_state);
-	struct rte_mbuf **exit_pkts = state->exit_pkts;
 
-	count = pg_packets_pack(exit_pkts,
-				pkts, pkts_mask);
+	rte_eth_tx_prepare(state->portid, state->queue_id, pkts, count);
+	pkts_bursted = nic_tx_burst(state, pkts, count);
+	while (unlikely(pkts_bursted < count) && retries--) {
+		uint16_t sent = nic_tx_burst(state, pkts + pkts_bursted,
+					     count - pkts_bursted);
 
-	pg_packets_incref(pkts, pkts_mask);
-	rte_eth_tx_prepare(state->portid, 0, exit_pkts, count);
-#ifndef PG_NIC_STUB
-	pkts_bursted = rte_eth_tx_burst(state->portid, 0,
-					exit_pkts,
-					count);
-#else
-	if (count > max_pkts)
-		pkts_bursted = rte_eth_tx_burst(state->portid, 0,
-						exit_pkts, max_pkts);
-	else
-		pkts_bursted = rte_eth_tx_burst(state->portid, 0,
-						exit_pkts, count);
-#endif /* #ifndef PG_NIC_STUB */
+		++state->tx_stats.retries;
+		if (!sent)
+			break;
+		pkts_bursted += sent;
+	}
 
 #ifdef PG_NIC_BENCH
 	struct pg_brick_side *side = &brick->side;
@@ -183,12 +202,88 @@ static int nic_burst(struct pg_brick *brick, enum pg_side from,
 #endif /* #ifdef PG_NIC_BENCH */
 
 	if (unlikely(pkts_bursted < count)) {
-		pg_packets_free(exit_pkts, pg_mask_firsts(count) &
-				~pg_mask_firsts(pkts_bursted));
+		state->tx_stats.drops += count - pkts_bursted;
+		for (uint16_t i = pkts_bursted; i < count; i++)
+			rte_pktmbuf_free(pkts[i]);
+	}
+}
+
+static void nic_tx_flush(struct pg_brick *brick, struct pg_nic_state *state)
+{
+	if (!state->tx_buf_count)
+		return;
+	nic_tx(brick, state, state->tx_buf, state->tx_buf_count,
+	       NIC_TX_RETRIES);
+	state->tx_buf_count = 0;
+}
+
+/* The fastpath data function of the nic_brick just forward the bursts */
+static int nic_burst(struct pg_brick *brick, enum pg_side from,
+		     uint16_t edge_index, struct rte_mbuf **pkts,
+		     uint64_t pkts_mask,
+		     struct pg_error **errp)
+{
+	struct pg_nic_state *state = pg_brick_get_state(brick,
+							struct pg_nic_state);
+	uint16_t count;
+
+	pg_packets_incref(pkts, pkts_mask);
+	if (!state->tx_threshold) {
+		count = pg_packets_pack(state->exit_pkts, pkts, pkts_mask);
+		nic_tx(brick, state, state->exit_pkts, count, 0);
+		return 0;
+	}
+
+	/* tx_buf can hold tx_threshold - 1 + PG_MAX_PKTS_BURST packets */
+	count = pg_packets_pack(state->tx_buf + state->tx_buf_count,
+				pkts, pkts_mask);
+	state->tx_buf_count += count;
+	if (state->tx_buf_count >= state->tx_threshold) {
+		++state->tx_stats.fill_flushes;
+		nic_tx_flush(brick, state);
+	}
+	return 0;
+}
+
+static int nic_flush(struct pg_brick *brick, struct pg_error **errp)
+{
+	struct pg_nic_state *state = pg_brick_get_state(brick,
+							struct pg_nic_state);
+
+	if (state->tx_buf_count) {
+		++state->tx_stats.poll_flushes;
+		nic_tx_flush(brick, state);
 	}
 	return 0;
 }
 
+int pg_nic_set_tx_buffer(struct pg_brick *nic, uint16_t threshold,
+			 struct pg_error **errp)
+{
+	struct pg_nic_state *state = pg_brick_get_state(nic,
+							struct pg_nic_state);
+
+	if (threshold > PG_NIC_TX_BUFFER_MAX) {
+		*errp = pg_error_new("tx buffer threshold %u is above %u",
+				     threshold, PG_NIC_TX_BUFFER_MAX);
+		return -1;
+	}
+	nic_tx_flush(nic, state);
+	g_free(state->tx_buf);
+	state->tx_buf = NULL;
+	state->tx_threshold = threshold;
+	if (threshold)
+		state->tx_buf = g_new(struct rte_mbuf *,
+				      threshold + PG_MAX_PKTS_BURST - 1);
+	pg_brick_flush_set(nic, threshold ? nic_flush : NULL);
+	return 0;
+}
+
+void pg_nic_tx_stats(struct pg_brick *nic, struct pg_nic_tx_stats *stats)
+{
+	*stats = pg_brick_get_state(nic, struct pg_nic_state)->tx_stats;
+}
+
 static int nic_burst_no_offload(struct pg_brick *brick, enum pg_side from,
 				    uint16_t edge_index,
 				    struct rte_mbuf **pkts,
@@ -269,7 +364,7 @@ static int nic_poll(struct pg_brick *brick, uint16_t *pkts_cnt,
 		pg_brick_get_state(brick, struct pg_nic_state);
 	struct rte_mbuf **pkts = state->pkts;
 
-	nb_pkts = rte_eth_rx_burst(state->portid, 0,
+	nb_pkts = rte_eth_rx_burst(state->portid, state->queue_id,
 				   state->pkts, PG_MAX_PKTS_BURST);
 	if (!nb_pkts) {
 		*pkts_cnt = 0;
@@ -289,9 +384,9 @@ static int nic_init_ports(struct pg_nic_state *state, struct pg_error **errp)
 {
 	int ret;
 	struct rte_eth_dev_info dev_info;
-	static struct rte_eth_txconf tx_conf;
+	struct rte_eth_txconf tx_conf;
 	struct rte_mempool *mp = pg_get_mempool();
-	static struct rte_eth_conf port_conf = {
+	struct rte_eth_conf port_conf = {
 		.rxmode = {
 			.split_hdr_size = 0,
 			.max_rx_pkt_len = ETHER_MAX_LEN,
@@ -305,37 +400,115 @@ static int nic_init_ports(struct pg_nic_state *state, struct pg_error **errp)
 	if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_CHECK)
 		port_conf.txmode.offloads |= DEV_TX_OFFLOAD_CHECK;
 
-	ret = rte_eth_dev_configure(state->portid, 1, 1, &port_conf);
-	if (ret < 0) {
+	if (state->nb_queues > dev_info.max_rx_queues ||
+	    state->nb_queues > dev_info.max_tx_queues) {
 		*errp = pg_error_new(
-			"Port configuration %u failed (may already be in use)",
-			state->portid);
+			"Port %u supports at most %u rx and %u tx queues",
+			state->portid, dev_info.max_rx_queues,
+			dev_info.max_tx_queues);
 		return -1;
 	}
 
-	/* Setup queues */
-	ret = rte_eth_rx_queue_setup(state->portid, 0, 128,
-				     rte_eth_dev_socket_id(state->portid),
-				     NULL,
-				     mp);
+	/* spread incoming flows over queues */
+	if (state->nb_queues > 1) {
+		port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
+		port_conf.rx_adv_conf.rss_conf.rss_hf =
+			(ETH_RSS_IP | ETH_RSS_UDP | ETH_RSS_TCP) &
+			dev_info.flow_type_rss_offloads;
+		if (port_conf.rx_adv_conf.rss_conf.rss_hf)
+			port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+	}
+
+	ret = rte_eth_dev_configure(state->portid, state->nb_queues,
+				    state->nb_queues, &port_conf);
 	if (ret < 0) {
 		*errp = pg_error_new(
-			"Setup failed for port rx queue 0, port %d",
+			"Port configuration %u failed (may already be in use)",
 			state->portid);
 		return -1;
 	}
 
+	/* Setup queues */
 	tx_conf = dev_info.default_txconf;
 	tx_conf.offloads = port_conf.txmode.offloads;
-	ret = rte_eth_tx_queue_setup(state->portid, 0, 128,
-				     rte_eth_dev_socket_id(state->portid),
-				     &tx_conf);
-	if (ret < 0) {
-		*errp = pg_error_new(
-			"Setup failed for port tx queue 0, port %d",
-			state->portid);
+	for (uint16_t q = 0; q < state->nb_queues; q++) {
+		ret = rte_eth_rx_queue_setup(
+			state->portid, q, 128,
+			rte_eth_dev_socket_id(state->portid),
+			NULL,
+			mp);
+		if (ret < 0) {
+			*errp = pg_error_new(
+				"Setup failed for port rx queue %u, port %d",
+				q, state->portid);
+			return -1;
+		}
+
+		ret = rte_eth_tx_queue_setup(
+			state->portid, q, 128,
+			rte_eth_dev_socket_id(state->portid),
+			&tx_conf);
+		if (ret < 0) {
+			*errp = pg_error_new(
+				"Setup failed for port tx queue %u, port %d",
+				q, state->portid);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* use the checksum offloading burst if the nic supports it */
+static void nic_set_burst(struct pg_brick *brick, uint16_t portid)
+{
+	struct rte_eth_txq_info qinfo;
+
+	if (rte_eth_tx_queue_info_get(portid, 0, &qinfo) == 0 &&
+	    ((qinfo.conf.offloads & DEV_TX_OFFLOAD_TCP_CKSUM) &&
+	     (qinfo.conf.offloads & DEV_TX_OFFLOAD_UDP_CKSUM))) {
+		brick->burst = nic_burst;
+	} else {
+		brick->burst = nic_burst_no_offload;
+	}
+}
+
+static int nic_queue_init(struct pg_brick *brick,
+			  struct pg_nic_config *nic_config,
+			  struct pg_error **errp)
+{
+	struct pg_nic_state *state =
+		pg_brick_get_state(brick, struct pg_nic_state);
+	struct pg_brick *master = nic_config->master;
+	struct pg_nic_state *master_state;
+
+	if (g_strcmp0(pg_brick_type(master), "nic")) {
+		*errp = pg_error_new("%s is not a nic brick",
+				     pg_brick_name(master));
 		return -1;
 	}
+	master_state = pg_brick_get_state(master, struct pg_nic_state);
+	if (master_state->master) {
+		*errp = pg_error_new("%s does not own its port",
+				     pg_brick_name(master));
+		return -1;
+	}
+	if (nic_config->queue_id >= master_state->nb_queues) {
+		*errp = pg_error_new("Invalid queue id %u, port %u has %u",
+				     nic_config->queue_id,
+				     master_state->portid,
+				     master_state->nb_queues);
+		return -1;
+	}
+
+	/* keep the port open while this brick uses one of its queues */
+	pg_brick_incref(master);
+	state->master = master;
+	state->portid = master_state->portid;
+	state->nb_queues = master_state->nb_queues;
+	state->queue_id = nic_config->queue_id;
+	/* master->burst may be wrapped by an instrumentation trampoline */
+	nic_set_burst(brick, state->portid);
+	brick->poll = nic_poll;
 	return 0;
 }
 
@@ -344,12 +517,17 @@ static int nic_init(struct pg_brick *brick, struct pg_brick_config *config,
 {
 	struct pg_nic_state *state;
 	struct pg_nic_config *nic_config;
-	struct rte_eth_txq_info qinfo;
 	int ret;
 
 	state = pg_brick_get_state(brick, struct pg_nic_state);
 	nic_config = config->brick_config;
 
+	if (nic_config->master)
+		return nic_queue_init(brick, nic_config, errp);
+
+	state->nb_queues = nic_config->nb_queues ? nic_config->nb_queues : 1;
+	state->queue_id = 0;
+
 	/* Setup port id */
 	if (nic_config->ifname[0]) {
 		ret = pg_nic_port(nic_config->ifname);
@@ -378,14 +556,7 @@ static int nic_init(struct pg_brick *brick, struct pg_brick_config *config,
 	}
 	rte_eth_promiscuous_enable(state->portid);
 
-	/* check if nic supports offloading */
-	if (rte_eth_tx_queue_info_get(state->portid, 0, &qinfo) == 0 &&
-	    ((qinfo.conf.offloads & DEV_TX_OFFLOAD_TCP_CKSUM) &&
-	     (qinfo.conf.offloads & DEV_TX_OFFLOAD_UDP_CKSUM))) {
-		brick->burst = nic_burst;
-	} else {
-		brick->burst = nic_burst_no_offload;
-	}
+	nic_set_burst(brick, state->portid);
 	brick->poll = nic_poll;
 
 	return 0;
@@ -397,6 +568,14 @@ static void nic_destroy(struct pg_brick *brick, struct pg_error **errp)
 {
 	struct pg_nic_state *state =
 		pg_brick_get_state(brick, struct pg_nic_state);
+
+	nic_tx_flush(brick, state);
+	g_free(state->tx_buf);
+	state->tx_buf = NULL;
+	if (state->master) {
+		pg_brick_decref(state->master, errp);
+		return;
+	}
 	rte_eth_xstats_reset(state->portid);
 	rte_eth_dev_stop(state->portid);
 	rte_eth_dev_close(state->portid);
@@ -406,7 +585,21 @@ struct pg_brick *pg_nic_new(const char *name,
 			    const char *ifname,
 			    struct pg_error **errp)
 {
-	struct pg_brick_config *config = nic_config_new(name, ifname, 0);
+	struct pg_brick_config *config = nic_config_new(name, ifname, 0, 1);
+
+	struct pg_brick *ret = pg_brick_new("nic", config, errp);
+
+	pg_brick_config_free(config);
+	return ret;
+}
+
+struct pg_brick *pg_nic_new_mq(const char *name,
+			       const char *ifname,
+			       uint16_t nb_queues,
+			       struct pg_error **errp)
+{
+	struct pg_brick_config *config = nic_config_new(name, ifname, 0,
+							nb_queues);
 
 	struct pg_brick *ret = pg_brick_new("nic", config, errp);
 
@@ -414,6 +607,33 @@ struct pg_brick *pg_nic_new(const char *name,
 	return ret;
 }
 
+struct pg_brick *pg_nic_new_queue(const char *name,
+				  struct pg_brick *nic,
+				  uint16_t queue_id,
+				  struct pg_error **errp)
+{
+	struct pg_brick_config *config;
+	struct pg_nic_config *nic_config;
+	struct pg_brick *ret;
+
+	if (!nic) {
+		*errp = pg_error_new("nic brick is NULL");
+		return NULL;
+	}
+	config = nic_config_new(name, NULL, 0, 0);
+	nic_config = config->brick_config;
+	nic_config->master = nic;
+	nic_config->queue_id = queue_id;
+	ret = pg_brick_new("nic", config, errp);
+	pg_brick_config_free(config);
+	return ret;
+}
+
+uint16_t pg_nic_queue_count(struct pg_brick *nic)
+{
+	return pg_brick_get_state(nic, struct pg_nic_state)->nb_queues;
+}
+
 int pg_nic_set_mtu(struct pg_brick *brick, uint16_t mtu,
 		   struct pg_error **errp)
 {
@@ -450,7 +670,23 @@ struct pg_brick *pg_nic_new_by_id(const char *name,
 {
 	struct pg_brick_config *config = nic_config_new(name,
 							NULL,
-							portid);
+							portid, 1);
+
+	struct pg_brick *ret = pg_brick_new("nic", config, errp);
+
+	pg_brick_config_free(config);
+	return ret;
+}
+
+struct pg_brick *pg_nic_new_mq_by_id(const char *name,
+				     uint16_t portid,
+				     uint16_t nb_queues,
+				     struct pg_error **errp)
+{
+	struct pg_brick_config *config = nic_config_new(name,
+							NULL,
+							portid,
+							nb_queues);
 
 	struct pg_brick *ret = pg_brick_new("nic", config, errp);
 
@@ -500,5 +736,6 @@ static struct pg_brick_ops nic_ops = {
 pg_brick_register(nic, &nic_ops);
 
 #undef NIC_ARGS_MAX_SIZE
+#undef NIC_TX_RETRIES
 #undef TCP_PROTOCOL_NUMBER
 #undef UDP_PROTOCOL_NUMBER
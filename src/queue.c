@@ -15,7 +15,11 @@
  * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
 #include <rte_config.h>
+#include <rte_atomic.h>
+#include <rte_errno.h>
+#include <rte_ring.h>
 #include <packetgraph/packetgraph.h>
 #include "utils/bitmask.h"
 #include "brick-int.h"
@@ -23,6 +27,7 @@
 
 struct pg_queue_config {
 	uint32_t rx_max_size;
+	bool ring;
 };
 
 struct pg_queue_state {
@@ -35,21 +40,32 @@ struct pg_queue_state {
 	GAsyncQueue *rx;
 	/* queue's friend */
 	struct pg_queue_state *friend;
+	/* store bursted packets in a SPSC ring instead of rx (ring mode) */
+	struct rte_ring *ring;
+	/* packets dequeued from friend's ring during a poll (ring mode) */
+	struct rte_mbuf *pkts[PG_MAX_PKTS_BURST];
+	/* set while dequeuing from friend's ring, see queue_assert_idle */
+	bool polling;
 };
 
+/* used to give an unique name to each ring */
+static rte_atomic32_t ring_cnt = RTE_ATOMIC32_INIT(0);
+
 struct pg_queue_burst {
 	struct rte_mbuf **pkts;
 	uint64_t mask;
 };
 
 static struct pg_brick_config *queue_config_new(const char *name,
-						uint32_t rx_max_size)
+						uint32_t rx_max_size,
+						bool ring)
 {
 	struct pg_brick_config *config = g_new0(struct pg_brick_config, 1);
 	struct pg_queue_config *queue_config = g_new0(struct pg_queue_config,
 						      1);
 
 	queue_config->rx_max_size = rx_max_size;
+	queue_config->ring = ring;
 	config->brick_config = (void *) queue_config;
 	return pg_brick_config_init(config, name, 1, 1, PG_MONOPOLE);
 }
@@ -58,8 +74,12 @@ uint8_t pg_queue_pressure(struct pg_brick *queue)
 {
 	struct pg_queue_state *state =
 		pg_brick_get_state(queue, struct pg_queue_state);
-	int queue_size = g_async_queue_length(state->rx);
+	int queue_size;
 
+	if (state->ring)
+		return rte_ring_count(state->ring) * 255 /
+			rte_ring_get_capacity(state->ring);
+	queue_size = g_async_queue_length(state->rx);
 	return queue_size <= 0 ? 0 : queue_size * 255 / state->rx_max_size;
 }
 
@@ -130,6 +150,90 @@ static int queue_poll(struct pg_brick *brick, uint16_t *pkts_cnt,
 	return ret;
 }
 
+static int queue_ring_burst(struct pg_brick *brick, enum pg_side from,
+			    uint16_t edge_index, struct rte_mbuf **pkts,
+			    uint64_t pkts_mask, struct pg_error **error)
+{
+	struct pg_queue_state *state =
+		pg_brick_get_state(brick, struct pg_queue_state);
+	struct rte_mbuf *to_enqueue[PG_MAX_PKTS_BURST];
+	int nb = pg_packets_pack(to_enqueue, pkts, pkts_mask);
+	unsigned int enqueued;
+
+	/*
+	 * Only the consumer can dequeue from a SPSC ring, so once the ring is
+	 * full, newest packets are dropped instead of oldest bursts.
+	 */
+	pg_packets_incref(to_enqueue, pg_mask_firsts(nb));
+	enqueued = rte_ring_sp_enqueue_burst(state->ring,
+					     (void **)to_enqueue, nb, NULL);
+	if (unlikely(enqueued < (unsigned int)nb))
+		pg_packets_free(to_enqueue,
+				pg_mask_firsts(nb) &
+				~pg_mask_firsts(enqueued));
+
+#ifdef PG_QUEUE_BENCH
+	struct pg_brick_side *side = &brick->side;
+
+	if (side->burst_count_cb != NULL)
+		side->burst_count_cb(side->burst_count_private_data, enqueued);
+#endif /* #ifdef PG_QUEUE_BENCH */
+	return 0;
+}
+
+static int queue_ring_poll(struct pg_brick *brick, uint16_t *pkts_cnt,
+			   struct pg_error **error)
+{
+	int ret;
+	uint64_t mask;
+	struct pg_queue_state *state =
+		pg_brick_get_state(brick, struct pg_queue_state);
+	struct pg_queue_state *friend = state->friend;
+	struct pg_brick_side *s = &brick->side;
+
+	if (!friend) {
+		*pkts_cnt = 0;
+		return 0;
+	}
+
+	__atomic_store_n(&state->polling, true, __ATOMIC_RELAXED);
+	*pkts_cnt = rte_ring_sc_dequeue_burst(friend->ring,
+					      (void **)state->pkts,
+					      PG_MAX_PKTS_BURST, NULL);
+	__atomic_store_n(&state->polling, false, __ATOMIC_RELAXED);
+	if (!*pkts_cnt)
+		return 0;
+
+	mask = pg_mask_firsts(*pkts_cnt);
+	ret = pg_brick_burst(s->edge.link, state->output,
+			     s->edge.pair_index,
+			     state->pkts, mask, error);
+	pg_packets_free(state->pkts, mask);
+	return ret;
+}
+
+static int queue_ring_init(struct pg_queue_state *state,
+			   struct pg_error **error)
+{
+	char name[RTE_RING_NAMESIZE];
+
+	snprintf(name, RTE_RING_NAMESIZE, "pg_queue_%d",
+		 rte_atomic32_add_return(&ring_cnt, 1));
+	state->ring = rte_ring_create(name,
+				      state->rx_max_size * PG_MAX_PKTS_BURST,
+				      SOCKET_ID_ANY,
+				      RING_F_SP_ENQ | RING_F_SC_DEQ |
+				      RING_F_EXACT_SZ);
+	if (!state->ring) {
+		*error = pg_error_new_errno(rte_errno,
+					    "Queue ring allocation failed");
+		return -1;
+	}
+	state->brick.burst = queue_ring_burst;
+	state->brick.poll = queue_ring_poll;
+	return 0;
+}
+
 static int queue_init(struct pg_brick *brick,
 		      struct pg_brick_config *config,
 		      struct pg_error **error)
@@ -143,13 +247,16 @@ static int queue_init(struct pg_brick *brick,
 		queue_config->rx_max_size = 10;
 	}
 
+	state->rx_max_size = queue_config->rx_max_size;
+	state->friend = NULL;
+	if (queue_config->ring)
+		return queue_ring_init(state, error);
+
 	state->rx = g_async_queue_new();
 	if (state->rx == NULL) {
 		*error = pg_error_new("Queue allocation failed");
 		return -1;
 	}
-	state->rx_max_size = queue_config->rx_max_size;
-	state->friend = NULL;
 	brick->burst = queue_burst;
 	brick->poll = queue_poll;
 	return 0;
@@ -176,6 +283,14 @@ int pg_queue_friend(struct pg_brick *queue_1,
 		return -1;
 	}
 
+	if (!state1->ring != !state2->ring) {
+		*error = pg_error_new("Queues %s and %s %s",
+				      pg_brick_name(&state1->brick),
+				      pg_brick_name(&state2->brick),
+				      "do not use the same queue mode");
+		return -1;
+	}
+
 	state1->friend = state2;
 	state2->friend = state1;
 	return 0;
@@ -205,11 +320,34 @@ static inline void unfriend(struct pg_queue_state *state)
 	state->friend = NULL;
 }
 
+/*
+ * The ring only has one consumer: the friend must not be polled while
+ * empty drains the ring from another thread. Best effort, the friend may
+ * start polling right after the check.
+ */
+static inline void queue_assert_idle(struct pg_queue_state *state)
+{
+	g_assert(!state->ring || !state->friend ||
+		 !__atomic_load_n(&state->friend->polling, __ATOMIC_RELAXED));
+}
+
 static inline void empty(struct pg_queue_state *state)
 {
 	struct pg_queue_burst *burst = NULL;
 	GAsyncQueue *queue = state->rx;
 
+	if (state->ring) {
+		struct rte_mbuf *pkts[PG_MAX_PKTS_BURST];
+		unsigned int nb;
+
+		while ((nb = rte_ring_sc_dequeue_burst(state->ring,
+						       (void **)pkts,
+						       PG_MAX_PKTS_BURST,
+						       NULL)) > 0)
+			pg_packets_free(pkts, pg_mask_firsts(nb));
+		return;
+	}
+
 	while ((burst = g_async_queue_try_pop(queue)) != NULL) {
 		pg_packets_free(burst->pkts, burst->mask);
 		g_free(burst);
@@ -226,15 +364,29 @@ static void queue_destroy(struct pg_brick *brick, struct pg_error **error)
 	struct pg_queue_state *state =
 		pg_brick_get_state(brick, struct pg_queue_state);
 
+	queue_assert_idle(state);
 	unfriend(state);
 	empty(state);
-	g_async_queue_unref(state->rx);
+	if (state->ring)
+		rte_ring_free(state->ring);
+	else
+		g_async_queue_unref(state->rx);
 }
 
 struct pg_brick *pg_queue_new(const char *name, int size,
 			      struct pg_error **error)
 {
-	struct pg_brick_config *config = queue_config_new(name, size);
+	struct pg_brick_config *config = queue_config_new(name, size, false);
+	struct pg_brick *ret = pg_brick_new("queue", config, error);
+
+	pg_brick_config_free(config);
+	return ret;
+}
+
+struct pg_brick *pg_queue_ring_new(const char *name, int size,
+				   struct pg_error **error)
+{
+	struct pg_brick_config *config = queue_config_new(name, size, true);
 	struct pg_brick *ret = pg_brick_new("queue", config, error);
 
 	pg_brick_config_free(config);
@@ -265,6 +417,7 @@ static int queue_reset(struct pg_brick *brick, struct pg_error **errp)
 	struct pg_queue_state *state =
 		pg_brick_get_state(brick, struct pg_queue_state);
 
+	queue_assert_idle(state);
 	unfriend(state);
 	empty(state);
 	return 0;
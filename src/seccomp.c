@@ -48,6 +48,7 @@ int pg_init_seccomp(void)
 		ALLOW_SYSCALL(dup),
 		ALLOW_SYSCALL(dup2),
 		ALLOW_SYSCALL(nanosleep),
+		ALLOW_SYSCALL(clock_nanosleep),
 		ALLOW_SYSCALL(socket),
 		ALLOW_SYSCALL(sendto),
 		ALLOW_SYSCALL(recvmsg),
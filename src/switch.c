@@ -24,6 +24,8 @@
 
 #define HASH_ENTRIES		(1024 * 32)
 #define HASH_KEY_SIZE		8
+/* number of compact mac table slots the aging look at per burst */
+#define AGING_SLOTS_PER_BURST	32
 
 #include <packetgraph/packetgraph.h>
 #include "brick-int.h"
@@ -37,16 +39,35 @@ struct pg_address_source {
 	enum pg_side from;	/* side of the switch the packet came from */
 };
 
+/*
+ * what the mac table remember about a source mac address, kept as small as
+ * struct pg_address_source as the 24/24 table allocates 2^24 of them per OUI
+ */
+struct pg_switch_entry {
+	uint16_t edge_index;
+	uint16_t from;
+	uint32_t tick;		/* last burst the address was seen */
+};
+
 struct pg_switch_side {
 	struct pg_address_source *sources;
 	uint64_t *masks;	/* outgoing packet masks (one per port) */
+	/* packets waiting for the end of the poll (one per port) */
+	struct pg_brick_stage *stages;
 };
 
 struct pg_switch_state {
 	struct pg_brick brick;
 	struct pg_mac_table table;
 	int is_table_dead;
+	uint32_t mac_table_capacity;	/* 0 for the default layout */
+	uint32_t tick;			/* incremented at each burst */
+	uint32_t max_lifetime;		/* in ticks, 0 to never expire */
+	uint32_t aging_cursor;		/* next compact table slot to age */
+	uint64_t aging_mac;		/* next 24/24 table address to age */
 	enum pg_side output;
+	/* stage packets until flushed instead of forwarding them */
+	bool deferred;
 	/* sides of the switch */
 	struct pg_switch_side sides[PG_MAX_SIDE];
 	jmp_buf exeption_env;
@@ -101,6 +122,10 @@ static inline int forward(struct pg_switch_state *state, enum pg_side to,
 
 
 	switch_side->masks[index] = 0;
+	if (state->deferred)
+		return pg_brick_stage_burst(&switch_side->stages[index], edge,
+					    pg_flip_side(to), pkts, mask,
+					    errp);
 	return pg_brick_burst(edge->link, pg_flip_side(to), edge->pair_index,
 			      pkts, mask, errp);
 }
@@ -150,8 +175,52 @@ static inline void learn_addr(struct pg_switch_state *state,
 			     uint8_t *key,
 			     struct pg_address_source *source)
 {
-	pg_mac_table_ptr_set(&state->table, *((union pg_mac *)key),
-			     source);
+	struct pg_switch_entry entry = {source->edge_index, source->from,
+					state->tick};
+
+	pg_mac_table_elem_set(&state->table, *((union pg_mac *)key),
+			      &entry, sizeof(entry));
+}
+
+static inline bool is_expired(struct pg_switch_state *state,
+			      struct pg_switch_entry *entry)
+{
+	/* ticks wrap around, see PG_SWITCH_MAC_LIFETIME_MAX */
+	return state->max_lifetime &&
+		(uint32_t)(state->tick - entry->tick) > state->max_lifetime;
+}
+
+/*
+ * Forget expired addresses, looking at a bounded number of slots (or mask
+ * words with the 24/24 layout) per burst so a big table never stall the
+ * datapath.
+ * The 24/24 layout keeps the memory of an OUI once allocated, but unset
+ * addresses are no more walked by unlink_notify nor counted.
+ */
+static void age_addrs(struct pg_switch_state *state)
+{
+	struct pg_mac_table *ma = &state->table;
+	uint32_t budget = AGING_SLOTS_PER_BURST;
+	union pg_mac mac;
+	uint32_t slot;
+
+	if (!state->max_lifetime)
+		return;
+	if (!pg_mac_table_is_compact(ma)) {
+		while (pg_mac_table_walk(ma, &state->aging_mac, &budget,
+					 &mac)) {
+			if (is_expired(state, pg_mac_table_elem_get(
+					       ma, mac,
+					       struct pg_switch_entry)))
+				pg_mac_table_elem_unset(ma, mac);
+		}
+		return;
+	}
+	while ((slot = pg_mac_table_compact_walk(ma, &state->aging_cursor,
+						 &budget)) != UINT32_MAX) {
+		if (is_expired(state, pg_mac_table_compact_elem_at(ma, slot)))
+			pg_mac_table_compact_unset_at(ma, slot);
+	}
 }
 
 static void do_learn_filter_multicast(struct pg_switch_state *state,
@@ -207,7 +276,7 @@ static void do_switch(struct pg_switch_state *state,
 
 	for ( ; pkts_mask; ) {
 		struct pg_switch_side *switch_side;
-		struct pg_address_source *entry;
+		struct pg_switch_entry *entry;
 		uint16_t edge_index;
 		uint64_t bit;
 		uint16_t i;
@@ -215,14 +284,18 @@ static void do_switch(struct pg_switch_state *state,
 		pg_low_bit_iterate_full(pkts_mask, bit, i);
 
 		eth_hdr = rte_pktmbuf_mtod(pkts[i], struct ether_hdr *);
-		entry = pg_mac_table_ptr_get(
+		entry = pg_mac_table_elem_get(
 			&state->table,
-			*((union pg_mac *)&eth_hdr->d_addr));
-		if (entry) {
+			*((union pg_mac *)&eth_hdr->d_addr),
+			struct pg_switch_entry);
+		if (entry && !is_expired(state, entry)) {
 			switch_side = &state->sides[entry->from];
 			edge_index = entry->edge_index;
 
-		/* the lookup table entry is stale due to a port hotplug */
+		/*
+		 * the lookup table entry is stale due to a port hotplug
+		 * or because the address has not been seen for too long
+		 */
 		} else {
 			flood_mask |= bit;
 			continue;
@@ -247,6 +320,17 @@ static int mac_table_no_mem(struct pg_brick *brick, struct pg_error **errp)
 	return -1;
 }
 
+static int switch_table_init(struct pg_switch_state *state)
+{
+	state->aging_cursor = 0;
+	state->aging_mac = 0;
+	if (state->mac_table_capacity)
+		return pg_mac_table_init_compact(
+			&state->table, state->mac_table_capacity,
+			sizeof(struct pg_switch_entry), &state->exeption_env);
+	return pg_mac_table_init(&state->table, &state->exeption_env);
+}
+
 static int switch_burst(struct pg_brick *brick, enum pg_side from,
 			uint16_t edge_index, struct rte_mbuf **pkts,
 			uint64_t pkts_mask,
@@ -262,10 +346,12 @@ static int switch_burst(struct pg_brick *brick, enum pg_side from,
 		state->is_table_dead = 1;
 	}
 	if (unlikely(state->is_table_dead)) {
-		if (pg_mac_table_init(&state->table, &state->exeption_env) < 0)
+		if (switch_table_init(state) < 0)
 			return mac_table_no_mem(brick, errp);
 		state->is_table_dead = 0;
 	}
+	++state->tick;
+	age_addrs(state);
 	source = &state->sides[from].sources[edge_index];
 	source->from = from;
 	source->edge_index = edge_index;
@@ -288,7 +374,10 @@ static int switch_init(struct pg_brick *brick,
 	brick->burst = switch_burst;
 
 	state->is_table_dead = 0;
-	if (pg_mac_table_init(&state->table, &state->exeption_env) < 0)
+	state->mac_table_capacity = 0;
+	state->tick = 0;
+	state->max_lifetime = 0;
+	if (switch_table_init(state) < 0)
 		return mac_table_no_mem(brick, errp);
 	for (i = 0; i < PG_MAX_SIDE; i++) {
 		uint16_t max = brick->sides[i].max;
@@ -330,6 +419,94 @@ struct pg_brick *pg_switch_new(const char *name,
 	return ret;
 }
 
+int pg_switch_set_mac_table_capacity(struct pg_brick *brick,
+				     uint32_t capacity,
+				     struct pg_error **errp)
+{
+	struct pg_switch_state *state =
+		pg_brick_get_state(brick, struct pg_switch_state);
+
+	if (capacity > PG_MAC_TABLE_COMPACT_MAX_CAPACITY) {
+		*errp = pg_error_new("mac table capacity %u is too big",
+				     capacity);
+		return -1;
+	}
+	if (!state->is_table_dead)
+		pg_mac_table_free(&state->table);
+	state->mac_table_capacity = capacity;
+	if (switch_table_init(state) < 0) {
+		state->is_table_dead = 1;
+		return mac_table_no_mem(brick, errp);
+	}
+	state->is_table_dead = 0;
+	return 0;
+}
+
+void pg_switch_set_mac_lifetime(struct pg_brick *brick, uint64_t max_lifetime)
+{
+	struct pg_switch_state *state =
+		pg_brick_get_state(brick, struct pg_switch_state);
+
+	if (max_lifetime > PG_SWITCH_MAC_LIFETIME_MAX)
+		max_lifetime = PG_SWITCH_MAC_LIFETIME_MAX;
+	state->max_lifetime = max_lifetime;
+}
+
+uint32_t pg_switch_mac_count(struct pg_brick *brick)
+{
+	struct pg_switch_state *state =
+		pg_brick_get_state(brick, struct pg_switch_state);
+
+	if (state->is_table_dead)
+		return 0;
+	return pg_mac_table_compute_length(&state->table);
+}
+
+static int switch_flush(struct pg_brick *brick, struct pg_error **errp)
+{
+	struct pg_switch_state *state =
+		pg_brick_get_state(brick, struct pg_switch_state);
+	int forwarded = 0;
+
+	for (enum pg_side i = 0; i < PG_MAX_SIDE; i++) {
+		struct pg_switch_side *switch_side = &state->sides[i];
+
+		for (uint16_t j = 0; j < brick->sides[i].nb; j++) {
+			int ret = pg_brick_stage_flush(
+				&switch_side->stages[j],
+				&brick->sides[i].edges[j],
+				pg_flip_side(i), errp);
+
+			if (unlikely(ret < 0))
+				return -1;
+			forwarded += ret;
+		}
+	}
+	return forwarded;
+}
+
+int pg_switch_set_deferred(struct pg_brick *brick, bool deferred,
+			   struct pg_error **errp)
+{
+	struct pg_switch_state *state =
+		pg_brick_get_state(brick, struct pg_switch_state);
+
+	if (deferred == state->deferred)
+		return 0;
+	if (!deferred && switch_flush(brick, errp) < 0)
+		return -1;
+	for (enum pg_side i = 0; i < PG_MAX_SIDE; i++) {
+		struct pg_switch_side *switch_side = &state->sides[i];
+
+		g_free(switch_side->stages);
+		switch_side->stages = deferred ?
+			g_new0(struct pg_brick_stage, brick->sides[i].max) :
+			NULL;
+	}
+	state->deferred = deferred;
+	pg_brick_flush_set(brick, deferred ? switch_flush : NULL);
+	return 0;
+}
 
 static void switch_destroy(struct pg_brick *brick, struct pg_error **errp)
 {
@@ -338,6 +515,17 @@ static void switch_destroy(struct pg_brick *brick, struct pg_error **errp)
 	enum pg_side i;
 
 	for (i = 0; i < PG_MAX_SIDE; i++) {
+		struct pg_switch_side *switch_side = &state->sides[i];
+
+		/* staged packets of a destroyed switch are dropped */
+		for (uint16_t j = 0; switch_side->stages &&
+		     j < brick->sides[i].max; j++) {
+			struct pg_brick_stage *stage = &switch_side->stages[j];
+
+			pg_packets_free(stage->pkts,
+					pg_mask_firsts(stage->count));
+		}
+		g_free(switch_side->stages);
 		g_free(state->sides[i].masks);
 		g_free(state->sides[i].sources);
 	}
@@ -356,11 +544,11 @@ static void switch_unlink_notify(struct pg_brick *brick,
 
 	if (state->is_table_dead)
 		return;
-	PG_MAC_TABLE_FOREACH_PTR(&state->table, cur_mac,
-				 struct pg_address_source, src) {
-		if (src->from == side &&
-		    src->edge_index == edge_index)
-			pg_mac_table_ptr_unset(&state->table, cur_mac);
+	PG_MAC_TABLE_FOREACH_ELEM(&state->table, cur_mac,
+				  struct pg_switch_entry, entry) {
+		if (entry->from == side &&
+		    entry->edge_index == edge_index)
+			pg_mac_table_elem_unset(&state->table, cur_mac);
 	}
 }
 
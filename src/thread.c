@@ -17,11 +17,20 @@
 
 #include <rte_config.h>
 #include <rte_branch_prediction.h>
-#include <rte_atomic.h>
+#include <rte_cycles.h>
 #include <rte_lcore.h>
+#include <rte_pause.h>
+#ifdef __WAITPKG__
+#include <immintrin.h>
+#endif
 
 #include <glib.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <packetgraph/thread.h>
 
 #include "utils/stack.h"
@@ -41,8 +50,6 @@ const char *pg_thread_str_states[PG_THREAD_RUNNING + 1] = {
 static STACK_CREATE(free_thread_ids, int16);
 
 enum pg_thread_op {
-	PG_THREAD_NONE,
-	PG_THREAD_ANSWER,
 	PG_THREAD_STATE,
 	PG_THREAD_ADD_GRAPH,
 	PG_THREAD_RM_GRAPH,
@@ -50,11 +57,26 @@ enum pg_thread_op {
 	PG_THREAD_POP_ERROR,
 	PG_THREAD_FORCE_START,
 	PG_THREAD_STOP,
+	PG_THREAD_IDLE_POLICY,
 	PG_THREAD_QUIT,
 };
 
+/* size of the command ring, must be a power of 2 */
 #define PG_THREAD_MAX_OP 128
 
+/*
+ * Adaptive idle policy, a round being 32 polls of every graph:
+ * busy poll during the first PG_THREAD_IDLE_SPIN_ROUNDS empty rounds,
+ * then pause the core until PG_THREAD_IDLE_PAUSE_ROUNDS empty rounds,
+ * then sleep, doubling the sleep duration up to
+ * PG_THREAD_IDLE_SLEEP_MAX_NS.
+ */
+#define PG_THREAD_IDLE_SPIN_ROUNDS 64
+#define PG_THREAD_IDLE_PAUSE_ROUNDS 512
+#define PG_THREAD_IDLE_PAUSE_CYCLES 2000
+#define PG_THREAD_IDLE_SLEEP_MIN_NS 1000
+#define PG_THREAD_IDLE_SLEEP_MAX_NS 128000
+
 union pg_thread_arg {
 	void *ptr;
 	uint64_t u64;
@@ -66,16 +88,48 @@ union pg_thread_arg {
 	};
 };
 
+/* answer of an op, the caller sleeps on done until the thread sets it */
+struct thread_future {
+	uint32_t done;
+	union pg_thread_arg arg;
+	union pg_thread_arg arg2;
+};
+
+struct thread_op {
+	/* slot sequence number, see thread_post */
+	uint64_t seq;
+	enum pg_thread_op op;
+	union pg_thread_arg arg;
+	/* NULL when nobody waits for an answer */
+	struct thread_future *future;
+};
+
 struct pg_thread_client {
 	int id;
-	rte_atomic16_t is_queue_locked;
-	rte_atomic16_t is_queue_empty;
-	int queue_size;
-	struct thread_op {
-		enum pg_thread_op op;
-		union pg_thread_arg arg;
-		union pg_thread_arg arg2;
-	} queue[PG_THREAD_MAX_OP];
+	/*
+	 * Bounded multi-producer single-consumer ring of ops: producers
+	 * reserve a slot by moving tail forward, the thread consumes from
+	 * head and nobody takes a lock.
+	 */
+	uint64_t tail;
+	uint64_t head;
+	/* 1 while the thread sleeps on it waiting for ops */
+	uint32_t parked;
+	struct thread_op queue[PG_THREAD_MAX_OP];
+	/* written by the thread only, in TSC cycles */
+	uint64_t idle_pauses;
+	uint64_t idle_sleeps;
+	uint64_t idle_wakeups;
+	uint64_t idle_wakeup_cycles;
+	uint64_t idle_wakeup_max_cycles;
+	/* poll statistics, written by the thread only */
+	struct pg_thread_stats stats;
+	struct pg_thread_stats graph_stats[PG_STACK_BLOCK_SIZE];
+	/* 1 when the graph slot is in use, written by the thread only */
+	uint8_t graph_slots[PG_STACK_BLOCK_SIZE];
+	/* rebalancer snapshots, written by pg_thread_rebalance only */
+	uint64_t rebalance_tsc;
+	uint64_t rebalance_busy[PG_STACK_BLOCK_SIZE];
 };
 
 struct pg_thread_client *thread_ids[PG_THREAD_MAX];
@@ -84,27 +138,128 @@ static bool is_init;
 static int16_t threads_max;
 static int16_t last_thread_id;
 static int16_t nb_thread_id_used;
-static _Thread_local int queue_pos;
 
-static inline int try_lock(struct pg_thread_client *client)
+static inline void thread_futex_wait(uint32_t *addr, uint32_t val,
+				     uint64_t ns)
 {
-	return rte_atomic16_test_and_set(&client->is_queue_locked);
+	struct timespec ts = {ns / 1000000000, ns % 1000000000};
+
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, ns ? &ts : NULL,
+		NULL, 0);
 }
 
-static inline struct thread_op *get_thread_op(struct pg_thread_client *client)
+static inline void thread_futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* get the next op posted to the thread, NULL if there is none */
+static inline struct thread_op *thread_peek(struct pg_thread_client *client)
+{
+	struct thread_op *cur =
+		&client->queue[client->head & (PG_THREAD_MAX_OP - 1)];
+
+	if (__atomic_load_n(&cur->seq, __ATOMIC_ACQUIRE) != client->head + 1)
+		return NULL;
+	return cur;
+}
+
+/* give the slot of the op got by thread_peek back to producers */
+static inline void thread_consume(struct pg_thread_client *client,
+				  struct thread_op *cur)
+{
+	__atomic_store_n(&cur->seq, client->head + PG_THREAD_MAX_OP,
+			 __ATOMIC_RELEASE);
+	client->head++;
+}
+
+/* sleep until an op is posted or ns are elapsed, 0 meaning forever */
+static void thread_park(struct pg_thread_client *client, uint64_t ns)
+{
+	__atomic_store_n(&client->parked, 1, __ATOMIC_RELAXED);
+	/* pairs with the fence of thread_kick */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!thread_peek(client))
+		thread_futex_wait(&client->parked, 1, ns);
+	__atomic_store_n(&client->parked, 0, __ATOMIC_RELAXED);
+}
+
+static inline void thread_kick(struct pg_thread_client *client)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&client->parked, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&client->parked, 0, __ATOMIC_RELAXED))
+		thread_futex_wake(&client->parked);
+}
+
+static void thread_answer(struct thread_future *future,
+			  union pg_thread_arg arg, union pg_thread_arg arg2)
+{
+	if (!future)
+		return;
+	future->arg = arg;
+	future->arg2 = arg2;
+	__atomic_store_n(&future->done, 1, __ATOMIC_RELEASE);
+	thread_futex_wake(&future->done);
+}
+
+/**
+ * Wait a bit because graphs have been idle for idle_rounds rounds.
+ *
+ * @return	TSC cycles spent waiting
+ */
+static uint64_t thread_idle_wait(struct pg_thread_client *client,
+				 uint32_t idle_rounds)
 {
-	return &client->queue[queue_pos];
+	uint64_t start = rte_rdtsc();
+	uint32_t shift;
+	uint64_t ns;
+
+	if (idle_rounds < PG_THREAD_IDLE_SPIN_ROUNDS)
+		return 0;
+	if (idle_rounds < PG_THREAD_IDLE_PAUSE_ROUNDS) {
+#ifdef __WAITPKG__
+		/* light C0.2 state, left on deadline or interrupt */
+		_tpause(0, start + PG_THREAD_IDLE_PAUSE_CYCLES);
+#else
+		while (rte_rdtsc() - start < PG_THREAD_IDLE_PAUSE_CYCLES)
+			rte_pause();
+#endif
+		client->idle_pauses++;
+	} else {
+		shift = idle_rounds - PG_THREAD_IDLE_PAUSE_ROUNDS;
+		ns = PG_THREAD_IDLE_SLEEP_MAX_NS;
+		if (shift < 32 &&
+		    ((uint64_t)PG_THREAD_IDLE_SLEEP_MIN_NS << shift) < ns)
+			ns = (uint64_t)PG_THREAD_IDLE_SLEEP_MIN_NS << shift;
+		/* posted ops cut the sleep short */
+		thread_park(client, ns);
+		client->idle_sleeps++;
+	}
+	return rte_rdtsc() - start;
 }
 
-static inline enum pg_thread_op
-dequeue_op_nolock(struct pg_thread_client *client)
+static inline void thread_stats_add(struct pg_thread_stats *stats,
+				    uint32_t pkts, uint64_t cycles)
 {
-	return client->queue[queue_pos].op;
+	stats->pkts += pkts;
+	if (pkts) {
+		stats->busy_polls++;
+		stats->busy_cycles += cycles;
+	} else {
+		stats->idle_polls++;
+		stats->idle_cycles += cycles;
+	}
 }
 
-static inline void relock(struct pg_thread_client *client)
+/* packets came back after a wait which delayed them up to wait_cycles */
+static void thread_idle_wakeup(struct pg_thread_client *client,
+			       uint64_t wait_cycles)
 {
-	rte_atomic16_clear(&client->is_queue_locked);
+	client->idle_wakeups++;
+	client->idle_wakeup_cycles += wait_cycles;
+	if (wait_cycles > client->idle_wakeup_max_cycles)
+		client->idle_wakeup_max_cycles = wait_cycles;
 }
 
 static int pg_thread_main(void *a)
@@ -112,11 +267,20 @@ static int pg_thread_main(void *a)
 	int id = rte_lcore_id();
 	struct pg_thread_client *client = thread_ids[id];
 	enum pg_thread_state state = PG_THREAD_STOPPED;
-	struct thread_op *cur;
+	struct thread_op *slot;
+	struct thread_op cur;
+	union pg_thread_arg answer, answer2;
 	struct pg_graph *graphs[PG_STACK_BLOCK_SIZE];
 	uint8_t started[PG_STACK_BLOCK_SIZE];
 	int last_graph = 0;
+	bool run_pending = false;
 	struct pg_error *error;
+	enum pg_thread_idle_policy idle_policy = PG_THREAD_IDLE_BUSY_POLL;
+	uint32_t idle_rounds = 0;
+	uint64_t wait_cycles = 0;
+	uint64_t last_tsc, tsc;
+	uint32_t count;
+	uint64_t pkts;
 	int ret;
 
 	STACK_CREATE(free_graph, int8);
@@ -126,55 +290,54 @@ static int pg_thread_main(void *a)
 	stack_set_limit(errors, 128);
 	stack_set_limit(errors_gid, 128);
 	while (1) {
-		if (try_lock(client)) {
-			queue_pos = client->queue_size - 1;
-			if (queue_pos < 0) {
-				relock(client);
-				continue;
-			}
-again:
-			switch (dequeue_op_nolock(client)) {
+		/* a single load when no op is pending */
+		while ((slot = thread_peek(client))) {
+			cur = *slot;
+			thread_consume(client, slot);
+			answer.u64 = 0;
+			answer2.u64 = 0;
+			switch (cur.op) {
 			case PG_THREAD_QUIT:
 				stack_destroy(free_graph);
 				stack_destroy(errors);
 				stack_destroy(errors_gid);
-				relock(client);
 				return 0;
 			case PG_THREAD_POP_ERROR:
-				cur = get_thread_op(client);
-				cur->arg.ptr = stack_pop(errors, NULL);
-				cur->arg2.i32_1 = stack_pop(errors_gid, -1);
-				cur->arg2.i32_2 = stack_len(errors_gid);
-				cur->op = PG_THREAD_ANSWER;
+				answer.ptr = stack_pop(errors, NULL);
+				answer2.i32_1 = stack_pop(errors_gid, -1);
+				answer2.i32_2 = stack_len(errors_gid);
 				break;
 			case PG_THREAD_RM_GRAPH:
-				cur = get_thread_op(client);
-				ret = cur->arg.i16;
+				ret = cur.arg.i32;
 				stack_push(free_graph, (int8_t)ret);
-				cur->arg.ptr = graphs[ret];
+				answer.ptr = graphs[ret];
 				started[ret] = PG_THREAD_STOPPED;
-				cur->op = PG_THREAD_ANSWER;
+				client->graph_slots[ret] = 0;
 				break;
 			case PG_THREAD_ADD_GRAPH:
-				cur = get_thread_op(client);
 				ret = stack_pop(free_graph, -1);
 				if (ret == -1) {
 					ret = last_graph;
 					if (ret == PG_STACK_BLOCK_SIZE) {
-						cur->op = PG_THREAD_ANSWER;
-						cur->arg.i32 = -1;
-						continue;
+						answer.i32 = -1;
+						break;
 					}
 					last_graph += 1;
 				}
-				graphs[ret] = cur->arg.ptr;
+				graphs[ret] = cur.arg.ptr;
 				started[ret] = PG_THREAD_RUNNING;
-				cur->arg.i32 = ret;
-				cur->op = PG_THREAD_ANSWER;
+				memset(&client->graph_stats[ret], 0,
+				       sizeof(struct pg_thread_stats));
+				client->graph_slots[ret] = 1;
+				answer.i32 = ret;
+				/* pg_thread_run was called without graph */
+				if (run_pending) {
+					state = PG_THREAD_RUNNING;
+					run_pending = false;
+				}
 				break;
 			case PG_THREAD_FORCE_START:
-				cur = get_thread_op(client);
-				started[cur->arg.i32] = PG_THREAD_RUNNING;
+				started[cur.arg.i32] = PG_THREAD_RUNNING;
 				ret = 0;
 
 				for (int i = 0; i < last_graph; ++i) {
@@ -183,57 +346,73 @@ again:
 				}
 				if (!ret && !stack_len(errors))
 					state = PG_THREAD_RUNNING;
-				cur->op = PG_THREAD_NONE;
 				break;
 			case PG_THREAD_RUN:
-				if (!last_graph)
+				if (!last_graph) {
+					run_pending = true;
 					break;
-				cur = get_thread_op(client);
+				}
 				for (int i = 0; i < last_graph; ++i) {
 					if (started[i] == PG_THREAD_BROKEN)
 						started[i] = PG_THREAD_RUNNING;
 				}
 				state = PG_THREAD_RUNNING;
-				cur->op = PG_THREAD_NONE;
 				break;
 			case PG_THREAD_STOP:
-				cur = get_thread_op(client);
 				state = PG_THREAD_STOPPED;
-				cur->op = PG_THREAD_ANSWER;
+				run_pending = false;
 				break;
-			case PG_THREAD_STATE:
-				cur = get_thread_op(client);
-				cur->arg.u64 = state;
-				cur->op = PG_THREAD_ANSWER;
+			case PG_THREAD_IDLE_POLICY:
+				idle_policy = cur.arg.i32;
+				idle_rounds = 0;
 				break;
-			case PG_THREAD_NONE:
-			case PG_THREAD_ANSWER:
+			case PG_THREAD_STATE:
+				answer.u64 = state;
 				break;
 			}
-
-			queue_pos -= 1;
-			if (queue_pos > 0)
-				goto again;
-
-			relock(client);
+			thread_answer(cur.future, answer, answer2);
 		}
 		if (unlikely(state == PG_THREAD_STOPPED)) {
-			sched_yield();
+			thread_park(client, 0);
 			continue;
 		}
+		pkts = 0;
+		last_tsc = rte_rdtsc();
 		for (int j = 0; j < 32; ++j) {
 			for (int16_t i = 0; i < last_graph; ++i) {
 				if (started[i] != PG_THREAD_RUNNING)
 					continue;
-				if (unlikely(pg_graph_poll(graphs[i],
-							   &error) < 0)) {
+				if (unlikely(pg_graph_poll_count(graphs[i],
+								 &count,
+								 &error) < 0)) {
 					state = PG_THREAD_BROKEN;
 					started[i] = PG_THREAD_BROKEN;
 					stack_push(errors, (void *)error);
 					stack_push(errors_gid, i);
 				}
+				/* one TSC read per poll */
+				tsc = rte_rdtsc();
+				thread_stats_add(&client->graph_stats[i], count,
+						 tsc - last_tsc);
+				thread_stats_add(&client->stats, count,
+						 tsc - last_tsc);
+				last_tsc = tsc;
+				pkts += count;
 			}
 		}
+		if (idle_policy == PG_THREAD_IDLE_BUSY_POLL)
+			continue;
+		if (pkts) {
+			/* back to busy polling on the first packet */
+			if (wait_cycles)
+				thread_idle_wakeup(client, wait_cycles);
+			idle_rounds = 0;
+			wait_cycles = 0;
+		} else {
+			if (idle_rounds < UINT32_MAX)
+				idle_rounds++;
+			wait_cycles = thread_idle_wait(client, idle_rounds);
+		}
 	}
 	return 0;
 }
@@ -271,175 +450,296 @@ int16_t pg_thread_init(struct pg_error **errp)
 	}
 	nb_thread_id_used += 1;
 	thread_ids[ret] = g_new0(struct pg_thread_client, 1);
-	rte_atomic16_init(&thread_ids[ret]->is_queue_locked);
-	rte_atomic16_init(&thread_ids[ret]->is_queue_empty);
-	rte_atomic16_set(&thread_ids[ret]->is_queue_empty, 1);
-	rte_atomic16_clear(&thread_ids[ret]->is_queue_locked);
+	for (int i = 0; i < PG_THREAD_MAX_OP; ++i)
+		thread_ids[ret]->queue[i].seq = i;
 	thread_ids[ret]->id = ret;
 	rte_eal_remote_launch(pg_thread_main, NULL, ret);
 	return ret;
 }
 
-#define TYPE_NAME ptr
-#include "thread-impl.h"
-#undef TYPE_NAME
-#define TYPE_NAME i16
-#include "thread-impl.h"
-#undef TYPE_NAME
-#define TYPE_NAME i32
-#include "thread-impl.h"
-#undef TYPE_NAME
-
-#define enqueue(thread_id, op, arg)		\
-	(_Generic((arg), void * : enqueue_ptr,	\
-		  int16_t : enqueue_i16,	\
-		  int32_t : enqueue_i32		\
-		)(thread_id, op, arg))
-
-
-#define wait_enqueue(thread_id, op, arg)		\
-	(_Generic((arg), void * : wait_enqueue_ptr,	\
-		  struct pg_graph * : wait_enqueue_ptr,	\
-		  int16_t : wait_enqueue_i16,		\
-		  int32_t : wait_enqueue_i32		\
-		)(thread_id, op, arg))
+/**
+ * Post an op to a thread.
+ * A producer owns the slot at tail once its sequence number equals tail,
+ * it then publishes the op by setting the sequence number to tail + 1,
+ * which is what thread_peek waits for.
+ *
+ * @return	0 on success, -1 if the ring is full
+ */
+static int thread_post(struct pg_thread_client *client, enum pg_thread_op op,
+		       union pg_thread_arg arg, struct thread_future *future)
+{
+	uint64_t pos = __atomic_load_n(&client->tail, __ATOMIC_RELAXED);
+	struct thread_op *cur;
+	int64_t diff;
 
+	while (1) {
+		cur = &client->queue[pos & (PG_THREAD_MAX_OP - 1)];
+		diff = (int64_t)(__atomic_load_n(&cur->seq, __ATOMIC_ACQUIRE) -
+				 pos);
+		if (!diff) {
+			if (__atomic_compare_exchange_n(&client->tail, &pos,
+							pos + 1, true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = __atomic_load_n(&client->tail, __ATOMIC_RELAXED);
+		}
+	}
+	cur->op = op;
+	cur->arg = arg;
+	cur->future = future;
+	__atomic_store_n(&cur->seq, pos + 1, __ATOMIC_RELEASE);
+	thread_kick(client);
+	return 0;
+}
 
-static void shrink_queue(struct pg_thread_client *client, int should_lock)
+static void thread_send(int16_t thread_id, enum pg_thread_op op,
+			union pg_thread_arg arg, struct thread_future *future)
 {
-	int i;
-
-	if (should_lock)
-		while (!rte_atomic16_test_and_set(&client->is_queue_locked))
-			;
-
-	for (i = client->queue_size; i > 0 &&
-		     client->queue[i - 1].op == PG_THREAD_NONE; --i)
-		;
-	client->queue_size = i;
-	if (!client->queue_size)
-		rte_atomic16_set(&client->is_queue_empty, 1);
-	if (should_lock)
-		rte_atomic16_clear(&client->is_queue_locked);
+	while (thread_post(thread_ids[thread_id], op, arg, future) < 0)
+		sched_yield();
 }
 
-static struct thread_op *try_get_answer(struct pg_thread_client *client,
-					int queue_idx)
+/* post an op and sleep until the thread answers it */
+static void thread_call(int16_t thread_id, enum pg_thread_op op,
+			union pg_thread_arg arg, struct thread_future *future)
 {
-	if (!rte_atomic16_test_and_set(&client->is_queue_locked))
-		return NULL;
-	if (client->queue[queue_idx].op == PG_THREAD_ANSWER)
-		return &client->queue[queue_idx];
-	g_assert(client->queue[queue_idx].op != PG_THREAD_NONE);
-	rte_atomic16_clear(&client->is_queue_locked);
-	return NULL;
+	future->done = 0;
+	thread_send(thread_id, op, arg, future);
+	while (!__atomic_load_n(&future->done, __ATOMIC_ACQUIRE))
+		thread_futex_wait(&future->done, 0, 0);
 }
 
-static struct thread_op *wait_answer(int16_t thread_id, int queue_id)
+enum pg_thread_state pg_thread_state(int16_t thread_id)
 {
-	struct thread_op *cur_op;
+	struct thread_future future;
 
-	while (!(cur_op = try_get_answer(thread_ids[thread_id], queue_id)))
-		sched_yield();
-	return cur_op;
+	thread_call(thread_id, PG_THREAD_STATE, (union pg_thread_arg){0},
+		    &future);
+	return future.arg.u64;
 }
 
-enum pg_thread_state pg_thread_state(int16_t thread_id)
+int pg_thread_run(int16_t thread_id)
 {
-	struct pg_thread_client *client = thread_ids[thread_id];
-	int queue_id;
-	enum pg_thread_state ret;
-	struct thread_op *cur_op;
-
-	queue_id = wait_enqueue(thread_id, PG_THREAD_STATE, NULL);
-	sched_yield();
-	cur_op = wait_answer(thread_id, queue_id);
-	ret = cur_op->arg.u64;
-	cur_op->op = PG_THREAD_NONE;
-	shrink_queue(client, 0);
-	rte_atomic16_clear(&client->is_queue_locked);
-	return ret;
+	thread_send(thread_id, PG_THREAD_RUN, (union pg_thread_arg){0}, NULL);
+	return 0;
 }
 
-int pg_thread_run(int16_t thread_id)
+int pg_thread_set_idle_policy(int16_t thread_id,
+			      enum pg_thread_idle_policy policy)
 {
-	wait_enqueue(thread_id, PG_THREAD_RUN, NULL);
+	if (unlikely(thread_id > threads_max || !thread_ids[thread_id]))
+		return -1;
+	thread_send(thread_id, PG_THREAD_IDLE_POLICY,
+		    (union pg_thread_arg){.i32 = policy}, NULL);
+	return 0;
+}
+int pg_thread_idle_stats(int16_t thread_id,
+			 struct pg_thread_idle_stats *stats)
+{
+	struct pg_thread_client *client;
+	double ns_per_cycle = 1E9 / rte_get_tsc_hz();
+
+	if (unlikely(thread_id > threads_max || !thread_ids[thread_id]))
+		return -1;
+	client = thread_ids[thread_id];
+	stats->pauses = client->idle_pauses;
+	stats->sleeps = client->idle_sleeps;
+	stats->wakeups = client->idle_wakeups;
+	stats->wakeup_latency_max_ns =
+		client->idle_wakeup_max_cycles * ns_per_cycle;
+	stats->wakeup_latency_avg_ns = stats->wakeups ?
+		client->idle_wakeup_cycles * ns_per_cycle / stats->wakeups : 0;
+	return 0;
+}
+
+int pg_thread_stats(int16_t thread_id, int32_t graph_id,
+		    struct pg_thread_stats *stats)
+{
+	if (unlikely(thread_id > threads_max || !thread_ids[thread_id] ||
+		     graph_id >= PG_STACK_BLOCK_SIZE))
+		return -1;
+	if (graph_id < 0)
+		*stats = thread_ids[thread_id]->stats;
+	else
+		*stats = thread_ids[thread_id]->graph_stats[graph_id];
 	return 0;
 }
 
 int pg_thread_stop(int16_t thread_id)
 {
-	struct thread_op *cur_op;
-	int queue_id = wait_enqueue(thread_id, PG_THREAD_STOP, NULL);
+	struct thread_future future;
 
-	cur_op = wait_answer(thread_id, queue_id);
-	shrink_queue(thread_ids[thread_id], 0);
-	cur_op->op = PG_THREAD_NONE;
-	rte_atomic16_clear(&thread_ids[thread_id]->is_queue_locked);
+	thread_call(thread_id, PG_THREAD_STOP, (union pg_thread_arg){0},
+		    &future);
 	return 0;
 }
 
 int pg_thread_add_graph(int16_t thread_id, struct pg_graph *graph)
 {
-	struct pg_thread_client *client = thread_ids[thread_id];
-	int queue_id;
-	enum pg_thread_state ret;
-	struct thread_op *cur_op;
+	struct thread_future future;
+	int ret;
 
 	if (unlikely(!graph))
 		return -1;
-	queue_id = wait_enqueue(thread_id, PG_THREAD_ADD_GRAPH, graph);
-	sched_yield();
-	cur_op = wait_answer(thread_id, queue_id);
-	ret = cur_op->arg.i32;
-	cur_op->op = PG_THREAD_NONE;
-	shrink_queue(client, 0);
-	rte_atomic16_clear(&client->is_queue_locked);
+	thread_call(thread_id, PG_THREAD_ADD_GRAPH,
+		    (union pg_thread_arg){.ptr = graph}, &future);
+	ret = future.arg.i32;
+	if (ret >= 0)
+		thread_ids[thread_id]->rebalance_busy[ret] = 0;
 	return ret;
-
 }
 
 int pg_thread_pop_error(int16_t thread_id, int *graph_id,
 			struct pg_error **errp)
 {
-	struct pg_thread_client *client = thread_ids[thread_id];
-	int queue_id;
-	int ret;
-	struct thread_op *cur_op;
-
-	queue_id = wait_enqueue(thread_id, PG_THREAD_POP_ERROR, NULL);
-	sched_yield();
-	cur_op = wait_answer(thread_id, queue_id);
-	*errp = cur_op->arg.ptr;
-	*graph_id = cur_op->arg2.i32_1;
-	ret = *graph_id < 0 ? -1 : cur_op->arg2.i32_2;
-	cur_op->op = PG_THREAD_NONE;
-	shrink_queue(client, 0);
-	rte_atomic16_clear(&client->is_queue_locked);
-	return ret;
+	struct thread_future future;
+
+	thread_call(thread_id, PG_THREAD_POP_ERROR, (union pg_thread_arg){0},
+		    &future);
+	*errp = future.arg.ptr;
+	*graph_id = future.arg2.i32_1;
+	return *graph_id < 0 ? -1 : future.arg2.i32_2;
 }
 
 int pg_thread_force_start_graph(int16_t thread_id, int32_t graph_id)
 {
-	wait_enqueue(thread_id, PG_THREAD_FORCE_START, graph_id);
-	sched_yield();
+	thread_send(thread_id, PG_THREAD_FORCE_START,
+		    (union pg_thread_arg){.i32 = graph_id}, NULL);
 	return 0;
 }
 
 struct pg_graph *pg_thread_pop_graph(int16_t thread_id, int32_t graph_id)
 {
-	struct pg_thread_client *client = thread_ids[thread_id];
-	int queue_id;
-	struct pg_graph *ret;
-	struct thread_op *cur_op;
-
-	queue_id = wait_enqueue(thread_id, PG_THREAD_RM_GRAPH, graph_id);
-	sched_yield();
-	cur_op = wait_answer(thread_id, queue_id);
-	ret = cur_op->arg.ptr;
-	cur_op->op = PG_THREAD_NONE;
-	shrink_queue(client, 0);
-	rte_atomic16_clear(&client->is_queue_locked);
+	struct thread_future future;
+
+	thread_call(thread_id, PG_THREAD_RM_GRAPH,
+		    (union pg_thread_arg){.i32 = graph_id}, &future);
+	return future.arg.ptr;
+}
+
+int pg_thread_migrate_graph(int16_t src_tid, int32_t graph_id,
+			    int16_t dst_tid)
+{
+	struct pg_graph *graph;
+	int ret;
+
+	if (unlikely(src_tid > threads_max || !thread_ids[src_tid] ||
+		     dst_tid > threads_max || !thread_ids[dst_tid] ||
+		     graph_id < 0 || graph_id >= PG_STACK_BLOCK_SIZE ||
+		     !thread_ids[src_tid]->graph_slots[graph_id]))
+		return -1;
+	if (src_tid == dst_tid)
+		return graph_id;
+	/*
+	 * The source thread answers between two poll rounds, once popped
+	 * the graph has no packet in flight and is not polled anymore.
+	 */
+	graph = pg_thread_pop_graph(src_tid, graph_id);
+	ret = pg_thread_add_graph(dst_tid, graph);
+	/* destination is full, give the graph back */
+	if (ret < 0)
+		pg_thread_add_graph(src_tid, graph);
+	return ret;
+}
+
+/* busy cycles of each graph of a thread since the last rebalancing */
+static uint64_t thread_rebalance_sample(struct pg_thread_client *client,
+					uint64_t *busy)
+{
+	uint64_t total = 0;
+	uint64_t cur;
+
+	for (int i = 0; i < PG_STACK_BLOCK_SIZE; ++i) {
+		busy[i] = 0;
+		if (!client->graph_slots[i])
+			continue;
+		cur = client->graph_stats[i].busy_cycles;
+		if (cur > client->rebalance_busy[i])
+			busy[i] = cur - client->rebalance_busy[i];
+		client->rebalance_busy[i] = cur;
+		total += busy[i];
+	}
+	return total;
+}
+
+int pg_thread_rebalance(const int16_t *tids, int nb_tids, int threshold)
+{
+	uint64_t now = rte_rdtsc();
+	uint64_t (*busy)[PG_STACK_BLOCK_SIZE];
+	uint64_t *elapsed;
+	double *loads;
+	struct pg_thread_client *client;
+	bool sampled = true;
+	int hi = -1, lo = -1;
+	int32_t best = -1;
+	double gap, load, dist, best_dist = 0;
+	int ret = 0;
+
+	if (unlikely(nb_tids < 2 || threshold < 0))
+		return -1;
+	for (int t = 0; t < nb_tids; ++t) {
+		if (unlikely(tids[t] < 0 || tids[t] > threads_max ||
+			     !thread_ids[tids[t]]))
+			return -1;
+	}
+
+	busy = g_malloc_n(nb_tids, sizeof(*busy));
+	elapsed = g_new(uint64_t, nb_tids);
+	loads = g_new(double, nb_tids);
+	for (int t = 0; t < nb_tids; ++t) {
+		client = thread_ids[tids[t]];
+		loads[t] = thread_rebalance_sample(client, busy[t]);
+		elapsed[t] = now - client->rebalance_tsc;
+		if (!client->rebalance_tsc || !elapsed[t])
+			sampled = false;
+		else
+			loads[t] = loads[t] * 100 / elapsed[t];
+		client->rebalance_tsc = now;
+		/* stopped threads neither give nor take graphs */
+		if (pg_thread_state(tids[t]) != PG_THREAD_RUNNING)
+			continue;
+		if (hi < 0 || loads[t] > loads[hi])
+			hi = t;
+		if (lo < 0 || loads[t] < loads[lo])
+			lo = t;
+	}
+	/* first call only takes the snapshot loads are measured from */
+	if (!sampled || hi < 0 || hi == lo)
+		goto exit;
+	gap = loads[hi] - loads[lo];
+	if (gap <= threshold)
+		goto exit;
+
+	/*
+	 * Moving a graph of load l turns the gap into |gap - 2l|, pick the
+	 * graph bringing it the closest to zero.
+	 */
+	client = thread_ids[tids[hi]];
+	for (int32_t i = 0; i < PG_STACK_BLOCK_SIZE; ++i) {
+		if (!client->graph_slots[i] || !busy[hi][i])
+			continue;
+		load = (double)busy[hi][i] * 100 / elapsed[hi];
+		if (load >= gap)
+			continue;
+		dist = gap - 2 * load;
+		if (dist < 0)
+			dist = -dist;
+		if (best < 0 || dist < best_dist) {
+			best = i;
+			best_dist = dist;
+		}
+	}
+	if (best < 0)
+		goto exit;
+	ret = pg_thread_migrate_graph(tids[hi], best, tids[lo]) < 0 ? -1 : 1;
+exit:
+	g_free(busy);
+	g_free(elapsed);
+	g_free(loads);
 	return ret;
 }
 
@@ -447,7 +747,7 @@ int pg_thread_destroy(int16_t thread_id)
 {
 	if (unlikely(thread_id > threads_max || !thread_ids[thread_id]))
 		return -1;
-	enqueue(thread_id, PG_THREAD_QUIT, NULL);
+	thread_send(thread_id, PG_THREAD_QUIT, (union pg_thread_arg){0}, NULL);
 	rte_eal_wait_lcore(thread_id);
 	nb_thread_id_used -= 1;
 	g_free(thread_ids[thread_id]);
@@ -26,8 +26,12 @@
 
 #include "utils/bitmask.h"
 #include "utils/ip.h"
+#include "utils/network.h"
 #include "brick-int.h"
 
+/* number of possible UDP ports */
+#define UDP_FILTER_PORTS (UINT16_MAX + 1)
+
 struct pg_udp_filter_config {
 	enum pg_side to;
 	struct pg_udp_filter_info *ports;
@@ -37,74 +41,106 @@ struct pg_udp_filter_config {
 struct pg_udp_filter_state {
 	struct pg_brick brick;
 	enum pg_side to;
-	struct pg_udp_filter_info *filters;
-	int nb_filters;
+	/* edge of each port, indexed by network endian ports, 0 means that
+	 * no filter matches the port
+	 */
+	uint16_t *dst_ports;
+	uint16_t *src_ports;
 };
 
-struct header {
-	struct ether_hdr ethernet;
-	struct ipv4_hdr    ip;
-	struct udp_hdr   udp;
-}  __attribute__((__packed__));
+/**
+ * Find the UDP header of an ethernet frame, vlan tagged or not.
+ *
+ * @return	the UDP header, NULL for non UDP packets
+ */
+static inline struct udp_hdr *udp_filter_get_udp(struct rte_mbuf *pkt)
+{
+	struct ether_hdr *eth = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
+	uint16_t len = rte_pktmbuf_data_len(pkt);
+	uint16_t l3_off = sizeof(struct ether_hdr);
+	uint16_t type = eth->ether_type;
+	uint16_t l4_off;
+
+	if (unlikely(len < l3_off))
+		return NULL;
+	if (type == PG_BE_ETHER_TYPE_VLAN && len >= l3_off + 4) {
+		type = ((struct vlan_hdr *)(eth + 1))->eth_proto;
+		l3_off += sizeof(struct vlan_hdr);
+	}
+
+	if (type == PG_BE_ETHER_TYPE_IPv4 &&
+	    len >= l3_off + sizeof(struct ipv4_hdr)) {
+		struct ipv4_hdr *ip = (struct ipv4_hdr *)((uint8_t *)eth +
+							  l3_off);
+
+		if (ip->next_proto_id != PG_UDP_PROTOCOL_NUMBER)
+			return NULL;
+		/* only the first fragment has ports */
+		if (ip->fragment_offset & PG_CPU_TO_BE_16(IPV4_HDR_OFFSET_MASK))
+			return NULL;
+		l4_off = l3_off + (ip->version_ihl & IPV4_HDR_IHL_MASK) *
+			IPV4_IHL_MULTIPLIER;
+	} else if (type == PG_BE_ETHER_TYPE_IPv6 &&
+		   len >= l3_off + sizeof(struct ipv6_hdr)) {
+		struct ipv6_hdr *ip = (struct ipv6_hdr *)((uint8_t *)eth +
+							  l3_off);
+
+		if (ip->proto != PG_UDP_PROTOCOL_NUMBER)
+			return NULL;
+		l4_off = l3_off + sizeof(struct ipv6_hdr);
+	} else {
+		return NULL;
+	}
+
+	if (unlikely(len < l4_off + sizeof(struct udp_hdr)))
+		return NULL;
+	return (struct udp_hdr *)((uint8_t *)eth + l4_off);
+}
 
 static int udp_filter_burst(struct pg_brick *brick, enum pg_side from,
 			    uint16_t edge_index, struct rte_mbuf **pkts,
 			    uint64_t pkts_mask, struct pg_error **errp)
 {
-	int ret;
 	struct pg_udp_filter_state *state =
 		pg_brick_get_state(brick, struct pg_udp_filter_state);
 	struct pg_brick_side *s = &brick->sides[pg_flip_side(from)];
 	struct pg_brick_edge *edges = s->edges;
-	int nb_filters = state->nb_filters;
-	int nb_ports = nb_filters + 1;
-	struct pg_udp_filter_info *filters = state->filters;
-	/*
-	 * So it's a VLA,  but number of filters should be limited
-	 * As it's the packatgraph user that configure it,
-	 * If correctly configure we should never have stack overflow
-	 */
-	uint64_t port_mask[nb_ports];
+	uint16_t pkts_edge[PG_MAX_PKTS_BURST];
 
 	if (from == state->to)
 		return pg_brick_side_forward(s, from, pkts, pkts_mask, errp);
 
-	memset(port_mask, 0, nb_ports * sizeof(*port_mask));
-
 	/* came from filtered side, so no filters aply here */
 	PG_FOREACH_BIT(pkts_mask, i) {
-		struct rte_mbuf *pkt = pkts[i];
-		struct header *hdr = pg_packet_cast_data(pkt, struct header);
-
-		/* true mean default case */
-		if (hdr->ethernet.ether_type != PG_BE_ETHER_TYPE_IPv4 ||
-		    hdr->ip.next_proto_id != PG_UDP_PROTOCOL_NUMBER) {
-			port_mask[0] |= 1LLU << i;
-		}
+		struct udp_hdr *udp = udp_filter_get_udp(pkts[i]);
+		uint16_t dst_edge, src_edge;
 
-		for (int j = 0; j < nb_filters; ++j) {
-			uint32_t filter_flag = filters[j].flag;
-
-			if (filter_flag & PG_USP_FILTER_DST_PORT &&
-			    hdr->udp.dst_port == filters[j].udp_dst_port) {
-				port_mask[j + 1] |= 1LLU << i;
-				goto next;
-			}
-			if (filter_flag & PG_USP_FILTER_SRC_PORT &&
-			    hdr->udp.src_port == filters[j].udp_src_port) {
-				port_mask[j + 1] |= 1LLU << i;
-				goto next;
-			}
+		if (!udp) {
+			pkts_edge[i] = 0;
+			continue;
 		}
-		port_mask[0] |= 1LLU << i;
-next:;
+		/* the first matching filter wins, so the lowest edge */
+		dst_edge = state->dst_ports[udp->dst_port];
+		src_edge = state->src_ports[udp->src_port];
+		if (!dst_edge || (src_edge && src_edge < dst_edge))
+			dst_edge = src_edge;
+		pkts_edge[i] = dst_edge;
 	}
 
-	for (int i = 0; i < nb_ports; ++i) {
-		ret = pg_brick_burst(edges[i].link,
-				     from,
-				     edges[i].pair_index,
-				     pkts, port_mask[i], errp);
+	/* send packets going to the same edge in a single burst */
+	while (pkts_mask) {
+		uint16_t edge = pkts_edge[ctz64(pkts_mask)];
+		uint64_t edge_mask = 0;
+		int ret;
+
+		PG_FOREACH_BIT(pkts_mask, i) {
+			if (pkts_edge[i] == edge)
+				edge_mask |= ONE64 << i;
+		}
+		pkts_mask &= ~edge_mask;
+		ret = pg_brick_burst(edges[edge].link, from,
+				     edges[edge].pair_index,
+				     pkts, edge_mask, errp);
 		if (unlikely(ret < 0))
 			return ret;
 	}
@@ -124,16 +160,18 @@ static int udp_filter_init(struct pg_brick *brick,
 	/* initialize fast path */
 	brick->burst = udp_filter_burst;
 	s->to = fc->to;
-	s->filters = g_new(struct pg_udp_filter_info, nb_f);
-	/* let's store port as network endian */
-	for (int i = 0; i < nb_f; ++i) {
-		s->filters[i].flag = pts[i].flag;
-		s->filters[i].udp_src_port =
-			rte_cpu_to_be_16(pts[i].udp_src_port);
-		s->filters[i].udp_dst_port =
-			rte_cpu_to_be_16(pts[i].udp_dst_port);
+	s->dst_ports = g_new0(uint16_t, UDP_FILTER_PORTS);
+	s->src_ports = g_new0(uint16_t, UDP_FILTER_PORTS);
+	/* compile filters, the first filter matching a port keeps it */
+	for (int i = nb_f - 1; i >= 0; --i) {
+		/* let's index ports as network endian */
+		if (pts[i].flag & PG_USP_FILTER_DST_PORT)
+			s->dst_ports[rte_cpu_to_be_16(pts[i].udp_dst_port)] =
+				i + 1;
+		if (pts[i].flag & PG_USP_FILTER_SRC_PORT)
+			s->src_ports[rte_cpu_to_be_16(pts[i].udp_src_port)] =
+				i + 1;
 	}
-	s->nb_filters = nb_f;
 	return 0;
 }
 
@@ -185,7 +223,8 @@ static void udp_filter_destroy(struct pg_brick *brick,
 	struct  pg_udp_filter_state *state =
 		pg_brick_get_state(brick, struct pg_udp_filter_state);
 
-	g_free(state->filters);
+	g_free(state->dst_ports);
+	g_free(state->src_ports);
 }
 
 static struct pg_brick_ops udp_filter_ops = {
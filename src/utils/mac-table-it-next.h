@@ -34,8 +34,14 @@ pg_mac_table_iterator_init(struct pg_mac_table_iterator *it,
 	it->j = 0;
 	it->mj = 0;
 	it->mi = 0;
-	it->m0 = tbl->mask[0];
 	it->tbl = tbl;
+	if (pg_mac_table_is_compact(tbl)) {
+		it->i = pg_mac_table_compact_scan(tbl, 0);
+		if (it->i != UINT32_MAX)
+			MAC_TABLE_COMPACT_SETTER(&tbl->compact, it->i);
+		return;
+	}
+	it->m0 = tbl->mask[0];
 	if (unlikely(it->m0 & 1)) {
 		it->m1 = tbl->elems[0]->mask[0];
 		if (unlikely(it->m1 & 1)) {
@@ -78,6 +84,13 @@ MAC_TABLE_IT_NEXT(struct pg_mac_table_iterator *it)
 	int been_out = 0;
 	int mi = it->mi;
 
+	if (pg_mac_table_is_compact(ma)) {
+		it->i = pg_mac_table_compact_scan(ma, i + 1);
+		if (it->i != UINT32_MAX)
+			MAC_TABLE_COMPACT_SETTER(&ma->compact, it->i);
+		return;
+	}
+
 	for (;i < PG_MAC_TABLE_MASK_SIZE; m0 = ma->mask[++i]) {
 		for(;({mi = ctz64(m0); m0;});) {
 			struct ST *imt = ma->TARGET[i * 64 + mi];
@@ -118,5 +131,6 @@ MAC_TABLE_IT_NEXT(struct pg_mac_table_iterator *it)
 
 /* external args */
 #undef MAC_TABLE_SETTER
+#undef MAC_TABLE_COMPACT_SETTER
 #undef MAC_TABLE_IT_NEXT
 #undef MAC_TABLE_TYPE
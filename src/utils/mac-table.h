@@ -31,6 +31,14 @@
 
 #define PG_MAC_TABLE_MASK_SIZE (0xffffff / 64 + 1)
 
+/* a compact slot is either empty (0), a tombstone, or USED | 48 bits mac */
+#define PG_MAC_TABLE_COMPACT_USED (ONE64 << 63)
+#define PG_MAC_TABLE_COMPACT_TOMB (ONE64 << 62)
+#define PG_MAC_TABLE_COMPACT_KEY_MASK 0xffffffffffffLLU
+#define PG_MAC_TABLE_COMPACT_MAX_CAPACITY (1U << 30)
+/* 2^64 / golden ratio, used for fibonacci hashing */
+#define PG_MAC_TABLE_COMPACT_HASH_MUL 0x9e3779b97f4a7c15LLU
+
 struct pg_mac_table_ptr {
 	uint64_t mask[PG_MAC_TABLE_MASK_SIZE];
 	void **entries;
@@ -41,6 +49,27 @@ struct pg_mac_table_elem {
 	int8_t *entries;
 };
 
+/**
+ * Open addressing (linear probing) hash table used by compact mac tables.
+ * Keys are stored inline, so a lookup usually touches one cache line in
+ * keys and one in values.
+ * Deleted slots are marked with a tombstone, so unsetting an entry while
+ * iterating is safe; tombstones are purged on the next rebuild.
+ */
+struct pg_mac_table_compact {
+	uint64_t *keys;
+	union {
+		void **ptrs;
+		int8_t *elems;
+	} values;
+	uint32_t slots_mask;	/* number of slots - 1 */
+	uint32_t shift;		/* 64 - log2(number of slots) */
+	uint32_t nb;		/* used slots */
+	uint32_t nb_tombs;	/* tombstones */
+	uint32_t max_fill;	/* nb + nb_tombs that triggers a rebuild */
+	size_t elem_size;
+};
+
 /**
  * A mac array containing pointers or elements
  * the idea of this mac table, is that a mac is an unique identifier,
@@ -52,13 +81,20 @@ struct pg_mac_table_elem {
  * and "04.05.06" will serve as the index of the sub mac table
  * if order to take advantage of Virtual Memory, we use bitmask, so we
  * don't have to allocate 512 MB of physical ram for each unlucky mac.
+ *
+ * When created with pg_mac_table_init_compact, the table instead uses a
+ * struct pg_mac_table_compact bounded to a given number of entries.
+ * Once full, setting an unknown mac is silently ignored, so the caller
+ * behave like the mac was never learned.
  */
 struct pg_mac_table {
-	uint64_t mask[PG_MAC_TABLE_MASK_SIZE];
+	uint64_t *mask;
 	union {
 		struct pg_mac_table_ptr **ptrs;
 		struct pg_mac_table_elem **elems;
 	};
+	uint32_t capacity;	/* 0 for the 24/24 layout */
+	struct pg_mac_table_compact compact;
 	jmp_buf *exeption_env;
 };
 
@@ -107,15 +143,84 @@ static inline int pg_mac_table_init(struct pg_mac_table *ma,
 			     sizeof(struct pg_mac_table_ptr *));
 	if (!ma->ptrs)
 		return -1;
-	memset(ma->mask, 0, (PG_MAC_TABLE_MASK_SIZE) * sizeof(uint64_t));
+	/*
+	 * one more word is kept at 0, as iterating loops read the mask
+	 * after the last one before leaving.
+	 */
+	ma->mask = pg_malloc((PG_MAC_TABLE_MASK_SIZE + 1) * sizeof(uint64_t));
+	if (!ma->mask) {
+		free(ma->ptrs);
+		ma->ptrs = NULL;
+		return -1;
+	}
+	memset(ma->mask, 0, (PG_MAC_TABLE_MASK_SIZE + 1) * sizeof(uint64_t));
+	ma->capacity = 0;
 	ma->exeption_env = exeption_env;
 	return 0;
 }
 
+/**
+ * Init a mac table using the compact layout
+ *
+ * @param	ma the mac table
+ * @param	capacity maximum number of macs the table can hold, the
+ *		memory used is allocated here and never grows.
+ * @param	elem_size size of the elements stored with
+ *		pg_mac_table_elem_set, 0 for a table of pointers
+ * @param	exeption_env where to longjmp on allocation failure
+ * @return	0 on success, -1 on error
+ */
+static inline int pg_mac_table_init_compact(struct pg_mac_table *ma,
+					    uint32_t capacity,
+					    size_t elem_size,
+					    jmp_buf *exeption_env)
+{
+	struct pg_mac_table_compact *ct = &ma->compact;
+	uint32_t log2_slots = 3;
+	uint64_t nb_slots;
+
+	if (!capacity || capacity > PG_MAC_TABLE_COMPACT_MAX_CAPACITY)
+		return -1;
+	/* keep the load factor under 3/4 when the table is full */
+	while ((ONE64 << log2_slots) * 3 < (uint64_t)capacity * 4)
+		++log2_slots;
+	nb_slots = ONE64 << log2_slots;
+
+	ct->elem_size = elem_size ? elem_size : sizeof(void *);
+	ct->keys = pg_malloc(nb_slots * sizeof(uint64_t));
+	ct->values.elems = pg_malloc(nb_slots * ct->elem_size);
+	if (!ct->keys || !ct->values.elems) {
+		free(ct->keys);
+		free(ct->values.elems);
+		ct->keys = NULL;
+		ct->values.elems = NULL;
+		return -1;
+	}
+	memset(ct->keys, 0, nb_slots * sizeof(uint64_t));
+	ct->slots_mask = nb_slots - 1;
+	ct->shift = 64 - log2_slots;
+	ct->nb = 0;
+	ct->nb_tombs = 0;
+	ct->max_fill = nb_slots * 7 / 8;
+	ma->mask = NULL;
+	ma->ptrs = NULL;
+	ma->capacity = capacity;
+	ma->exeption_env = exeption_env;
+	return 0;
+}
+
+static inline int pg_mac_table_is_compact(struct pg_mac_table *ma)
+{
+	return !!ma->capacity;
+}
+
 static inline size_t pg_mac_table_compute_length(struct pg_mac_table *ma)
 {
 	size_t r = 0;
 
+	if (pg_mac_table_is_compact(ma))
+		return ma->compact.nb;
+
 	for (uint64_t i = 0, m = ma->mask[i];
 	     i < PG_MAC_TABLE_MASK_SIZE; m = ma->mask[++i]) {
 		PG_FOREACH_BIT(m, it) {
@@ -133,10 +238,24 @@ static inline size_t pg_mac_table_compute_length(struct pg_mac_table *ma)
 	return r;
 }
 
+static inline void pg_mac_table_compact_clear(struct pg_mac_table *ma)
+{
+	struct pg_mac_table_compact *ct = &ma->compact;
+
+	memset(ct->keys, 0,
+	       ((uint64_t)ct->slots_mask + 1) * sizeof(uint64_t));
+	ct->nb = 0;
+	ct->nb_tombs = 0;
+}
+
 static inline void pg_mac_table_clear(struct pg_mac_table *ma)
 {
 	if (unlikely(!ma))
 		return;
+	if (pg_mac_table_is_compact(ma)) {
+		pg_mac_table_compact_clear(ma);
+		return;
+	}
 	for (int i = 0; i < (PG_MAC_TABLE_MASK_SIZE); ++i) {
 		if (likely(!ma->mask[i]))
 			continue;
@@ -158,6 +277,13 @@ static inline void pg_mac_table_free(struct pg_mac_table *ma)
 {
 	if (unlikely(!ma))
 		return;
+	if (pg_mac_table_is_compact(ma)) {
+		free(ma->compact.keys);
+		free(ma->compact.values.elems);
+		ma->compact.keys = NULL;
+		ma->compact.values.elems = NULL;
+		return;
+	}
 	for (int i = 0; i < (PG_MAC_TABLE_MASK_SIZE); ++i) {
 		if (!ma->mask[i])
 			continue;
@@ -172,6 +298,8 @@ static inline void pg_mac_table_free(struct pg_mac_table *ma)
 		}
 	}
 	free(ma->ptrs);
+	free(ma->mask);
+	ma->mask = NULL;
 }
 
 #define pg_mac_table_part2(mac) (mac.part2 & 0x00ffffff)
@@ -187,6 +315,245 @@ static inline void pg_mac_table_alloc_fail_exeption(struct pg_mac_table *ma)
 	longjmp(*ma->exeption_env, 1);
 }
 
+#define pg_mac_table_compact_key(mac)				\
+	(((mac).mac & PG_MAC_TABLE_COMPACT_KEY_MASK) |		\
+	 PG_MAC_TABLE_COMPACT_USED)
+
+static inline uint32_t
+pg_mac_table_compact_hash(struct pg_mac_table_compact *ct, uint64_t key)
+{
+	return (key * PG_MAC_TABLE_COMPACT_HASH_MUL) >> ct->shift;
+}
+
+/**
+ * @return the slot of mac, UINT32_MAX if mac is not in the table
+ */
+static inline uint32_t
+pg_mac_table_compact_lookup(struct pg_mac_table_compact *ct, union pg_mac mac)
+{
+	uint64_t key = pg_mac_table_compact_key(mac);
+
+	for (uint32_t i = pg_mac_table_compact_hash(ct, key);;
+	     i = (i + 1) & ct->slots_mask) {
+		uint64_t cur = ct->keys[i];
+
+		if (cur == key)
+			return i;
+		if (!cur)
+			return UINT32_MAX;
+	}
+}
+
+/* rehash all entries in new arrays to get rid of tombstones */
+static inline void pg_mac_table_compact_rebuild(struct pg_mac_table *ma)
+{
+	struct pg_mac_table_compact *ct = &ma->compact;
+	uint64_t nb_slots = (uint64_t)ct->slots_mask + 1;
+	uint64_t *keys = pg_malloc(nb_slots * sizeof(uint64_t));
+	int8_t *elems = pg_malloc(nb_slots * ct->elem_size);
+
+	if (unlikely(!keys || !elems)) {
+		free(keys);
+		free(elems);
+		pg_mac_table_alloc_fail_exeption(ma);
+	}
+	memset(keys, 0, nb_slots * sizeof(uint64_t));
+	for (uint64_t i = 0; i < nb_slots; ++i) {
+		uint64_t key = ct->keys[i];
+		uint32_t j;
+
+		if (!(key & PG_MAC_TABLE_COMPACT_USED))
+			continue;
+		for (j = pg_mac_table_compact_hash(ct, key); keys[j];
+		     j = (j + 1) & ct->slots_mask)
+			;
+		keys[j] = key;
+		rte_memcpy(elems + j * ct->elem_size,
+			   ct->values.elems + i * ct->elem_size,
+			   ct->elem_size);
+	}
+	free(ct->keys);
+	free(ct->values.elems);
+	ct->keys = keys;
+	ct->values.elems = elems;
+	ct->nb_tombs = 0;
+}
+
+/**
+ * @return the slot of mac, inserting it if needed,
+ *	   UINT32_MAX if mac is new and the table is full
+ */
+static inline uint32_t pg_mac_table_compact_insert(struct pg_mac_table *ma,
+						   union pg_mac mac)
+{
+	struct pg_mac_table_compact *ct = &ma->compact;
+	uint64_t key = pg_mac_table_compact_key(mac);
+	uint32_t free_slot = UINT32_MAX;
+	uint32_t i;
+
+	for (i = pg_mac_table_compact_hash(ct, key);;
+	     i = (i + 1) & ct->slots_mask) {
+		uint64_t cur = ct->keys[i];
+
+		if (cur == key)
+			return i;
+		if (!cur)
+			break;
+		if (cur == PG_MAC_TABLE_COMPACT_TOMB &&
+		    free_slot == UINT32_MAX)
+			free_slot = i;
+	}
+
+	if (unlikely(ct->nb >= ma->capacity))
+		return UINT32_MAX;
+
+	if (free_slot != UINT32_MAX) {
+		--ct->nb_tombs;
+	} else if (unlikely(ct->nb + ct->nb_tombs >= ct->max_fill)) {
+		pg_mac_table_compact_rebuild(ma);
+		return pg_mac_table_compact_insert(ma, mac);
+	} else {
+		free_slot = i;
+	}
+	ct->keys[free_slot] = key;
+	++ct->nb;
+	return free_slot;
+}
+
+static inline void
+pg_mac_table_compact_unset_slot(struct pg_mac_table_compact *ct, uint32_t i)
+{
+	--ct->nb;
+	/* no probe sequence goes through i if the next slot is empty */
+	if (!ct->keys[(i + 1) & ct->slots_mask]) {
+		ct->keys[i] = 0;
+		return;
+	}
+	ct->keys[i] = PG_MAC_TABLE_COMPACT_TOMB;
+	++ct->nb_tombs;
+}
+
+static inline int pg_mac_table_compact_unset(struct pg_mac_table_compact *ct,
+					     union pg_mac mac)
+{
+	uint32_t i = pg_mac_table_compact_lookup(ct, mac);
+
+	if (i == UINT32_MAX)
+		return -1;
+	pg_mac_table_compact_unset_slot(ct, i);
+	return 0;
+}
+
+/**
+ * @return the first used slot from i, UINT32_MAX if there is none
+ */
+static inline uint32_t pg_mac_table_compact_scan(struct pg_mac_table *ma,
+						 uint32_t i)
+{
+	struct pg_mac_table_compact *ct = &ma->compact;
+
+	for (; i <= ct->slots_mask; ++i) {
+		if (ct->keys[i] & PG_MAC_TABLE_COMPACT_USED)
+			return i;
+	}
+	return UINT32_MAX;
+}
+
+/**
+ * Walk a compact table a few slots at a time, for background work
+ * (like aging) which must not stall the datapath with a full table walk.
+ * The walk wrap around at the end of the table.
+ *
+ * @param	ma a compact mac table
+ * @param	cursor slot where to start, updated to the next slot to look at
+ * @param	budget maximum number of slots to look at, decremented
+ * @return	a used slot, UINT32_MAX once the budget is exhausted
+ */
+static inline uint32_t pg_mac_table_compact_walk(struct pg_mac_table *ma,
+						 uint32_t *cursor,
+						 uint32_t *budget)
+{
+	struct pg_mac_table_compact *ct = &ma->compact;
+
+	while (*budget) {
+		uint32_t i = *cursor & ct->slots_mask;
+
+		--*budget;
+		*cursor = (i + 1) & ct->slots_mask;
+		if (ct->keys[i] & PG_MAC_TABLE_COMPACT_USED)
+			return i;
+	}
+	return UINT32_MAX;
+}
+
+/**
+ * Same as pg_mac_table_compact_walk, for the 24/24 layout.
+ * The budget is counted in mask words, so each step looks at 64 addresses.
+ *
+ * @param	ma a mac table using the 24/24 layout
+ * @param	cursor address where to start (part1 << 24 | part2), updated
+ * @param	budget maximum number of mask words to look at, decremented
+ * @param	mac set to the address found
+ * @return	1 if an address has been found, 0 once the budget is exhausted
+ */
+static inline int pg_mac_table_walk(struct pg_mac_table *ma,
+				    uint64_t *cursor, uint32_t *budget,
+				    union pg_mac *mac)
+{
+	while (*budget) {
+		uint32_t part1 = (*cursor >> 24) & 0xffffff;
+		uint32_t part2 = *cursor & 0xffffff;
+		uint64_t m;
+
+		--*budget;
+		if (!pg_mac_table_is_set(*ma, part1)) {
+			/* jump to the next used part1 of this mask word */
+			m = ma->mask[pg_mac_table_mask_idx(part1)] &
+				(~0LLU << pg_mac_table_mask_pos(part1));
+			part1 = m ? (part1 & ~63U) + ctz64(m) :
+				(part1 | 63) + 1;
+			*cursor = ((uint64_t)part1 << 24) & 0xffffffffffffLLU;
+			continue;
+		}
+		m = ma->elems[part1]->mask[pg_mac_table_mask_idx(part2)] &
+			(~0LLU << pg_mac_table_mask_pos(part2));
+		if (!m) {
+			*cursor = (((uint64_t)part1 << 24) | (part2 | 63)) + 1;
+			*cursor &= 0xffffffffffffLLU;
+			continue;
+		}
+		part2 = (part2 & ~63U) + ctz64(m);
+		*cursor = ((((uint64_t)part1 << 24) | part2) + 1) &
+			0xffffffffffffLLU;
+		mac->mac = 0;
+		mac->bytes32[0] = part1;
+		mac->part2 = part2;
+		return 1;
+	}
+	return 0;
+}
+
+static inline union pg_mac pg_mac_table_compact_key_at(struct pg_mac_table *ma,
+						       uint32_t slot)
+{
+	union pg_mac mac;
+
+	mac.mac = ma->compact.keys[slot] & PG_MAC_TABLE_COMPACT_KEY_MASK;
+	return mac;
+}
+
+static inline void *pg_mac_table_compact_elem_at(struct pg_mac_table *ma,
+						 uint32_t slot)
+{
+	return ma->compact.values.elems + slot * ma->compact.elem_size;
+}
+
+static inline void pg_mac_table_compact_unset_at(struct pg_mac_table *ma,
+						 uint32_t slot)
+{
+	pg_mac_table_compact_unset_slot(&ma->compact, slot);
+}
+
 static inline void pg_mac_table_elem_set(struct pg_mac_table *ma,
 					 union pg_mac mac, void *entry,
 					 size_t elem_size)
@@ -194,6 +561,18 @@ static inline void pg_mac_table_elem_set(struct pg_mac_table *ma,
 	uint32_t part1 = pg_mac_table_part1(mac);
 	uint32_t part2 = pg_mac_table_part2(mac);
 
+	if (pg_mac_table_is_compact(ma)) {
+		uint32_t slot = pg_mac_table_compact_insert(ma, mac);
+
+		assert(elem_size <= ma->compact.elem_size);
+		if (unlikely(slot == UINT32_MAX))
+			return;
+		rte_memcpy(ma->compact.values.elems +
+			   slot * ma->compact.elem_size,
+			   entry, elem_size);
+		return;
+	}
+
 	/* Part 1 is unset */
 	if (unlikely(!pg_mac_table_is_set(*ma, part1))) {
 		ma->elems[part1] = pg_malloc(sizeof(struct pg_mac_table_elem));
@@ -219,6 +598,14 @@ static inline void pg_mac_table_ptr_set(struct pg_mac_table *ma,
 	uint32_t part1 = pg_mac_table_part1(mac);
 	uint32_t part2 = pg_mac_table_part2(mac);
 
+	if (pg_mac_table_is_compact(ma)) {
+		uint32_t slot = pg_mac_table_compact_insert(ma, mac);
+
+		if (likely(slot != UINT32_MAX))
+			ma->compact.values.ptrs[slot] = entry;
+		return;
+	}
+
 	/* Part 1 is unset */
 	if (unlikely(!pg_mac_table_is_set(*ma, part1))) {
 		ma->ptrs[part1] = pg_malloc(sizeof(struct pg_mac_table_ptr));
@@ -243,6 +630,9 @@ static inline int pg_mac_table_ptr_unset(struct pg_mac_table *ma,
 	uint32_t part1 = pg_mac_table_part1(mac);
 	uint32_t part2 = pg_mac_table_part2(mac);
 
+	if (pg_mac_table_is_compact(ma))
+		return pg_mac_table_compact_unset(&ma->compact, mac);
+
 	if (!pg_mac_table_is_set(*ma, part1) ||
 	    !pg_mac_table_is_set(*ma->ptrs[part1], part2))
 		return -1;
@@ -256,6 +646,9 @@ static inline int pg_mac_table_elem_unset(struct pg_mac_table *ma,
 	uint32_t part1 = pg_mac_table_part1(mac);
 	uint32_t part2 = pg_mac_table_part2(mac);
 
+	if (pg_mac_table_is_compact(ma))
+		return pg_mac_table_compact_unset(&ma->compact, mac);
+
 	if (!pg_mac_table_is_set(*ma, part1) ||
 	    !pg_mac_table_is_set(*ma->elems[part1], part2))
 		return -1;
@@ -274,6 +667,14 @@ static inline void *pg_mac_table_elem_get_internal(struct pg_mac_table *ma,
 	uint32_t part1 = pg_mac_table_part1(mac);
 	uint32_t part2 = pg_mac_table_part2(mac);
 
+	if (pg_mac_table_is_compact(ma)) {
+		uint32_t slot = pg_mac_table_compact_lookup(&ma->compact, mac);
+
+		if (slot == UINT32_MAX)
+			return NULL;
+		return ma->compact.values.elems + slot * ma->compact.elem_size;
+	}
+
 	/* Part 1 is unset */
 	if (unlikely(!pg_mac_table_is_set(*ma, part1)))
 		return NULL;
@@ -288,6 +689,14 @@ static inline void *pg_mac_table_ptr_get(struct pg_mac_table *ma,
 	uint32_t part1 = pg_mac_table_part1(mac);
 	uint32_t part2 = pg_mac_table_part2(mac);
 
+	if (pg_mac_table_is_compact(ma)) {
+		uint32_t slot = pg_mac_table_compact_lookup(&ma->compact, mac);
+
+		if (slot == UINT32_MAX)
+			return NULL;
+		return ma->compact.values.ptrs[slot];
+	}
+
 	/* Part 1 is unset */
 	if (unlikely(!pg_mac_table_is_set(*ma, part1)))
 		return NULL;
@@ -299,10 +708,14 @@ static inline void *pg_mac_table_ptr_get(struct pg_mac_table *ma,
 #define MAC_TABLE_IT_NEXT pg_mac_table_iterator_e_next
 #define MAC_TABLE_TYPE elem
 #define MAC_TABLE_SETTER(inner_t, useless) (it->c_ptr = (inner_t)->entries);
+#define MAC_TABLE_COMPACT_SETTER(ct, slot)			\
+	(it->c_ptr = (ct)->values.elems + (slot) * (ct)->elem_size);
 
 #include "mac-table-it-next.h"
 
 #define MAC_TABLE_SETTER(inner_t, idx) (it->v_ptr = (inner_t)->entries[idx]);
+#define MAC_TABLE_COMPACT_SETTER(ct, slot)		\
+	(it->v_ptr = (ct)->values.ptrs[slot]);
 #define MAC_TABLE_TYPE ptr
 #define MAC_TABLE_IT_NEXT pg_mac_table_iterator_next
 
@@ -318,6 +731,11 @@ static inline union pg_mac
 pg_mac_table_iterator_mk_key(struct pg_mac_table_iterator *it,
 			     union pg_mac *k)
 {
+	if (pg_mac_table_is_compact(it->tbl)) {
+		k->mac = it->tbl->compact.keys[it->i] &
+			PG_MAC_TABLE_COMPACT_KEY_MASK;
+		return *k;
+	}
 	k->bytes32[0] = (it->i * 64) + it->mi;
 	k->part2 = (it->j * 64) + it->mj;
 	return *k;
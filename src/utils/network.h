@@ -25,6 +25,7 @@
 #include <rte_udp.h>
 #include <rte_tcp.h>
 #include <rte_ether.h>
+#include <rte_hash_crc.h>
 #include <endian.h>
 
 #include "utils/bitmask.h"
@@ -160,6 +161,64 @@ static inline void pg_utils_guess_l2(struct rte_mbuf *pkt)
 	}
 }
 
+/**
+ * Hash the flow of an ethernet frame: IP addresses, protocol and TCP/UDP
+ * ports, or ethernet addresses for non IP frames.
+ * Use crc32 instructions when the CPU has them.
+ *
+ * @param	pkt packet starting with an ethernet header
+ * @return	the flow hash
+ */
+static inline uint32_t pg_utils_flow_hash(struct rte_mbuf *pkt)
+{
+	struct ether_hdr *eth = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
+	uint16_t len = rte_pktmbuf_data_len(pkt);
+	uint16_t l3_off = sizeof(struct ether_hdr);
+	uint16_t type = eth->ether_type;
+	uint16_t l4_off;
+	uint32_t hash;
+	uint8_t proto;
+
+	if (unlikely(len < l3_off))
+		return 0;
+	if (type == PG_BE_ETHER_TYPE_VLAN && len >= l3_off + 4) {
+		type = ((struct vlan_hdr *)(eth + 1))->eth_proto;
+		l3_off += sizeof(struct vlan_hdr);
+	}
+
+	if (type == PG_BE_ETHER_TYPE_IPv4 &&
+	    len >= l3_off + sizeof(struct ipv4_hdr)) {
+		struct ipv4_hdr *ip = (struct ipv4_hdr *)((uint8_t *)eth +
+							  l3_off);
+
+		proto = ip->next_proto_id;
+		/* source and destination addresses are contiguous */
+		hash = rte_hash_crc_8byte(*(uint64_t *)&ip->src_addr, proto);
+		l4_off = l3_off + (ip->version_ihl & 0xf) * 4;
+		/* only the first fragment has ports */
+		if (ip->fragment_offset &
+		    PG_CPU_TO_BE_16(IPV4_HDR_OFFSET_MASK | IPV4_HDR_MF_FLAG))
+			return hash;
+	} else if (type == PG_BE_ETHER_TYPE_IPv6 &&
+		   len >= l3_off + sizeof(struct ipv6_hdr)) {
+		struct ipv6_hdr *ip = (struct ipv6_hdr *)((uint8_t *)eth +
+							  l3_off);
+
+		proto = ip->proto;
+		hash = rte_hash_crc(ip->src_addr, 32, proto);
+		l4_off = l3_off + sizeof(struct ipv6_hdr);
+	} else {
+		return rte_hash_crc(eth, 2 * ETHER_ADDR_LEN, type);
+	}
+
+	/* source and destination ports are the first 4 bytes of both */
+	if ((proto == IPPROTO_TCP || proto == IPPROTO_UDP) &&
+	    len >= l4_off + 4)
+		hash = rte_hash_crc_4byte(*(uint32_t *)((uint8_t *)eth +
+							l4_off), hash);
+	return hash;
+}
+
 static inline void pg_utils_guess_metadata(struct rte_mbuf *pkt)
 {
 	pg_utils_guess_l2(pkt);
@@ -56,18 +56,36 @@ struct headers {
 	struct vxlan_hdr vxlan; /* define in rte_ether.h */
 } __attribute__((__packed__));
 
-struct full_header {
+/**
+ * Ready to copy outer headers of a destination: only lengths, IP id,
+ * UDP source port and checksums change from one packet to another.
+ */
+struct outer_header {
 	struct ether_hdr ethernet; /* define in rte_ether.h */
 	struct headers outer;
-	struct eth_ip_l4 inner;
 } __attribute__((__packed__));
 
 struct dest_addresses {
 	struct ether_addr mac;
+	uint16_t remote;	/* index of the remote VTEP in port->remotes */
 	IP_TYPE ip;
 	uint64_t lifetime;
 };
 
+/* remote VTEP of a port, shared by all the MACs learned behind it */
+struct vtep_remote {
+	struct outer_header tmpl;
+	bool used;		/* a mac_to_dst entry may point to it */
+};
+
+#define VTEP_REMOTES_MAX (UINT16_MAX + 1)
+
+/* remote VTEP getting the BUM traffic of a VNI by head-end replication */
+struct vtep_flood_dst {
+	IP_TYPE ip;
+	struct outer_header tmpl;
+};
+
 struct vtep_config {
 	enum pg_side output;
 	struct ether_addr mac;
@@ -111,10 +129,27 @@ struct vtep_config {
 /* structure used to describe a port of the vtep */
 struct vtep_port {
 	uint32_t vni;		/* the VNI of this ethernet port */
-	IP_TYPE multicast_ip;
+	bool attached;		/* a VNI has been added to this port */
+	IP_TYPE multicast_ip;	/* unspecified if the VNI has no group */
+	struct outer_header multicast_tmpl;
 	struct pg_mac_table mac_to_dst;
+	struct vtep_remote *remotes;
+	uint32_t nb_remotes;	/* size of remotes, used or not */
 	struct pg_mac_table known_mac;	/* is the MAC adress on this port  */
 	int32_t dead_tables;
+	uint64_t burst_mask;	/* packets of the burst going to this port */
+	/* replaces multicast_ip if set, the group is left meanwhile */
+	struct vtep_flood_dst *flood;
+	uint16_t nb_flood;
+};
+
+/* port of free slots of the VNI index, VNI 0 being valid */
+#define VNI_INDEX_FREE UINT16_MAX
+
+/* VNI to port index hash, VNI are stored in network byte order */
+struct vtep_vni_slot {
+	uint32_t vni;
+	uint16_t port;
 };
 
 struct vtep_state {
@@ -130,6 +165,13 @@ struct vtep_state {
 	IP_TYPE ip; /* IP of the VTEP */
 	int64_t max_lifetime;
 	int64_t vtep_tick;
+	uint32_t mac_table_capacity;	/* 0 for the default layout */
+	enum pg_vtep_src_port_mode src_port_mode;
+	struct vtep_vni_slot *vni_index;
+	uint32_t vni_index_mask;
+	/* encapsulated packets are staged until the end of the poll */
+	bool deferred;
+	struct pg_brick_stage stage;
 	jmp_buf exeption_env;
 };
 
@@ -138,14 +180,68 @@ static inline int are_mac_tables_dead(struct vtep_port *port)
 	return port->dead_tables & (IS_MAC_TO_DST_DEAD | IS_KNOWN_MAC_DEAD);
 }
 
-static inline void ip6_build(struct vtep_state *state,
-			     struct ipv6_hdr *restrict ip_hdr,
+static inline uint32_t vni_index_hash(struct vtep_state *state, uint32_t vni)
+{
+	return (vni * 0x9e3779b1U) & state->vni_index_mask;
+}
+
+/**
+ * @return	the index of the port using this VNI, -1 if there is none
+ */
+static inline int vni_index_lookup(struct vtep_state *state, uint32_t vni)
+{
+	struct vtep_vni_slot *index = state->vni_index;
+
+	for (uint32_t i = vni_index_hash(state, vni);;
+	     i = (i + 1) & state->vni_index_mask) {
+		if (index[i].port == VNI_INDEX_FREE)
+			return -1;
+		if (index[i].vni == vni)
+			return index[i].port;
+	}
+}
+
+static void vni_index_alloc(struct vtep_state *state, uint16_t nb_ports)
+{
+	uint32_t size = 2;
+
+	/* keep at least half of the slots free so probing stays short */
+	while (size < 2U * nb_ports)
+		size <<= 1;
+	state->vni_index = g_new0(struct vtep_vni_slot, size);
+	state->vni_index_mask = size - 1;
+	for (uint32_t i = 0; i < size; ++i)
+		state->vni_index[i].port = VNI_INDEX_FREE;
+}
+
+/* called each time a VNI is added or removed, the first port wins */
+static void vni_index_rebuild(struct vtep_state *state, uint16_t nb_ports)
+{
+	struct vtep_vni_slot *index = state->vni_index;
+
+	for (uint32_t i = 0; i <= state->vni_index_mask; ++i)
+		index[i].port = VNI_INDEX_FREE;
+	for (uint16_t p = 0; p < nb_ports; ++p) {
+		uint32_t vni = state->ports[p].vni;
+		uint32_t i;
+
+		if (!state->ports[p].attached ||
+		    vni_index_lookup(state, vni) >= 0)
+			continue;
+		for (i = vni_index_hash(state, vni);
+		     index[i].port != VNI_INDEX_FREE;
+		     i = (i + 1) & state->vni_index_mask)
+			;
+		index[i].vni = vni;
+		index[i].port = p;
+	}
+}
+
+static inline void ip6_build(struct ipv6_hdr *restrict ip_hdr,
 			     union pg_ipv6_addr src_ip,
-			     union pg_ipv6_addr dst_ip,
-			     uint16_t pkt_len)
+			     union pg_ipv6_addr dst_ip)
 {
 	ip_hdr->vtc_flow = PG_CPU_TO_BE_32(6 << 28);
-	ip_hdr->payload_len = rte_cpu_to_be_16(pkt_len);
 	ip_hdr->proto = PG_UDP_PROTOCOL_NUMBER;
 	ip_hdr->hop_limits = 0xff;
 
@@ -154,31 +250,49 @@ static inline void ip6_build(struct vtep_state *state,
 	pg_ip_copy(dst_ip, ip_hdr->dst_addr);
 }
 
-static inline void ip4_build(struct vtep_state *state,
-			     struct ipv4_hdr *restrict ip_hdr,
-			     uint32_t src_ip, uint32_t dst_ip,
-			     uint16_t datagram_len)
+static inline void ip4_build(struct ipv4_hdr *restrict ip_hdr,
+			     uint32_t src_ip, uint32_t dst_ip)
 {
-	uint16_t total_length = rte_cpu_to_be_16(datagram_len);
-
 	ip_hdr->version_ihl = 0x45;
 	ip_hdr->type_of_service = 0;
-	ip_hdr->total_length = total_length;
-	state->packet_id += 1;
-	ip_hdr->packet_id = state->packet_id;
 	ip_hdr->time_to_live = 64;
 	ip_hdr->fragment_offset = 0;
 	ip_hdr->next_proto_id = PG_UDP_PROTOCOL_NUMBER;
 	ip_hdr->src_addr = src_ip;
 	ip_hdr->dst_addr = dst_ip;
-	ip_hdr->hdr_checksum = pg_ipv4_udp_cksum(state->sum, total_length,
-						 state->packet_id, dst_ip);
 }
 
-#define ip_build(state, ip_hdr, src_ip, dst_ip, len)		\
+/* build the constant part of the IP header, see ip_set_len */
+#define ip_build(ip_hdr, src_ip, dst_ip)			\
 	(_Generic((ip_hdr), struct ipv4_hdr * : ip4_build,	\
 		 struct ipv6_hdr * : ip6_build)			\
-	 (state, ip_hdr, src_ip, dst_ip, len))
+	 (ip_hdr, src_ip, dst_ip))
+
+static inline void ip6_set_len(struct vtep_state *state,
+			       struct ipv6_hdr *restrict ip_hdr,
+			       uint16_t pkt_len)
+{
+	ip_hdr->payload_len = rte_cpu_to_be_16(pkt_len);
+}
+
+static inline void ip4_set_len(struct vtep_state *state,
+			       struct ipv4_hdr *restrict ip_hdr,
+			       uint16_t datagram_len)
+{
+	uint16_t total_length = rte_cpu_to_be_16(datagram_len);
+
+	ip_hdr->total_length = total_length;
+	state->packet_id += 1;
+	ip_hdr->packet_id = state->packet_id;
+	ip_hdr->hdr_checksum = pg_ipv4_udp_cksum(state->sum, total_length,
+						 state->packet_id,
+						 ip_hdr->dst_addr);
+}
+
+#define ip_set_len(state, ip_hdr, len)				\
+	(_Generic((ip_hdr), struct ipv4_hdr * : ip4_set_len,	\
+		 struct ipv6_hdr * : ip6_set_len)		\
+	 (state, ip_hdr, len))
 
 /**
  * Build the VXLAN header
@@ -213,6 +327,34 @@ static inline uint16_t src_port_compute(uint16_t seed)
 	return (seed & UDP_PORT_RANGE) + UDP_MIN_PORT;
 }
 
+/**
+ * Get the seed of the UDP source port of a packet to encapsulate
+ *
+ * @param	state the vtep
+ * @param	pkt the packet, not yet encapsulated
+ * @return	a seed for src_port_compute
+ */
+static inline uint16_t src_port_seed(struct vtep_state *state,
+				     struct rte_mbuf *pkt)
+{
+	uint32_t hash;
+
+	switch (state->src_port_mode) {
+	case PG_VTEP_SRC_PORT_FIXED:
+		return 0;
+	case PG_VTEP_SRC_PORT_FLOW_HASH:
+		if (pkt->ol_flags & PKT_RX_RSS_HASH) {
+			hash = pkt->hash.rss;
+			break;
+		}
+		/* fall through */
+	default:
+		hash = pg_utils_flow_hash(pkt);
+		break;
+	}
+	return hash ^ (hash >> 16);
+}
+
 /**
  * Build the UDP header
  *
@@ -238,16 +380,13 @@ static inline void udp_build_cksum(struct ip_hdr *restrict ip,
 #endif
 }
 
-static inline void udp_build(struct udp_hdr *restrict udp_hdr,
-			     uint16_t udp_dst_port,
-			     uint16_t datagram_len,
-			     uint16_t seed)
+/* set the per packet fields of an UDP header copied from a template */
+static inline void udp_set_len(struct udp_hdr *restrict udp_hdr,
+			       uint16_t datagram_len,
+			       uint16_t seed)
 {
 	udp_hdr->src_port = rte_cpu_to_be_16(src_port_compute(seed));
-	udp_hdr->dst_port = udp_dst_port;
 	udp_hdr->dgram_len = rte_cpu_to_be_16(datagram_len);
-	/* UDP checksum SHOULD be transmited as zero */
-	udp_hdr->dgram_cksum = 0;
 }
 
 /**
@@ -269,6 +408,30 @@ static inline void ethernet_build(struct ether_hdr *restrict eth_hdr,
 	eth_hdr->ether_type = PG_BE_ETHER_TYPE_IP;
 }
 
+/**
+ * Build the outer headers template of a destination
+ *
+ * @param	state the vtep
+ * @param	tmpl the template to fill
+ * @param	vni VNI in network byte order
+ * @param	dst_mac destination MAC address
+ * @param	dst_ip destination IP
+ */
+static inline void outer_header_build(struct vtep_state *state,
+				      struct outer_header *tmpl,
+				      uint32_t vni,
+				      struct ether_addr *dst_mac,
+				      IP_TYPE dst_ip)
+{
+	memset(tmpl, 0, sizeof(struct outer_header));
+	ethernet_build(&tmpl->ethernet, &state->mac, dst_mac);
+	ip_build(&tmpl->outer.ip, state->ip, dst_ip);
+	tmpl->outer.udp.dst_port = state->udp_dst_port_be;
+	/* UDP checksum SHOULD be transmited as zero */
+	tmpl->outer.udp.dgram_cksum = 0;
+	vxlan_build(&tmpl->outer.vxlan, vni);
+}
+
 static inline uint16_t udp_overhead(void)
 {
 	return sizeof(struct vxlan_hdr) + sizeof(struct udp_hdr);
@@ -282,6 +445,59 @@ static inline uint16_t ip_overhead(void)
 
 static inline void do_add_mac(struct vtep_port *port, struct ether_addr *mac);
 
+/**
+ * Copy outer headers from a template and set their per packet fields
+ *
+ * @param	state the vtep
+ * @param	outer_header where to write the outer headers
+ * @param	tmpl template of the destination
+ * @param	packet_len length of the encapsulated frame
+ * @param	seed seed for udp src port building
+ */
+static inline void outer_header_fill(struct vtep_state *state,
+				     struct outer_header *outer_header,
+				     struct outer_header *tmpl,
+				     uint16_t packet_len, uint16_t seed)
+{
+	struct headers *headers = &outer_header->outer;
+
+	rte_memcpy(outer_header, tmpl, HEADER_LENGTH);
+	ip_set_len(state, &headers->ip, packet_len + ip_overhead());
+	/*
+	 * It is recommended to have UDP source port randomized to be
+	 * ECMP/load-balancing friendly (RFC 7348). Let's use a hash of the
+	 * inner flow.
+	 */
+	if (unlikely(state->flags & PG_VTEP_FORCE_UPD_IPV6_CHECKSUM)) {
+		udp_build_cksum(&headers->ip, &headers->udp,
+				state->udp_dst_port_be,
+				packet_len + udp_overhead(), seed);
+	} else {
+		udp_set_len(&headers->udp, packet_len + udp_overhead(), seed);
+	}
+}
+
+/**
+ * Set offload informations of an encapsulated packet
+ *
+ * @param	head first segment of the encapsulated packet
+ * @param	pkt the inner packet
+ */
+static inline void outer_offload_set(struct rte_mbuf *head,
+				     struct rte_mbuf *pkt)
+{
+	head->l2_len = HEADER_LENGTH + sizeof(struct ether_hdr);
+
+	if (unlikely(pkt->udata64 & PG_FRAGMENTED_MBUF)) {
+		head->l2_len = sizeof(struct ether_hdr);
+		head->l3_len = sizeof(struct ipv4_hdr);
+		head->ol_flags |= PKT_TX_UDP_CKSUM;
+	} else if (pkt->ol_flags & PKT_TX_TCP_SEG) {
+		head->ol_flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM |
+			PKT_TX_TCP_CKSUM | PKT_TX_TCP_SEG;
+	}
+}
+
 static inline int vtep_header_prepend(struct vtep_state *state,
 				      struct rte_mbuf *pkt,
 				      struct vtep_port *port,
@@ -291,75 +507,50 @@ static inline int vtep_header_prepend(struct vtep_state *state,
 {
 	struct ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
 	uint16_t packet_len = rte_pktmbuf_data_len(pkt);
-	struct full_header *full_header;
-	struct headers *headers;
-	struct ether_hdr *ethernet;
-
-	full_header =
-		(struct full_header *)rte_pktmbuf_prepend(pkt, HEADER_LENGTH);
-	if (unlikely(!full_header)) {
-		*errp = pg_error_new("%s on a packet of %ld/%d",
-				     "No enough headroom to add VTEP headers",
-				     HEADER_LENGTH, pkt->pkt_len);
-		return -1;
-	}
-
-	ethernet = &full_header->ethernet;
-	headers = &full_header->outer;
-	vxlan_build(&headers->vxlan, port->vni);
+	uint16_t seed = src_port_seed(state, pkt);
+	struct outer_header *outer_header;
+	struct outer_header *tmpl;
 
 	/* select destination IP and MAC address */
 	if (likely(unicast)) {
 		entry->lifetime = state->vtep_tick;
-		ethernet_build(ethernet, &state->mac, &entry->mac);
-		ip_build(state, &headers->ip, state->ip, entry->ip,
-			 packet_len + ip_overhead());
+		tmpl = &port->remotes[entry->remote].tmpl;
 	} else {
-		struct ether_addr dst =
-			pg_multicast_get_dst_addr(port->multicast_ip);
-
 		if (!(state->flags & PG_VTEP_NO_INNERMAC_CHECK))
 			do_add_mac(port, &eth_hdr->s_addr);
-		ethernet_build(ethernet, &state->mac, &dst);
-		ip_build(state, &headers->ip, state->ip, port->multicast_ip,
-			 packet_len + ip_overhead());
-	}
-	/*
-	 * It is recommended to have UDP source port randomized to be
-	 * ECMP/load-balancing friendly. Let's use computed hash from
-	 * IP header.
-	 */
-	if (unlikely(state->flags & PG_VTEP_FORCE_UPD_IPV6_CHECKSUM)) {
-		udp_build_cksum(&headers->ip, &headers->udp,
-				state->udp_dst_port_be,
-				packet_len + udp_overhead(),
-				((uint16_t *)pkt)[0]);
-	} else {
-		udp_build(&headers->udp, state->udp_dst_port_be,
-			  packet_len + udp_overhead(), ((uint16_t *)pkt)[0]);
+		tmpl = &port->multicast_tmpl;
 	}
 
-	pkt->l2_len = HEADER_LENGTH + sizeof(struct ether_hdr);
-
-	if (unlikely(pkt->udata64 & PG_FRAGMENTED_MBUF)) {
-		pkt->l2_len = sizeof(struct ether_hdr);
-		pkt->l3_len = sizeof(struct ipv4_hdr);
-		pkt->ol_flags |= PKT_TX_UDP_CKSUM;
-	} else if (pkt->ol_flags & PKT_TX_TCP_SEG) {
-		pkt->ol_flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM |
-			PKT_TX_TCP_CKSUM | PKT_TX_TCP_SEG;
+	outer_header =
+		(struct outer_header *)rte_pktmbuf_prepend(pkt, HEADER_LENGTH);
+	if (unlikely(!outer_header)) {
+		*errp = pg_error_new("%s on a packet of %ld/%d",
+				     "No enough headroom to add VTEP headers",
+				     HEADER_LENGTH, pkt->pkt_len);
+		return -1;
 	}
 
+	outer_header_fill(state, outer_header, tmpl, packet_len, seed);
+	outer_offload_set(pkt, pkt);
 	return 0;
 }
 
+/**
+ * Encapsulate packets of a port in state->pkts
+ *
+ * @param	flood_mask set to the BUM packets left to vtep_flood
+ * @return	0 on success, -1 on error
+ */
 static inline int vtep_encapsulate(struct vtep_state *state,
 				   struct vtep_port *port,
 				   struct rte_mbuf **pkts, uint64_t pkts_mask,
+				   uint64_t *flood_mask,
 				   struct pg_error **errp)
 {
 	struct rte_mempool *mp = pg_get_mempool();
 
+	*flood_mask = 0;
+
 	/* do the encapsulation */
 	for (; pkts_mask;) {
 		struct dest_addresses *entry = NULL;
@@ -388,6 +579,20 @@ static inline int vtep_encapsulate(struct vtep_state *state,
 				unicast = 0;
 		}
 
+		/*
+		 * BUM packets are replicated later to each flood destination,
+		 * without flood list nor group there is none
+		 */
+		if (!unicast && (port->nb_flood ||
+				 !pg_is_multicast_ip(port->multicast_ip))) {
+			if (!(state->flags & PG_VTEP_NO_INNERMAC_CHECK))
+				do_add_mac(port,
+					   pg_util_get_ether_src_addr(pkt));
+			state->pkts[i] = NULL;
+			*flood_mask |= ONE64 << i;
+			continue;
+		}
+
 		if (unlikely(!(state->flags & PG_VTEP_NO_COPY))) {
 			tmp = rte_pktmbuf_clone(pkt, mp);
 			if (unlikely(!tmp))
@@ -410,13 +615,162 @@ static inline int vtep_encapsulate(struct vtep_state *state,
 	return 0;
 }
 
+#if IP_VERSION == 6
+/* UDP checksum of a replica, the payload being in another segment */
+static inline void udp_replica_cksum(struct ip_hdr *ip,
+				     struct udp_hdr *udp_hdr,
+				     uint32_t payload_sum)
+{
+	uint32_t sum = rte_ipv6_phdr_cksum(ip, 0);
+	uint16_t cksum;
+
+	sum += rte_raw_cksum(udp_hdr, udp_overhead()) + payload_sum;
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	cksum = ~sum;
+	udp_hdr->dgram_cksum = cksum ? cksum : 0xffff;
+}
+#endif
+
+/**
+ * Build a replica of a BUM packet: a small mbuf holding the outer headers
+ * chained to an indirect mbuf sharing the payload of the original packet.
+ *
+ * @return	the replica, NULL if the mempool is empty
+ */
+static inline struct rte_mbuf *vtep_replica_new(struct vtep_state *state,
+						struct rte_mempool *mp,
+						struct rte_mbuf *pkt,
+						struct outer_header *tmpl,
+						uint16_t seed,
+						uint32_t payload_sum)
+{
+	uint16_t packet_len = rte_pktmbuf_pkt_len(pkt);
+	struct outer_header *outer_header;
+	struct rte_mbuf *payload;
+	struct rte_mbuf *head;
+
+	head = rte_pktmbuf_alloc(mp);
+	if (unlikely(!head))
+		return NULL;
+	payload = rte_pktmbuf_clone(pkt, mp);
+	if (unlikely(!payload))
+		goto free_head;
+	outer_header = (struct outer_header *)
+		rte_pktmbuf_append(head, HEADER_LENGTH);
+	if (unlikely(!outer_header || rte_pktmbuf_chain(head, payload)))
+		goto free_payload;
+
+	rte_memcpy(outer_header, tmpl, HEADER_LENGTH);
+	ip_set_len(state, &outer_header->outer.ip,
+		   packet_len + ip_overhead());
+	udp_set_len(&outer_header->outer.udp, packet_len + udp_overhead(),
+		    seed);
+#if IP_VERSION == 6
+	if (unlikely(state->flags & PG_VTEP_FORCE_UPD_IPV6_CHECKSUM))
+		udp_replica_cksum(&outer_header->outer.ip,
+				  &outer_header->outer.udp, payload_sum);
+#endif
+
+	head->udata64 = pkt->udata64;
+	head->tx_offload = pkt->tx_offload;
+	head->ol_flags = pkt->ol_flags & PKT_TX_OFFLOAD_MASK;
+	outer_offload_set(head, pkt);
+	return head;
+free_payload:
+	rte_pktmbuf_free(payload);
+free_head:
+	rte_pktmbuf_free(head);
+	return NULL;
+}
+
+/* send encapsulated packets to the output edge, or stage them */
+static inline int vtep_output(struct vtep_state *state,
+			      struct pg_brick_side *s, enum pg_side from,
+			      struct rte_mbuf **pkts, uint64_t pkts_mask,
+			      struct pg_error **errp)
+{
+	if (likely(!state->deferred))
+		return pg_brick_side_forward(s, from, pkts, pkts_mask, errp);
+	if (unlikely(pg_brick_stage_burst(&state->stage, &s->edges[0], from,
+					  pkts, pkts_mask, errp) < 0))
+		return -1;
+	return 0;
+}
+
+/**
+ * Head-end replication: send a copy of BUM packets to each remote VTEP of
+ * the flood list, one burst per destination. Only outer headers are
+ * allocated, payloads are shared between replicas.
+ *
+ * @return	0 on success, -1 on error
+ */
+static inline int vtep_flood(struct vtep_state *state,
+			     struct vtep_port *port,
+			     struct pg_brick_side *s, enum pg_side from,
+			     struct rte_mbuf **pkts, uint64_t flood_mask,
+			     struct pg_error **errp)
+{
+	struct rte_mempool *mp = pg_get_mempool();
+	uint32_t payload_sums[64];
+	uint16_t seeds[64];
+
+	PG_FOREACH_BIT(flood_mask, i) {
+		uint16_t sum = 0;
+
+		seeds[i] = src_port_seed(state, pkts[i]);
+		/* inner frames may be chained, sum all their segments */
+		if (IP_VERSION == 6 &&
+		    unlikely(state->flags & PG_VTEP_FORCE_UPD_IPV6_CHECKSUM))
+			rte_raw_cksum_mbuf(pkts[i], 0,
+					   rte_pktmbuf_pkt_len(pkts[i]), &sum);
+		payload_sums[i] = sum;
+	}
+
+	for (uint16_t d = 0; d < port->nb_flood; ++d) {
+		struct outer_header *tmpl = &port->flood[d].tmpl;
+		uint64_t built = 0;
+		int ret;
+
+		PG_FOREACH_BIT(flood_mask, i) {
+			state->pkts[i] = vtep_replica_new(state, mp, pkts[i],
+							  tmpl, seeds[i],
+							  payload_sums[i]);
+			if (unlikely(!state->pkts[i])) {
+				pg_packets_free(state->pkts, built);
+				*errp = pg_error_new_errno(ENOMEM,
+							   "out of mbufs");
+				return -1;
+			}
+			built |= ONE64 << i;
+		}
+		ret = vtep_output(state, s, from, state->pkts, flood_mask,
+				  errp);
+		pg_packets_free(state->pkts, flood_mask);
+		if (unlikely(ret < 0))
+			return -1;
+	}
+	return 0;
+}
+
+static inline int vtep_mac_table_init(struct vtep_state *state,
+				      struct pg_mac_table *ma,
+				      size_t elem_size)
+{
+	if (state->mac_table_capacity)
+		return pg_mac_table_init_compact(ma, state->mac_table_capacity,
+						 elem_size,
+						 &state->exeption_env);
+	return pg_mac_table_init(ma, &state->exeption_env);
+}
+
 static inline int try_fix_tables(struct vtep_state *state,
 				 struct vtep_port *port,
 				 struct pg_error **errp)
 {
 	if (port->dead_tables & IS_MAC_TO_DST_DEAD) {
-		if (pg_mac_table_init(&port->mac_to_dst,
-				      &state->exeption_env) < 0) {
+		if (vtep_mac_table_init(state, &port->mac_to_dst,
+					sizeof(struct dest_addresses)) < 0) {
 			*errp = pg_error_new_errno(ENOMEM, "out of memory");
 			return -1;
 		}
@@ -424,8 +778,7 @@ static inline int try_fix_tables(struct vtep_state *state,
 	}
 
 	if (port->dead_tables & IS_KNOWN_MAC_DEAD) {
-		if (pg_mac_table_init(&port->known_mac,
-				      &state->exeption_env)  < 0) {
+		if (vtep_mac_table_init(state, &port->known_mac, 0) < 0) {
 			*errp = pg_error_new_errno(ENOMEM, "out of memory");
 			return -1;
 		}
@@ -442,6 +795,8 @@ static inline int to_vtep(struct pg_brick *brick, enum pg_side from,
 	struct vtep_state *state = pg_brick_get_state(brick, struct vtep_state);
 	struct pg_brick_side *s = &brick->sides[pg_flip_side(from)];
 	struct vtep_port *port = &state->ports[edge_index];
+	uint64_t unicast_mask;
+	uint64_t flood_mask;
 	int ret;
 
 	if (unlikely(!(state->flags & PG_VTEP_NO_INNERMAC_CHECK))) {
@@ -460,16 +815,100 @@ static inline int to_vtep(struct pg_brick *brick, enum pg_side from,
 		     try_fix_tables(state, port, errp) < 0))
 		return -1;
 	/* if the port VNI is not set up ignore the packets */
-	if (unlikely(!pg_is_multicast_ip(port->multicast_ip)))
+	if (unlikely(!port->attached))
 		return 0;
 
-	if (unlikely(vtep_encapsulate(state, port, pkts, pkts_mask, errp) < 0))
+	if (unlikely(vtep_encapsulate(state, port, pkts, pkts_mask,
+				      &flood_mask, errp) < 0))
 		return -1;
 
-	ret = pg_brick_side_forward(s, from, state->pkts, pkts_mask, errp);
-	if (!(state->flags & PG_VTEP_NO_COPY))
-		pg_packets_free(state->pkts, pkts_mask);
-	return ret;
+	if (likely(!flood_mask)) {
+		ret = vtep_output(state, s, from, state->pkts, pkts_mask,
+				  errp);
+		if (!(state->flags & PG_VTEP_NO_COPY))
+			pg_packets_free(state->pkts, pkts_mask);
+		return ret;
+	}
+
+	unicast_mask = pkts_mask & ~flood_mask;
+	if (unicast_mask) {
+		ret = vtep_output(state, s, from, state->pkts, unicast_mask,
+				  errp);
+		if (!(state->flags & PG_VTEP_NO_COPY))
+			pg_packets_free(state->pkts, unicast_mask);
+		if (unlikely(ret < 0))
+			return ret;
+	}
+	return vtep_flood(state, port, s, from, pkts, flood_mask, errp);
+}
+
+/* mark the remote VTEPs still pointed by mac_to_dst, the others are free */
+static void vtep_remotes_collect(struct vtep_port *port)
+{
+	for (uint32_t i = 0; i < port->nb_remotes; ++i)
+		port->remotes[i].used = false;
+	PG_MAC_TABLE_FOREACH_ELEM(&port->mac_to_dst, key,
+				  struct dest_addresses, da) {
+		port->remotes[da->remote].used = true;
+	}
+}
+
+static int vtep_remote_lookup(struct vtep_port *port,
+			      struct ether_addr *mac, IP_TYPE *ip,
+			      int *free_slot)
+{
+	*free_slot = -1;
+	for (uint32_t i = 0; i < port->nb_remotes; ++i) {
+		struct outer_header *tmpl = &port->remotes[i].tmpl;
+
+		if (!port->remotes[i].used) {
+			if (*free_slot < 0)
+				*free_slot = i;
+			continue;
+		}
+		if (is_same_ether_addr(&tmpl->ethernet.d_addr, mac) &&
+		    !memcmp(&tmpl->outer.ip.dst_addr, ip, sizeof(IP_TYPE)))
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * Find or create the remote VTEP of a learned destination
+ *
+ * @return	index of the remote in port->remotes, -1 if they are all used
+ */
+static int vtep_remote_get(struct vtep_state *state, struct vtep_port *port,
+			   struct ether_addr *mac, IP_TYPE ip)
+{
+	int free_slot;
+	int i;
+
+	i = vtep_remote_lookup(port, mac, &ip, &free_slot);
+	if (i >= 0)
+		return i;
+	if (free_slot < 0) {
+		vtep_remotes_collect(port);
+		i = vtep_remote_lookup(port, mac, &ip, &free_slot);
+		if (i >= 0)
+			return i;
+	}
+	if (free_slot < 0) {
+		uint32_t size = port->nb_remotes ? port->nb_remotes * 2 : 8;
+
+		if (port->nb_remotes == VTEP_REMOTES_MAX)
+			return -1;
+		port->remotes = g_renew(struct vtep_remote, port->remotes,
+					size);
+		memset(&port->remotes[port->nb_remotes], 0,
+		       (size - port->nb_remotes) * sizeof(struct vtep_remote));
+		free_slot = port->nb_remotes;
+		port->nb_remotes = size;
+	}
+	outer_header_build(state, &port->remotes[free_slot].tmpl, port->vni,
+			   mac, ip);
+	port->remotes[free_slot].used = true;
+	return free_slot;
 }
 
 static inline void add_dst_iner_macs(struct vtep_state *state,
@@ -491,7 +930,9 @@ static inline void add_dst_iner_macs(struct vtep_state *state,
 	for (mask = multicast_mask; mask;) {
 		int i;
 		struct dest_addresses dst;
+		struct dest_addresses *entry;
 		struct ether_hdr *pkt_addr;
+		int remote;
 
 		pg_low_bit_iterate_full(mask, bit, i);
 
@@ -503,6 +944,21 @@ static inline void add_dst_iner_macs(struct vtep_state *state,
 		pg_ip_copy(hdrs[i]->ip.src_addr, &dst.ip);
 #endif
 		rte_memcpy(tmp.bytes, &pkt_addr->s_addr.addr_bytes, 6);
+
+		/* known destination, keep its remote VTEP */
+		entry = pg_mac_table_elem_get(&port->mac_to_dst, tmp,
+					      struct dest_addresses);
+		if (entry && is_same_ether_addr(&entry->mac, &dst.mac) &&
+		    !memcmp(&entry->ip, &dst.ip, sizeof(IP_TYPE))) {
+			entry->lifetime = state->vtep_tick;
+			continue;
+		}
+
+		/* too many remote VTEPs, the MAC stays unknown */
+		remote = vtep_remote_get(state, port, &dst.mac, dst.ip);
+		if (unlikely(remote < 0))
+			continue;
+		dst.remote = remote;
 		dst.lifetime = state->vtep_tick;
 		pg_mac_table_elem_set(&port->mac_to_dst, tmp, &dst,
 				      sizeof(struct dest_addresses));
@@ -525,19 +981,26 @@ static inline bool check_udp_checksum(struct headers *hdr)
 
 
 /**
+ * Check vxlan headers and sort packets by destination port in one pass.
+ * Each packet is added to the burst_mask of its port.
+ *
  * @multicast_mask store multicast packets
- * @computed_mask store package contening a valide vxlan header
+ * @touched store the index of ports having packets to handle
+ * @return the number of ports in touched
  */
-static inline void classify_pkts(struct rte_mbuf **pkts,
-				 uint64_t mask,
-				 struct ether_addr **eths,
-				 struct headers **hdrs,
-				 uint64_t *multicast_mask,
-				 uint64_t *computed_mask,
-				 uint16_t udp_dst_port_be)
-{
-	for (*multicast_mask = 0, *computed_mask = 0; mask;) {
+static inline int classify_pkts(struct vtep_state *state,
+				struct rte_mbuf **pkts,
+				uint64_t mask,
+				struct ether_addr **eths,
+				struct headers **hdrs,
+				uint64_t *multicast_mask,
+				uint16_t *touched)
+{
+	int nb_touched = 0;
+
+	for (*multicast_mask = 0; mask;) {
 		int i;
+		int p;
 		struct headers *tmp;
 
 		pg_low_bit_iterate(mask, i);
@@ -545,9 +1008,12 @@ static inline void classify_pkts(struct rte_mbuf **pkts,
 		eths[i] = pg_util_get_ether_src_addr(pkts[i]);
 		hdrs[i] = tmp;
 		if (unlikely(pg_ip_proto(tmp->ip) != 17 ||
-			     tmp->udp.dst_port != udp_dst_port_be ||
+			     tmp->udp.dst_port != state->udp_dst_port_be ||
 			     tmp->vxlan.vx_flags != PG_VTEP_BE_I_FLAG))
 			continue;
+		p = vni_index_lookup(state, tmp->vxlan.vx_vni);
+		if (unlikely(p < 0))
+			continue;
 		if (tmp->udp.dgram_cksum) {
 			if (unlikely(!check_udp_checksum(hdrs[i])))
 				continue;
@@ -556,42 +1022,40 @@ static inline void classify_pkts(struct rte_mbuf **pkts,
 		}
 		if (pg_is_multicast_ip(tmp->ip.dst_addr))
 			*multicast_mask |= (1LLU << i);
-		*computed_mask |= (1LLU << i);
+		if (!state->ports[p].burst_mask)
+			touched[nb_touched++] = p;
+		state->ports[p].burst_mask |= (1LLU << i);
 	}
+	return nb_touched;
 }
 
-static inline uint64_t check_and_clone_vni_pkts(struct vtep_state *state,
-						struct rte_mbuf **pkts,
-						uint64_t mask,
-						struct headers **hdrs,
-						struct vtep_port *port,
-						struct rte_mbuf **out_pkts)
+static inline uint64_t clone_vni_pkts(struct vtep_state *state,
+				      struct rte_mbuf **pkts,
+				      uint64_t mask,
+				      struct rte_mbuf **out_pkts)
 {
 	uint64_t vni_mask = 0;
 
 	for (; mask;) {
 		int j;
+		struct rte_mbuf *tmp;
 
 		pg_low_bit_iterate(mask, j);
-		if (hdrs[j]->vxlan.vx_vni == port->vni) {
-			struct rte_mbuf *tmp;
-
-			if (unlikely(!(state->flags & PG_VTEP_NO_COPY))) {
-				struct rte_mempool *mp = pg_get_mempool();
+		if (unlikely(!(state->flags & PG_VTEP_NO_COPY))) {
+			struct rte_mempool *mp = pg_get_mempool();
 
-				tmp = rte_pktmbuf_clone(pkts[j], mp);
-			} else {
-				tmp = pkts[j];
-			}
-			if (unlikely(!tmp))
-				return 0;
-			out_pkts[j] = tmp;
-			if (!rte_pktmbuf_adj(out_pkts[j],
-					     out_pkts[j]->l2_len +
-					     sizeof(struct headers)))
-				return 0;
-			vni_mask |= (1LLU << j);
+			tmp = rte_pktmbuf_clone(pkts[j], mp);
+		} else {
+			tmp = pkts[j];
 		}
+		if (unlikely(!tmp))
+			return 0;
+		out_pkts[j] = tmp;
+		if (!rte_pktmbuf_adj(out_pkts[j],
+				     out_pkts[j]->l2_len +
+				     sizeof(struct headers)))
+			return 0;
+		vni_mask |= (1LLU << j);
 	}
 	return vni_mask;
 }
@@ -627,28 +1091,28 @@ static inline int decapsulate(struct pg_brick *brick, enum pg_side from,
 	struct headers *hdrs[64];
 	struct rte_mbuf **out_pkts = state->pkts;
 	uint64_t multicast_mask;
+	uint16_t touched[64];
+	int nb_touched;
 
-	classify_pkts(pkts, pkts_mask, eths, hdrs, &multicast_mask, &pkts_mask,
-		      state->udp_dst_port_be);
+	nb_touched = classify_pkts(state, pkts, pkts_mask, eths, hdrs,
+				   &multicast_mask, touched);
 
-	for (int i = 0; i < s->nb; ++i) {
+	for (int t = 0; t < nb_touched; ++t) {
+		int i = touched[t];
 		struct vtep_port *port = &ports[i];
 		uint64_t hitted_mask = 0;
 		uint64_t vni_mask;
 
-		if (!pkts_mask)
-			break;
+		vni_mask = port->burst_mask;
+		port->burst_mask = 0;
 		if (unlikely(are_mac_tables_dead(port) &&
-			     try_fix_tables(state, port,errp) < 0))
-			return -1;
-		/* Decaspulate and check the vni*/
-		vni_mask = check_and_clone_vni_pkts(state, pkts, pkts_mask,
-						    hdrs, port, out_pkts);
+			     try_fix_tables(state, port, errp) < 0))
+			goto error;
+		/* Decaspulate */
+		vni_mask = clone_vni_pkts(state, pkts, vni_mask, out_pkts);
 		if (!vni_mask)
 			continue;
 
-		/* BROKEN see simple */
-		pkts_mask ^= vni_mask;
 		if (state->flags & PG_VTEP_NO_INNERMAC_CHECK) {
 			hitted_mask = vni_mask;
 		} else {
@@ -677,7 +1141,7 @@ static inline int decapsulate(struct pg_brick *brick, enum pg_side from,
 						    errp) < 0)) {
 				if (!(state->flags & PG_VTEP_NO_COPY))
 					pg_packets_free(out_pkts, vni_mask);
-				return -1;
+				goto error;
 			}
 		}
 
@@ -685,28 +1149,18 @@ static inline int decapsulate(struct pg_brick *brick, enum pg_side from,
 			pg_packets_free(out_pkts, vni_mask);
 	}
 	return 0;
+error:
+	for (int t = 0; t < nb_touched; ++t)
+		ports[touched[t]].burst_mask = 0;
+	return -1;
 }
 
-static inline uint64_t check_vni_pkts(struct rte_mbuf **pkts,
-				      uint64_t mask,
-				      struct headers **hdrs,
-				      struct vtep_port *port)
+static inline void adj_vni_pkts(struct rte_mbuf **pkts, uint64_t mask)
 {
-	uint64_t vni_mask = 0;
-
-	for (; mask;) {
-		int j;
-		uint64_t bit;
-
-		pg_low_bit_iterate_full(mask, bit, j);
-		if (hdrs[j]->vxlan.vx_vni == port->vni) {
-			rte_pktmbuf_adj(pkts[j],
-					pkts[j]->l2_len +
-					sizeof(struct headers));
-			vni_mask |= bit;
-		}
+	PG_FOREACH_BIT(mask, j) {
+		rte_pktmbuf_adj(pkts[j],
+				pkts[j]->l2_len + sizeof(struct headers));
 	}
-	return vni_mask;
 }
 
 static inline int decapsulate_simple(struct pg_brick *brick, enum pg_side from,
@@ -722,32 +1176,36 @@ static inline int decapsulate_simple(struct pg_brick *brick, enum pg_side from,
 	struct headers *hdrs[64];
 	struct pg_brick_edge *edges = s->edges;
 	uint64_t multicast_mask;
+	uint16_t touched[64];
+	int nb_touched;
 
-	classify_pkts(pkts, pkts_mask, eths, hdrs, &multicast_mask, &pkts_mask,
-		      state->udp_dst_port_be);
+	nb_touched = classify_pkts(state, pkts, pkts_mask, eths, hdrs,
+				   &multicast_mask, touched);
 
-	for (int i = 0, nb = s->nb; pkts_mask && i < nb; ++i) {
+	for (int t = 0; t < nb_touched; ++t) {
+		int i = touched[t];
 		struct vtep_port *port = &ports[i];
-		uint64_t vni_mask;
+		uint64_t vni_mask = port->burst_mask;
 
+		port->burst_mask = 0;
 		if (unlikely(are_mac_tables_dead(port) &&
 			     try_fix_tables(state, port, errp) < 0))
-			return -1;
-		/* Decaspulate and check the vni*/
-		vni_mask = check_vni_pkts(pkts, pkts_mask,
-					  hdrs, port);
-		if (!vni_mask)
-			continue;
-		pkts_mask ^= vni_mask;
+			goto error;
+		/* Decaspulate */
+		adj_vni_pkts(pkts, vni_mask);
 		add_dst_iner_macs(state, port, pkts, eths, hdrs,
 				  vni_mask, multicast_mask);
 		restore_metadata(pkts, hdrs, vni_mask);
 
 		if (unlikely(pg_brick_burst(edges[i].link, from, i, pkts,
 					    vni_mask, errp) < 0))
-			return -1;
+			goto error;
 	}
 	return 0;
+error:
+	for (int t = 0; t < nb_touched; ++t)
+		ports[touched[t]].burst_mask = 0;
+	return -1;
 }
 
 static inline int from_vtep(struct pg_brick *brick, enum pg_side from,
@@ -766,6 +1224,7 @@ static inline int from_vtep(struct pg_brick *brick, enum pg_side from,
 
 			port->dead_tables = IS_MAC_TO_DST_DEAD |
 				HAS_BEEN_BROKEN;
+			port->burst_mask = 0;
 			pg_mac_table_free(&port->mac_to_dst);
 		}
 		*errp = pg_error_new_errno(ENOMEM,
@@ -786,27 +1245,34 @@ static int do_add_vni(struct vtep_state *state, uint16_t edge_index,
 		       struct pg_error **errp)
 {
 	struct vtep_port *port = &state->ports[edge_index];
+	struct ether_addr dst_mac;
 
 	if (unlikely(!port)) {
 		*errp = pg_error_new("bad vtep internal port provided");
 		return -1;
 	}
-	if (unlikely(port->vni)) {
+	if (unlikely(port->attached)) {
 		*errp = pg_error_new("port already attached to a vni");
 		return -1;
 	}
-	if (unlikely(pg_is_multicast_ip(port->multicast_ip))) {
-		*errp = pg_error_new("port alread have a mutlicast IP");
-		return -1;
-	}
 	/* vni is on the first 24 bits */
 	port->vni = rte_cpu_to_be_32(vni << 8);
+	port->attached = true;
 	pg_ip_copy(multicast_ip, &port->multicast_ip);
+	if (pg_is_multicast_ip(multicast_ip)) {
+		dst_mac = pg_multicast_get_dst_addr(multicast_ip);
+		outer_header_build(state, &port->multicast_tmpl, port->vni,
+				   &dst_mac, multicast_ip);
+	}
+	vni_index_rebuild(state, pg_side_get_max(&state->brick,
+						 pg_flip_side(state->output)));
 
-	g_assert(!pg_mac_table_init(&port->mac_to_dst, &state->exeption_env));
-	g_assert(!pg_mac_table_init(&port->known_mac, &state->exeption_env));
+	g_assert(!vtep_mac_table_init(state, &port->mac_to_dst,
+				      sizeof(struct dest_addresses)));
+	g_assert(!vtep_mac_table_init(state, &port->known_mac, 0));
 
-	multicast_subscribe(state, port, multicast_ip, errp);
+	if (pg_is_multicast_ip(multicast_ip))
+		multicast_subscribe(state, port, multicast_ip, errp);
 	return 0;
 }
 
@@ -824,23 +1290,28 @@ static void do_remove_vni(struct vtep_state *state,
 {
 	struct vtep_port *port = &state->ports[edge_index];
 
-	if (!pg_is_multicast_ip(port->multicast_ip))
+	if (!port->attached)
 		return;
 
-	multicast_unsubscribe(state, port, port->multicast_ip,
-			      errp);
-
-	if (pg_error_is_set(errp))
-		return;
+	/* the group has been left when the flood list was set */
+	if (pg_is_multicast_ip(port->multicast_ip) && !port->nb_flood) {
+		multicast_unsubscribe(state, port, port->multicast_ip, errp);
+		if (pg_error_is_set(errp))
+			return;
+	}
 
 	/* Do the hash destroy at the end since it's the less idempotent */
 	if (!(port->dead_tables & IS_KNOWN_MAC_DEAD))
 		pg_mac_table_free(&port->known_mac);
 	if (!(port->dead_tables & IS_MAC_TO_DST_DEAD))
 		pg_mac_table_free(&port->mac_to_dst);
+	g_free(port->remotes);
+	g_free(port->flood);
 
 	/* clear for next user */
 	memset(port, 0, sizeof(struct vtep_port));
+	vni_index_rebuild(state, pg_side_get_max(&state->brick,
+						 pg_flip_side(state->output)));
 }
 
 /**
@@ -879,8 +1350,12 @@ static void vtep_destroy(struct pg_brick *brick, struct pg_error **errp)
 			pg_mac_table_free(&port->mac_to_dst);
 		if (!(port->dead_tables & IS_KNOWN_MAC_DEAD))
 			pg_mac_table_free(&port->known_mac);
+		g_free(port->remotes);
+		g_free(port->flood);
 	}
 	g_free(state->ports);
+	g_free(state->vni_index);
+	pg_packets_free(state->stage.pkts, pg_mask_firsts(state->stage.count));
 }
 
 static struct pg_brick_config *vtep_config_new(const char *name,
@@ -951,6 +1426,7 @@ static int vtep_init(struct pg_brick *brick,
 	 */
 	max = pg_side_get_max(brick, pg_flip_side(state->output));
 	state->ports = g_new0(struct vtep_port, max);
+	vni_index_alloc(state, max);
 
 	brick->burst = vtep_burst;
 	return 0;
@@ -1053,7 +1529,9 @@ int pg_vtep_add_vni_(struct pg_brick *brick,
 
 	pg_ip_copy(multicast_ip, &tmp_ip);
 
-	if (!pg_is_multicast_ip(tmp_ip)) {
+	/* the unspecified address adds a VNI without group */
+	if (!pg_is_multicast_ip(tmp_ip) &&
+	    memcmp(&tmp_ip, &(IP_TYPE){0}, sizeof(IP_TYPE))) {
 		*errp = pg_error_new(
 			"Provided IP is not in the multicast range");
 		return -1;
@@ -1078,6 +1556,114 @@ int pg_vtep_add_vni_(struct pg_brick *brick,
 	return 0;
 }
 
+/* @return	the flood list index of ip, -1 if there is none */
+static int flood_dst_lookup(struct vtep_port *port, IP_TYPE *ip)
+{
+	for (int i = 0; i < port->nb_flood; ++i) {
+		if (!memcmp(&port->flood[i].ip, ip, sizeof(IP_TYPE)))
+			return i;
+	}
+	return -1;
+}
+
+static struct vtep_port *vni_port_get(struct pg_brick *brick, uint32_t vni,
+				      struct pg_error **errp)
+{
+	struct vtep_state *state = pg_brick_get_state(brick, struct vtep_state);
+	struct pg_brick_side *s = &brick->sides[pg_flip_side(state->output)];
+	uint32_t be_vni = rte_cpu_to_be_32(vni << 8);
+
+	for (int i = 0; i < s->nb; ++i) {
+		struct vtep_port *port = &state->ports[i];
+
+		if (port->vni == be_vni && port->attached)
+			return port;
+	}
+	*errp = pg_error_new("vni '%u' not found in brick '%s'", vni,
+			     brick->name);
+	return NULL;
+}
+
+#define pg_vtep_add_flood_dst__(v) CATCAT(pg_vtep, v, _add_flood_dst)
+#define pg_vtep_add_flood_dst_ pg_vtep_add_flood_dst__(IP_VERSION)
+
+int pg_vtep_add_flood_dst_(struct pg_brick *brick, uint32_t vni,
+			   IP_IN_TYPE ip, struct ether_addr *mac,
+			   struct pg_error **errp)
+{
+	struct vtep_state *state = pg_brick_get_state(brick, struct vtep_state);
+	struct vtep_port *port = vni_port_get(brick, vni, errp);
+	IP_TYPE tmp_ip;
+	int i;
+
+	if (!port)
+		return -1;
+	pg_ip_copy(ip, &tmp_ip);
+	if (pg_is_multicast_ip(tmp_ip)) {
+		*errp = pg_error_new("flood destination must be unicast");
+		return -1;
+	}
+
+	i = flood_dst_lookup(port, &tmp_ip);
+	if (i < 0) {
+		if (port->nb_flood == UINT16_MAX) {
+			*errp = pg_error_new("flood list of vni '%u' is full",
+					     vni);
+			return -1;
+		}
+		/* replicas replace the group, stop receiving its frames */
+		if (!port->nb_flood && pg_is_multicast_ip(port->multicast_ip)) {
+			multicast_unsubscribe(state, port, port->multicast_ip,
+					      errp);
+			if (pg_error_is_set(errp))
+				return -1;
+		}
+		i = port->nb_flood;
+		port->flood = g_renew(struct vtep_flood_dst, port->flood,
+				      port->nb_flood + 1);
+		pg_ip_copy(tmp_ip, &port->flood[i].ip);
+		port->nb_flood++;
+	}
+	outer_header_build(state, &port->flood[i].tmpl, port->vni, mac,
+			   tmp_ip);
+	return 0;
+}
+
+#define pg_vtep_remove_flood_dst__(v) CATCAT(pg_vtep, v, _remove_flood_dst)
+#define pg_vtep_remove_flood_dst_ pg_vtep_remove_flood_dst__(IP_VERSION)
+
+int pg_vtep_remove_flood_dst_(struct pg_brick *brick, uint32_t vni,
+			      IP_IN_TYPE ip, struct pg_error **errp)
+{
+	struct vtep_state *state = pg_brick_get_state(brick, struct vtep_state);
+	struct vtep_port *port = vni_port_get(brick, vni, errp);
+	IP_TYPE tmp_ip;
+	int i;
+
+	if (!port)
+		return -1;
+	pg_ip_copy(ip, &tmp_ip);
+	i = flood_dst_lookup(port, &tmp_ip);
+	if (i < 0) {
+		*errp = pg_error_new("flood destination not found");
+		return -1;
+	}
+
+	port->nb_flood--;
+	memmove(&port->flood[i], &port->flood[i + 1],
+		(port->nb_flood - i) * sizeof(struct vtep_flood_dst));
+	if (!port->nb_flood) {
+		g_free(port->flood);
+		port->flood = NULL;
+		if (pg_is_multicast_ip(port->multicast_ip))
+			multicast_subscribe(state, port, port->multicast_ip,
+					    errp);
+	}
+	if (pg_error_is_set(errp))
+		return -1;
+	return 0;
+}
+
 #define pg_vtep_clean_all_mac__(version)		\
 	CATCAT(pg_vtep, version, _clean_all_mac)
 #define pg_vtep_clean_all_mac_ pg_vtep_clean_all_mac__(IP_VERSION)
@@ -1118,6 +1704,65 @@ void pg_vtep_cleanup_mac_(struct pg_brick *brick, int port_id)
 
 }
 
+#define pg_vtep_set_src_port_mode__(v)				\
+	CATCAT(pg_vtep, v, _set_src_port_mode)
+#define pg_vtep_set_src_port_mode_				\
+	pg_vtep_set_src_port_mode__(IP_VERSION)
+
+void pg_vtep_set_src_port_mode_(struct pg_brick *brick,
+				enum pg_vtep_src_port_mode mode)
+{
+	struct vtep_state *s = pg_brick_get_state(brick, struct vtep_state);
+
+	s->src_port_mode = mode;
+}
+
+static int vtep_flush(struct pg_brick *brick, struct pg_error **errp)
+{
+	struct vtep_state *state = pg_brick_get_state(brick, struct vtep_state);
+
+	return pg_brick_stage_flush(&state->stage,
+				    &brick->sides[state->output].edges[0],
+				    pg_flip_side(state->output), errp);
+}
+
+#define pg_vtep_set_deferred__(v) CATCAT(pg_vtep, v, _set_deferred)
+#define pg_vtep_set_deferred_ pg_vtep_set_deferred__(IP_VERSION)
+
+int pg_vtep_set_deferred_(struct pg_brick *brick, bool deferred,
+			  struct pg_error **errp)
+{
+	struct vtep_state *state = pg_brick_get_state(brick, struct vtep_state);
+
+	if (deferred == state->deferred)
+		return 0;
+	if (!deferred && vtep_flush(brick, errp) < 0)
+		return -1;
+	state->deferred = deferred;
+	pg_brick_flush_set(brick, deferred ? vtep_flush : NULL);
+	return 0;
+}
+
+#define pg_vtep_set_mac_table_capacity__(v)			\
+	CATCAT(pg_vtep, v, _set_mac_table_capacity)
+#define pg_vtep_set_mac_table_capacity_				\
+	pg_vtep_set_mac_table_capacity__(IP_VERSION)
+
+int pg_vtep_set_mac_table_capacity_(struct pg_brick *brick,
+				    uint32_t capacity,
+				    struct pg_error **errp)
+{
+	struct vtep_state *s = pg_brick_get_state(brick, struct vtep_state);
+
+	if (capacity > PG_MAC_TABLE_COMPACT_MAX_CAPACITY) {
+		*errp = pg_error_new("mac table capacity %u is too big",
+				     capacity);
+		return -1;
+	}
+	s->mac_table_capacity = capacity;
+	return 0;
+}
+
 #define pg_vtep_mac_to_dst__(v) CATCAT(pg_vtep, v, _mac_to_dst)
 #define pg_vtep_mac_to_dst_ pg_vtep_mac_to_dst__(IP_VERSION)
 
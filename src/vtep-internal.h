@@ -48,6 +48,23 @@ struct pg_mac_table *pg_vtep4_mac_to_dst(struct pg_brick *brick,
 struct pg_mac_table *pg_vtep6_mac_to_dst(struct pg_brick *brick,
 					 int port_id);
 
+int pg_vtep4_set_mac_table_capacity(struct pg_brick *brick,
+				    uint32_t capacity,
+				    struct pg_error **errp);
+int pg_vtep6_set_mac_table_capacity(struct pg_brick *brick,
+				    uint32_t capacity,
+				    struct pg_error **errp);
+
+void pg_vtep4_set_src_port_mode(struct pg_brick *brick,
+				enum pg_vtep_src_port_mode mode);
+void pg_vtep6_set_src_port_mode(struct pg_brick *brick,
+				enum pg_vtep_src_port_mode mode);
+
+int pg_vtep4_set_deferred(struct pg_brick *brick, bool deferred,
+			  struct pg_error **errp);
+int pg_vtep6_set_deferred(struct pg_brick *brick, bool deferred,
+			  struct pg_error **errp);
+
 int pg_vtep4_unset_mac(struct pg_brick *brick, uint32_t vni,
 		       struct ether_addr *mac, struct pg_error **errp);
 int pg_vtep6_unset_mac(struct pg_brick *brick, uint32_t vni,
@@ -71,6 +88,7 @@ struct headers_v6 {
 
 struct dest_addresses_v4 {
 	struct ether_addr mac;
+	uint16_t remote;
 	uint32_t ip;
 	uint64_t lifetime;
 };
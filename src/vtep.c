@@ -250,6 +250,32 @@ int pg_vtep_unset_mac(struct pg_brick *brick, uint32_t vni,
 
 }
 
+int pg_vtep_set_mac_table_capacity(struct pg_brick *brick,
+				   uint32_t capacity,
+				   struct pg_error **errp)
+{
+	if (!strcmp(pg_brick_type(brick), "vtep4"))
+		return pg_vtep4_set_mac_table_capacity(brick, capacity, errp);
+	return pg_vtep6_set_mac_table_capacity(brick, capacity, errp);
+}
+
+void pg_vtep_set_src_port_mode(struct pg_brick *brick,
+			       enum pg_vtep_src_port_mode mode)
+{
+	if (!strcmp(pg_brick_type(brick), "vtep4"))
+		pg_vtep4_set_src_port_mode(brick, mode);
+	else
+		pg_vtep6_set_src_port_mode(brick, mode);
+}
+
+int pg_vtep_set_deferred(struct pg_brick *brick, bool deferred,
+			 struct pg_error **errp)
+{
+	if (!strcmp(pg_brick_type(brick), "vtep4"))
+		return pg_vtep4_set_deferred(brick, deferred, errp);
+	return pg_vtep6_set_deferred(brick, deferred, errp);
+}
+
 static struct pg_brick_ops vtep_ops = {
 	.name		= "vtep4",
 	.state_size	= sizeof(struct vtep_state),
@@ -17,6 +17,7 @@ tests_core_SOURCES = \
 	$(tests_core_DIR)/test-pkts-count.c\
 	$(tests_core_DIR)/test-graph.c\
 	$(tests_core_DIR)/test-hub.c\
+	$(tests_core_DIR)/test-dispatcher.c\
 	$(tests_core_DIR)/tests.c
 tests_core_OBJECTS = $(tests_core_SOURCES:.c=.o)
 
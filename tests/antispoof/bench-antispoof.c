@@ -16,9 +16,12 @@
  */
 
 #include "bench.h"
+#include <stdio.h>
+#include <inttypes.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <rte_config.h>
+#include <rte_arp.h>
 #include <rte_common.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
@@ -83,3 +86,69 @@ void test_benchmark_antispoof(int argc, char **argv)
 	pg_brick_destroy(antispoof);
 	g_free(bench.pkts);
 }
+
+/* ARP replies from a VM owning nb_ips addresses, using the last one */
+static void antispoof_arp_bench(uint32_t nb_ips, int argc, char **argv)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *antispoof;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	struct arp_hdr arp;
+
+	g_assert(!pg_bench_init(&bench, "antispoof arp", argc, argv,
+				&error));
+	antispoof = pg_antispoof_new("antispoof", PG_EAST_SIDE,
+				     &mac1, &error);
+	g_assert(!error);
+	pg_antispoof_arp_enable(antispoof);
+	for (uint32_t i = 1; i <= nb_ips; ++i)
+		g_assert(!pg_antispoof_arp_add(antispoof, htonl(0x0a000000 | i),
+					       &error));
+
+	arp.arp_hrd = htons(ARP_HRD_ETHER);
+	arp.arp_pro = htons(ETHER_TYPE_IPv4);
+	arp.arp_hln = ETHER_ADDR_LEN;
+	arp.arp_pln = 4;
+	arp.arp_op = htons(ARP_OP_REPLY);
+	ether_addr_copy(&mac1, &arp.arp_data.arp_sha);
+	arp.arp_data.arp_sip = htonl(0x0a000000 | nb_ips);
+	ether_addr_copy(&mac2, &arp.arp_data.arp_tha);
+	arp.arp_data.arp_tip = htonl(0x0b000001);
+
+	bench.input_brick = antispoof;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = antispoof;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 1000000;
+	bench.count_brick = NULL;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(bench.pkts, bench.pkts_mask,
+					     &mac1, &mac2, ETHER_TYPE_ARP);
+	bench.pkts = pg_packets_append_buf(bench.pkts, bench.pkts_mask,
+					   &arp, sizeof(arp));
+	bench.brick_full_burst = 1;
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	printf("================= antispoof arp, %"PRIu32" IPs ==========\n",
+	       nb_ips);
+	pg_bench_print(&stats);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(antispoof);
+	g_free(bench.pkts);
+}
+
+void test_benchmark_antispoof_arp(int argc, char **argv)
+{
+	/* cost must not depend on the number of allowed IPs */
+	antispoof_arp_bench(1, argc, argv);
+	antispoof_arp_bench(100, argc, argv);
+	antispoof_arp_bench(1000, argc, argv);
+	antispoof_arp_bench(10000, argc, argv);
+}
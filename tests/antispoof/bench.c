@@ -25,6 +25,7 @@ int main(int argc, char **argv)
 	g_test_init(&argc, &argv, NULL);
 	g_assert(pg_start(argc, argv) >= 0);
 	test_benchmark_antispoof(argc, argv);
+	test_benchmark_antispoof_arp(argc, argv);
 	int r = g_test_run();
 
 	pg_stop();
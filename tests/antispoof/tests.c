@@ -17,6 +17,7 @@
 
 #include <glib.h>
 #include <string.h>
+#include <arpa/inet.h>
 #include <rte_config.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
@@ -576,6 +577,276 @@ static void test_antispoof_ndp(void)
 	pg_brick_destroy(antispoof);
 }
 
+static bool antispoof_arp_pass(struct pg_brick *antispoof)
+{
+#	include "test-arp-request.c"
+	struct rte_mbuf *packet = build_packet(pkt1, 42);
+	bool ret = test_antispoof_filter(antispoof, packet) > 0;
+
+	pg_packets_free(&packet, pg_mask_firsts(1));
+	return ret;
+}
+
+static void test_antispoof_arp_many(void)
+{
+	uint32_t inside_ip = htobe32(IPv4(192, 168, 21, 253));
+	struct ether_addr inside_mac;
+	struct pg_brick *antispoof;
+	struct pg_error *error = NULL;
+
+	pg_scan_ether_addr(&inside_mac, "00:e0:81:d5:02:91");
+	antispoof = pg_antispoof_new("antispoof", PG_EAST_SIDE,
+				     &inside_mac, &error);
+	g_assert(!error);
+	pg_antispoof_arp_enable(antispoof);
+
+	/* the allow-list is not bounded by PG_ARP_MAX anymore */
+	for (uint32_t i = 0; i < PG_ARP_MAX * 4; ++i)
+		g_assert(!pg_antispoof_arp_add(antispoof,
+					       htobe32(IPv4(10, 0, i >> 8, i)),
+					       &error));
+	g_assert(!antispoof_arp_pass(antispoof));
+	g_assert(!pg_antispoof_arp_add(antispoof, inside_ip, &error));
+	g_assert(antispoof_arp_pass(antispoof));
+
+	/* removing the other addresses keeps the inside one */
+	for (uint32_t i = 0; i < PG_ARP_MAX * 4; ++i)
+		g_assert(!pg_antispoof_arp_del(antispoof,
+					       htobe32(IPv4(10, 0, i >> 8, i)),
+					       &error));
+	g_assert(!error);
+	g_assert(antispoof_arp_pass(antispoof));
+
+	/* adding twice stores the address once */
+	g_assert(!pg_antispoof_arp_add(antispoof, inside_ip, &error));
+	g_assert(!pg_antispoof_arp_del(antispoof, inside_ip, &error));
+	g_assert(!error);
+	g_assert(!antispoof_arp_pass(antispoof));
+	g_assert(pg_antispoof_arp_del(antispoof, inside_ip, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	/* delete all */
+	g_assert(!pg_antispoof_arp_add(antispoof, inside_ip, &error));
+	g_assert(antispoof_arp_pass(antispoof));
+	pg_antispoof_arp_del_all(antispoof);
+	g_assert(!antispoof_arp_pass(antispoof));
+
+	pg_brick_destroy(antispoof);
+}
+
+static bool antispoof_ndp_pass(struct pg_brick *antispoof)
+{
+#	include "test-ndp.c"
+	/* only the legit packet is used, others are tested above */
+	const unsigned char *pkts[] = {pkt0, pkt1, pkt2};
+	struct rte_mbuf *packet = build_packet(pkts[0], 86);
+	bool ret = test_antispoof_filter(antispoof, packet) > 0;
+
+	pg_packets_free(&packet, pg_mask_firsts(1));
+	return ret;
+}
+
+static void test_antispoof_ndp_many(void)
+{
+	struct ether_addr inside_mac;
+	struct pg_brick *antispoof;
+	struct pg_error *error = NULL;
+	uint8_t inside_ip[16];
+	uint8_t ip[16];
+
+	pg_scan_ether_addr(&inside_mac, "52:54:00:12:34:02");
+	antispoof = pg_antispoof_new("antispoof", PG_EAST_SIDE,
+				     &inside_mac, &error);
+	g_assert(!error);
+	pg_antispoof_ndp_enable(antispoof);
+	pg_ip_from_str(inside_ip, "2001:db8:2000:aff0::2");
+
+	/* the allow-list is not bounded by PG_NPD_MAX anymore */
+	pg_ip_from_str(ip, "2001:db8:3000::");
+	for (uint32_t i = 0; i < PG_NPD_MAX * 4; ++i) {
+		ip[14] = i >> 8;
+		ip[15] = i;
+		g_assert(!pg_antispoof_ndp_add(antispoof, ip, &error));
+	}
+	g_assert(!antispoof_ndp_pass(antispoof));
+	g_assert(!pg_antispoof_ndp_add(antispoof, inside_ip, &error));
+	g_assert(antispoof_ndp_pass(antispoof));
+
+	/* removing the other addresses keeps the inside one */
+	for (uint32_t i = 0; i < PG_NPD_MAX * 4; ++i) {
+		ip[14] = i >> 8;
+		ip[15] = i;
+		g_assert(!pg_antispoof_ndp_del(antispoof, ip, &error));
+	}
+	g_assert(!error);
+	g_assert(antispoof_ndp_pass(antispoof));
+
+	/* adding twice stores the address once */
+	g_assert(!pg_antispoof_ndp_add(antispoof, inside_ip, &error));
+	g_assert(!pg_antispoof_ndp_del(antispoof, inside_ip, &error));
+	g_assert(!error);
+	g_assert(!antispoof_ndp_pass(antispoof));
+	g_assert(pg_antispoof_ndp_del(antispoof, inside_ip, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	/* delete all */
+	g_assert(!pg_antispoof_ndp_add(antispoof, inside_ip, &error));
+	g_assert(antispoof_ndp_pass(antispoof));
+	pg_antispoof_ndp_del_all(antispoof);
+	g_assert(!antispoof_ndp_pass(antispoof));
+
+	pg_brick_destroy(antispoof);
+}
+
+static struct rte_mbuf *build_ip_src_packet(struct ether_addr *mac,
+					    const char *src, bool ipv6)
+{
+	uint64_t mask = pg_mask_firsts(1);
+	struct rte_mbuf **pkts = pg_packets_create(mask);
+	struct rte_mbuf *packet;
+	uint8_t src6[16], dst6[16];
+
+	if (ipv6) {
+		pg_ip_from_str(src6, src);
+		pg_ip_from_str(dst6, "2001:db8::1");
+		pg_packets_append_ether(pkts, mask, mac, mac,
+					ETHER_TYPE_IPv6);
+		pg_packets_append_ipv6(pkts, mask, src6, dst6, 0, 17);
+	} else {
+		pg_packets_append_ether(pkts, mask, mac, mac,
+					ETHER_TYPE_IPv4);
+		pg_packets_append_ipv4(pkts, mask, inet_addr(src),
+				       inet_addr("10.0.0.1"), 0, 17);
+	}
+	pkts[0]->l2_len = sizeof(struct ether_hdr);
+	packet = pkts[0];
+	g_free(pkts);
+	return packet;
+}
+
+static bool antispoof_ip_src_pass(struct pg_brick *antispoof,
+				  struct ether_addr *mac, const char *src,
+				  bool ipv6)
+{
+	struct rte_mbuf *packet = build_ip_src_packet(mac, src, ipv6);
+	bool ret = test_antispoof_filter(antispoof, packet) > 0;
+
+	pg_packets_free(&packet, pg_mask_firsts(1));
+	return ret;
+}
+
+static void test_antispoof_ip_src(void)
+{
+	struct ether_addr mac;
+	struct pg_brick *antispoof;
+	struct pg_error *error = NULL;
+	uint8_t ip6[16];
+
+	pg_scan_ether_addr(&mac, "52:54:00:12:34:02");
+	antispoof = pg_antispoof_new("antispoof", PG_EAST_SIDE,
+				     &mac, &error);
+	g_assert(!error);
+
+	/* everything pass until enabled */
+	g_assert(antispoof_ip_src_pass(antispoof, &mac, "6.6.6.6", false));
+	pg_antispoof_ip_src_enable(antispoof);
+	g_assert(!antispoof_ip_src_pass(antispoof, &mac, "6.6.6.6", false));
+	g_assert(pg_antispoof_ip_src_drops(antispoof) == 1);
+
+	g_assert(!pg_antispoof_ipv4_src_add(antispoof,
+					    inet_addr("10.0.0.0"), 24,
+					    &error));
+	g_assert(!pg_antispoof_ipv4_src_add(antispoof,
+					    inet_addr("192.168.1.42"), 32,
+					    &error));
+	pg_ip_from_str(ip6, "2001:db8:2000::");
+	g_assert(!pg_antispoof_ipv6_src_add(antispoof, ip6, 48, &error));
+	g_assert(pg_antispoof_ipv4_src_add(antispoof, 0, 33, &error) < 0);
+	pg_error_free(error);
+	error = NULL;
+
+	g_assert(antispoof_ip_src_pass(antispoof, &mac, "10.0.0.2", false));
+	g_assert(antispoof_ip_src_pass(antispoof, &mac, "192.168.1.42",
+				       false));
+	g_assert(!antispoof_ip_src_pass(antispoof, &mac, "192.168.1.43",
+					false));
+	g_assert(!antispoof_ip_src_pass(antispoof, &mac, "10.0.1.2", false));
+	g_assert(antispoof_ip_src_pass(antispoof, &mac, "0.0.0.0", false));
+	g_assert(antispoof_ip_src_pass(antispoof, &mac, "2001:db8:2000::2",
+				       true));
+	g_assert(!antispoof_ip_src_pass(antispoof, &mac, "2001:db8:2001::2",
+					true));
+	g_assert(pg_antispoof_ip_src_drops(antispoof) == 4);
+
+	/* removed prefixes are not allowed anymore */
+	g_assert(pg_antispoof_ipv4_src_del(antispoof, inet_addr("10.0.0.0"),
+					   24, &error) == 0);
+	g_assert(pg_antispoof_ipv4_src_del(antispoof, inet_addr("10.0.0.0"),
+					   24, &error) < 0);
+	pg_error_free(error);
+	error = NULL;
+	g_assert(!antispoof_ip_src_pass(antispoof, &mac, "10.0.0.2", false));
+
+	pg_antispoof_ip_src_del_all(antispoof);
+	g_assert(!antispoof_ip_src_pass(antispoof, &mac, "192.168.1.42",
+					false));
+	pg_antispoof_ip_src_disable(antispoof);
+	g_assert(antispoof_ip_src_pass(antispoof, &mac, "192.168.1.42",
+				       false));
+	g_assert(pg_antispoof_ip_src_drops(antispoof) == 6);
+
+	pg_brick_destroy(antispoof);
+}
+
+static void test_antispoof_ip_src_any(void)
+{
+	struct ether_addr mac;
+	struct pg_brick *antispoof;
+	struct pg_error *error = NULL;
+	uint8_t ip6[16] = {0};
+
+	pg_scan_ether_addr(&mac, "52:54:00:12:34:02");
+	antispoof = pg_antispoof_new("antispoof", PG_EAST_SIDE,
+				     &mac, &error);
+	g_assert(!error);
+	pg_antispoof_ip_src_enable(antispoof);
+
+	/* 0.0.0.0/0 allows every IPv4 source but no IPv6 one */
+	g_assert(!pg_antispoof_ipv4_src_add(antispoof, 0, 0, &error));
+	g_assert(antispoof_ip_src_pass(antispoof, &mac, "6.6.6.6", false));
+	g_assert(!antispoof_ip_src_pass(antispoof, &mac, "2001:db8::2",
+					true));
+
+	/* ::/0 has never been added, removing it keeps 0.0.0.0/0 */
+	g_assert(pg_antispoof_ipv6_src_del(antispoof, ip6, 0, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+	g_assert(antispoof_ip_src_pass(antispoof, &mac, "6.6.6.6", false));
+
+	/* ::/0 allows every IPv6 source, removing it keeps 0.0.0.0/0 */
+	g_assert(!pg_antispoof_ipv6_src_add(antispoof, ip6, 0, &error));
+	g_assert(antispoof_ip_src_pass(antispoof, &mac, "2001:db8::2", true));
+	g_assert(!pg_antispoof_ipv6_src_del(antispoof, ip6, 0, &error));
+	g_assert(!antispoof_ip_src_pass(antispoof, &mac, "2001:db8::2",
+					true));
+	g_assert(antispoof_ip_src_pass(antispoof, &mac, "6.6.6.6", false));
+
+	g_assert(!pg_antispoof_ipv4_src_del(antispoof, 0, 0, &error));
+	g_assert(!antispoof_ip_src_pass(antispoof, &mac, "6.6.6.6", false));
+	g_assert(pg_antispoof_ipv4_src_del(antispoof, 0, 0, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+	g_assert(pg_antispoof_ip_src_drops(antispoof) == 3);
+
+	pg_brick_destroy(antispoof);
+}
+
 int main(int argc, char **argv)
 {
 	/* tests in the same order as the header function declarations */
@@ -601,6 +872,14 @@ int main(int argc, char **argv)
 			test_antispoof_empty_burst);
 	pg_test_add_func("/antispoof/ndp",
 			test_antispoof_ndp);
+	pg_test_add_func("/antispoof/arp/many",
+			test_antispoof_arp_many);
+	pg_test_add_func("/antispoof/ndp/many",
+			test_antispoof_ndp_many);
+	pg_test_add_func("/antispoof/ip_src",
+			test_antispoof_ip_src);
+	pg_test_add_func("/antispoof/ip_src/any",
+			test_antispoof_ip_src_any);
 	int r = g_test_run();
 
 	pg_stop();
@@ -0,0 +1,121 @@
+/* Copyright 2019 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <glib.h>
+#include <rte_config.h>
+#include <rte_cycles.h>
+#include <packetgraph/packetgraph.h>
+
+/* mimic many vhost ports sending a few packets each to one nic */
+#define FLUSH_BENCH_INPUTS 16
+#define FLUSH_BENCH_POLLS 1000000
+
+struct flush_bench_sink {
+	uint64_t calls;
+	uint64_t pkts;
+};
+
+static void flush_bench_tx(struct pg_brick *brick, pg_packet_t **tx_burst,
+			   uint16_t *tx_burst_len, void *private_data)
+{
+	uint16_t burst = *(uint16_t *)private_data;
+
+	for (uint16_t i = 0; i < burst; ++i) {
+		uint8_t *data = pg_packet_data(tx_burst[i]);
+
+		g_assert(!pg_packet_set_len(tx_burst[i], 60));
+		memset(data, 0, 60);
+		memcpy(data, "\x52\x54\x00\x00\x00\xff", 6);
+		memcpy(data + 6, "\x52\x54\x00\x00\x00\x01", 6);
+	}
+	*tx_burst_len = burst;
+}
+
+static void flush_bench_rx(struct pg_brick *brick, pg_packet_t **rx_burst,
+			   uint16_t rx_burst_len, void *private_data)
+{
+	struct flush_bench_sink *sink = private_data;
+
+	sink->calls++;
+	sink->pkts += rx_burst_len;
+}
+
+static void flush_bench(uint16_t burst, bool deferred)
+{
+	struct flush_bench_sink sink = {0, 0};
+	struct pg_error *error = NULL;
+	struct pg_brick *sw, *rx;
+	struct pg_graph *g;
+	double hz = rte_get_timer_hz();
+	uint64_t start, cycles;
+
+	/*
+	 * [gen0]--\
+	 * [gen1]---[switch]--[sink]
+	 * [gen.]--/
+	 */
+	sw = pg_switch_new("switch", FLUSH_BENCH_INPUTS, 1, PG_EAST_SIDE,
+			   &error);
+	g_assert(sw && !error);
+	rx = pg_rxtx_new("sink", flush_bench_rx, NULL, &sink);
+	g_assert(rx);
+	g_assert(!pg_brick_link(sw, rx, &error));
+	for (int i = 0; i < FLUSH_BENCH_INPUTS; i++) {
+		char *tmp = g_strdup_printf("gen%i", i);
+		struct pg_brick *gen;
+
+		gen = pg_rxtx_new(tmp, NULL, flush_bench_tx, &burst);
+		g_assert(gen);
+		g_assert(!pg_brick_link(gen, sw, &error));
+		g_free(tmp);
+	}
+	g_assert(!pg_switch_set_deferred(sw, deferred, &error));
+	g = pg_graph_new("flush", sw, &error);
+	g_assert(g && !error);
+
+	start = rte_get_timer_cycles();
+	for (int i = 0; i < FLUSH_BENCH_POLLS; i++)
+		g_assert(!pg_graph_poll(g, &error));
+	cycles = rte_get_timer_cycles() - start;
+	g_assert(sink.pkts ==
+		 (uint64_t)FLUSH_BENCH_POLLS * FLUSH_BENCH_INPUTS * burst);
+
+	printf("================= flush, %s switch =================\n",
+	       deferred ? "deferred" : "direct");
+	printf("inputs: %i, packets per input burst: %u\n",
+	       FLUSH_BENCH_INPUTS, burst);
+	printf("sink packets per call: %.2lf\n",
+	       (double)sink.pkts / sink.calls);
+	printf("graph speed: %.2lf Mpps\n",
+	       (double)sink.pkts / 1000000 / (cycles / hz));
+
+	pg_graph_destroy(g);
+}
+
+void test_benchmark_flush(int argc, char **argv)
+{
+	flush_bench(1, false);
+	flush_bench(1, true);
+	flush_bench(4, false);
+	flush_bench(4, true);
+	flush_bench(32, false);
+	flush_bench(32, true);
+}
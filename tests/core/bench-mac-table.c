@@ -0,0 +1,127 @@
+/* Copyright 2019 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <glib.h>
+#include <rte_config.h>
+#include <rte_cycles.h>
+#include <packetgraph/packetgraph.h>
+#include "utils/mac-table.h"
+
+/* mimic a vtep port: one table per VNI, all VMs sharing the same OUI */
+#define MAC_TABLE_BENCH_LOOKUPS 20000000LLU
+#define MAC_TABLE_BENCH_OUI 0x005452LLU
+
+struct mac_table_bench_elem {
+	uint64_t a;
+	uint64_t b;
+	uint64_t c;
+};
+
+/* return resident and virtual memory in bytes */
+static void mac_table_bench_mem(uint64_t *rss, uint64_t *vsz)
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	uint64_t pages_vsz = 0;
+	uint64_t pages_rss = 0;
+
+	g_assert(f);
+	g_assert(fscanf(f, "%"SCNu64" %"SCNu64, &pages_vsz, &pages_rss) == 2);
+	fclose(f);
+	*vsz = pages_vsz * sysconf(_SC_PAGESIZE);
+	*rss = pages_rss * sysconf(_SC_PAGESIZE);
+}
+
+static void mac_table_bench(const char *title, uint32_t nb_tables,
+			    uint32_t nb_macs, bool compact)
+{
+	struct pg_mac_table *tables = g_new0(struct pg_mac_table, nb_tables);
+	union pg_mac *macs = g_new0(union pg_mac, nb_macs);
+	struct mac_table_bench_elem elem = {0, 0, 0};
+	uint64_t rss_start, vsz_start, rss, vsz;
+	uint64_t start, insert_cycles, lookup_cycles;
+	uint64_t hits = 0;
+	double hz = rte_get_timer_hz();
+
+	for (uint32_t i = 0; i < nb_macs; ++i) {
+		macs[i].mac = MAC_TABLE_BENCH_OUI |
+			(((uint64_t)g_random_int() & 0xffffff) << 24);
+	}
+
+	mac_table_bench_mem(&rss_start, &vsz_start);
+	for (uint32_t t = 0; t < nb_tables; ++t) {
+		if (compact)
+			g_assert(!pg_mac_table_init_compact(
+					 &tables[t], nb_macs,
+					 sizeof(elem), NULL));
+		else
+			g_assert(!pg_mac_table_init(&tables[t], NULL));
+	}
+
+	start = rte_get_timer_cycles();
+	for (uint32_t t = 0; t < nb_tables; ++t) {
+		for (uint32_t i = 0; i < nb_macs; ++i) {
+			elem.a = i;
+			pg_mac_table_elem_set(&tables[t], macs[i], &elem,
+					      sizeof(elem));
+		}
+	}
+	insert_cycles = rte_get_timer_cycles() - start;
+	mac_table_bench_mem(&rss, &vsz);
+
+	start = rte_get_timer_cycles();
+	for (uint64_t i = 0; i < MAC_TABLE_BENCH_LOOKUPS; ++i) {
+		struct mac_table_bench_elem *e;
+
+		e = pg_mac_table_elem_get(&tables[i % nb_tables],
+					  macs[(i * 7919) % nb_macs],
+					  struct mac_table_bench_elem);
+		hits += !!e;
+	}
+	lookup_cycles = rte_get_timer_cycles() - start;
+	g_assert(hits == MAC_TABLE_BENCH_LOOKUPS);
+
+	printf("================= %s =================\n", title);
+	printf("tables: %"PRIu32", macs per table: %"PRIu32"\n",
+	       nb_tables, nb_macs);
+	printf("insert speed: %.2lf Minsert/s\n",
+	       (double)nb_tables * nb_macs / 1000000 /
+	       (insert_cycles / hz));
+	printf("lookup speed: %.2lf Mlookup/s\n",
+	       (double)MAC_TABLE_BENCH_LOOKUPS / 1000000 /
+	       (lookup_cycles / hz));
+	printf("resident memory: %.2lf MB\n",
+	       (double)(rss - rss_start) / (1024 * 1024));
+	printf("virtual memory: %.2lf MB\n",
+	       (double)(vsz - vsz_start) / (1024 * 1024));
+
+	for (uint32_t t = 0; t < nb_tables; ++t)
+		pg_mac_table_free(&tables[t]);
+	g_free(tables);
+	g_free(macs);
+}
+
+void test_benchmark_mac_table(int argc, char **argv)
+{
+	mac_table_bench("mac table 24/24, 1 table", 1, 65536, false);
+	mac_table_bench("mac table compact, 1 table", 1, 65536, true);
+	mac_table_bench("mac table 24/24, 64 tables", 64, 1024, false);
+	mac_table_bench("mac table compact, 64 tables", 64, 1024, true);
+}
@@ -989,6 +989,100 @@ static void test_mac_table(void)
 	pg_mac_table_free(&ma);
 }
 
+static void test_mac_table_compact(void)
+{
+	struct pg_mac_table ma;
+	union pg_mac m;
+	uint32_t val = 1337;
+	uintptr_t i = 0;
+
+	g_assert(pg_mac_table_init_compact(&ma, 0, 4, NULL) < 0);
+	g_assert(!pg_mac_table_init_compact(&ma, 1000, 4, NULL));
+	m.mac = 0;
+	pg_mac_table_elem_set(&ma, m, &val, 4);
+	g_assert(*pg_mac_table_elem_get(&ma, m, uint32_t) == 1337);
+	m.mac = 4;
+	MULTIPLE_OPS(10000, pg_mac_table_elem_set, &ma, m, &val, 4);
+	MULTIPLE_CHECK_EQ(10000, *pg_mac_table_elem_get, 1337,
+			  &ma, m, uint32_t);
+	g_assert(pg_mac_table_compute_length(&ma) == 2);
+
+	/* only the 6 first bytes are part of the key */
+	m.mac = 0xffff000000000004LLU;
+	g_assert(*pg_mac_table_elem_get(&ma, m, uint32_t) == 1337);
+
+	/* once full, new macs are ignored but known ones are updated */
+	for (uint32_t j = 0; j < 2000; ++j) {
+		m.mac = 0x525400000000LLU + j;
+		pg_mac_table_elem_set(&ma, m, &j, 4);
+	}
+	g_assert(pg_mac_table_compute_length(&ma) == 1000);
+	m.mac = 0x525400000000LLU + 1500;
+	g_assert(!pg_mac_table_elem_get(&ma, m, uint32_t));
+	m.mac = 4;
+	val = 42;
+	pg_mac_table_elem_set(&ma, m, &val, 4);
+	g_assert(*pg_mac_table_elem_get(&ma, m, uint32_t) == 42);
+
+	/* unset while iterating */
+	PG_MAC_TABLE_FOREACH_ELEM(&ma, k, uint32_t, v) {
+		if (k.mac < 0x525400000000LLU) {
+			++i;
+			continue;
+		}
+		g_assert(k.mac - 0x525400000000LLU == *v);
+		if (*v & 1)
+			g_assert(!pg_mac_table_elem_unset(&ma, k));
+		++i;
+	}
+	g_assert(i == 1000);
+	g_assert(pg_mac_table_compute_length(&ma) == 501);
+	m.mac = 0x525400000000LLU + 1;
+	g_assert(pg_mac_table_elem_unset(&ma, m) < 0);
+
+	/* fill and empty the table many times to force tombstone purges */
+	for (uint32_t r = 1; r < 50; ++r) {
+		for (uint32_t j = 0; j < 499; ++j) {
+			m.mac = 0x0a0000000000LLU + r * 0x10000 + j;
+			pg_mac_table_elem_set(&ma, m, &j, 4);
+		}
+		g_assert(pg_mac_table_compute_length(&ma) == 1000);
+		for (uint32_t j = 0; j < 499; ++j) {
+			m.mac = 0x0a0000000000LLU + r * 0x10000 + j;
+			g_assert(*pg_mac_table_elem_get(&ma, m, uint32_t) == j);
+			g_assert(!pg_mac_table_elem_unset(&ma, m));
+		}
+	}
+	for (uint32_t j = 0; j < 998; j += 2) {
+		m.mac = 0x525400000000LLU + j;
+		g_assert(*pg_mac_table_elem_get(&ma, m, uint32_t) == j);
+	}
+	pg_mac_table_clear(&ma);
+	g_assert(pg_mac_table_compute_length(&ma) == 0);
+	pg_mac_table_free(&ma);
+
+	/* check mac table containing pointers */
+	val = 1337;
+	g_assert(!pg_mac_table_init_compact(&ma, 16, 0, NULL));
+	m.mac = 0;
+	pg_mac_table_ptr_set(&ma, m, &val);
+	m.mac = 4;
+	pg_mac_table_ptr_set(&ma, m, &val);
+	m.mac = 50000004;
+	pg_mac_table_ptr_set(&ma, m, &val);
+	m.mac = 0;
+	pg_mac_table_ptr_unset(&ma, m);
+	g_assert(!pg_mac_table_ptr_get(&ma, m));
+	i = 0;
+	PG_MAC_TABLE_FOREACH_PTR(&ma, k2, uint32_t, val_check) {
+		g_assert(val_check == &val);
+		g_assert(k2.mac == 4 || k2.mac == 50000004);
+		++i;
+	}
+	g_assert(i == 2);
+	pg_mac_table_free(&ma);
+}
+
 #undef MULTIPLE_OPS
 #undef MULTIPLE_OPS_EQ
 
@@ -1015,5 +1109,7 @@ void test_brick_core(void)
 			test_brick_verify_re_link_monopole);
 	pg_test_add_func("/core/verify/big_endian", test_big_endian);
 	pg_test_add_func("/core/verify/mac_table", test_mac_table);
+	pg_test_add_func("/core/verify/mac_table_compact",
+			 test_mac_table_compact);
 }
 
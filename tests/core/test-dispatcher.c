@@ -0,0 +1,240 @@
+/* Copyright 2019 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <arpa/inet.h>
+#include <rte_config.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+#include <rte_udp.h>
+#include <packetgraph/packetgraph.h>
+#include <packetgraph/dispatcher.h>
+#include "utils/tests.h"
+#include "brick-int.h"
+#include "packets.h"
+#include "utils/bitmask.h"
+#include "collect.h"
+#include "tests.h"
+
+#define NB_EDGES 4
+
+static struct rte_mbuf **dispatcher_pkts(uint64_t mask)
+{
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct rte_mbuf **pkts = pg_packets_create(mask);
+
+	/* 16 UDP flows of 4 packets */
+	pg_packets_append_ether(pkts, mask, &mac, &mac, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, mask, inet_addr("10.0.0.1"),
+			       inet_addr("10.0.0.2"),
+			       sizeof(struct udp_hdr), 17);
+	PG_FOREACH_BIT(mask, i) {
+		pg_packets_append_udp(pkts, ONE64 << i, 1000 + i % 16, 53,
+				      sizeof(struct udp_hdr));
+		pkts[i]->udata64 = i;
+	}
+	return pkts;
+}
+
+static void test_dispatcher_flows(void)
+{
+	struct pg_error *error = NULL;
+	uint64_t mask = pg_mask_firsts(64);
+	struct pg_brick *col[NB_EDGES];
+	struct pg_brick *west, *dispatcher;
+	struct rte_mbuf **pkts, **res;
+	uint16_t reta[PG_DISPATCHER_RETA_SIZE];
+	uint64_t res_mask, all = 0;
+	int flow_edge[16];
+	uint64_t total = 0;
+
+	dispatcher = pg_dispatcher_new("dispatcher", 1, NB_EDGES,
+				       PG_EAST_SIDE, &error);
+	g_assert(!error);
+	g_assert(dispatcher);
+	west = pg_collect_new("west", &error);
+	g_assert(!error);
+	g_assert(!pg_brick_link(west, dispatcher, &error));
+	for (int i = 0; i < NB_EDGES; i++) {
+		char *name = g_strdup_printf("col%d", i);
+
+		col[i] = pg_collect_new(name, &error);
+		g_assert(!error);
+		g_assert(!pg_brick_link(dispatcher, col[i], &error));
+		g_free(name);
+	}
+	pkts = dispatcher_pkts(mask);
+
+	/* packets of a flow all go to the same edge */
+	for (int i = 0; i < 16; i++)
+		flow_edge[i] = -1;
+	g_assert(!pg_brick_burst_to_east(dispatcher, 0, pkts, mask, &error));
+	g_assert(!error);
+	for (int e = 0; e < NB_EDGES; e++) {
+		res = pg_brick_west_burst_get(col[e], &res_mask, &error);
+		g_assert(!error);
+		g_assert(!(all & res_mask));
+		all |= res_mask;
+		g_assert(pg_dispatcher_edge_pkts(dispatcher, e) ==
+			 (uint64_t)pg_mask_count(res_mask));
+		total += pg_dispatcher_edge_pkts(dispatcher, e);
+		PG_FOREACH_BIT(res_mask, i) {
+			int flow = res[i]->udata64 % 16;
+
+			g_assert(flow_edge[flow] == -1 ||
+				 flow_edge[flow] == e);
+			flow_edge[flow] = e;
+		}
+	}
+	g_assert(all == mask);
+	g_assert(total == 64);
+
+	/* nic RSS hashes are used as is */
+	pg_dispatcher_pkts_reset(dispatcher);
+	PG_FOREACH_BIT(mask, i) {
+		pkts[i]->ol_flags |= PKT_RX_RSS_HASH;
+		pkts[i]->hash.rss = i % 8;
+	}
+	g_assert(!pg_brick_burst_to_east(dispatcher, 0, pkts, mask, &error));
+	g_assert(!error);
+	for (int e = 0; e < NB_EDGES; e++) {
+		g_assert(pg_dispatcher_edge_pkts(dispatcher, e) == 16);
+		pg_brick_west_burst_get(col[e], &res_mask, &error);
+		g_assert(res_mask == 0x1111111111111111LLU << e);
+	}
+	for (int b = 0; b < 8; b++)
+		g_assert(pg_dispatcher_reta_pkts(dispatcher, b) == 8);
+	g_assert(pg_dispatcher_reta_pkts(dispatcher, 8) == 0);
+
+	/* move everything to one edge */
+	pg_dispatcher_reta_get(dispatcher, reta);
+	for (int i = 0; i < PG_DISPATCHER_RETA_SIZE; i++) {
+		g_assert(reta[i] == i % NB_EDGES);
+		reta[i] = 2;
+	}
+	g_assert(!pg_dispatcher_reta_set(dispatcher, reta, &error));
+	g_assert(!error);
+	pg_dispatcher_pkts_reset(dispatcher);
+	g_assert(!pg_brick_burst_to_east(dispatcher, 0, pkts, mask, &error));
+	g_assert(!error);
+	g_assert(pg_dispatcher_edge_pkts(dispatcher, 2) == 64);
+	g_assert(pg_dispatcher_edge_pkts(dispatcher, 0) == 0);
+	pg_brick_west_burst_get(col[2], &res_mask, &error);
+	g_assert(res_mask == mask);
+
+	reta[3] = NB_EDGES;
+	g_assert(pg_dispatcher_reta_set(dispatcher, reta, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	/* packets from output edges go back to the west */
+	g_assert(!pg_brick_burst_to_west(dispatcher, 1, pkts,
+					 pg_mask_firsts(8), &error));
+	g_assert(!error);
+	pg_brick_east_burst_get(west, &res_mask, &error);
+	g_assert(res_mask == pg_mask_firsts(8));
+
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+	pg_brick_destroy(dispatcher);
+	pg_brick_destroy(west);
+	for (int i = 0; i < NB_EDGES; i++)
+		pg_brick_destroy(col[i]);
+}
+
+static void test_dispatcher_few_links(void)
+{
+	struct pg_error *error = NULL;
+	uint64_t mask = pg_mask_firsts(64);
+	struct pg_brick *col[NB_EDGES];
+	struct pg_brick *dispatcher;
+	struct rte_mbuf **pkts;
+	uint16_t reta[PG_DISPATCHER_RETA_SIZE];
+	uint64_t res_mask, all = 0;
+
+	/* only 2 of the 4 output edges are linked */
+	dispatcher = pg_dispatcher_new("dispatcher", 1, NB_EDGES,
+				       PG_EAST_SIDE, &error);
+	g_assert(!error);
+	for (int i = 0; i < NB_EDGES; i++) {
+		char *name = g_strdup_printf("col%d", i);
+
+		col[i] = pg_collect_new(name, &error);
+		g_assert(!error);
+		g_free(name);
+	}
+	g_assert(!pg_brick_link(dispatcher, col[0], &error));
+	g_assert(!pg_brick_link(dispatcher, col[1], &error));
+	pkts = dispatcher_pkts(mask);
+
+	/* the default table only uses linked edges */
+	pg_dispatcher_reta_get(dispatcher, reta);
+	for (int i = 0; i < PG_DISPATCHER_RETA_SIZE; i++)
+		g_assert(reta[i] == i % 2);
+	g_assert(!pg_brick_burst_to_east(dispatcher, 0, pkts, mask, &error));
+	g_assert(!error);
+	for (int e = 0; e < 2; e++) {
+		pg_brick_west_burst_get(col[e], &res_mask, &error);
+		g_assert(pg_dispatcher_edge_pkts(dispatcher, e) ==
+			 (uint64_t)pg_mask_count(res_mask));
+		all |= res_mask;
+	}
+	g_assert(all == mask);
+	g_assert(pg_dispatcher_edge_pkts(dispatcher, 2) == 0);
+	g_assert(pg_dispatcher_edge_pkts(dispatcher, 3) == 0);
+
+	/* user tables can not point to unlinked edges */
+	reta[7] = 2;
+	g_assert(pg_dispatcher_reta_set(dispatcher, reta, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	/* unlinking an edge moves its flows to the remaining one */
+	pg_brick_unlink(col[0], &error);
+	g_assert(!error);
+	pg_dispatcher_reta_get(dispatcher, reta);
+	for (int i = 0; i < PG_DISPATCHER_RETA_SIZE; i++)
+		g_assert(reta[i] == 1);
+	pg_dispatcher_pkts_reset(dispatcher);
+	g_assert(!pg_brick_burst_to_east(dispatcher, 0, pkts, mask, &error));
+	g_assert(!error);
+	g_assert(pg_dispatcher_edge_pkts(dispatcher, 1) == 64);
+	pg_brick_west_burst_get(col[1], &res_mask, &error);
+	g_assert(res_mask == mask);
+
+	/* a user table is kept when edges are linked */
+	g_assert(!pg_dispatcher_reta_set(dispatcher, reta, &error));
+	g_assert(!pg_brick_link(dispatcher, col[2], &error));
+	g_assert(!error);
+	pg_dispatcher_reta_get(dispatcher, reta);
+	for (int i = 0; i < PG_DISPATCHER_RETA_SIZE; i++)
+		g_assert(reta[i] == 1);
+
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+	pg_brick_destroy(dispatcher);
+	for (int i = 0; i < NB_EDGES; i++)
+		pg_brick_destroy(col[i]);
+}
+
+void test_dispatcher(void)
+{
+	pg_test_add_func("/dispatcher/flows", test_dispatcher_flows);
+	pg_test_add_func("/dispatcher/few_links", test_dispatcher_few_links);
+}
@@ -18,8 +18,10 @@
 #include <glib.h>
 #include <glib/gprintf.h>
 #include <string.h>
+#include <arpa/inet.h>
 #include <rte_config.h>
 #include <rte_ether.h>
+#include <rte_mbuf.h>
 #include <packetgraph/packetgraph.h>
 #include "utils/tests.h"
 #include "tests.h"
@@ -690,6 +692,389 @@ static void test_graph_complex_merge(void)
 	pg_graph_destroy(g_west);
 }
 
+#define PARTITION_PKTS 800
+#define PARTITION_ROUNDS 110
+
+struct partition_sink {
+	uint64_t pkts;
+	uint64_t bytes;
+	uint64_t hash;
+};
+
+static void partition_tx(struct pg_brick *brick, pg_packet_t **tx_burst,
+			 uint16_t *tx_burst_len, void *private_data)
+{
+	uint32_t *seq = private_data;
+
+	*tx_burst_len = 0;
+	for (uint16_t i = 0; i < 8 && *seq < PARTITION_PKTS; ++i) {
+		g_assert(!pg_packet_set_len(tx_burst[i], 60 + *seq % 32));
+		pg_packet_data(tx_burst[i])[0] = *seq;
+		*tx_burst_len = i + 1;
+		*seq += 1;
+	}
+}
+
+static void partition_rx(struct pg_brick *brick, pg_packet_t **rx_burst,
+			 uint16_t rx_burst_len, void *private_data)
+{
+	struct partition_sink *sink = private_data;
+
+	for (uint16_t i = 0; i < rx_burst_len; ++i) {
+		sink->pkts++;
+		sink->bytes += pg_packet_len(rx_burst[i]);
+		sink->hash = sink->hash * 31 + pg_packet_data(rx_burst[i])[0];
+	}
+}
+
+/* [gen]--[nop0]--[nop1]--[nop2]--[nop3]--[sink] */
+static struct pg_graph *partition_chain(struct pg_brick **nop,
+					uint32_t *seq,
+					struct partition_sink *sink)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *gen = pg_rxtx_new("gen", NULL, partition_tx, seq);
+	struct pg_brick *rx = pg_rxtx_new("sink", partition_rx, NULL, sink);
+	struct pg_graph *g;
+	char *tmp;
+
+	g_assert(gen && rx);
+	for (int i = 0; i < 4; i++) {
+		tmp = g_strdup_printf("nop%i", i);
+		nop[i] = pg_nop_new(tmp, &error);
+		g_assert(nop[i]);
+		g_free(tmp);
+	}
+	g_assert(!pg_brick_chained_links(&error, gen, nop[0], nop[1],
+					 nop[2], nop[3], rx));
+	g_assert(!error);
+	g = pg_graph_new("partition", gen, &error);
+	g_assert(g && !error);
+	g_assert(pg_graph_count(g) == 6);
+	return g;
+}
+
+static void test_graph_partition(void)
+{
+	struct partition_sink serial = {0, 0, 0};
+	struct partition_sink parted = {0, 0, 0};
+	uint32_t serial_seq = 0, parted_seq = 0;
+	struct pg_graph *parts[8];
+	struct pg_brick *nop[4];
+	struct pg_error *error = NULL;
+	struct pg_graph *g;
+	int nb;
+
+	/* reference run on a single core */
+	g = partition_chain(nop, &serial_seq, &serial);
+	for (int i = 0; i < PARTITION_ROUNDS; i++)
+		g_assert(!pg_graph_poll(g, &error));
+	g_assert(!error);
+	g_assert(serial.pkts == PARTITION_PKTS);
+	pg_graph_destroy(g);
+
+	g = partition_chain(nop, &parted_seq, &parted);
+	g_assert(pg_graph_partition(g, 0, parts, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	/*
+	 * nop1 costs as much as the four other bricks:
+	 * [gen]--[nop0]--[q] ~ [q]--[nop1]--[q] ~ [q]--[nop2]--[nop3]--[sink]
+	 */
+	pg_brick_weight_set(nop[1], 4);
+	g_assert(pg_brick_weight(nop[1]) == 4);
+	g_assert(pg_graph_partition(g, 3, parts, &error) == 3);
+	g_assert(!error);
+	g_assert(parts[0] == g);
+	g_assert(pg_graph_count(parts[0]) == 3);
+	g_assert(pg_graph_get(parts[0], "gen"));
+	g_assert(pg_graph_get(parts[0], "nop0") == nop[0]);
+	g_assert(pg_graph_get(parts[0], "nop0-nop1-queue-west"));
+	g_assert(pg_graph_count(parts[1]) == 3);
+	g_assert(pg_graph_get(parts[1], "nop0-nop1-queue-east"));
+	g_assert(pg_graph_get(parts[1], "nop1") == nop[1]);
+	g_assert(pg_graph_get(parts[1], "nop1-nop2-queue-west"));
+	g_assert(pg_graph_count(parts[2]) == 4);
+	g_assert(pg_graph_get(parts[2], "nop1-nop2-queue-east"));
+	g_assert(pg_graph_get(parts[2], "sink"));
+	for (int i = 0; i < 3; i++) {
+		g_assert(!pg_graph_sanity(parts[i], &error));
+		g_assert(!error);
+	}
+
+	/* running stages one after the other gives the serial output */
+	for (int i = 0; i < PARTITION_ROUNDS; i++) {
+		for (int p = 0; p < 3; p++)
+			g_assert(!pg_graph_poll(parts[p], &error));
+	}
+	g_assert(!error);
+	g_assert(parted.pkts == serial.pkts);
+	g_assert(parted.bytes == serial.bytes);
+	g_assert(parted.hash == serial.hash);
+
+	g_assert(!pg_graph_merge(parts[0], parts[1], &error));
+	g_assert(!pg_graph_merge(parts[0], parts[2], &error));
+	g_assert(!error);
+	g_assert(pg_graph_count(g) == 6);
+	g_assert(!pg_graph_sanity(g, &error));
+	g_assert(!error);
+
+	/* no more parts than bricks */
+	nb = pg_graph_partition(g, 8, parts, &error);
+	g_assert(nb == 6);
+	g_assert(!error);
+	for (int i = 1; i < nb; i++)
+		g_assert(!pg_graph_merge(parts[0], parts[i], &error));
+	g_assert(!error);
+	g_assert(pg_graph_count(g) == 6);
+
+	pg_graph_destroy(g);
+}
+
+/* outer headers of a packet encapsulated by a vtep over IPv4 */
+#define PARTITION_VXLAN_HDR (14 + 20 + 8 + 8)
+
+/* broadcast frames from a few sources, so they are flooded everywhere */
+static void partition_l2_tx(struct pg_brick *brick, pg_packet_t **tx_burst,
+			    uint16_t *tx_burst_len, void *private_data)
+{
+	uint32_t *seq = private_data;
+
+	*tx_burst_len = 0;
+	for (uint16_t i = 0; i < 8 && *seq < PARTITION_PKTS; ++i) {
+		uint16_t len = 60 + *seq % 32;
+		uint8_t *data = pg_packet_data(tx_burst[i]);
+
+		g_assert(!pg_packet_set_len(tx_burst[i], len));
+		memset(data, *seq, len);
+		memcpy(data, "\xff\xff\xff\xff\xff\xff", 6);
+		memcpy(data + 6, "\x52\x54\x00\x00\x00", 5);
+		data[11] = 1 + *seq % 4;
+		*tx_burst_len = i + 1;
+		*seq += 1;
+	}
+}
+
+static void partition_vxlan_rx(struct pg_brick *brick, pg_packet_t **rx_burst,
+			       uint16_t rx_burst_len, void *private_data)
+{
+	struct partition_sink *sink = private_data;
+	uint8_t buf[2048];
+
+	for (uint16_t i = 0; i < rx_burst_len; ++i) {
+		uint32_t len = pg_packet_len(rx_burst[i]);
+		const uint8_t *inner;
+
+		sink->pkts++;
+		sink->bytes += len;
+		/* flood replicas may chain the inner frame to the headers */
+		if (len <= PARTITION_VXLAN_HDR)
+			continue;
+		len -= PARTITION_VXLAN_HDR;
+		g_assert(len <= sizeof(buf));
+		inner = rte_pktmbuf_read(rx_burst[i], PARTITION_VXLAN_HDR,
+					 len, buf);
+		g_assert(inner);
+		for (uint32_t j = 0; j < len; ++j)
+			sink->hash = sink->hash * 31 + inner[j];
+	}
+}
+
+/* [gen]--[switch]--[vtep]--[sink] */
+static struct pg_graph *partition_vxlan(struct pg_brick **sw,
+					struct pg_brick **vtep,
+					uint32_t *seq,
+					struct partition_sink *sink)
+{
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x00, 0x01, 0x01}};
+	struct pg_error *error = NULL;
+	struct pg_brick *gen, *rx;
+	struct pg_graph *g;
+
+	gen = pg_rxtx_new("gen", NULL, partition_l2_tx, seq);
+	rx = pg_rxtx_new("sink", partition_vxlan_rx, NULL, sink);
+	g_assert(gen && rx);
+	*sw = pg_switch_new("switch", 1, 1, PG_EAST_SIDE, &error);
+	g_assert(*sw && !error);
+	*vtep = pg_vtep_new_by_string("vtep", 1, PG_EAST_SIDE, "10.0.0.1",
+				      mac, PG_VTEP_DST_PORT, PG_VTEP_NONE,
+				      &error);
+	g_assert(*vtep && !error);
+	g_assert(!pg_brick_chained_links(&error, gen, *sw, *vtep, rx));
+	g_assert(!error);
+	g_assert(!pg_vtep_add_vni(*vtep, *sw, 1, inet_addr("225.0.0.50"),
+				  &error));
+	g_assert(!error);
+	g = pg_graph_new("partition", gen, &error);
+	g_assert(g && !error);
+	g_assert(pg_graph_count(g) == 4);
+	return g;
+}
+
+static void test_graph_partition_vxlan(void)
+{
+	struct partition_sink serial = {0, 0, 0};
+	struct partition_sink parted = {0, 0, 0};
+	uint32_t serial_seq = 0, parted_seq = 0;
+	struct pg_graph *parts[4];
+	struct pg_error *error = NULL;
+	struct pg_brick *sw, *vtep;
+	struct pg_graph *g;
+
+	/* reference run on a single core */
+	g = partition_vxlan(&sw, &vtep, &serial_seq, &serial);
+	for (int i = 0; i < PARTITION_ROUNDS; i++)
+		g_assert(!pg_graph_poll(g, &error));
+	g_assert(!error);
+	/* encapsulated frames and the IGMP join of the VNI */
+	g_assert(serial.pkts == PARTITION_PKTS + 1);
+	pg_graph_destroy(g);
+
+	/*
+	 * Every edge is cut, the VNI of the switch port and the MACs learned
+	 * by both bricks must survive:
+	 * [gen]--[q] ~ [q]--[switch]--[q] ~ [q]--[vtep]--[q] ~ [q]--[sink]
+	 */
+	g = partition_vxlan(&sw, &vtep, &parted_seq, &parted);
+	for (int i = 0; i < PARTITION_ROUNDS / 2; i++)
+		g_assert(!pg_graph_poll(g, &error));
+	g_assert(!error);
+	g_assert(pg_graph_partition(g, 4, parts, &error) == 4);
+	g_assert(!error);
+	g_assert(pg_graph_get(parts[1], "switch") == sw);
+	g_assert(pg_graph_get(parts[2], "vtep") == vtep);
+	g_assert(pg_graph_get(parts[2], "switch-vtep-queue-east"));
+	for (int i = 0; i < 4; i++) {
+		g_assert(pg_graph_count(parts[i]) == 1 + !!i + (i < 3));
+		g_assert(!pg_graph_sanity(parts[i], &error));
+		g_assert(!error);
+	}
+	for (int i = PARTITION_ROUNDS / 2; i < PARTITION_ROUNDS; i++) {
+		for (int p = 0; p < 4; p++)
+			g_assert(!pg_graph_poll(parts[p], &error));
+	}
+	g_assert(!error);
+	g_assert(parted.pkts == serial.pkts);
+	g_assert(parted.bytes == serial.bytes);
+	g_assert(parted.hash == serial.hash);
+
+	for (int i = 1; i < 4; i++)
+		g_assert(!pg_graph_merge(parts[0], parts[i], &error));
+	g_assert(!error);
+	g_assert(pg_graph_count(g) == 4);
+	pg_graph_destroy(g);
+}
+
+#define FLUSH_INPUTS 4
+#define FLUSH_BURST 4
+
+struct flush_sink {
+	uint64_t calls;
+	uint64_t pkts;
+};
+
+static void flush_tx(struct pg_brick *brick, pg_packet_t **tx_burst,
+		     uint16_t *tx_burst_len, void *private_data)
+{
+	uint8_t *id = private_data;
+
+	for (uint16_t i = 0; i < FLUSH_BURST; ++i) {
+		uint8_t *data = pg_packet_data(tx_burst[i]);
+
+		g_assert(!pg_packet_set_len(tx_burst[i], 60));
+		memset(data, 0, 60);
+		/* unknown destination, flooded by the switch */
+		memcpy(data, "\x52\x54\x00\x00\x00\xff", 6);
+		memcpy(data + 6, "\x52\x54\x00\x00\x00", 5);
+		data[11] = *id;
+	}
+	*tx_burst_len = FLUSH_BURST;
+}
+
+static void flush_rx(struct pg_brick *brick, pg_packet_t **rx_burst,
+		     uint16_t rx_burst_len, void *private_data)
+{
+	struct flush_sink *sink = private_data;
+
+	sink->calls++;
+	sink->pkts += rx_burst_len;
+}
+
+static void test_graph_flush(void)
+{
+	struct pg_brick *gen[FLUSH_INPUTS], *sw, *rx;
+	uint8_t ids[FLUSH_INPUTS];
+	struct flush_sink sink = {0, 0};
+	struct pg_error *error = NULL;
+	struct pg_graph *g;
+	uint16_t count;
+
+	/*
+	 * [gen0]--\
+	 * [gen1]---[switch]--[sink]
+	 * [gen.]--/
+	 */
+	sw = pg_switch_new("switch", FLUSH_INPUTS, 1, PG_EAST_SIDE, &error);
+	g_assert(sw && !error);
+	rx = pg_rxtx_new("sink", flush_rx, NULL, &sink);
+	g_assert(rx);
+	g_assert(!pg_brick_link(sw, rx, &error));
+	for (int i = 0; i < FLUSH_INPUTS; i++) {
+		char *tmp = g_strdup_printf("gen%i", i);
+
+		ids[i] = i;
+		gen[i] = pg_rxtx_new(tmp, NULL, flush_tx, &ids[i]);
+		g_assert(gen[i]);
+		g_assert(!pg_brick_link(gen[i], sw, &error));
+		g_free(tmp);
+	}
+	g = pg_graph_new("flush", sw, &error);
+	g_assert(g && !error);
+	g_assert(!pg_brick_flushable(sw));
+	g_assert(!pg_brick_flushable(rx));
+
+	/* each input burst is forwarded on its own */
+	g_assert(!pg_graph_poll(g, &error));
+	g_assert(!error);
+	g_assert(sink.calls == FLUSH_INPUTS);
+	g_assert(sink.pkts == FLUSH_INPUTS * FLUSH_BURST);
+
+	/* deferred switch forwards all of them at the end of the poll,
+	 * the graph notices the switch became flushable
+	 */
+	g_assert(!pg_switch_set_deferred(sw, true, &error));
+	g_assert(!error);
+	g_assert(pg_brick_flushable(sw));
+	sink.calls = 0;
+	sink.pkts = 0;
+	g_assert(!pg_graph_poll(g, &error));
+	g_assert(!error);
+	g_assert(sink.calls == 1);
+	g_assert(sink.pkts == FLUSH_INPUTS * FLUSH_BURST);
+
+	/* disabling deferred mode forwards staged packets */
+	g_assert(!pg_brick_poll(gen[0], &count, &error));
+	g_assert(!error);
+	g_assert(sink.calls == 1);
+	g_assert(!pg_switch_set_deferred(sw, false, &error));
+	g_assert(!error);
+	g_assert(!pg_brick_flushable(sw));
+	g_assert(sink.calls == 2);
+	g_assert(sink.pkts == (FLUSH_INPUTS + 1) * FLUSH_BURST);
+
+	/* back to direct mode, each input burst is forwarded on its own */
+	g_assert(!pg_graph_poll(g, &error));
+	g_assert(!error);
+	g_assert(sink.calls == 2 + FLUSH_INPUTS);
+
+	pg_graph_destroy(g);
+}
+
+#undef FLUSH_INPUTS
+#undef FLUSH_BURST
+
 void test_graph(void)
 {
 	pg_test_add_func("/core/graph/lifecycle", test_graph_lifecycle);
@@ -698,4 +1083,8 @@ void test_graph(void)
 	pg_test_add_func("/core/graph/poll", test_graph_poll);
 	pg_test_add_func("/core/graph/complex-merge", test_graph_complex_merge);
 	pg_test_add_func("/core/graph/split-merge", test_graph_split_merge);
+	pg_test_add_func("/core/graph/partition", test_graph_partition);
+	pg_test_add_func("/core/graph/partition-vxlan",
+			 test_graph_partition_vxlan);
+	pg_test_add_func("/core/graph/flush", test_graph_flush);
 }
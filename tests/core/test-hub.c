@@ -199,6 +199,69 @@ static void test_hub_west_dispatch(void)
 	TEST_HUB_DESTROY();
 }
 
+/* stats keep counting once the hub stops sending back */
+static void test_hub_no_backward_stats(void)
+{
+	struct pg_brick *hub;
+	struct pg_brick *collect0_1, *collect0_2, *collect1_1, *collect1_2;
+	struct rte_mbuf *pkts[NB_PKTS], **result_pkts;
+	struct rte_mempool *mbuf_pool = pg_get_mempool();
+	struct pg_error *error = NULL;
+	struct pg_brick_stats stats;
+	uint16_t i;
+	uint64_t pkts_mask;
+
+	for (i = 0; i < NB_PKTS; i++) {
+		pkts[i] = rte_pktmbuf_alloc(mbuf_pool);
+		g_assert(pkts[i]);
+		pkts[i]->udata64 = i;
+	}
+	hub = pg_hub_new("myhub", 4, 4, &error);
+	g_assert(!error);
+	collect0_1 = pg_collect_new("collect0_1", &error);
+	g_assert(!error);
+	collect0_2 = pg_collect_new("collect0_2", &error);
+	g_assert(!error);
+	collect1_1 = pg_collect_new("collect1_1", &error);
+	g_assert(!error);
+	collect1_2 = pg_collect_new("collect1_2", &error);
+	g_assert(!error);
+	pg_brick_link(collect0_1, hub, &error);
+	g_assert(!error);
+	pg_brick_link(collect0_2, hub, &error);
+	g_assert(!error);
+	pg_brick_link(hub, collect1_1, &error);
+	g_assert(!error);
+	pg_brick_link(hub, collect1_2, &error);
+	g_assert(!error);
+
+	g_assert(!pg_brick_stats_enable(hub, &error));
+	g_assert(!error);
+	pg_hub_set_no_backward(hub, 1);
+	g_assert(pg_brick_stats_enabled(hub));
+
+	pg_brick_burst_to_east(hub, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	g_assert(!error);
+	g_assert(!pg_brick_stats_get(hub, &stats, &error));
+	g_assert(stats.sides[PG_WEST_SIDE].calls == 1);
+	g_assert(stats.sides[PG_WEST_SIDE].pkts == NB_PKTS);
+	TEST_HUB_COLLECT_AND_TEST(pg_brick_east_burst_get, collect0_2, 0);
+	TEST_HUB_COLLECT_AND_TEST(pg_brick_west_burst_get, collect1_1, NB_PKTS);
+
+	/* the hub still does not send back without stats */
+	pg_brick_stats_disable(hub);
+	pg_brick_burst_to_east(hub, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	g_assert(!error);
+	g_assert(!pg_brick_stats_get(hub, &stats, &error));
+	g_assert(stats.sides[PG_WEST_SIDE].calls == 1);
+	TEST_HUB_COLLECT_AND_TEST(pg_brick_east_burst_get, collect0_2, 0);
+	TEST_HUB_COLLECT_AND_TEST(pg_brick_west_burst_get, collect1_2, NB_PKTS);
+
+	TEST_HUB_DESTROY();
+}
+
 /*Test, allow create multipole with a null side*/
 
 static void test_hub_one_side_null(void)
@@ -347,4 +410,6 @@ void test_hub(void)
 	pg_test_add_func("/hub/east", test_hub_east_dispatch);
 	pg_test_add_func("/hub/west", test_hub_west_dispatch);
 	pg_test_add_func("/hub/test_side_null", test_hub_one_side_null);
+	pg_test_add_func("/hub/no_backward/stats",
+			 test_hub_no_backward_stats);
 }
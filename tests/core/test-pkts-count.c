@@ -156,6 +156,106 @@ static void test_brick_pkts_count_east(void)
 	TEST_PKTS_COUNT_DESTROY();
 }
 
+static void test_brick_pkts_count_stats(void)
+{
+	TEST_PKTS_COUNT_INIT();
+	struct pg_brick_stats stats;
+	void *burst = brick->burst;
+	char *dot;
+	int j;
+
+	g_assert(pg_brick_stats_get(brick, &stats, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	g_assert(!pg_brick_stats_enable(brick, &error));
+	g_assert(!error);
+	g_assert(!pg_brick_stats_enable(collect_east, &error));
+	g_assert(!error);
+	g_assert(pg_brick_stats_enabled(brick));
+	g_assert(brick->burst != burst);
+
+	for (j = 0; j < NB_LOOP; ++j) {
+		pg_brick_burst_to_east(brick, 0, pkts,
+				       pg_mask_firsts(NB_PKTS), &error);
+		g_assert(!error);
+	}
+	pg_brick_burst_to_east(brick, 0, pkts, 0, &error);
+	g_assert(!error);
+
+	g_assert(!pg_brick_stats_get(brick, &stats, &error));
+	g_assert(!error);
+	g_assert(stats.sides[PG_WEST_SIDE].calls == NB_LOOP + 1);
+	g_assert(stats.sides[PG_WEST_SIDE].pkts == NB_LOOP * NB_PKTS);
+	g_assert(stats.sides[PG_WEST_SIDE].burst_size_hist[0] == 1);
+	/* 3 packets bursts go in the [2, 3] bucket */
+	g_assert(stats.sides[PG_WEST_SIDE].burst_size_hist[2] == NB_LOOP);
+	g_assert(stats.sides[PG_EAST_SIDE].calls == 0);
+	g_assert(stats.poll.calls == 0);
+
+	g_assert(!pg_brick_stats_get(collect_east, &stats, &error));
+	g_assert(!error);
+	g_assert(stats.sides[PG_WEST_SIDE].calls == NB_LOOP + 1);
+
+	dot = pg_brick_dot(brick);
+	g_assert(strstr(dot, "west: 5 calls, 12 pkts"));
+	free(dot);
+
+	pg_brick_stats_disable(brick);
+	g_assert(!pg_brick_stats_enabled(brick));
+	g_assert(brick->burst == burst);
+	pg_brick_burst_to_east(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	g_assert(!error);
+	g_assert(!pg_brick_stats_get(brick, &stats, &error));
+	g_assert(stats.sides[PG_WEST_SIDE].calls == NB_LOOP + 1);
+
+	pg_brick_stats_reset(brick);
+	g_assert(!pg_brick_stats_get(brick, &stats, &error));
+	g_assert(stats.sides[PG_WEST_SIDE].calls == 0);
+	g_assert(stats.sides[PG_WEST_SIDE].cycles == 0);
+	TEST_PKTS_COUNT_DESTROY();
+}
+
+#define PKTS_COUNT_THREAD_LOOPS 100000
+
+static gpointer pkts_count_thread(gpointer data)
+{
+	struct pg_brick *brick = data;
+	struct pg_error *error = NULL;
+	struct rte_mbuf *pkts[PG_MAX_PKTS_BURST] = { NULL };
+
+	for (int j = 0; j < PKTS_COUNT_THREAD_LOOPS; ++j)
+		pg_brick_burst_to_east(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+				       &error);
+	g_assert(!error);
+	return NULL;
+}
+
+static void test_brick_pkts_count_threads(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *brick;
+	GThread *threads[2];
+
+	/* a lonely nop does not touch packets, so no need to allocate them */
+	brick = pg_nop_new("nop", &error);
+	g_assert(!error);
+
+	/* non-EAL threads share the same counter slot */
+	threads[0] = g_thread_new("count 0", pkts_count_thread, brick);
+	threads[1] = g_thread_new("count 1", pkts_count_thread, brick);
+	pkts_count_thread(brick);
+	g_thread_join(threads[0]);
+	g_thread_join(threads[1]);
+
+	g_assert(pg_brick_pkts_count_get(brick, PG_EAST_SIDE) ==
+		 3 * PKTS_COUNT_THREAD_LOOPS * NB_PKTS);
+	g_assert(pg_brick_pkts_count_get(brick, PG_WEST_SIDE) == 0);
+	pg_brick_destroy(brick);
+}
+
 #undef	TEST_PKTS_COUNT_CHECK
 #undef	TEST_PKTS_COUNT_INIT
 #undef	TEST_PKTS_COUNT_DESTROY
@@ -165,4 +265,8 @@ void test_pkts_count(void)
 	/* tests in the same order as the header function declarations */
 	pg_test_add_func("/core/pkts-counter/west", test_brick_pkts_count_west);
 	pg_test_add_func("/core/pkts-counter/east", test_brick_pkts_count_east);
+	pg_test_add_func("/core/pkts-counter/stats",
+			 test_brick_pkts_count_stats);
+	pg_test_add_func("/core/pkts-counter/threads",
+			 test_brick_pkts_count_threads);
 }
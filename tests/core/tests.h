@@ -32,6 +32,7 @@ void test_mac(void);
 void test_pkts_count(void);
 void test_benchmark_nop(void);
 void test_hub(void);
+void test_dispatcher(void);
 void test_graph(void);
 
 extern uint16_t  max_pkts;
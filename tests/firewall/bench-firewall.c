@@ -16,6 +16,7 @@
  */
 
 #include "bench.h"
+#include <stdio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <rte_config.h>
@@ -97,3 +98,99 @@ void test_benchmark_firewall(int argc, char **argv)
 	g_free(bench.pkts);
 }
 
+#define FIREWALL_BENCH_FLOWS 65536
+
+static uint16_t firewall_bench_port;
+
+/* move the burst to the next 64 flows */
+static void firewall_bench_next_flows(struct pg_bench *bench)
+{
+	firewall_bench_port += 64;
+	if (firewall_bench_port >= FIREWALL_BENCH_FLOWS)
+		firewall_bench_port = 0;
+	for (int i = 0; i < 64; ++i) {
+		struct udp_hdr *udp;
+
+		udp = rte_pktmbuf_mtod_offset(bench->pkts[i], struct udp_hdr *,
+					      sizeof(struct ether_hdr) +
+					      sizeof(struct ipv4_hdr));
+		udp->src_port = rte_cpu_to_be_16(firewall_bench_port + i);
+	}
+}
+
+static void firewall_bench_flows(const char *title, uint32_t cache_size,
+				 int argc, char **argv)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *fw;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	uint64_t hits, misses;
+	uint32_t ip_src;
+	uint32_t ip_dst;
+	uint32_t len;
+
+	g_assert(!pg_bench_init(&bench, title, argc, argv, &error));
+	fw = pg_firewall_new(title, PG_NO_CONN_WORKER, &error);
+	g_assert(!error);
+	g_assert(!pg_firewall_rule_add(fw, "src host 10.0.0.1",
+				       PG_WEST_SIDE, 0, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+	if (cache_size)
+		g_assert(!pg_firewall_flow_cache_enable(fw, cache_size,
+							&error));
+
+	bench.input_brick = fw;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = fw;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 1000000;
+	bench.count_brick = NULL;
+	bench.post_burst_op = firewall_bench_next_flows;
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac1, &mac2,
+		ETHER_TYPE_IPv4);
+	bench.brick_full_burst = 1;
+	len = sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + 64;
+	inet_pton(AF_INET, "10.0.0.1", (void *) &ip_src);
+	inet_pton(AF_INET, "10.0.0.2", (void *) &ip_dst);
+	pg_packets_append_ipv4(
+		bench.pkts,
+		bench.pkts_mask,
+		ip_src, ip_dst, len, 17);
+	bench.pkts = pg_packets_append_udp(
+		bench.pkts,
+		bench.pkts_mask,
+		1000, 2000, 64);
+	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask, 64);
+	firewall_bench_port = 0;
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+	pg_firewall_flow_cache_stats(fw, &hits, &misses);
+	if (hits + misses)
+		printf("flow cache hit rate: %.2lf%%\n",
+		       100.0 * hits / (hits + misses));
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(fw);
+	g_free(bench.pkts);
+}
+
+void test_benchmark_firewall_flows(int argc, char **argv)
+{
+	firewall_bench_flows("firewall-65536-flows-no-cache", 0, argc, argv);
+	firewall_bench_flows("firewall-65536-flows-cache-16384", 16384,
+			     argc, argv);
+	firewall_bench_flows("firewall-65536-flows-cache-131072", 131072,
+			     argc, argv);
+}
@@ -36,6 +36,7 @@ int main(int argc, char **argv)
 	test_benchmark_firewall(argc, argv);
 	pg_npf_nworkers = 0;
 	test_benchmark_firewall(argc, argv);
+	test_benchmark_firewall_flows(argc, argv);
 	int r = g_test_run();
 
 	pg_stop();
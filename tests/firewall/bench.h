@@ -19,3 +19,4 @@
 #include <packetgraph/packetgraph.h>
 
 void test_benchmark_firewall(int argc, char **argv);
+void test_benchmark_firewall_flows(int argc, char **argv);
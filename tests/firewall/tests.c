@@ -25,6 +25,9 @@
 
 #include <rte_config.h>
 #include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
 #include <pcap/pcap.h>
 
 #include <packetgraph/packetgraph.h>
@@ -647,6 +650,462 @@ static void test_firewall_noip(void)
 		rte_pktmbuf_free(pkts[i]);
 }
 
+static void test_firewall_mixed_burst(void)
+{
+	int nb = 63;
+	struct rte_mbuf *pkts[63];
+	uint64_t mask = pg_mask_firsts(nb);
+	uint64_t expected = 0;
+
+	/* interleave non-IP, allowed and blocked packets in one burst */
+	for (int i = 0; i < nb; i++) {
+		if (i % 3 == 0) {
+			pkts[i] = build_non_ip_packet();
+		} else if (i % 3 == 1) {
+			pkts[i] = build_ip_packet("10.0.0.1", "10.0.0.255",
+						  i, AF_INET);
+		} else {
+			pkts[i] = build_ip_packet("10.0.0.2", "10.0.0.255",
+						  i, AF_INET);
+			continue;
+		}
+		expected |= ONE64 << i;
+	}
+
+	g_assert(firewall_scenario_filter("src host 10.0.0.1", pkts,
+					  mask) == expected);
+	/* layer 2 is given back to every packet */
+	for (int i = 0; i < nb; i++)
+		g_assert(pkts[i]->data_off == RTE_PKTMBUF_HEADROOM);
+
+	/* clean */
+	for (int i = 0; i < nb; i++)
+		rte_pktmbuf_free(pkts[i]);
+}
+
+static void firewall_flow_cache_burst(struct pg_brick *fw,
+				      struct pg_brick *col,
+				      uint64_t expected_hits,
+				      uint64_t expected_misses)
+{
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	uint64_t mask = pg_mask_firsts(32);
+	struct pg_error *error = NULL;
+	struct rte_mbuf **pkts;
+	uint64_t filtered_mask;
+	uint64_t hits, misses;
+
+	/* 16 allowed UDP flows then 16 blocked UDP flows */
+	pkts = pg_packets_create(mask);
+	pg_packets_append_ether(pkts, mask, &mac, &mac, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, pg_mask_firsts(16), inet_addr("10.0.0.1"),
+			       inet_addr("10.0.0.255"),
+			       sizeof(struct udp_hdr), 17);
+	pg_packets_append_ipv4(pkts, mask & ~pg_mask_firsts(16),
+			       inet_addr("10.0.0.2"), inet_addr("10.0.0.255"),
+			       sizeof(struct udp_hdr), 17);
+	for (int i = 0; i < 32; ++i)
+		pg_packets_append_udp(pkts, ONE64 << i, 1000 + i % 16, 53,
+				      sizeof(struct udp_hdr));
+	PG_FOREACH_BIT(mask, i)
+		pkts[i]->l2_len = sizeof(struct ether_hdr);
+
+	pg_brick_burst_to_east(fw, 0, pkts, mask, &error);
+	g_assert(!error);
+	pg_brick_west_burst_get(col, &filtered_mask, &error);
+	g_assert(!error);
+	g_assert(filtered_mask == pg_mask_firsts(16));
+	pg_firewall_flow_cache_stats(fw, &hits, &misses);
+	g_assert(hits == expected_hits);
+	g_assert(misses == expected_misses);
+
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+}
+
+static void test_firewall_flow_cache(void)
+{
+	struct pg_brick *fw, *col;
+	struct pg_error *error = NULL;
+
+	fw = pg_firewall_new("fw", PG_NONE, &error);
+	g_assert(!error);
+	col = pg_collect_new("col", &error);
+	g_assert(!error);
+	pg_brick_link(fw, col, &error);
+	g_assert(!error);
+	g_assert(!pg_firewall_rule_add(fw, "src host 10.0.0.1",
+				       PG_WEST_SIDE, 0, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+
+	g_assert(pg_firewall_flow_cache_enable(fw, 100, &error) < 0);
+	pg_error_free(error);
+	error = NULL;
+	g_assert(!pg_firewall_flow_cache_enable(fw, 64, &error));
+	g_assert(!error);
+
+	/* blocked packets are never cached */
+	firewall_flow_cache_burst(fw, col, 0, 32);
+	firewall_flow_cache_burst(fw, col, 16, 48);
+	/* reloading rules invalidate cached verdicts */
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+	firewall_flow_cache_burst(fw, col, 16, 80);
+	firewall_flow_cache_burst(fw, col, 32, 96);
+
+	pg_firewall_flow_cache_disable(fw);
+	firewall_flow_cache_burst(fw, col, 0, 0);
+
+	pg_brick_destroy(fw);
+	pg_brick_destroy(col);
+}
+
+#define FLOW_CACHE_TCP_ROUNDS 64
+#define FLOW_CACHE_TCP_SEGMENTS 16
+#define FLOW_CACHE_TCP_MSS 1000
+
+static struct rte_mbuf *build_tcp_packet(const char *src, const char *dst,
+					 uint16_t src_port, uint16_t dst_port,
+					 uint32_t seq, uint32_t ack,
+					 uint8_t flags, uint16_t payload_len)
+{
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct rte_mbuf *pkt = rte_pktmbuf_alloc(pg_get_mempool());
+	uint16_t len = sizeof(struct ether_hdr) + sizeof(struct ipv4_hdr) +
+		sizeof(struct tcp_hdr) + payload_len;
+	struct ether_hdr *eth;
+	struct ipv4_hdr *ip;
+	struct tcp_hdr *tcp;
+
+	g_assert(pkt);
+	eth = (struct ether_hdr *)rte_pktmbuf_append(pkt, len);
+	g_assert(eth);
+	memset(eth, 0, len);
+	ether_addr_copy(&mac, &eth->s_addr);
+	ether_addr_copy(&mac, &eth->d_addr);
+	eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+	ip = (struct ipv4_hdr *)(eth + 1);
+	ip->version_ihl = 0x45;
+	ip->total_length = rte_cpu_to_be_16(len - sizeof(struct ether_hdr));
+	ip->time_to_live = 64;
+	ip->next_proto_id = IPPROTO_TCP;
+	ip->src_addr = inet_addr(src);
+	ip->dst_addr = inet_addr(dst);
+	ip->hdr_checksum = rte_ipv4_cksum(ip);
+	tcp = (struct tcp_hdr *)(ip + 1);
+	tcp->src_port = rte_cpu_to_be_16(src_port);
+	tcp->dst_port = rte_cpu_to_be_16(dst_port);
+	tcp->sent_seq = rte_cpu_to_be_32(seq);
+	tcp->recv_ack = rte_cpu_to_be_32(ack);
+	tcp->data_off = (sizeof(struct tcp_hdr) / 4) << 4;
+	tcp->tcp_flags = flags;
+	tcp->rx_win = rte_cpu_to_be_16(UINT16_MAX);
+	tcp->cksum = rte_ipv4_udptcp_cksum(ip, tcp);
+	pkt->l2_len = sizeof(struct ether_hdr);
+	return pkt;
+}
+
+/* burst packets on one side of the firewall, all of them must pass */
+static void firewall_tcp_burst(struct pg_brick *fw, struct pg_brick *col,
+			       enum pg_side to, struct rte_mbuf **pkts,
+			       uint16_t nb)
+{
+	uint64_t mask = pg_mask_firsts(nb);
+	struct pg_error *error = NULL;
+	uint64_t filtered_mask;
+
+	if (to == PG_EAST_SIDE) {
+		pg_brick_burst_to_east(fw, 0, pkts, mask, &error);
+		g_assert(!error);
+		pg_brick_west_burst_get(col, &filtered_mask, &error);
+	} else {
+		pg_brick_burst_to_west(fw, 0, pkts, mask, &error);
+		g_assert(!error);
+		pg_brick_east_burst_get(col, &filtered_mask, &error);
+	}
+	g_assert(!error);
+	g_assert(filtered_mask == mask);
+	pg_packets_free(pkts, mask);
+}
+
+static void test_firewall_flow_cache_tcp(void)
+{
+	struct rte_mbuf *pkts[FLOW_CACHE_TCP_SEGMENTS];
+	struct pg_brick *fw, *col_west, *col_east;
+	struct pg_error *error = NULL;
+	uint32_t client_seq = 1000;
+	uint32_t server_seq = 5000;
+	uint64_t hits, misses;
+
+	col_west = pg_collect_new("col_west", &error);
+	g_assert(!error);
+	fw = pg_firewall_new("fw", PG_NONE, &error);
+	g_assert(!error);
+	col_east = pg_collect_new("col_east", &error);
+	g_assert(!error);
+	pg_brick_chained_links(&error, col_west, fw, col_east);
+	g_assert(!error);
+	g_assert(!pg_firewall_rule_add(fw, "tcp dst port 80", PG_WEST_SIDE, 1,
+				       &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!pg_firewall_flow_cache_enable(fw, 64, &error));
+	g_assert(!error);
+
+	/* handshake */
+	pkts[0] = build_tcp_packet("10.0.0.1", "10.0.0.2", 1234, 80,
+				   client_seq++, 0, TCP_SYN_FLAG, 0);
+	firewall_tcp_burst(fw, col_east, PG_EAST_SIDE, pkts, 1);
+	pkts[0] = build_tcp_packet("10.0.0.2", "10.0.0.1", 80, 1234,
+				   server_seq++, client_seq,
+				   TCP_SYN_FLAG | TCP_ACK_FLAG, 0);
+	firewall_tcp_burst(fw, col_west, PG_WEST_SIDE, pkts, 1);
+
+	/* the client sends way more than a window while the server acks,
+	 * and the flow cache TTL expires in the middle of the transfer
+	 */
+	for (int r = 0; r < FLOW_CACHE_TCP_ROUNDS; ++r) {
+		for (int i = 0; i < FLOW_CACHE_TCP_SEGMENTS; ++i) {
+			pkts[i] = build_tcp_packet("10.0.0.1", "10.0.0.2",
+						   1234, 80, client_seq,
+						   server_seq, TCP_ACK_FLAG,
+						   FLOW_CACHE_TCP_MSS);
+			client_seq += FLOW_CACHE_TCP_MSS;
+		}
+		firewall_tcp_burst(fw, col_east, PG_EAST_SIDE, pkts,
+				   FLOW_CACHE_TCP_SEGMENTS);
+		pkts[0] = build_tcp_packet("10.0.0.2", "10.0.0.1", 80, 1234,
+					   server_seq, client_seq,
+					   TCP_ACK_FLAG, 0);
+		firewall_tcp_burst(fw, col_west, PG_WEST_SIDE, pkts, 1);
+		if (r == FLOW_CACHE_TCP_ROUNDS / 2)
+			g_usleep(1100000);
+	}
+
+	/* every segment went through NPF */
+	pg_firewall_flow_cache_stats(fw, &hits, &misses);
+	g_assert(hits == 0);
+	g_assert(misses == 0);
+
+	pg_brick_destroy(col_west);
+	pg_brick_destroy(fw);
+	pg_brick_destroy(col_east);
+}
+
+#define RELOAD_UNDER_TRAFFIC_RELOADS 500
+
+static int reload_done;
+
+static struct rte_mbuf **build_udp_burst(uint64_t mask, const char *src,
+					 const char *dst, uint16_t src_port,
+					 uint16_t dst_port)
+{
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct rte_mbuf **pkts = pg_packets_create(mask);
+
+	pg_packets_append_ether(pkts, mask, &mac, &mac, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, mask, inet_addr(src), inet_addr(dst),
+			       sizeof(struct udp_hdr), 17);
+	pg_packets_append_udp(pkts, mask, src_port, dst_port,
+			      sizeof(struct udp_hdr));
+	PG_FOREACH_BIT(mask, i)
+		pkts[i]->l2_len = sizeof(struct ether_hdr);
+	return pkts;
+}
+
+static gpointer reload_thread(gpointer arg)
+{
+	struct pg_brick *fw = arg;
+	struct pg_error *error = NULL;
+
+	for (int i = 1; i <= RELOAD_UNDER_TRAFFIC_RELOADS; ++i) {
+		/* change the ruleset of the other direction at each reload */
+		if (i % 32)
+			g_assert(!pg_firewall_rule_add(fw, "src host 6.6.6.6",
+						       PG_EAST_SIDE, 0,
+						       &error));
+		else
+			pg_firewall_rule_flush_side(fw, PG_EAST_SIDE);
+		g_assert(!pg_firewall_reload(fw, &error));
+		g_assert(!error);
+	}
+	g_atomic_int_set(&reload_done, 1);
+	return NULL;
+}
+
+static void test_firewall_reload_under_traffic(void)
+{
+	uint64_t mask = pg_mask_firsts(32);
+	struct pg_brick *fw, *col_west, *col_east;
+	struct rte_mbuf **requests, **replies;
+	struct pg_error *error = NULL;
+	uint64_t filtered_mask;
+	GThread *thread;
+	uint64_t bursts = 0;
+
+	fw = pg_firewall_new("fw", PG_NONE, &error);
+	g_assert(!error);
+	col_west = pg_collect_new("col-west", &error);
+	g_assert(!error);
+	col_east = pg_collect_new("col-east", &error);
+	g_assert(!error);
+	pg_brick_chained_links(&error, col_west, fw, col_east);
+	g_assert(!error);
+	g_assert(!pg_firewall_rule_add(fw, "src host 10.0.0.1",
+				       PG_WEST_SIDE, 1, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+
+	requests = build_udp_burst(mask, "10.0.0.1", "10.0.0.2", 1000, 53);
+	replies = build_udp_burst(mask, "10.0.0.2", "10.0.0.1", 53, 1000);
+
+	/* replies only pass thanks to the connection opened by requests */
+	pg_brick_burst_to_west(fw, 0, replies, mask, &error);
+	g_assert(!error);
+	g_assert(pg_brick_pkts_count_get(col_west, PG_EAST_SIDE) == 0);
+
+	g_atomic_int_set(&reload_done, 0);
+	thread = g_thread_new("reload", reload_thread, fw);
+	while (!bursts || !g_atomic_int_get(&reload_done)) {
+		pg_brick_burst_to_east(fw, 0, requests, mask, &error);
+		g_assert(!error);
+		pg_brick_west_burst_get(col_east, &filtered_mask, &error);
+		g_assert(filtered_mask == mask);
+		pg_brick_burst_to_west(fw, 0, replies, mask, &error);
+		g_assert(!error);
+		pg_brick_east_burst_get(col_west, &filtered_mask, &error);
+		g_assert(filtered_mask == mask);
+		++bursts;
+	}
+	g_thread_join(thread);
+
+	/* no packet has been lost while reloading */
+	g_assert(pg_brick_pkts_count_get(col_east, PG_WEST_SIDE) ==
+		 bursts * 32);
+	g_assert(pg_brick_pkts_count_get(col_west, PG_EAST_SIDE) ==
+		 bursts * 32);
+
+	pg_packets_free(requests, mask);
+	pg_packets_free(replies, mask);
+	g_free(requests);
+	g_free(replies);
+	pg_brick_destroy(fw);
+	pg_brick_destroy(col_west);
+	pg_brick_destroy(col_east);
+}
+
+static void firewall_match_stats_burst(struct pg_brick *fw,
+				       const char *src, uint16_t dst_port,
+				       uint64_t *pkt_len)
+{
+	uint64_t mask = pg_mask_firsts(32);
+	struct pg_error *error = NULL;
+	struct rte_mbuf **pkts;
+
+	pkts = build_udp_burst(mask, src, "10.0.0.2", 1000, dst_port);
+	*pkt_len = rte_pktmbuf_pkt_len(pkts[0]);
+	pg_brick_burst_to_east(fw, 0, pkts, mask, &error);
+	g_assert(!error);
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+}
+
+static void test_firewall_match_stats(void)
+{
+	struct pg_firewall_match_stats stats;
+	struct pg_brick *fw, *col;
+	struct pg_error *error = NULL;
+	uint64_t len;
+
+	fw = pg_firewall_new("fw", PG_NONE, &error);
+	g_assert(!error);
+	col = pg_collect_new("col", &error);
+	g_assert(!error);
+	pg_brick_link(fw, col, &error);
+	g_assert(!error);
+	g_assert(!pg_firewall_rule_add(fw, "src host 10.0.0.1",
+				       PG_WEST_SIDE, 0, &error));
+	g_assert(!pg_firewall_rule_add(fw, "udp dst port 53",
+				       PG_WEST_SIDE, 0, &error));
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+
+	/* nothing is accounted until enabled */
+	firewall_match_stats_burst(fw, "10.0.0.1", 53, &len);
+	g_assert(!pg_firewall_rule_match_stats(fw, 1, &stats, &error));
+	g_assert(stats.pkts == 0);
+
+	pg_firewall_match_stats_enable(fw);
+	/* the last matching rule gets the hit */
+	firewall_match_stats_burst(fw, "10.0.0.1", 53, &len);
+	firewall_match_stats_burst(fw, "10.0.0.1", 80, &len);
+	firewall_match_stats_burst(fw, "10.0.0.3", 53, &len);
+	firewall_match_stats_burst(fw, "10.0.0.3", 80, &len);
+	g_assert(!pg_firewall_rule_match_stats(fw, 0, &stats, &error));
+	g_assert(stats.pkts == 32);
+	g_assert(stats.bytes == 32 * len);
+	g_assert(!pg_firewall_rule_match_stats(fw, 1, &stats, &error));
+	g_assert(stats.pkts == 64);
+	g_assert(stats.bytes == 64 * len);
+	pg_firewall_default_stats(fw, &stats);
+	g_assert(stats.pkts == 32);
+	g_assert(stats.bytes == 32 * len);
+
+	g_assert(pg_firewall_rule_match_stats(fw, 2, &stats, &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+
+	/* counters are kept when disabled and across reloads */
+	pg_firewall_match_stats_disable(fw);
+	firewall_match_stats_burst(fw, "10.0.0.1", 80, &len);
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+	g_assert(!pg_firewall_rule_match_stats(fw, 0, &stats, &error));
+	g_assert(stats.pkts == 32);
+
+	pg_firewall_rule_flush(fw);
+	g_assert(!pg_firewall_reload(fw, &error));
+	g_assert(!error);
+	g_assert(pg_firewall_rule_match_stats(fw, 0, &stats, &error) < 0);
+	pg_error_free(error);
+
+	pg_brick_destroy(fw);
+	pg_brick_destroy(col);
+}
+
+static void test_firewall_shared_burst(void)
+{
+	int nb = 32;
+	struct rte_mbuf *pkts[32];
+	uint64_t mask = pg_mask_firsts(nb);
+	uint64_t expected = 0;
+
+	/* packets also referenced elsewhere, as after a switch flood */
+	for (int i = 0; i < nb; i++) {
+		const char *src = i % 2 ? "10.0.0.2" : "10.0.0.1";
+
+		pkts[i] = build_ip_packet(src, "10.0.0.255", i, AF_INET);
+		rte_pktmbuf_refcnt_update(pkts[i], 1);
+		if (!(i % 2))
+			expected |= ONE64 << i;
+	}
+
+	g_assert(firewall_scenario_filter("src host 10.0.0.1", pkts,
+					  mask) == expected);
+	/* shared packets are filtered through clones and never modified */
+	for (int i = 0; i < nb; i++) {
+		g_assert(pkts[i]->data_off == RTE_PKTMBUF_HEADROOM);
+		g_assert(rte_mbuf_refcnt_read(pkts[i]) == 2);
+	}
+
+	/* clean */
+	for (int i = 0; i < nb; i++) {
+		rte_pktmbuf_free(pkts[i]);
+		rte_pktmbuf_free(pkts[i]);
+	}
+}
+
 static void test_firewall_filter(void)
 {
 	firewall_filter_rules(PG_WEST_SIDE);
@@ -804,6 +1263,14 @@ static void test_firewall(void)
 	pg_test_add_func("/firewall/tcp", test_firewall_tcp);
 	pg_test_add_func("/firewall/icmp", test_firewall_icmp);
 	pg_test_add_func("/firewall/noip", test_firewall_noip);
+	pg_test_add_func("/firewall/mixed_burst", test_firewall_mixed_burst);
+	pg_test_add_func("/firewall/shared_burst", test_firewall_shared_burst);
+	pg_test_add_func("/firewall/flow_cache", test_firewall_flow_cache);
+	pg_test_add_func("/firewall/flow_cache/tcp",
+			 test_firewall_flow_cache_tcp);
+	pg_test_add_func("/firewall/reload_under_traffic",
+			 test_firewall_reload_under_traffic);
+	pg_test_add_func("/firewall/match_stats", test_firewall_match_stats);
 	pg_test_add_func("/firewall/rules", test_firewall_rules);
 	pg_test_add_func("/firewall/empty_burst", test_firewall_empty_burst);
 	pg_test_add_func("/firewall/tcp6", test_firewall_tcp6);
@@ -25,11 +25,16 @@
 #include <unistd.h>
 #include <packetgraph/common.h>
 #include <packetgraph/nic.h>
+#include <packetgraph/nop.h>
+#include <packetgraph/graph.h>
 #include <packetgraph/errors.h>
 #include "utils/tests.h"
 #include "utils/mempool.h"
 #include "utils/config.h"
 #include "brick-int.h"
+#include "packets.h"
+#include "utils/bitmask.h"
+#include "utils/mac.h"
 #include "collect.h"
 #include "tests.h"
 
@@ -109,10 +114,187 @@ static void test_nic_simple_flow(void)
 	g_assert(g_unlink("out.pcap") == 0);
 }
 
+static void test_nic_multi_queue(void)
+{
+#	define NB_QUEUES 4
+	struct pg_brick *nics[NB_QUEUES], *nops[NB_QUEUES];
+	struct rte_mbuf *pkts[PG_MAX_PKTS_BURST];
+	struct rte_mempool *mbuf_pool = pg_get_mempool();
+	struct pg_error *error = NULL;
+	uint16_t count;
+
+	/*
+	 * eth_ring1 loops back each tx queue to the rx queue of the same id:
+	 * [nop q] ---- [nic q] for q in [0, NB_QUEUES[
+	 */
+	nics[0] = pg_nic_new_mq_by_id("nic-q0", 1, NB_QUEUES, &error);
+	CHECK_ERROR(error);
+	g_assert(pg_nic_queue_count(nics[0]) == NB_QUEUES);
+	for (int q = 1; q < NB_QUEUES; q++) {
+		nics[q] = pg_nic_new_queue("nic-q", nics[0], q, &error);
+		CHECK_ERROR(error);
+		g_assert(pg_nic_queue_count(nics[q]) == NB_QUEUES);
+	}
+	g_assert(!pg_nic_new_queue("nic-q", nics[0], NB_QUEUES, &error));
+	g_assert(pg_error_is_set(&error));
+	pg_error_free(error);
+	error = NULL;
+	g_assert(!pg_nic_new_queue("nic-q", nics[1], 0, &error));
+	g_assert(pg_error_is_set(&error));
+	pg_error_free(error);
+	error = NULL;
+
+	for (int q = 0; q < NB_QUEUES; q++) {
+		nops[q] = pg_nop_new("nop", &error);
+		CHECK_ERROR(error);
+		pg_brick_link(nops[q], nics[q], &error);
+		CHECK_ERROR(error);
+	}
+
+	for (int q = 0; q < NB_QUEUES; q++) {
+		for (int i = 0; i < PG_MAX_PKTS_BURST; i++) {
+			pkts[i] = rte_pktmbuf_alloc(mbuf_pool);
+			g_assert(pkts[i]);
+			pg_set_mac_addrs(pkts[i],
+					 "F0:F1:F2:F3:F4:F5",
+					 "E0:E1:E2:E3:E4:E5");
+		}
+		pg_brick_burst_to_east(nops[q], 0, pkts,
+				       pg_mask_firsts(PG_MAX_PKTS_BURST),
+				       &error);
+		CHECK_ERROR(error);
+		pg_packets_free(pkts, pg_mask_firsts(PG_MAX_PKTS_BURST));
+
+		/* packets only come back on the queue they were sent on */
+		for (int o = 0; o < NB_QUEUES; o++) {
+			pg_brick_poll(nics[o], &count, &error);
+			CHECK_ERROR(error);
+			g_assert(count == (o == q ? PG_MAX_PKTS_BURST : 0));
+		}
+	}
+
+	/* the port must stay usable until every queue brick is gone */
+	pg_brick_destroy(nics[0]);
+	for (int q = 1; q < NB_QUEUES; q++) {
+		pg_brick_poll(nics[q], &count, &error);
+		CHECK_ERROR(error);
+		g_assert(count == 0);
+		pg_brick_destroy(nics[q]);
+	}
+	for (int q = 0; q < NB_QUEUES; q++)
+		pg_brick_destroy(nops[q]);
+#	undef NB_QUEUES
+}
+
+static void test_nic_tx_buffer(void)
+{
+#	define TX_THRESHOLD 32
+#	define SMALL_BURST 4
+	struct pg_brick *nic, *nop;
+	struct pg_graph *graph;
+	struct rte_mbuf *pkts[SMALL_BURST];
+	struct rte_mempool *mbuf_pool = pg_get_mempool();
+	struct pg_nic_tx_stats stats;
+	struct pg_error *error = NULL;
+	uint16_t count;
+	uint32_t graph_count;
+
+	/* eth_ring2 loops tx back to rx: [nop] ---- [nic] */
+	nic = pg_nic_new_by_id("nic-buf", 2, &error);
+	CHECK_ERROR(error);
+	nop = pg_nop_new("nop", &error);
+	CHECK_ERROR(error);
+	pg_brick_link(nop, nic, &error);
+	CHECK_ERROR(error);
+	g_assert(!pg_brick_flushable(nic));
+	g_assert(pg_nic_set_tx_buffer(nic, PG_NIC_TX_BUFFER_MAX + 1,
+				      &error) < 0);
+	g_assert(pg_error_is_set(&error));
+	pg_error_free(error);
+	error = NULL;
+	g_assert(!pg_nic_set_tx_buffer(nic, TX_THRESHOLD, &error));
+	CHECK_ERROR(error);
+	g_assert(pg_brick_flushable(nic));
+	g_assert(!pg_brick_flushable(nop));
+
+	for (int i = 0; i < SMALL_BURST; i++) {
+		pkts[i] = rte_pktmbuf_alloc(mbuf_pool);
+		g_assert(pkts[i]);
+		pg_set_mac_addrs(pkts[i],
+				 "F0:F1:F2:F3:F4:F5",
+				 "E0:E1:E2:E3:E4:E5");
+	}
+
+	/* small bursts stay in the buffer until the nic is flushed */
+	for (int i = 0; i < 3; i++) {
+		pg_brick_burst_to_east(nop, 0, pkts,
+				       pg_mask_firsts(SMALL_BURST), &error);
+		CHECK_ERROR(error);
+	}
+	pg_brick_poll(nic, &count, &error);
+	CHECK_ERROR(error);
+	g_assert(count == 0);
+	g_assert(!pg_brick_flush(nic, &error));
+	CHECK_ERROR(error);
+	pg_brick_poll(nic, &count, &error);
+	CHECK_ERROR(error);
+	g_assert(count == 3 * SMALL_BURST);
+	pg_nic_tx_stats(nic, &stats);
+	g_assert(stats.poll_flushes == 1);
+	g_assert(stats.fill_flushes == 0);
+
+	/* reaching the threshold sends the whole buffer at once */
+	for (int i = 0; i < TX_THRESHOLD / SMALL_BURST; i++) {
+		pg_brick_burst_to_east(nop, 0, pkts,
+				       pg_mask_firsts(SMALL_BURST), &error);
+		CHECK_ERROR(error);
+	}
+	pg_brick_poll(nic, &count, &error);
+	CHECK_ERROR(error);
+	g_assert(count == TX_THRESHOLD);
+	pg_nic_tx_stats(nic, &stats);
+	g_assert(stats.fill_flushes == 1);
+	g_assert(stats.poll_flushes == 1);
+
+	/* pg_graph_poll flushes the nic at the end of the poll cycle */
+	graph = pg_graph_new("graph", nic, &error);
+	CHECK_ERROR(error);
+	pg_brick_burst_to_east(nop, 0, pkts, pg_mask_firsts(SMALL_BURST),
+			       &error);
+	CHECK_ERROR(error);
+	g_assert(!pg_graph_poll_count(graph, &graph_count, &error));
+	CHECK_ERROR(error);
+	g_assert(graph_count == 0);
+	g_assert(!pg_graph_poll_count(graph, &graph_count, &error));
+	CHECK_ERROR(error);
+	g_assert(graph_count == SMALL_BURST);
+	pg_nic_tx_stats(nic, &stats);
+	g_assert(stats.poll_flushes == 2);
+
+	/* packets the queue refuses are retried, then dropped */
+	max_pkts = 0;
+	pg_brick_burst_to_east(nop, 0, pkts, pg_mask_firsts(SMALL_BURST),
+			       &error);
+	CHECK_ERROR(error);
+	g_assert(!pg_brick_flush(nic, &error));
+	CHECK_ERROR(error);
+	max_pkts = PG_MAX_PKTS_BURST;
+	pg_nic_tx_stats(nic, &stats);
+	g_assert(stats.retries == 1);
+	g_assert(stats.drops == SMALL_BURST);
+
+	pg_packets_free(pkts, pg_mask_firsts(SMALL_BURST));
+	pg_graph_destroy(graph);
+#	undef SMALL_BURST
+#	undef TX_THRESHOLD
+}
+
 #undef NB_PKTS
 #undef CHECK_ERROR
 
 void test_nic(void)
 {
 	pg_test_add_func("/nic/pcap/nic-pcap", test_nic_simple_flow);
+	pg_test_add_func("/nic/ring/multi-queue", test_nic_multi_queue);
+	pg_test_add_func("/nic/ring/tx-buffer", test_nic_tx_buffer);
 }
@@ -1,2 +1,2 @@
 #!/bin/sh
-sudo ./tests-nic -c1 -n1 --socket-mem 256 --no-shconf --vdev=eth_ring0
+sudo ./tests-nic -c1 -n1 --socket-mem 256 --no-shconf --vdev=eth_ring0 --vdev=eth_ring1 --vdev=eth_ring2
@@ -25,6 +25,11 @@
 #include <rte_ether.h>
 #include <rte_ip.h>
 #include <rte_udp.h>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_launch.h>
+#include <rte_lcore.h>
+#include <rte_pause.h>
 #include <packetgraph/packetgraph.h>
 #include "utils/tests.h"
 #include "packets.h"
@@ -36,33 +41,68 @@
 
 uint16_t max_pkts = PG_MAX_PKTS_BURST;
 
-void test_benchmark_queue(int argc, char **argv)
+#define CROSS_CORE_BURST_CNT 1000000
+
+typedef struct pg_brick *(*queue_new_t)(const char *, int,
+					 struct pg_error **);
+
+struct cross_core_producer {
+	struct pg_brick *queue;
+	struct rte_mbuf **pkts;
+	uint64_t pkts_mask;
+	rte_atomic16_t done;
+};
+
+static struct rte_mbuf **bench_packets(uint64_t pkts_mask)
 {
-	struct pg_error *error = NULL;
-	struct pg_brick *queue_enter;
-	struct pg_brick *queue_exit;
-	struct pg_bench bench;
-	struct pg_bench_stats stats;
 	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
 	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	struct rte_mbuf **pkts = pg_packets_create(pkts_mask);
 	uint32_t len;
 
-	queue_enter = pg_queue_new("enter", 10, &error);
+	pkts = pg_packets_append_ether(pkts, pkts_mask,
+				       &mac1, &mac2, ETHER_TYPE_IPv4);
+	len = sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + 1400;
+	pg_packets_append_ipv4(pkts, pkts_mask,
+			       0x000000EE, 0x000000CC, len, 17);
+	pkts = pg_packets_append_udp(pkts, pkts_mask, 1000, 2000, 1400);
+	return pg_packets_append_blank(pkts, pkts_mask, 1400);
+}
+
+static void queue_pair_new(queue_new_t queue_new,
+			   struct pg_brick **queue_enter,
+			   struct pg_brick **queue_exit)
+{
+	struct pg_error *error = NULL;
+
+	*queue_enter = queue_new("enter", 10, &error);
 	if (error) {
 		pg_error_print(error);
 		g_assert(0);
 	}
-	queue_exit = pg_queue_new("enter", 10, &error);
+	*queue_exit = queue_new("exit", 10, &error);
 	if (error) {
 		pg_error_print(error);
 		g_assert(0);
 	}
-	if (pg_queue_friend(queue_enter, queue_exit, &error)) {
+	if (pg_queue_friend(*queue_enter, *queue_exit, &error)) {
 		pg_error_print(error);
 		g_assert(0);
 	}
+}
+
+static void test_benchmark_queue_mode(int argc, char **argv,
+				      queue_new_t queue_new,
+				      const char *title)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *queue_enter;
+	struct pg_brick *queue_exit;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
 
-	g_assert(!pg_bench_init(&bench, "queue", argc, argv, &error));
+	queue_pair_new(queue_new, &queue_enter, &queue_exit);
+	g_assert(!pg_bench_init(&bench, title, argc, argv, &error));
 	bench.input_brick = queue_enter;
 	bench.input_side = PG_WEST_SIDE;
 	bench.output_brick = queue_exit;
@@ -72,22 +112,7 @@ void test_benchmark_queue(int argc, char **argv)
 	bench.count_brick = NULL;
 	bench.pkts_nb = 64;
 	bench.pkts_mask = pg_mask_firsts(64);
-	bench.pkts = pg_packets_create(bench.pkts_mask);
-	bench.pkts = pg_packets_append_ether(
-		bench.pkts,
-		bench.pkts_mask,
-		&mac1, &mac2,
-		ETHER_TYPE_IPv4);
-	len = sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + 1400;
-	pg_packets_append_ipv4(
-		bench.pkts,
-		bench.pkts_mask,
-		0x000000EE, 0x000000CC, len, 17);
-	bench.pkts = pg_packets_append_udp(
-		bench.pkts,
-		bench.pkts_mask,
-		1000, 2000, 1400);
-	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask, 1400);
+	bench.pkts = bench_packets(bench.pkts_mask);
 
 	g_assert(!pg_bench_run(&bench, &stats, &error));
 	pg_bench_print(&stats);
@@ -98,3 +123,85 @@ void test_benchmark_queue(int argc, char **argv)
 	g_free(bench.pkts);
 }
 
+static int cross_core_produce(void *arg)
+{
+	struct cross_core_producer *p = arg;
+	struct pg_error *error = NULL;
+
+	for (uint64_t i = 0; i < CROSS_CORE_BURST_CNT; i++) {
+		/* don't let the bench measure drops */
+		while (pg_queue_pressure(p->queue) == 255)
+			rte_pause();
+		pg_brick_burst_to_east(p->queue, 0, p->pkts, p->pkts_mask,
+				       &error);
+		g_assert(!error);
+	}
+	rte_atomic16_set(&p->done, 1);
+	return 0;
+}
+
+/*
+ * [producer lcore] -> [enter] ~ [exit] -> [nop] polled by the master lcore.
+ */
+static void test_benchmark_queue_cross_core(queue_new_t queue_new,
+					    const char *title)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *queue_enter;
+	struct pg_brick *queue_exit;
+	struct pg_brick *nop;
+	struct cross_core_producer producer;
+	unsigned int lcore = rte_get_next_lcore(-1, 1, 0);
+	uint64_t start, duration, received;
+	uint16_t cnt;
+
+	if (lcore >= RTE_MAX_LCORE) {
+		printf("================= %s =================\n", title);
+		printf("skipped: needs at least 2 lcores\n");
+		return;
+	}
+
+	queue_pair_new(queue_new, &queue_enter, &queue_exit);
+	nop = pg_nop_new("nop-bench", &error);
+	g_assert(!error);
+	pg_brick_link(nop, queue_exit, &error);
+	g_assert(!error);
+
+	producer.queue = queue_enter;
+	producer.pkts_mask = pg_mask_firsts(64);
+	producer.pkts = bench_packets(producer.pkts_mask);
+	rte_atomic16_init(&producer.done);
+
+	start = rte_get_timer_cycles();
+	rte_eal_remote_launch(cross_core_produce, &producer, lcore);
+	do {
+		pg_brick_poll(queue_exit, &cnt, &error);
+		g_assert(!error);
+	} while (cnt || !rte_atomic16_read(&producer.done) ||
+		 pg_queue_pressure(queue_enter));
+	duration = rte_get_timer_cycles() - start;
+	rte_eal_wait_lcore(lcore);
+
+	received = pg_brick_pkts_count_get(nop, PG_WEST_SIDE);
+	printf("================= %s =================\n", title);
+	printf("pkts_sent: %"PRIu64"\n", (uint64_t)CROSS_CORE_BURST_CNT * 64);
+	printf("pkts_received: %"PRIu64"\n", received);
+	printf("received packet speed: %.2lf MPkts/s\n",
+	       received / 1000000.0 /
+	       ((double)duration / rte_get_timer_hz()));
+
+	pg_packets_free(producer.pkts, producer.pkts_mask);
+	g_free(producer.pkts);
+	pg_brick_destroy(nop);
+	pg_brick_destroy(queue_enter);
+	pg_brick_destroy(queue_exit);
+}
+
+void test_benchmark_queue(int argc, char **argv)
+{
+	test_benchmark_queue_mode(argc, argv, pg_queue_new, "queue");
+	test_benchmark_queue_mode(argc, argv, pg_queue_ring_new, "queue ring");
+	test_benchmark_queue_cross_core(pg_queue_new, "queue cross-core");
+	test_benchmark_queue_cross_core(pg_queue_ring_new,
+					"queue ring cross-core");
+}
@@ -1,2 +1,2 @@
 #!/bin/sh
-sudo ./bench-queue -c1 -n1 --socket-mem 256 --no-shconf -- "$@"
+sudo ./bench-queue -c3 -n1 --socket-mem 256 --no-shconf -- "$@"
@@ -277,6 +277,288 @@ static void test_switch_learn(void)
 	CHECK_ERROR(error);
 }
 
+static void test_switch_learn_compact(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *brick, *collect1, *collect2, *collect3;
+	struct rte_mbuf **result_pkts;
+	struct rte_mbuf *pkts[PG_MAX_PKTS_BURST];
+	uint64_t pkts_mask, i;
+
+	brick = pg_switch_new("switch", 4, 4, PG_DEFAULT_SIDE, &error);
+	g_assert(brick);
+	CHECK_ERROR(error);
+	g_assert(pg_switch_set_mac_table_capacity(brick, UINT32_MAX,
+						  &error) < 0);
+	g_assert(error);
+	pg_error_free(error);
+	error = NULL;
+	/* only room for one address */
+	g_assert(!pg_switch_set_mac_table_capacity(brick, 1, &error));
+	CHECK_ERROR(error);
+
+	collect1 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	collect2 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	collect3 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+
+	pg_brick_link(collect1, brick, &error);
+	CHECK_ERROR(error);
+	pg_brick_link(collect2, brick, &error);
+	CHECK_ERROR(error);
+	pg_brick_link(brick, collect3, &error);
+	CHECK_ERROR(error);
+
+	for (i = 0; i < NB_PKTS; i++) {
+		pkts[i] = rte_pktmbuf_alloc(mbuf_pool);
+		g_assert(pkts[i]);
+		pkts[i]->udata64 = i;
+	}
+
+	/* F0:... is learned on west port 0, then D0:... on west port 1 */
+	for (i = 0; i < NB_PKTS; i++)
+		pg_set_mac_addrs(pkts[i],
+				 "F0:F1:F2:F3:F4:F5", "E0:E1:E2:E3:E4:E5");
+	pg_brick_burst_to_east(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	for (i = 0; i < NB_PKTS; i++)
+		pg_set_mac_addrs(pkts[i],
+				 "D0:D1:D2:D3:D4:D5", "E0:E1:E2:E3:E4:E5");
+	pg_brick_burst_to_east(brick, 1, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	g_assert(pg_brick_reset(collect1, &error) == 0);
+	g_assert(pg_brick_reset(collect2, &error) == 0);
+	g_assert(pg_brick_reset(collect3, &error) == 0);
+
+	/* F0:... is known so the answer only goes to collect1 */
+	for (i = 0; i < NB_PKTS; i++)
+		pg_set_mac_addrs(pkts[i],
+				 "E0:E1:E2:E3:E4:E5", "F0:F1:F2:F3:F4:F5");
+	pg_brick_burst_to_west(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	result_pkts = pg_brick_east_burst_get(collect1, &pkts_mask, &error);
+	CHECK_ERROR(error);
+	g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+	g_assert(result_pkts);
+	result_pkts = pg_brick_east_burst_get(collect2, &pkts_mask, &error);
+	CHECK_ERROR(error);
+	g_assert(!pkts_mask);
+	g_assert(pg_brick_reset(collect1, &error) == 0);
+
+	/* the table was full when D0:... came, so it is flooded */
+	for (i = 0; i < NB_PKTS; i++)
+		pg_set_mac_addrs(pkts[i],
+				 "E0:E1:E2:E3:E4:E5", "D0:D1:D2:D3:D4:D5");
+	pg_brick_burst_to_west(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	result_pkts = pg_brick_east_burst_get(collect1, &pkts_mask, &error);
+	CHECK_ERROR(error);
+	g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+	result_pkts = pg_brick_east_burst_get(collect2, &pkts_mask, &error);
+	CHECK_ERROR(error);
+	g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+	g_assert(result_pkts);
+
+	for (i = 0; i < NB_PKTS; i++)
+		rte_pktmbuf_free(pkts[i]);
+
+	pg_brick_unlink(collect1, &error);
+	CHECK_ERROR(error);
+	pg_brick_unlink(collect2, &error);
+	CHECK_ERROR(error);
+	pg_brick_unlink(collect3, &error);
+	CHECK_ERROR(error);
+
+	pg_brick_decref(collect1, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(collect2, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(collect3, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(brick, &error);
+	CHECK_ERROR(error);
+}
+
+static void test_switch_aging(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *brick, *collect1, *collect2, *collect3;
+	struct rte_mbuf *pkts[PG_MAX_PKTS_BURST];
+	uint64_t pkts_mask, i;
+
+	brick = pg_switch_new("switch", 4, 4, PG_DEFAULT_SIDE, &error);
+	g_assert(brick);
+	CHECK_ERROR(error);
+	g_assert(!pg_switch_set_mac_table_capacity(brick, 2, &error));
+	CHECK_ERROR(error);
+	pg_switch_set_mac_lifetime(brick, 3);
+
+	collect1 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	collect2 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	collect3 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+
+	pg_brick_link(collect1, brick, &error);
+	CHECK_ERROR(error);
+	pg_brick_link(collect2, brick, &error);
+	CHECK_ERROR(error);
+	pg_brick_link(brick, collect3, &error);
+	CHECK_ERROR(error);
+
+	for (i = 0; i < NB_PKTS; i++) {
+		pkts[i] = rte_pktmbuf_alloc(mbuf_pool);
+		g_assert(pkts[i]);
+	}
+
+#define SEND(port, src, dst, burst_fn) do {				\
+		for (i = 0; i < NB_PKTS; i++)				\
+			pg_set_mac_addrs(pkts[i], src, dst);		\
+		burst_fn(brick, port, pkts, pg_mask_firsts(NB_PKTS),	\
+			 &error);					\
+		CHECK_ERROR(error);					\
+		g_assert(pg_brick_reset(collect1, &error) == 0);	\
+		g_assert(pg_brick_reset(collect2, &error) == 0);	\
+		g_assert(pg_brick_reset(collect3, &error) == 0);	\
+	} while (0)
+
+	/* learn F0:... on west port 0, the answer is not flooded */
+	SEND(0, "F0:F1:F2:F3:F4:F5", "E0:E1:E2:E3:E4:E5",
+	     pg_brick_burst_to_east);
+	for (i = 0; i < NB_PKTS; i++)
+		pg_set_mac_addrs(pkts[i],
+				 "E0:E1:E2:E3:E4:E5", "F0:F1:F2:F3:F4:F5");
+	pg_brick_burst_to_west(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	pg_brick_east_burst_get(collect2, &pkts_mask, &error);
+	g_assert(!pkts_mask);
+	pg_brick_east_burst_get(collect1, &pkts_mask, &error);
+	g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+	g_assert(pg_brick_reset(collect1, &error) == 0);
+
+	/* traffic from other hosts make F0:... get old */
+	for (int j = 0; j < 4; ++j)
+		SEND(1, "D0:D1:D2:D3:D4:D5", "01:00:00:00:00:00",
+		     pg_brick_burst_to_east);
+
+	/* F0:... has expired, the answer is flooded */
+	for (i = 0; i < NB_PKTS; i++)
+		pg_set_mac_addrs(pkts[i],
+				 "E0:E1:E2:E3:E4:E5", "F0:F1:F2:F3:F4:F5");
+	pg_brick_burst_to_west(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	pg_brick_east_burst_get(collect1, &pkts_mask, &error);
+	g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+	pg_brick_east_burst_get(collect2, &pkts_mask, &error);
+	g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+	g_assert(pg_brick_reset(collect1, &error) == 0);
+	g_assert(pg_brick_reset(collect2, &error) == 0);
+
+	/*
+	 * the table only has room for 2 addresses, D0:... and E0:... are
+	 * known, so F0:... can only be learned again once E0:... is removed
+	 * by the aging
+	 */
+	for (int j = 0; j < 4; ++j)
+		SEND(1, "D0:D1:D2:D3:D4:D5", "01:00:00:00:00:00",
+		     pg_brick_burst_to_east);
+	SEND(0, "F0:F1:F2:F3:F4:F5", "E0:E1:E2:E3:E4:E5",
+	     pg_brick_burst_to_east);
+	for (i = 0; i < NB_PKTS; i++)
+		pg_set_mac_addrs(pkts[i],
+				 "E0:E1:E2:E3:E4:E5", "F0:F1:F2:F3:F4:F5");
+	pg_brick_burst_to_west(brick, 0, pkts, pg_mask_firsts(NB_PKTS),
+			       &error);
+	CHECK_ERROR(error);
+	pg_brick_east_burst_get(collect2, &pkts_mask, &error);
+	g_assert(!pkts_mask);
+	pg_brick_east_burst_get(collect1, &pkts_mask, &error);
+	g_assert(pkts_mask == pg_mask_firsts(NB_PKTS));
+#undef SEND
+
+	for (i = 0; i < NB_PKTS; i++)
+		rte_pktmbuf_free(pkts[i]);
+
+	pg_brick_unlink(collect1, &error);
+	CHECK_ERROR(error);
+	pg_brick_unlink(collect2, &error);
+	CHECK_ERROR(error);
+	pg_brick_unlink(collect3, &error);
+	CHECK_ERROR(error);
+
+	pg_brick_decref(collect1, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(collect2, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(collect3, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(brick, &error);
+	CHECK_ERROR(error);
+}
+
+static void test_switch_aging_default_table(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *brick, *collect1, *collect2;
+	struct rte_mbuf *pkt = rte_pktmbuf_alloc(mbuf_pool);
+	int bursts;
+
+	/* default 24/24 table, expired addresses must leave it too */
+	brick = pg_switch_new("switch", 4, 4, PG_DEFAULT_SIDE, &error);
+	g_assert(brick);
+	CHECK_ERROR(error);
+	pg_switch_set_mac_lifetime(brick, 3);
+	collect1 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	collect2 = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	pg_brick_link(collect1, brick, &error);
+	CHECK_ERROR(error);
+	pg_brick_link(brick, collect2, &error);
+	CHECK_ERROR(error);
+	g_assert(pkt);
+
+	pg_set_mac_addrs(pkt, "F0:F1:F2:F3:F4:F5", "01:00:00:00:00:00");
+	pg_brick_burst_to_east(brick, 0, &pkt, 1, &error);
+	CHECK_ERROR(error);
+	pg_set_mac_addrs(pkt, "D0:D1:D2:D3:D4:D5", "01:00:00:00:00:00");
+	pg_brick_burst_to_east(brick, 0, &pkt, 1, &error);
+	CHECK_ERROR(error);
+	g_assert(pg_switch_mac_count(brick) == 2);
+
+	/*
+	 * D0:... keeps talking, F0:... is removed once the aging has walked
+	 * the whole table, which takes a few bursts per mask word
+	 */
+	for (bursts = 0; bursts < 1000000; bursts++) {
+		pg_brick_burst_to_east(brick, 0, &pkt, 1, &error);
+		CHECK_ERROR(error);
+		g_assert(pg_brick_reset(collect2, &error) == 0);
+		if (!(bursts % 4096) && pg_switch_mac_count(brick) == 1)
+			break;
+	}
+	g_assert(pg_switch_mac_count(brick) == 1);
+
+	rte_pktmbuf_free(pkt);
+	pg_brick_unlink(brick, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(collect1, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(collect2, &error);
+	CHECK_ERROR(error);
+	pg_brick_decref(brick, &error);
+	CHECK_ERROR(error);
+}
+
 static void test_switch_switching(void)
 {
 	struct pg_error *error = NULL;
@@ -1301,6 +1583,10 @@ static void test_switch(void)
 	mbuf_pool = pg_get_mempool();
 	pg_test_add_func("/switch/lifecycle", test_switch_lifecycle);
 	pg_test_add_func("/switch/learn", test_switch_learn);
+	pg_test_add_func("/switch/learn/compact", test_switch_learn_compact);
+	pg_test_add_func("/switch/aging", test_switch_aging);
+	pg_test_add_func("/switch/aging/default-table",
+			 test_switch_aging_default_table);
 	pg_test_add_func("/switch/switching", test_switch_switching);
 	pg_test_add_func("/switch/unlink", test_switch_unlink);
 	pg_test_add_func("/switch/multicast/destination",
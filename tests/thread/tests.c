@@ -16,6 +16,7 @@
  */
 
 #include <glib.h>
+#include <inttypes.h>
 #include <packetgraph/packetgraph.h>
 #include <unistd.h>
 #include "utils/tests.h"
@@ -149,6 +150,205 @@ static void test_threads_errors(void)
 	pg_thread_destroy(tid);
 }
 
+static int idle_tx_enabled;
+
+static void idle_tx_callback(struct pg_brick *brick, pg_packet_t **tx_burst,
+			     uint16_t *tx_burst_len, void *private_data)
+{
+	if (!g_atomic_int_get(&idle_tx_enabled)) {
+		*tx_burst_len = 0;
+		return;
+	}
+	pg_packet_set_len(tx_burst[0], 100);
+	*tx_burst_len = 1;
+}
+
+static void test_threads_idle(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *col = pg_collect_new("col", &error);
+	struct pg_brick *rxtx = pg_rxtx_new("rxtx", NULL, idle_tx_callback,
+					    &error);
+	struct pg_thread_idle_stats stats;
+	struct pg_graph *graph;
+	int tid = pg_thread_init(&error);
+
+	g_assert(col && rxtx);
+	pg_brick_link(rxtx, col, &error);
+	graph = pg_graph_new("graph", rxtx, &error);
+	g_assert(tid >= 1);
+	g_assert(!error);
+	g_assert(!pg_thread_add_graph(tid, graph));
+	g_assert(!pg_thread_set_idle_policy(tid, PG_THREAD_IDLE_ADAPTIVE));
+	g_atomic_int_set(&idle_tx_enabled, 0);
+	pg_thread_run(tid);
+
+	/* an idle graph makes the thread sleep */
+	usleep(100000);
+	g_assert(!pg_thread_idle_stats(tid, &stats));
+	g_assert(stats.pauses > 0);
+	g_assert(stats.sleeps > 0);
+	g_assert(stats.wakeups == 0);
+
+	/* first packets wake the thread up */
+	g_atomic_int_set(&idle_tx_enabled, 1);
+	usleep(100000);
+	g_assert(pg_brick_tx_bytes(rxtx) > 0);
+	g_assert(!pg_thread_idle_stats(tid, &stats));
+	g_assert(stats.wakeups == 1);
+	g_assert(stats.wakeup_latency_max_ns > 0);
+	g_assert(stats.wakeup_latency_avg_ns <= stats.wakeup_latency_max_ns);
+	g_test_message("wakeup latency: %"PRIu64"ns",
+		       stats.wakeup_latency_max_ns);
+
+	pg_thread_stop(tid);
+	pg_thread_destroy(tid);
+	pg_graph_destroy(graph);
+}
+
+static void idle_callback(struct pg_brick *brick, pg_packet_t **tx_burst,
+			  uint16_t *tx_burst_len, void *private_data)
+{
+	*tx_burst_len = 0;
+}
+
+static void test_threads_stats(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *col = pg_collect_new("col", &error);
+	struct pg_brick *rxtx = pg_rxtx_new("rxtx", NULL, tx_callback, &error);
+	struct pg_brick *idle = pg_rxtx_new("idle", NULL, idle_callback,
+					    &error);
+	struct pg_thread_stats busy_stats, idle_stats, stats;
+	struct pg_graph *busy_graph, *idle_graph;
+	int tid = pg_thread_init(&error);
+
+	g_assert(col && rxtx && idle);
+	pg_brick_link(rxtx, col, &error);
+	busy_graph = pg_graph_new("busy", rxtx, &error);
+	idle_graph = pg_graph_new("idle", idle, &error);
+	g_assert(tid >= 1);
+	g_assert(!error);
+	g_assert(pg_thread_add_graph(tid, busy_graph) == 0);
+	g_assert(pg_thread_add_graph(tid, idle_graph) == 1);
+	pg_thread_run(tid);
+	usleep(100000);
+	pg_thread_stop(tid);
+
+	g_assert(!pg_thread_stats(tid, 0, &busy_stats));
+	g_assert(busy_stats.busy_polls > 0);
+	g_assert(busy_stats.busy_cycles > 0);
+	g_assert(busy_stats.idle_polls == 0);
+	g_assert(busy_stats.pkts == busy_stats.busy_polls);
+	g_assert(!pg_thread_stats(tid, 1, &idle_stats));
+	g_assert(idle_stats.busy_polls == 0);
+	g_assert(idle_stats.idle_polls > 0);
+	g_assert(idle_stats.idle_cycles > 0);
+	g_assert(idle_stats.pkts == 0);
+	g_assert(!pg_thread_stats(tid, PG_THREAD_ALL_GRAPHS, &stats));
+	g_assert(stats.busy_cycles == busy_stats.busy_cycles);
+	g_assert(stats.idle_cycles == idle_stats.idle_cycles);
+	g_assert(stats.pkts == busy_stats.pkts);
+	g_assert(pg_thread_stats(tid, 1000, &stats) < 0);
+
+	pg_thread_destroy(tid);
+	pg_graph_destroy(busy_graph);
+	pg_graph_destroy(idle_graph);
+}
+
+static void test_threads_rebalance(void)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *col[2];
+	struct pg_brick *rxtx[2];
+	struct pg_brick *idle = pg_rxtx_new("idle", NULL, idle_callback,
+					    &error);
+	struct pg_graph *graphs[2], *idle_graph;
+	struct pg_thread_stats stats;
+	int16_t tids[2];
+	int gid;
+
+	for (int i = 0; i < 2; ++i) {
+		col[i] = pg_collect_new("col", &error);
+		rxtx[i] = pg_rxtx_new("rxtx", NULL, tx_callback, &error);
+		g_assert(col[i] && rxtx[i]);
+		g_assert(!pg_brick_link(rxtx[i], col[i], &error));
+		graphs[i] = pg_graph_new("busy", rxtx[i], &error);
+		g_assert(graphs[i]);
+	}
+	idle_graph = pg_graph_new("idle", idle, &error);
+	g_assert(idle_graph);
+	tids[0] = pg_thread_init(&error);
+	tids[1] = pg_thread_init(&error);
+	g_assert(tids[0] >= 1 && tids[1] >= 1);
+	g_assert(!error);
+
+	/* both busy graphs on the first thread, the second one idles */
+	g_assert(pg_thread_add_graph(tids[0], graphs[0]) == 0);
+	g_assert(pg_thread_add_graph(tids[0], graphs[1]) == 1);
+	g_assert(pg_thread_add_graph(tids[1], idle_graph) == 0);
+	pg_thread_run(tids[0]);
+	pg_thread_run(tids[1]);
+
+	g_assert(pg_thread_rebalance(tids, 1, 0) < 0);
+	g_assert(pg_thread_rebalance(tids, 2, 0) == 0);
+	usleep(100000);
+	g_assert(pg_thread_rebalance(tids, 2, 0) == 1);
+	usleep(100000);
+	/* each thread now runs one busy graph */
+	g_assert(pg_thread_rebalance(tids, 2,
+				     PG_THREAD_REBALANCE_THRESHOLD) == 0);
+	g_assert(!pg_thread_stats(tids[1], 1, &stats));
+	g_assert(stats.busy_polls > 0);
+
+	/* manual migration back and forth */
+	gid = pg_thread_migrate_graph(tids[1], 1, tids[0]);
+	g_assert(gid >= 0);
+	g_assert(pg_thread_migrate_graph(tids[0], gid, tids[1]) == 1);
+	g_assert(pg_thread_migrate_graph(tids[0], 100, tids[1]) < 0);
+
+	pg_thread_destroy(tids[0]);
+	pg_thread_destroy(tids[1]);
+	for (int i = 0; i < 2; ++i) {
+		g_assert(pg_brick_tx_bytes(rxtx[i]) > 0);
+		pg_graph_destroy(graphs[i]);
+	}
+	pg_graph_destroy(idle_graph);
+}
+
+#define COMMANDS_PRODUCERS 4
+#define COMMANDS_CALLS 10000
+
+static void *commands_producer(void *arg)
+{
+	int16_t tid = GPOINTER_TO_INT(arg);
+
+	for (int i = 0; i < COMMANDS_CALLS; ++i) {
+		/* asynchronous ops fill the ring faster than it drains */
+		g_assert(!pg_thread_set_idle_policy(tid,
+						    PG_THREAD_IDLE_ADAPTIVE));
+		g_assert(pg_thread_state(tid) == PG_THREAD_STOPPED);
+	}
+	return NULL;
+}
+
+static void test_threads_commands(void)
+{
+	struct pg_error *error = NULL;
+	GThread *producers[COMMANDS_PRODUCERS];
+	int tid = pg_thread_init(&error);
+
+	g_assert(tid >= 1);
+	g_assert(!error);
+	/* a stopped thread sleeps and must be woken up by each command */
+	for (int i = 0; i < COMMANDS_PRODUCERS; ++i)
+		producers[i] = g_thread_new("producer", commands_producer,
+					    GINT_TO_POINTER(tid));
+	for (int i = 0; i < COMMANDS_PRODUCERS; ++i)
+		g_thread_join(producers[i]);
+	pg_thread_destroy(tid);
+}
+
 int main(int argc, char **argv)
 {
 	int ret;
@@ -163,6 +363,10 @@ int main(int argc, char **argv)
 	pg_test_add_func("/threads/lifecycle", test_threads_lifecycle);
 	pg_test_add_func("/threads/run", test_threads_run);
 	pg_test_add_func("/threads/error", test_threads_errors);
+	pg_test_add_func("/threads/idle", test_threads_idle);
+	pg_test_add_func("/threads/stats", test_threads_stats);
+	pg_test_add_func("/threads/rebalance", test_threads_rebalance);
+	pg_test_add_func("/threads/commands", test_threads_commands);
 
 	return g_test_run();
 }
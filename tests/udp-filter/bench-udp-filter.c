@@ -0,0 +1,102 @@
+/* Copyright 2019 Outscale SAS
+ *
+ * This file is part of Packetgraph.
+ *
+ * Packetgraph is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as published
+ * by the Free Software Foundation.
+ *
+ * Packetgraph is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Packetgraph.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bench.h"
+#include <stdio.h>
+#include <inttypes.h>
+#include <rte_config.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <packetgraph/packetgraph.h>
+#include <packetgraph/udp-filter.h>
+#include "packets.h"
+#include "brick-int.h"
+#include "utils/bench.h"
+#include "utils/bitmask.h"
+
+/* packets match the last filter, the worst case of a linear lookup */
+static void udp_filter_bench(int nb_filters, int argc, char **argv)
+{
+	struct pg_udp_filter_info *filters =
+		g_new0(struct pg_udp_filter_info, nb_filters);
+	struct pg_brick **nops = g_new0(struct pg_brick *, nb_filters + 1);
+	struct ether_addr mac1 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr mac2 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x21} };
+	struct pg_error *error = NULL;
+	struct pg_brick *sw;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	uint32_t len;
+
+	for (int i = 0; i < nb_filters; ++i) {
+		filters[i].udp_dst_port = 1000 + i;
+		filters[i].flag = PG_USP_FILTER_DST_PORT;
+	}
+	g_assert(!pg_bench_init(&bench, "udp-filter", argc, argv, &error));
+	sw = pg_udp_filter_new("udp-filter", filters, nb_filters,
+			       PG_EAST_SIDE, &error);
+	g_assert(!error);
+	for (int i = 0; i <= nb_filters; ++i) {
+		nops[i] = pg_nop_new("nop", &error);
+		g_assert(!error);
+		pg_brick_link(sw, nops[i], &error);
+		g_assert(!error);
+	}
+
+	bench.input_brick = sw;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = sw;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 10000000;
+	bench.count_brick = nops[nb_filters];
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(bench.pkts, bench.pkts_mask,
+					     &mac1, &mac2, ETHER_TYPE_IPv4);
+	bench.brick_full_burst = 1;
+	len = sizeof(struct ipv4_hdr) + sizeof(struct udp_hdr) + 1400;
+	pg_packets_append_ipv4(bench.pkts, bench.pkts_mask,
+			       0x000000EE, 0x000000CC, len, 17);
+	bench.pkts = pg_packets_append_udp(bench.pkts, bench.pkts_mask,
+					   2000, 1000 + nb_filters - 1, 1400);
+	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask,
+					     1400);
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	printf("================= udp-filter, %d filters ==========\n",
+	       nb_filters);
+	pg_bench_print(&stats);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	g_free(bench.pkts);
+	pg_brick_destroy(sw);
+	for (int i = 0; i <= nb_filters; ++i)
+		pg_brick_destroy(nops[i]);
+	g_free(nops);
+	g_free(filters);
+}
+
+void test_benchmark_udp_filter(int argc, char **argv)
+{
+	/* cost must not depend on the number of filters */
+	udp_filter_bench(1, argc, argv);
+	udp_filter_bench(16, argc, argv);
+	udp_filter_bench(256, argc, argv);
+}
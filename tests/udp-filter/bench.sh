@@ -0,0 +1,2 @@
+#!/bin/sh
+sudo ./bench-udp-filter -c1 -n1 --socket-mem 256 --no-shconf -- "$@"
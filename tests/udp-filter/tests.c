@@ -19,6 +19,7 @@
 
 #include <rte_config.h>
 #include <rte_ether.h>
+#include <rte_udp.h>
 
 #include <packetgraph/packetgraph.h>
 #include <packetgraph/udp-filter.h>
@@ -28,6 +29,7 @@
 #include "packets.h"
 #include "utils/common.h"
 #include "brick-int.h"
+#include "utils/bitmask.h"
 
 static void test_udp_filter(void)
 {
@@ -76,6 +78,68 @@ static void test_udp_filter(void)
 	pg_packets_free(pkts, -1LL);
 }
 
+static void test_udp_filter_ipv6_vlan(void)
+{
+	struct pg_error *error = NULL;
+	uint64_t mask = pg_mask_firsts(4);
+	struct rte_mbuf **pkts = pg_packets_create(mask);
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	uint8_t ip6[16] = {0x20, 0x01, 0x0d, 0xb8};
+	struct vlan_hdr vlan6 = {rte_cpu_to_be_16(42),
+				 rte_cpu_to_be_16(ETHER_TYPE_IPv6)};
+	struct vlan_hdr vlan4 = {rte_cpu_to_be_16(42),
+				 rte_cpu_to_be_16(ETHER_TYPE_IPv4)};
+	uint64_t pkts_mask;
+
+	pg_autobrick struct pg_brick *collect_default =
+		pg_collect_new("collect-default", &error);
+	pg_autobrick struct pg_brick *collect_dns =
+		pg_collect_new("collect-dns", &error);
+	pg_autobrick struct pg_brick *collect_dhcp =
+		pg_collect_new("collect-dhcp", &error);
+	/* packets matching both filters go to the first one */
+	pg_autobrick struct pg_brick *sw =
+		pg_udp_filter_new(
+			"sw_udp",
+			(struct pg_udp_filter_info [])
+			{{0, 53, PG_USP_FILTER_DST_PORT},
+			 {68, 67, PG_USP_FILTER_SRC_PORT |
+			  PG_USP_FILTER_DST_PORT}},
+			2, PG_EAST_SIDE, &error);
+	g_assert(!error);
+
+	/* IPv6, vlan tagged IPv6 and vlan tagged IPv4 packets */
+	pg_packets_append_ether(pkts, pg_mask_firsts(1), &mac, &mac,
+				ETHER_TYPE_IPv6);
+	pg_packets_append_ether(pkts, mask & ~pg_mask_firsts(1), &mac, &mac,
+				ETHER_TYPE_VLAN);
+	pg_packets_append_buf(pkts, 0x6, &vlan6, sizeof(vlan6));
+	pg_packets_append_buf(pkts, 0x8, &vlan4, sizeof(vlan4));
+	pg_packets_append_ipv6(pkts, 0x7, ip6, ip6,
+			       sizeof(struct udp_hdr), 17);
+	pg_packets_append_ipv4(pkts, 0x8, 1, 2, sizeof(struct udp_hdr), 17);
+	pg_packets_append_udp(pkts, 0x1, 1000, 53, 0);
+	pg_packets_append_udp(pkts, 0x2, 68, 53, 0);
+	pg_packets_append_udp(pkts, 0x4, 1000, 80, 0);
+	pg_packets_append_udp(pkts, 0x8, 68, 67, 0);
+
+	pg_brick_link(sw, collect_default, &error);
+	pg_brick_link(sw, collect_dns, &error);
+	pg_brick_link(sw, collect_dhcp, &error);
+
+	pg_brick_burst_to_east(sw, 0, pkts, mask, &error);
+	g_assert(!error);
+	pg_brick_west_burst_get(collect_default, &pkts_mask, &error);
+	g_assert(pkts_mask == 0x4);
+	pg_brick_west_burst_get(collect_dns, &pkts_mask, &error);
+	g_assert(pkts_mask == 0x3);
+	pg_brick_west_burst_get(collect_dhcp, &pkts_mask, &error);
+	g_assert(pkts_mask == 0x8);
+
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+}
+
 int main(int argc, char **argv)
 {
 	int r;
@@ -85,6 +149,8 @@ int main(int argc, char **argv)
 
 	pg_test_add_func("/udp-filtering",
 			 test_udp_filter);
+	pg_test_add_func("/udp-filtering/ipv6-vlan",
+			 test_udp_filter_ipv6_vlan);
 
 	r = g_test_run();
 
@@ -291,6 +291,102 @@ static void vxlan_to_inside(int flags, const char *title,
 	g_free(bench.pkts);
 }
 
+/*
+ * Decapsulate towards the last of nb_vnis VNIs, which was the worst case of
+ * the per port VNI matching.
+ */
+static void vxlan_to_inside_vnis(uint32_t nb_vnis, int argc, char **argv)
+{
+	struct pg_error *error = NULL;
+	struct pg_brick *vtep;
+	struct pg_bench bench;
+	struct pg_bench_stats stats;
+	struct pg_brick *outside_nop;
+	struct pg_brick **inside_nops;
+	struct ether_addr mac3 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x31} };
+	struct ether_addr mac4 = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x41} };
+	static struct ether_addr mac_vtep = {{0xb0, 0xb1, 0xb2,
+					      0xb3, 0xb4, 0xb5} };
+	char *title = g_strdup_printf("vxlan 4 all opti, %u VNIs", nb_vnis);
+	uint32_t len;
+
+	headers_length = sizeof(struct headers4);
+	vtep = pg_vtep_new("vtep", nb_vnis, PG_WEST_SIDE, 0x000000EE,
+			   mac_vtep, PG_VTEP_DST_PORT, PG_VTEP_ALL_OPTI,
+			   &error);
+	g_assert(!error);
+
+	g_assert(!pg_bench_init(&bench, title, argc, argv, &error));
+	outside_nop = pg_nop_new("nop-outside", &error);
+	g_assert(!error);
+	pg_brick_link(outside_nop, vtep, &error);
+	g_assert(!error);
+
+	inside_nops = g_new0(struct pg_brick *, nb_vnis);
+	for (uint32_t i = 0; i < nb_vnis; ++i) {
+		char *name = g_strdup_printf("nop-inside-%u", i);
+
+		inside_nops[i] = pg_nop_new(name, &error);
+		g_assert(!error);
+		g_free(name);
+		pg_brick_link(vtep, inside_nops[i], &error);
+		g_assert(!error);
+		pg_vtep_add_vni(vtep, inside_nops[i], i + 1,
+				inet_addr("224.0.0.1"), &error);
+		g_assert(!error);
+	}
+
+	bench.input_brick = outside_nop;
+	bench.input_side = PG_WEST_SIDE;
+	bench.output_brick = vtep;
+	bench.output_side = PG_EAST_SIDE;
+	bench.output_poll = false;
+	bench.max_burst_cnt = 1000000;
+	bench.count_brick = inside_nops[nb_vnis - 1];
+	bench.post_burst_op = add_vtep_hdr;
+
+	bench.pkts_nb = 64;
+	bench.pkts_mask = pg_mask_firsts(64);
+	bench.pkts = pg_packets_create(bench.pkts_mask);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac_vtep, &mac_vtep,
+		ETHER_TYPE_IPv4);
+	bench.brick_full_burst = 1;
+	len = headers_length + 1400;
+	pg_packets_append_ipv4(
+		bench.pkts,
+		bench.pkts_mask,
+		0x000000EE, 0x000000CC, len, 17);
+	bench.pkts = pg_packets_append_udp(
+		bench.pkts,
+		bench.pkts_mask,
+		1000, PG_VTEP_DST_PORT, 1400);
+	pg_packets_append_vxlan(bench.pkts, bench.pkts_mask, nb_vnis);
+	bench.pkts = pg_packets_append_ether(
+		bench.pkts,
+		bench.pkts_mask,
+		&mac3, &mac4,
+		ETHER_TYPE_IPv4);
+	bench.pkts = pg_packets_append_blank(bench.pkts, bench.pkts_mask, 1400);
+	memcpy(vxlan_hdr, rte_pktmbuf_mtod(bench.pkts[0], void *),
+	       headers_length);
+	vxlan_hdr[headers_length] = '\0';
+
+	g_assert(pg_bench_run(&bench, &stats, &error) == 0);
+	pg_bench_print(&stats);
+
+	pg_packets_free(bench.pkts, bench.pkts_mask);
+	pg_brick_destroy(vtep);
+	pg_brick_destroy(outside_nop);
+	for (uint32_t i = 0; i < nb_vnis; ++i)
+		pg_brick_destroy(inside_nops[i]);
+	g_free(inside_nops);
+	g_free(bench.pkts);
+	g_free(title);
+}
+
 void test_benchmark_vtep(int argc, char **argv)
 {
 	inside_to_vxlan(argc, argv, AF_INET);
@@ -312,5 +408,9 @@ void test_benchmark_vtep(int argc, char **argv)
 
 	vxlan_to_inside(0, "vxlan 4 bench slow", argc, argv, AF_INET);
 	vxlan_to_inside(0, "vxlan 6 bench slow", argc, argv, AF_INET6);
+
+	vxlan_to_inside_vnis(1, argc, argv);
+	vxlan_to_inside_vnis(64, argc, argv);
+	vxlan_to_inside_vnis(1024, argc, argv);
 }
 
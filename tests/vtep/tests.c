@@ -1098,6 +1098,266 @@ static void test_vtep_flood_encapsulate(void)
 	pg_packets_free(pkts, pg_mask_firsts(NB_PKTS));
 }
 
+static void vtep_flood_send(struct pg_brick *nop, uint64_t mask)
+{
+	struct ether_addr src = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr dst = {{0xff, 0xff, 0xff, 0xff, 0xff, 0xff} };
+	struct pg_error *error = NULL;
+	struct rte_mbuf **pkts;
+
+	pkts = pg_packets_create(mask);
+	pg_packets_append_ether(pkts, mask, &src, &dst, 0xCAFE);
+	pg_packets_append_blank(pkts, mask, 50);
+	pg_brick_burst_to_east(nop, 0, pkts, mask, &error);
+	CHECK_ERROR(error);
+	/* replicas share the payload, the original is left untouched */
+	PG_FOREACH_BIT(mask, i) {
+		struct ether_hdr *eth;
+
+		eth = rte_pktmbuf_mtod(pkts[i], struct ether_hdr *);
+		g_assert(rte_pktmbuf_data_len(pkts[i]) ==
+			 sizeof(struct ether_hdr) + 50);
+		g_assert(is_broadcast_ether_addr(&eth->d_addr));
+	}
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+}
+
+static void check_flood_pkts(struct pg_brick *collect, uint64_t mask,
+			     uint32_t dst_ip, uint16_t nb_segs)
+{
+	struct rte_mbuf **pkts;
+	struct pg_error *error = NULL;
+	uint64_t result_mask;
+
+	pkts = pg_brick_west_burst_get(collect, &result_mask, &error);
+	CHECK_ERROR(error);
+	g_assert(result_mask == mask);
+	PG_FOREACH_BIT(mask, i) {
+		struct ipv4_hdr *ip;
+		struct udp_hdr *udp;
+
+		ip = rte_pktmbuf_mtod_offset(pkts[i], struct ipv4_hdr *,
+					     sizeof(struct ether_hdr));
+		udp = (struct udp_hdr *)(ip + 1);
+		g_assert(pkts[i]->nb_segs == nb_segs);
+		g_assert(ip->dst_addr == dst_ip);
+		g_assert(rte_be_to_cpu_16(udp->dgram_len) ==
+			 sizeof(struct udp_hdr) + sizeof(struct vxlan_hdr) +
+			 sizeof(struct ether_hdr) + 50);
+		g_assert(rte_pktmbuf_pkt_len(pkts[i]) ==
+			 rte_be_to_cpu_16(ip->total_length) +
+			 sizeof(struct ether_hdr));
+	}
+}
+
+/* last packet received by collect is an IGMP message sent to ip_dst */
+static void vtep_check_igmp(struct pg_brick *collect, uint32_t ip_dst)
+{
+	struct pg_error *error = NULL;
+	struct multicast_pkt *hdr;
+	struct rte_mbuf **pkts;
+	uint64_t mask;
+
+	pkts = pg_brick_west_burst_get(collect, &mask, &error);
+	CHECK_ERROR(error);
+	g_assert(mask == 1);
+	hdr = rte_pktmbuf_mtod(pkts[0], struct multicast_pkt *);
+	g_assert(hdr->ipv4.next_proto_id == 0x02);
+	g_assert(hdr->ipv4.dst_addr == ip_dst);
+}
+
+static void test_vtep_flood_head_end_replication(void)
+{
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x01} };
+	struct ether_addr remote_mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x02} };
+	uint32_t remotes[3] = {inet_addr("10.0.0.2"), inet_addr("10.0.0.3"),
+			       inet_addr("10.0.0.4")};
+	uint64_t mask = pg_mask_firsts(8);
+	struct pg_brick *nop, *vtep, *collect;
+	struct pg_error *error = NULL;
+
+	nop = pg_nop_new("nop", &error);
+	CHECK_ERROR(error);
+	vtep = pg_vtep_new("vtep", 1, PG_EAST_SIDE, 1, mac,
+			   PG_VTEP_DST_PORT, 0, &error);
+	CHECK_ERROR(error);
+	collect = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	pg_brick_chained_links(&error, nop, vtep, collect);
+	CHECK_ERROR(error);
+	pg_vtep_add_vni(vtep, nop, 1, inet_addr("225.0.0.43"), &error);
+	CHECK_ERROR(error);
+
+	g_assert(pg_vtep_add_flood_dst(vtep, 2, remotes[0], &remote_mac,
+				       &error) < 0);
+	pg_error_free(error);
+	error = NULL;
+	g_assert(pg_vtep_add_flood_dst(vtep, 1, inet_addr("225.0.0.44"),
+				       &remote_mac, &error) < 0);
+	pg_error_free(error);
+	error = NULL;
+	for (int i = 0; i < 3; ++i) {
+		pg_vtep_add_flood_dst(vtep, 1, remotes[i], &remote_mac,
+				      &error);
+		CHECK_ERROR(error);
+	}
+	/* adding twice the same VTEP only updates it */
+	pg_vtep_add_flood_dst(vtep, 1, remotes[2], &remote_mac, &error);
+	CHECK_ERROR(error);
+
+	/* the group joined by add_vni is left for the flood list */
+	g_assert(pg_brick_pkts_count_get(collect, PG_EAST_SIDE) == 2);
+	vtep_check_igmp(collect, inet_addr("224.0.0.2"));
+
+	/* one burst of replicas per remote VTEP */
+	vtep_flood_send(nop, mask);
+	g_assert(pg_brick_pkts_count_get(collect, PG_EAST_SIDE) ==
+		 2 + 3 * 8);
+	check_flood_pkts(collect, mask, remotes[2], 2);
+
+	pg_vtep_remove_flood_dst(vtep, 1, remotes[2], &error);
+	CHECK_ERROR(error);
+	g_assert(pg_vtep_remove_flood_dst(vtep, 1, remotes[2], &error) < 0);
+	pg_error_free(error);
+	error = NULL;
+	vtep_flood_send(nop, mask);
+	g_assert(pg_brick_pkts_count_get(collect, PG_EAST_SIDE) ==
+		 2 + 5 * 8);
+	check_flood_pkts(collect, mask, remotes[1], 2);
+
+	/* back to multicast once the flood list is empty */
+	pg_vtep_remove_flood_dst(vtep, 1, remotes[0], &error);
+	CHECK_ERROR(error);
+	pg_vtep_remove_flood_dst(vtep, 1, remotes[1], &error);
+	CHECK_ERROR(error);
+	vtep_check_igmp(collect, inet_addr("225.0.0.43"));
+	vtep_flood_send(nop, mask);
+	g_assert(pg_brick_pkts_count_get(collect, PG_EAST_SIDE) ==
+		 3 + 6 * 8);
+	check_flood_pkts(collect, mask, inet_addr("225.0.0.43"), 1);
+
+	pg_brick_destroy(nop);
+	pg_brick_destroy(vtep);
+	pg_brick_destroy(collect);
+}
+
+static void test_vtep_flood_no_group(void)
+{
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x01} };
+	struct ether_addr remote_mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x02} };
+	uint32_t remote = inet_addr("10.0.0.2");
+	uint64_t mask = pg_mask_firsts(8);
+	struct pg_brick *nop, *vtep, *collect;
+	struct pg_error *error = NULL;
+
+	nop = pg_nop_new("nop", &error);
+	CHECK_ERROR(error);
+	vtep = pg_vtep_new("vtep", 1, PG_EAST_SIDE, 1, mac,
+			   PG_VTEP_DST_PORT, 0, &error);
+	CHECK_ERROR(error);
+	collect = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	pg_brick_chained_links(&error, nop, vtep, collect);
+	CHECK_ERROR(error);
+	g_assert(pg_vtep_add_vni(vtep, nop, 1, inet_addr("10.0.0.42"),
+				 &error) < 0);
+	pg_error_free(error);
+	error = NULL;
+	pg_vtep_add_vni(vtep, nop, 1, (uint32_t)0, &error);
+	CHECK_ERROR(error);
+
+	/* no group to join nor to send BUM frames to */
+	g_assert(pg_brick_pkts_count_get(collect, PG_EAST_SIDE) == 0);
+	vtep_flood_send(nop, mask);
+	g_assert(pg_brick_pkts_count_get(collect, PG_EAST_SIDE) == 0);
+
+	/* flood list changes send no IGMP message either */
+	pg_vtep_add_flood_dst(vtep, 1, remote, &remote_mac, &error);
+	CHECK_ERROR(error);
+	g_assert(pg_brick_pkts_count_get(collect, PG_EAST_SIDE) == 0);
+	vtep_flood_send(nop, mask);
+	g_assert(pg_brick_pkts_count_get(collect, PG_EAST_SIDE) == 8);
+	check_flood_pkts(collect, mask, remote, 2);
+	pg_vtep_remove_flood_dst(vtep, 1, remote, &error);
+	CHECK_ERROR(error);
+	vtep_flood_send(nop, mask);
+	g_assert(pg_brick_pkts_count_get(collect, PG_EAST_SIDE) == 8);
+
+	pg_brick_destroy(nop);
+	pg_brick_destroy(vtep);
+	pg_brick_destroy(collect);
+}
+
+static void test_vtep6_flood_chained_cksum(void)
+{
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x01} };
+	struct ether_addr remote_mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x02} };
+	struct ether_addr src = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr dst = {{0xff, 0xff, 0xff, 0xff, 0xff, 0xff} };
+	union pg_ipv6_addr group = {.word16 = {0xff, 0, 0, 0, 0, 0, 0, 0x1} };
+	union pg_ipv6_addr remote = {.word16 = {0, 0, 0, 0, 0, 0, 0, 0x200} };
+	struct rte_mempool *mp = pg_get_mempool();
+	struct pg_brick *nop, *vtep, *collect;
+	struct rte_mbuf *pkt, *tail, **result;
+	struct pg_error *error = NULL;
+	uint64_t mask;
+	uint32_t sum;
+	uint16_t payload_sum;
+
+	nop = pg_nop_new("nop", &error);
+	CHECK_ERROR(error);
+	vtep = pg_vtep_new_by_string("vtep", 1, PG_EAST_SIDE, "0::1", mac,
+				     PG_VTEP_DST_PORT,
+				     PG_VTEP_FORCE_UPD_IPV6_CHECKSUM, &error);
+	CHECK_ERROR(error);
+	collect = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	pg_brick_chained_links(&error, nop, vtep, collect);
+	CHECK_ERROR(error);
+	pg_vtep6_add_vni(vtep, nop, 1, group.word8, &error);
+	CHECK_ERROR(error);
+	pg_vtep6_add_flood_dst(vtep, 1, remote.word8, &remote_mac, &error);
+	CHECK_ERROR(error);
+	g_assert(!pg_brick_reset(collect, &error));
+
+	/* broadcast frame split in two segments, the second one odd sized */
+	pkt = rte_pktmbuf_alloc(mp);
+	tail = rte_pktmbuf_alloc(mp);
+	g_assert(pkt && tail);
+	pg_packets_append_ether(&pkt, 1, &src, &dst, 0xCAFE);
+	pg_packets_append_blank(&pkt, 1, 20);
+	memset(rte_pktmbuf_append(tail, 31), 0x5a, 31);
+	g_assert(!rte_pktmbuf_chain(pkt, tail));
+	pg_brick_burst_to_east(nop, 0, &pkt, 1, &error);
+	CHECK_ERROR(error);
+
+	result = pg_brick_west_burst_get(collect, &mask, &error);
+	CHECK_ERROR(error);
+	g_assert(mask == 1);
+	PG_FOREACH_BIT(mask, i) {
+		uint32_t off = sizeof(struct ether_hdr) +
+			sizeof(struct ipv6_hdr);
+		struct ipv6_hdr *ip = rte_pktmbuf_mtod_offset(
+			result[i], struct ipv6_hdr *,
+			sizeof(struct ether_hdr));
+
+		/* a valid checksum sums to 0xffff with the pseudo header */
+		g_assert(!rte_raw_cksum_mbuf(result[i], off,
+					     rte_pktmbuf_pkt_len(result[i]) -
+					     off, &payload_sum));
+		sum = rte_ipv6_phdr_cksum(ip, 0) + payload_sum;
+		sum = (sum & 0xffff) + (sum >> 16);
+		sum = (sum & 0xffff) + (sum >> 16);
+		g_assert(sum == 0xffff);
+	}
+
+	rte_pktmbuf_free(pkt);
+	pg_brick_destroy(nop);
+	pg_brick_destroy(vtep);
+	pg_brick_destroy(collect);
+}
+
 static void free_collectors(struct pg_brick *(*collects_ptr)[20])
 {
 	struct pg_brick **collectors = *collects_ptr;
@@ -1235,6 +1495,272 @@ static void test_vtep_lifetime(void)
 	g_free(pkts);
 }
 
+#define SRC_PORT_FLOWS 256
+
+/* encapsulate 64 UDP flows and return the outer UDP source ports */
+static void vtep_src_ports(struct pg_brick *nop, struct pg_brick *collect,
+			   uint16_t first_port, bool rss, uint16_t *ports)
+{
+	struct ether_addr src = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr dst = {{0xff, 0xff, 0xff, 0xff, 0xff, 0xff} };
+	uint64_t mask = pg_mask_firsts(64);
+	struct rte_mbuf **result_pkts;
+	struct pg_error *error = NULL;
+	struct rte_mbuf **pkts;
+	uint64_t result_mask;
+
+	pkts = pg_packets_create(mask);
+	pg_packets_append_ether(pkts, mask, &src, &dst, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, mask, 0x0a000001, 0x0a000002,
+			       sizeof(struct udp_hdr) + 16, 17);
+	for (int i = 0; i < 64; ++i) {
+		pg_packets_append_udp(pkts, ONE64 << i, first_port + i, 80,
+				      sizeof(struct udp_hdr) + 16);
+		if (rss) {
+			pkts[i]->ol_flags |= PKT_RX_RSS_HASH;
+			pkts[i]->hash.rss = 0xcafe;
+		}
+	}
+	pg_packets_append_blank(pkts, mask, 16);
+
+	pg_brick_burst_to_east(nop, 0, pkts, mask, &error);
+	CHECK_ERROR(error);
+	result_pkts = pg_brick_west_burst_get(collect, &result_mask, &error);
+	CHECK_ERROR(error);
+	g_assert(result_mask == mask);
+	for (int i = 0; i < 64; ++i) {
+		struct udp_hdr *udp;
+
+		udp = rte_pktmbuf_mtod_offset(result_pkts[i], struct udp_hdr *,
+					      sizeof(struct ether_hdr) +
+					      sizeof(struct ipv4_hdr));
+		ports[i] = rte_be_to_cpu_16(udp->src_port);
+		g_assert(ports[i] >= 49152);
+	}
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+}
+
+static void test_vtep_src_port(void)
+{
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x01} };
+	uint16_t ports[SRC_PORT_FLOWS];
+	uint16_t again[64];
+	uint32_t buckets[4] = {0, 0, 0, 0};
+	struct pg_brick *nop, *vtep, *collect;
+	struct pg_error *error = NULL;
+	GHashTable *distinct;
+
+	nop = pg_nop_new("nop", &error);
+	CHECK_ERROR(error);
+	vtep = pg_vtep_new("vtep", 1, PG_EAST_SIDE, 1, mac,
+			   PG_VTEP_DST_PORT, 0, &error);
+	CHECK_ERROR(error);
+	collect = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	pg_brick_chained_links(&error, nop, vtep, collect);
+	CHECK_ERROR(error);
+	pg_vtep_add_vni(vtep, nop, 1, inet_addr("225.0.0.43"), &error);
+	CHECK_ERROR(error);
+
+	/* a flow always gets the same source port, flows are spread */
+	for (int i = 0; i < SRC_PORT_FLOWS; i += 64)
+		vtep_src_ports(nop, collect, 1024 + i, false, &ports[i]);
+	vtep_src_ports(nop, collect, 1024, false, again);
+	g_assert(!memcmp(ports, again, sizeof(again)));
+
+	distinct = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (int i = 0; i < SRC_PORT_FLOWS; ++i) {
+		g_hash_table_add(distinct, GUINT_TO_POINTER(ports[i]));
+		buckets[(ports[i] - 49152) >> 12]++;
+	}
+	g_assert(g_hash_table_size(distinct) >= SRC_PORT_FLOWS - 16);
+	g_hash_table_destroy(distinct);
+	for (int i = 0; i < 4; ++i) {
+		g_assert(buckets[i] >= SRC_PORT_FLOWS / 8);
+		g_assert(buckets[i] <= SRC_PORT_FLOWS * 3 / 8);
+	}
+
+	/* the hash computed by the NIC is used when there is one */
+	vtep_src_ports(nop, collect, 1024, true, again);
+	for (int i = 1; i < 64; ++i)
+		g_assert(again[i] == again[0]);
+
+	pg_vtep_set_src_port_mode(vtep, PG_VTEP_SRC_PORT_SW_HASH);
+	vtep_src_ports(nop, collect, 1024, true, again);
+	g_assert(!memcmp(ports, again, sizeof(again)));
+
+	pg_vtep_set_src_port_mode(vtep, PG_VTEP_SRC_PORT_FIXED);
+	vtep_src_ports(nop, collect, 1024, false, again);
+	for (int i = 0; i < 64; ++i)
+		g_assert(again[i] == 49152);
+
+	pg_brick_destroy(nop);
+	pg_brick_destroy(vtep);
+	pg_brick_destroy(collect);
+}
+
+#define DEFERRED_PORTS 4
+#define DEFERRED_BURST 8
+
+static void vtep_deferred_burst(struct pg_brick *nop)
+{
+	struct ether_addr src = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x11} };
+	struct ether_addr dst = {{0xff, 0xff, 0xff, 0xff, 0xff, 0xff} };
+	uint64_t mask = pg_mask_firsts(DEFERRED_BURST);
+	struct pg_error *error = NULL;
+	struct rte_mbuf **pkts;
+
+	pkts = pg_packets_create(mask);
+	pg_packets_append_ether(pkts, mask, &src, &dst, ETHER_TYPE_IPv4);
+	pg_packets_append_ipv4(pkts, mask, 0x0a000001, 0x0a000002,
+			       sizeof(struct udp_hdr), 17);
+	pg_packets_append_udp(pkts, mask, 1024, 80, sizeof(struct udp_hdr));
+	pg_brick_burst_to_east(nop, 0, pkts, mask, &error);
+	CHECK_ERROR(error);
+	pg_packets_free(pkts, mask);
+	g_free(pkts);
+}
+
+static void test_vtep_deferred(void)
+{
+	struct ether_addr mac = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x01} };
+	struct pg_brick *nop[DEFERRED_PORTS], *vtep, *collect;
+	struct pg_error *error = NULL;
+	uint64_t result_mask;
+
+	vtep = pg_vtep_new("vtep", DEFERRED_PORTS, PG_EAST_SIDE, 1, mac,
+			   PG_VTEP_DST_PORT, 0, &error);
+	CHECK_ERROR(error);
+	collect = pg_collect_new("collect", &error);
+	CHECK_ERROR(error);
+	pg_brick_link(vtep, collect, &error);
+	CHECK_ERROR(error);
+	for (int i = 0; i < DEFERRED_PORTS; ++i) {
+		char *name = g_strdup_printf("nop%d", i);
+		char *group = g_strdup_printf("225.0.0.%d", 43 + i);
+
+		nop[i] = pg_nop_new(name, &error);
+		CHECK_ERROR(error);
+		pg_brick_link(nop[i], vtep, &error);
+		CHECK_ERROR(error);
+		pg_vtep_add_vni(vtep, nop[i], i + 1, inet_addr(group), &error);
+		CHECK_ERROR(error);
+		g_free(name);
+		g_free(group);
+	}
+	g_assert(!pg_brick_flushable(vtep));
+
+	/* each port burst is encapsulated and sent on its own */
+	for (int i = 0; i < DEFERRED_PORTS; ++i)
+		vtep_deferred_burst(nop[i]);
+	pg_brick_west_burst_get(collect, &result_mask, &error);
+	g_assert(result_mask == pg_mask_firsts(DEFERRED_BURST));
+	g_assert(pg_brick_reset(collect, &error) >= 0);
+
+	/* deferred vtep sends all of them as one burst when flushed */
+	g_assert(!pg_vtep_set_deferred(vtep, true, &error));
+	CHECK_ERROR(error);
+	g_assert(pg_brick_flushable(vtep));
+	for (int i = 0; i < DEFERRED_PORTS; ++i)
+		vtep_deferred_burst(nop[i]);
+	pg_brick_west_burst_get(collect, &result_mask, &error);
+	g_assert(result_mask == 0);
+	g_assert(pg_brick_flush(vtep, &error) ==
+		 DEFERRED_PORTS * DEFERRED_BURST);
+	CHECK_ERROR(error);
+	pg_brick_west_burst_get(collect, &result_mask, &error);
+	g_assert(result_mask ==
+		 pg_mask_firsts(DEFERRED_PORTS * DEFERRED_BURST));
+	g_assert(pg_brick_reset(collect, &error) >= 0);
+
+	/* disabling deferred mode sends staged packets */
+	vtep_deferred_burst(nop[0]);
+	g_assert(!pg_vtep_set_deferred(vtep, false, &error));
+	CHECK_ERROR(error);
+	g_assert(!pg_brick_flushable(vtep));
+	pg_brick_west_burst_get(collect, &result_mask, &error);
+	g_assert(result_mask == pg_mask_firsts(DEFERRED_BURST));
+
+	for (int i = 0; i < DEFERRED_PORTS; ++i)
+		pg_brick_destroy(nop[i]);
+	pg_brick_destroy(vtep);
+	pg_brick_destroy(collect);
+}
+
+#undef DEFERRED_PORTS
+#undef DEFERRED_BURST
+
+/* VNI 0 is as valid as any other VNI */
+static void test_vtep_decap_vni0(void)
+{
+	struct ether_addr mac_w = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x01} };
+	struct ether_addr mac_e = {{0x52, 0x54, 0x00, 0x12, 0x34, 0x02} };
+	struct pg_brick *nop[2], *collect[2], *vtep_w, *vtep_e, *callback;
+	struct pg_error *error = NULL;
+	uint64_t result_mask;
+
+	vtep_w = pg_vtep_new("vtep-w", 2, PG_EAST_SIDE, 1, mac_w,
+			     PG_VTEP_DST_PORT, PG_VTEP_NO_INNERMAC_CHECK,
+			     &error);
+	CHECK_ERROR(error);
+	vtep_e = pg_vtep_new("vtep-e", 2, PG_WEST_SIDE, 2, mac_e,
+			     PG_VTEP_DST_PORT, PG_VTEP_NO_INNERMAC_CHECK,
+			     &error);
+	CHECK_ERROR(error);
+	callback = pg_user_dipole_new("l2", l2_shorter, NULL, &error);
+	CHECK_ERROR(error);
+	pg_brick_chained_links(&error, vtep_w, callback, vtep_e);
+	CHECK_ERROR(error);
+	for (int i = 0; i < 2; ++i) {
+		char *name = g_strdup_printf("nop%d", i);
+		char *group = g_strdup_printf("225.0.0.%d", 50 + i);
+
+		nop[i] = pg_nop_new(name, &error);
+		CHECK_ERROR(error);
+		g_free(name);
+		name = g_strdup_printf("collect%d", i);
+		collect[i] = pg_collect_new(name, &error);
+		CHECK_ERROR(error);
+		g_free(name);
+		pg_brick_link(nop[i], vtep_w, &error);
+		CHECK_ERROR(error);
+		pg_brick_link(vtep_e, collect[i], &error);
+		CHECK_ERROR(error);
+		pg_vtep_add_vni(vtep_w, nop[i], i, inet_addr(group), &error);
+		CHECK_ERROR(error);
+		pg_vtep_add_vni(vtep_e, collect[i], i, inet_addr(group),
+				&error);
+		CHECK_ERROR(error);
+		g_free(group);
+	}
+
+	/* packets only reach the port of their VNI */
+	for (int i = 0; i < 2; ++i) {
+		vtep_deferred_burst(nop[i]);
+		pg_brick_west_burst_get(collect[i], &result_mask, &error);
+		g_assert(result_mask);
+		pg_brick_west_burst_get(collect[!i], &result_mask, &error);
+		g_assert(!result_mask);
+		g_assert(pg_brick_reset(collect[i], &error) >= 0);
+	}
+
+	/* VNI 0 is still found once the port of VNI 1 is unlinked */
+	g_assert(!pg_brick_unlink_edge(vtep_e, collect[1], &error));
+	CHECK_ERROR(error);
+	vtep_deferred_burst(nop[0]);
+	pg_brick_west_burst_get(collect[0], &result_mask, &error);
+	g_assert(result_mask);
+
+	for (int i = 0; i < 2; ++i) {
+		pg_brick_destroy(nop[i]);
+		pg_brick_destroy(collect[i]);
+	}
+	pg_brick_destroy(callback);
+	pg_brick_destroy(vtep_w);
+	pg_brick_destroy(vtep_e);
+}
+
 int main(int argc, char **argv)
 {
 	int r;
@@ -1261,6 +1787,15 @@ int main(int argc, char **argv)
 			test_vtep_flood_encapsulate);
 	pg_test_add_func("/vtep/flood/encap-decap",
 			test_vtep_flood_encap_decap);
+	pg_test_add_func("/vtep/flood/head-end-replication",
+			test_vtep_flood_head_end_replication);
+
+	pg_test_add_func("/vtep/flood/no-group", test_vtep_flood_no_group);
+	pg_test_add_func("/vtep6/flood/chained-cksum",
+			 test_vtep6_flood_chained_cksum);
+	pg_test_add_func("/vtep/src-port", test_vtep_src_port);
+	pg_test_add_func("/vtep/deferred", test_vtep_deferred);
+	pg_test_add_func("/vtep/decap/vni0", test_vtep_decap_vni0);
 
 	r = g_test_run();
 